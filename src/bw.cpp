@@ -174,6 +174,25 @@ ServerBW::ServerBW(const uint32 numIMC, const uint32 root_segment_ubox0, const u
     {
         mmioRanges.push_back(std::make_shared<MMIORange>(memBar, PCM_SERVER_IMC_MMAP_SIZE));
     }
+    last.values.resize(mmioRanges.size());
+}
+
+const ServerBW::Snapshot & ServerBW::snapshot()
+{
+    static_assert(PCM_SERVER_IMC_DRAM_DATA_WRITES == PCM_SERVER_IMC_DRAM_DATA_READS + 8 * ImcWrites, "unexpected counter layout");
+    static_assert(PCM_SERVER_IMC_PMM_DATA_READS == PCM_SERVER_IMC_DRAM_DATA_READS + 8 * PMMReads, "unexpected counter layout");
+    static_assert(PCM_SERVER_IMC_PMM_DATA_WRITES == PCM_SERVER_IMC_DRAM_DATA_READS + 8 * PMMWrites, "unexpected counter layout");
+    for (size_t c = 0; c < mmioRanges.size(); ++c)
+    {
+        // the counters are consecutive qwords of the controller BAR
+        auto & mmio = *mmioRanges[c];
+        auto & values = last.values[c];
+        for (uint32 i = 0; i < numCounters; ++i)
+        {
+            values[i] = mmio.read64(PCM_SERVER_IMC_DRAM_DATA_READS + 8 * i);
+        }
+    }
+    return last;
 }
 
 uint64 ServerBW::getImcReads()
@@ -68,12 +68,46 @@ size_t getServerSCFBar(const uint32 root_segment_ubox0, const uint32 root_bus_ub
 
 class ServerBW
 {
+public:
+    enum Counter
+    {
+        ImcReads,
+        ImcWrites,
+        PMMReads,
+        PMMWrites,
+        numCounters
+    };
+    //! \brief Free-running counters of all memory controllers of a socket read in one pass
+    struct Snapshot
+    {
+        std::vector<std::array<uint64, numCounters> > values; // [controller][counter], one entry per controller
+        uint32 getNumControllers() const { return (uint32)values.size(); }
+        uint64 getTotal(const Counter counter) const
+        {
+            uint64 result = 0;
+            for (const auto & controller : values)
+            {
+                result += controller[counter];
+            }
+            return result;
+        }
+    };
+private:
     std::vector<std::shared_ptr<MMIORange> > mmioRanges;
+    Snapshot last; // sized once for the controllers, refilled by each snapshot()
 
     ServerBW();
 public:
     ServerBW(const uint32 numIMC, const uint32 root_segment_ubox0, const uint32 root_bus_ubox0);
 
+    uint32 getNumControllers() const { return (uint32)mmioRanges.size(); }
+    /*! \brief Reads all counters of all memory controllers, one pass over the controller BARs
+
+        Returns the snapshot kept by the object (no allocation), valid until the next call.
+        Like the uncore PMU freezes of the socket, it must not be called concurrently.
+    */
+    const Snapshot & snapshot();
+
     uint64 getImcReads();
     uint64 getImcWrites();
     uint64 getPMMReads();
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+#include "collection_stats.h"
+#include "cpucounters.h"
+#include <algorithm>
+#include <cmath>
+
+namespace pcm {
+
+namespace {
+
+struct ThreadState
+{
+    CollectionStats::StageScope * active = nullptr; // innermost stage of the thread
+    CollectionStats::Sample * sample = nullptr;     // sample the thread works for
+    uint64 syscalls = 0;                            // system calls issued by the thread so far
+};
+
+thread_local ThreadState threadState;
+
+Mutex statsMutex;
+CollectionStats::Snapshot stats;
+
+} // namespace
+
+void CollectionStats::Histogram::add(const uint64 value)
+{
+    size_t bucket = 0;
+    for (uint64 v = value; v; v >>= 1) ++bucket;
+    ++buckets[bucket];
+    if (count == 0 || value < min) min = value;
+    if (count == 0 || value > max) max = value;
+    ++count;
+    total += value;
+}
+
+uint64 CollectionStats::Histogram::getQuantile(const double q) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    const uint64 target = (std::max)(uint64(1), uint64(std::ceil(q * double(count))));
+    uint64 seen = 0;
+    for (size_t b = 0; b < buckets.size(); ++b)
+    {
+        seen += buckets[b];
+        if (seen >= target)
+        {
+            const uint64 upper = (b == 0) ? 0 : ((b == 64) ? max : ((1ULL << b) - 1ULL));
+            return (std::min)(upper, max);
+        }
+    }
+    return max;
+}
+
+const char * CollectionStats::getStageName(const Stage stage)
+{
+    switch (stage)
+    {
+    case CoreReads:
+        return "core";
+    case UncoreReads:
+        return "uncore";
+    case PMTReads:
+        return "pmt";
+    case TPMIReads:
+        return "tpmi";
+    case ResctrlReads:
+        return "resctrl";
+    case Aggregation:
+        return "aggregation";
+    default:
+        break;
+    }
+    return "unknown";
+}
+
+void CollectionStats::countSyscall(const uint64 n)
+{
+    threadState.syscalls += n;
+}
+
+CollectionStats::StageScope::StageScope(const Stage s) : stage(s), parent(threadState.active)
+{
+    const uint64 now = RDTSC();
+    if (parent)
+    {
+        parent->pause(now, threadState.syscalls);
+    }
+    start = now;
+    startSyscalls = threadState.syscalls;
+    threadState.active = this;
+}
+
+CollectionStats::StageScope::~StageScope()
+{
+    const uint64 now = RDTSC();
+    pause(now, threadState.syscalls);
+    accumulate(stage, cycles, syscalls);
+    threadState.active = parent;
+    if (parent)
+    {
+        parent->resume(now, threadState.syscalls);
+    }
+}
+
+void CollectionStats::StageScope::pause(const uint64 now, const uint64 threadSyscalls)
+{
+    cycles += now - start;
+    syscalls += threadSyscalls - startSyscalls;
+}
+
+void CollectionStats::StageScope::resume(const uint64 now, const uint64 threadSyscalls)
+{
+    start = now;
+    startSyscalls = threadSyscalls;
+}
+
+CollectionStats::Sample * CollectionStats::getCurrentSample()
+{
+    return threadState.sample;
+}
+
+CollectionStats::AttachScope::AttachScope(Sample * sample) : previous(threadState.sample)
+{
+    threadState.sample = sample;
+}
+
+CollectionStats::AttachScope::~AttachScope()
+{
+    threadState.sample = previous;
+}
+
+CollectionStats::SampleScope::SampleScope() : outermost(threadState.sample == nullptr), start(RDTSC())
+{
+    if (outermost)
+    {
+        threadState.sample = &sample;
+    }
+}
+
+CollectionStats::SampleScope::~SampleScope()
+{
+    if (outermost)
+    {
+        commit(sample, RDTSC() - start);
+        threadState.sample = nullptr;
+    }
+}
+
+void CollectionStats::accumulate(const Stage stage, const uint64 cycles, const uint64 syscalls)
+{
+    if (threadState.sample == nullptr)
+    {
+        return;
+    }
+    auto & p = threadState.sample->stages[stage];
+    p.cycles.fetch_add(cycles, std::memory_order_relaxed);
+    p.syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+    p.used.store(true, std::memory_order_relaxed);
+}
+
+void CollectionStats::commit(Sample & sample, const uint64 sampleCycles)
+{
+    Mutex::Scope _(statsMutex);
+    ++stats.samples;
+    stats.sampleCycles.add(sampleCycles);
+    for (size_t s = 0; s < numStages; ++s)
+    {
+        const auto & p = sample.stages[s];
+        if (p.used.load(std::memory_order_relaxed) == false)
+        {
+            continue; // the stage did not run in this sample
+        }
+        stats.stages[s].cycles.add(p.cycles.load(std::memory_order_relaxed));
+        stats.stages[s].syscalls.add(p.syscalls.load(std::memory_order_relaxed));
+    }
+}
+
+CollectionStats::Snapshot CollectionStats::getSnapshot()
+{
+    Mutex::Scope _(statsMutex);
+    return stats;
+}
+
+void CollectionStats::reset()
+{
+    Mutex::Scope _(statsMutex);
+    stats = Snapshot();
+}
+
+} // namespace pcm
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+#pragma once
+
+/*!     \file collection_stats.h
+        \brief Self-overhead profile of the counter collection engine
+
+        Time (in TSC cycles) and system calls spent in each stage of a counter sample, collected as
+        per-sample histograms. Stages nest: the time and system calls of an inner stage are not
+        counted in the enclosing one, so the stages of a sample add up to its total cost.
+
+        Every sample keeps its own stage totals, so samples taken concurrently by several threads are
+        accounted separately. Worker threads attribute their stages to the sample they work for (see
+        AttachScope), stage work done outside of any sample is not counted.
+*/
+
+#include "types.h"
+#include "mutex.h"
+#include <array>
+#include <atomic>
+
+namespace pcm {
+
+class CollectionStats
+{
+public:
+    enum Stage
+    {
+        CoreReads = 0,  // core MSR and perf reads
+        UncoreReads,    // uncore PMUs over PCI config space, MMIO and package MSRs
+        PMTReads,       // PMT telemetry arrays
+        TPMIReads,      // TPMI registers
+        ResctrlReads,   // resctrl monitoring files
+        Aggregation,    // aggregation of core and socket states
+        numStages
+    };
+
+    //! \brief Histogram with log2 buckets: bucket 0 counts zeros, bucket i > 0 counts values in [2^(i-1), 2^i)
+    struct Histogram
+    {
+        enum { numBuckets = 65 };
+        uint64 count = 0;
+        uint64 total = 0;
+        uint64 min = 0;
+        uint64 max = 0;
+        std::array<uint64, numBuckets> buckets{};
+
+        void add(const uint64 value);
+        //! \brief Returns the upper bound of the bucket holding the given quantile (0..1) or 0 for an empty histogram
+        uint64 getQuantile(const double q) const;
+        double getMean() const { return count ? double(total) / double(count) : 0.; }
+    };
+
+    struct StageStats
+    {
+        Histogram cycles;   // per-sample TSC cycles spent in the stage, summed over all threads
+        Histogram syscalls; // per-sample system calls issued in the stage
+    };
+
+    struct Snapshot
+    {
+        uint64 samples = 0;
+        Histogram sampleCycles; // TSC cycles of the whole sample on the calling thread
+        std::array<StageStats, numStages> stages;
+    };
+
+    static const char * getStageName(const Stage stage);
+
+    //! \brief Stage totals of one sample in flight, added to by all threads working on the sample
+    class Sample
+    {
+        friend class CollectionStats;
+        struct PendingStage
+        {
+            std::atomic<uint64> cycles{0};
+            std::atomic<uint64> syscalls{0};
+            std::atomic<bool> used{false};
+        };
+        std::array<PendingStage, numStages> stages;
+    };
+
+    //! \brief Returns the sample the calling thread works for or nullptr outside of samples
+    static Sample * getCurrentSample();
+
+    //! \brief Attributes the stages of the calling thread to the given sample (may be nullptr) while in scope
+    //!
+    //! Used by worker threads running a part of a sample taken by another thread, the sample must outlive the scope.
+    class AttachScope
+    {
+        AttachScope(const AttachScope &) = delete;
+        AttachScope & operator = (const AttachScope &) = delete;
+        Sample * const previous;
+    public:
+        explicit AttachScope(Sample * sample);
+        ~AttachScope();
+    };
+
+    //! \brief Counts system calls of the calling thread towards its innermost active stage
+    static void countSyscall(const uint64 n = 1);
+
+    //! \brief Attributes the time and system calls of the calling thread to a stage while in scope
+    class StageScope
+    {
+        StageScope(const StageScope &) = delete;
+        StageScope & operator = (const StageScope &) = delete;
+        const Stage stage;
+        StageScope * const parent;
+        uint64 start = 0;
+        uint64 startSyscalls = 0;
+        uint64 cycles = 0;
+        uint64 syscalls = 0;
+        void pause(const uint64 now, const uint64 threadSyscalls);
+        void resume(const uint64 now, const uint64 threadSyscalls);
+    public:
+        explicit StageScope(const Stage s);
+        ~StageScope();
+    };
+
+    /*! \brief Delimits one counter sample taken by the calling thread
+
+        The stage totals of the sample are added to the histograms when the outermost scope of the
+        thread ends, nested scopes belong to the enclosing sample.
+    */
+    class SampleScope
+    {
+        SampleScope(const SampleScope &) = delete;
+        SampleScope & operator = (const SampleScope &) = delete;
+        Sample sample;
+        const bool outermost;
+        const uint64 start;
+    public:
+        SampleScope();
+        ~SampleScope();
+    };
+
+    static Snapshot getSnapshot();
+    static void reset();
+
+private:
+    static void accumulate(const Stage stage, const uint64 cycles, const uint64 syscalls);
+    static void commit(Sample & sample, const uint64 sampleCycles);
+};
+
+} // namespace pcm
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+//
+
+#include <algorithm>
+#include <assert.h>
+#include "core_metrics.h"
+
+namespace pcm {
+
+void CoreCounterColumns::load(const std::vector<CoreCounterState> & states)
+{
+    numCores = states.size();
+    stride = columnStride(numCores);
+    data.resize(size_t(numColumns + numCheckedColumns) * stride);
+    uint64 * col[numColumns + numCheckedColumns];
+    for (size_t c = 0; c < numColumns + numCheckedColumns; ++c)
+    {
+        col[c] = mutableColumn(c);
+    }
+    uint64 ** overflow = col + numColumns;
+    auto storeChecked = [&col, overflow](const size_t c, const size_t i, const checked_uint64 & value)
+    {
+        const uint64 raw = value.getRawData_NoOverflowProtection();
+        col[c][i] = raw;
+        overflow[c][i] = value - checked_uint64(raw, 0);
+    };
+    for (size_t i = 0; i < numCores; ++i)
+    {
+        const BasicCounterState & state = states[i];
+        storeChecked(InstRetiredAny, i, state.InstRetiredAny);
+        storeChecked(CpuClkUnhaltedThread, i, state.CpuClkUnhaltedThread);
+        storeChecked(CpuClkUnhaltedRef, i, state.CpuClkUnhaltedRef);
+        for (size_t e = 0; e < 4; ++e)
+        {
+            storeChecked(Event0 + e, i, state.Event[e]);
+        }
+        col[InvariantTSC][i] = state.InvariantTSC;
+        col[FrontendBoundSlots][i] = state.FrontendBoundSlots;
+        col[BadSpeculationSlots][i] = state.BadSpeculationSlots;
+        col[BackendBoundSlots][i] = state.BackendBoundSlots;
+        col[RetiringSlots][i] = state.RetiringSlots;
+        col[MemBoundSlots][i] = state.MemBoundSlots;
+        col[FetchLatSlots][i] = state.FetchLatSlots;
+        col[BrMispredSlots][i] = state.BrMispredSlots;
+        col[HeavyOpsSlots][i] = state.HeavyOpsSlots;
+    }
+}
+
+void CoreMetrics::compute(const std::vector<CoreCounterState> & before, const std::vector<CoreCounterState> & after)
+{
+    beforeColumns.load(before);
+    afterColumns.load(after);
+    compute(beforeColumns, afterColumns);
+}
+
+void CoreMetrics::compute(const CoreCounterColumns & before, const CoreCounterColumns & after)
+{
+    assert(before.size() == after.size());
+    const size_t n = numCores = after.size();
+    stride = columnStride(n);
+    values.resize(size_t(numMetrics) * stride);
+    delta.resize(size_t(CoreCounterColumns::numColumns) * stride);
+    misses.resize(n);
+    hits.resize(n);
+    allSlots.resize(n);
+
+    // counter differences, one pass per column
+    for (size_t c = 0; c < CoreCounterColumns::numColumns; ++c)
+    {
+        const auto column = CoreCounterColumns::Column(c);
+        const uint64 * b = before.column(column);
+        const uint64 * a = after.column(column);
+        const uint64 * overflow = after.overflowColumn(column);
+        uint64 * d = delta.data() + c * stride;
+        if (overflow)
+        {
+            for (size_t i = 0; i < n; ++i) d[i] = a[i] + overflow[i] - b[i];
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i) d[i] = a[i] - b[i];
+        }
+    }
+    auto diff = [this](const CoreCounterColumns::Column c) -> const uint64 * { return delta.data() + size_t(c) * stride; };
+
+    const uint64 * inst = diff(CoreCounterColumns::InstRetiredAny);
+    const uint64 * clocks = diff(CoreCounterColumns::CpuClkUnhaltedThread);
+    const uint64 * refClocks = diff(CoreCounterColumns::CpuClkUnhaltedRef);
+    const uint64 * tsc = diff(CoreCounterColumns::InvariantTSC);
+
+    PCM * m = PCM::getInstance();
+    assert(m);
+
+    {
+        double * out = output(IPC);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int64 c = clocks[i];
+            out[i] = (c != 0) ? double(inst[i]) / double(c) : -1.;
+        }
+    }
+    const double nominalFrequency = double(m->getNominalFrequency());
+    {
+        double * out = output(AverageFrequency);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int64 timer = tsc[i];
+            out[i] = (timer != 0) ? nominalFrequency * double(int64(clocks[i])) / double(timer) : -1.;
+        }
+    }
+    {
+        double * out = output(ActiveAverageFrequency);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int64 ref = refClocks[i];
+            out[i] = (ref != 0) ? nominalFrequency * double(int64(clocks[i])) / double(ref) : -1.;
+        }
+    }
+
+    // L3 cache: the model-dependent event selection of getL3CacheHits/getL3CacheMisses is resolved once
+    const uint64 * e0 = diff(CoreCounterColumns::Event0); // L3MissPos, ArchLLCMissPos
+    const uint64 * e1 = diff(CoreCounterColumns::Event1); // L3UnsharedHitPos, ArchLLCRefPos, SKLL3HitPos
+    const uint64 * e2 = diff(CoreCounterColumns::Event2); // L2HitMPos
+    const uint64 missesMask = m->isL3CacheMissesAvailable() ? ~0ULL : 0ULL;
+    for (size_t i = 0; i < n; ++i) misses[i] = e0[i] & missesMask;
+
+    if (!m->isL3CacheHitsAvailable())
+    {
+        std::fill(hits.begin(), hits.end(), 0ULL);
+    }
+    else if (m->memoryEventErrata())
+    {
+        for (size_t i = 0; i < n; ++i) hits[i] = (e1[i] > e0[i]) ? (e1[i] - e0[i]) : 0ULL;
+    }
+    else
+    {
+        const uint64 noSnoopMask = m->isL3CacheHitsNoSnoopAvailable() ? ~0ULL : 0ULL;
+        if (!m->isL3CacheHitsSnoopAvailable())
+        {
+            for (size_t i = 0; i < n; ++i) hits[i] = e1[i] & noSnoopMask;
+        }
+        else if (m->useArchLLCRefForL3CacheHitsSnoop())
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                const int64 snoop = int64(e1[i]) - int64(misses[i]);
+                hits[i] = uint64((snoop > 0) ? snoop : 0) + (e1[i] & noSnoopMask);
+            }
+        }
+        else
+        {
+            const uint64 * snoop = m->useSkylakeEvents() ? e1 : e2;
+            for (size_t i = 0; i < n; ++i) hits[i] = snoop[i] + (e1[i] & noSnoopMask);
+        }
+    }
+    {
+        double * outMisses = output(L3CacheMisses);
+        double * outHits = output(L3CacheHits);
+        for (size_t i = 0; i < n; ++i)
+        {
+            outMisses[i] = double(misses[i]);
+            outHits[i] = double(hits[i]);
+        }
+        double * out = output(L3CacheHitRatio);
+        if (m->isL3CacheHitRatioAvailable())
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                const double all = double(hits[i] + misses[i]);
+                out[i] = (all == 0.0) ? 0. : double(hits[i]) / all;
+            }
+        }
+        else
+        {
+            std::fill(out, out + n, 0.);
+        }
+    }
+
+    // top-down microarchitecture analysis
+    auto slotsRatio = [&](const Metric metric, const CoreCounterColumns::Column c, const bool supported)
+    {
+        double * out = output(metric);
+        if (!supported)
+        {
+            std::fill(out, out + n, 0.);
+            return;
+        }
+        const uint64 * slots = diff(c);
+        for (size_t i = 0; i < n; ++i) out[i] = double(slots[i]) / double(allSlots[i]);
+    };
+    auto difference = [&](const Metric metric, const Metric minuend, const Metric subtrahend, const bool supported)
+    {
+        double * out = output(metric);
+        if (!supported)
+        {
+            std::fill(out, out + n, 0.);
+            return;
+        }
+        const double * a = get(minuend);
+        const double * b = get(subtrahend);
+        for (size_t i = 0; i < n; ++i) out[i] = a[i] - b[i];
+    };
+    {
+        const uint64 * be = diff(CoreCounterColumns::BackendBoundSlots);
+        const uint64 * fe = diff(CoreCounterColumns::FrontendBoundSlots);
+        const uint64 * bs = diff(CoreCounterColumns::BadSpeculationSlots);
+        const uint64 * ret = diff(CoreCounterColumns::RetiringSlots);
+        for (size_t i = 0; i < n; ++i) allSlots[i] = be[i] + fe[i] + bs[i] + ret[i];
+    }
+    const bool tmaL1 = m->isHWTMAL1Supported();
+    const bool tmaL2 = m->isHWTMAL2Supported();
+    slotsRatio(FrontendBound, CoreCounterColumns::FrontendBoundSlots, tmaL1);
+    slotsRatio(BadSpeculation, CoreCounterColumns::BadSpeculationSlots, tmaL1);
+    slotsRatio(BackendBound, CoreCounterColumns::BackendBoundSlots, tmaL1);
+    slotsRatio(Retiring, CoreCounterColumns::RetiringSlots, tmaL1);
+    slotsRatio(FetchLatencyBound, CoreCounterColumns::FetchLatSlots, tmaL2);
+    slotsRatio(BranchMispredictionBound, CoreCounterColumns::BrMispredSlots, tmaL2);
+    slotsRatio(MemoryBound, CoreCounterColumns::MemBoundSlots, tmaL2);
+    slotsRatio(HeavyOperationsBound, CoreCounterColumns::HeavyOpsSlots, tmaL2);
+    difference(FetchBandwidthBound, FrontendBound, FetchLatencyBound, tmaL2);
+    difference(MachineClearsBound, BadSpeculation, BranchMispredictionBound, tmaL2);
+    difference(CoreBound, BackendBound, MemoryBound, tmaL2);
+    difference(LightOperationsBound, Retiring, HeavyOperationsBound, tmaL2);
+}
+
+} // namespace pcm
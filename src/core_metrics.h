@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+//
+
+#pragma once
+
+/*!     \file core_metrics.h
+        \brief Columnar (structure-of-arrays) evaluation of derived core metrics for all cores at once
+
+*/
+
+#include <vector>
+#include "cpucounters.h"
+
+namespace pcm {
+
+//! \brief Returns the distance between consecutive columns of n values: padded by a cache line
+//! so that columns of power-of-two length do not map to the same cache sets (4K aliasing)
+inline size_t columnStride(const size_t n) { return n + 8; }
+
+/*! \brief Counter values of all cores in structure-of-arrays form
+
+    Each counter of CoreCounterState is stored in one contiguous column indexed by the
+    position of the core in the state vector. The counters kept as checked_uint64 get an
+    additional column with their overflow contribution, so that
+    after.column(c)[i] + after.overflowColumn(c)[i] - before.column(c)[i]
+    equals the difference computed by the per-object metric functions.
+*/
+class CoreCounterColumns
+{
+public:
+    enum Column
+    {
+        // checked_uint64 counters
+        InstRetiredAny,
+        CpuClkUnhaltedThread,
+        CpuClkUnhaltedRef,
+        Event0,
+        Event1,
+        Event2,
+        Event3,
+        numCheckedColumns,
+        // plain uint64 counters
+        InvariantTSC = numCheckedColumns,
+        FrontendBoundSlots,
+        BadSpeculationSlots,
+        BackendBoundSlots,
+        RetiringSlots,
+        MemBoundSlots,
+        FetchLatSlots,
+        BrMispredSlots,
+        HeavyOpsSlots,
+        numColumns
+    };
+
+    //! \brief Transposes the core states into columns (reuses the allocated storage)
+    void load(const std::vector<CoreCounterState> & states);
+
+    size_t size() const { return numCores; }
+
+    const uint64 * column(const Column c) const { return data.data() + size_t(c) * stride; }
+
+    //! \brief Returns the overflow contribution column of a checked counter or nullptr for plain counters
+    const uint64 * overflowColumn(const Column c) const
+    {
+        return (c < numCheckedColumns) ? data.data() + size_t(numColumns + c) * stride : nullptr;
+    }
+
+private:
+    uint64 * mutableColumn(const size_t c) { return data.data() + c * stride; }
+
+    size_t numCores = 0;
+    size_t stride = 0;
+    std::vector<uint64> data;
+};
+
+/*! \brief Derived metrics of all cores computed one metric at a time over contiguous arrays
+
+    The results are identical to the per-core template functions (getIPC, getL3CacheHitRatio, etc.)
+    evaluated for each pair of before/after states, but the PCM capability checks are done once per
+    compute() call and every metric is a branch-free loop over the counter columns that the compiler
+    can vectorize.
+*/
+class CoreMetrics
+{
+public:
+    enum Metric
+    {
+        IPC,
+        AverageFrequency,
+        ActiveAverageFrequency,
+        L3CacheMisses,
+        L3CacheHits,
+        L3CacheHitRatio,
+        FrontendBound,
+        BadSpeculation,
+        BackendBound,
+        Retiring,
+        FetchLatencyBound,
+        FetchBandwidthBound,
+        BranchMispredictionBound,
+        MachineClearsBound,
+        MemoryBound,
+        CoreBound,
+        HeavyOperationsBound,
+        LightOperationsBound,
+        numMetrics
+    };
+
+    //! \brief Computes all metrics for the cores in before/after (both must hold the same cores)
+    void compute(const CoreCounterColumns & before, const CoreCounterColumns & after);
+
+    //! \brief Transposes the core states and computes all metrics
+    void compute(const std::vector<CoreCounterState> & before, const std::vector<CoreCounterState> & after);
+
+    size_t size() const { return numCores; }
+
+    //! \brief Returns the contiguous array of the metric values of all cores
+    const double * get(const Metric m) const { return values.data() + size_t(m) * stride; }
+
+    double get(const Metric m, const size_t core) const { return get(m)[core]; }
+
+private:
+    double * output(const Metric m) { return values.data() + size_t(m) * stride; }
+
+    size_t numCores = 0;
+    size_t stride = 0;
+    std::vector<double> values;
+    std::vector<uint64> delta; // scratch: counter differences, one column at a time
+    std::vector<uint64> misses, hits, allSlots;
+    CoreCounterColumns beforeColumns, afterColumns;
+};
+
+} // namespace pcm
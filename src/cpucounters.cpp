@@ -27,6 +27,8 @@
 #include "types.h"
 #include "utils.h"
 #include "topology.h"
+#include "discovery_cache.h"
+#include "simulated_hw.h"
 
 #if defined (__FreeBSD__) || defined(__DragonFly__)
 #include <sys/param.h>
@@ -70,11 +72,11 @@
 #include <thread>
 #include <future>
 #include <functional>
-#include <queue>
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
 #include <system_error>
+#include <optional>
 
 #ifdef __APPLE__
 #include <sys/types.h>
@@ -247,13 +249,26 @@ bool isNMIWatchdogEnabled(const bool silent);
 bool keepNMIWatchdogEnabled();
 #endif
 
+// CPUID leaf 0xA (architectural performance monitoring); the simulated backend reports a PMU if the host (e.g. a VM) has none
+static void pcm_cpuid_perfmon(PCM_CPUID_INFO & info)
+{
+    pcm_cpuid(0xa, info);
+    if (SimulatedHardware::isEnabled() && extract_bits_32(info.array[0], 0, 7) == 0)
+    {
+        info.array[0] = 5 | (8 << 8) | (48 << 16) | (7 << 24); // version 5, 8 general purpose counters, 48 bits
+        info.array[1] = 0;                                     // all architectural events are available
+        info.array[2] = 0xf;                                   // fixed counter bitmap
+        info.array[3] = 4 | (48 << 5);                         // 4 fixed counters, 48 bits
+    }
+}
+
 void PCM::readCoreCounterConfig(const bool complainAboutMSR)
 {
     if (max_cpuid >= 0xa)
     {
         // get counter related info
         PCM_CPUID_INFO cpuinfo;
-        pcm_cpuid(0xa, cpuinfo);
+        pcm_cpuid_perfmon(cpuinfo);
         perfmon_version = extract_bits_32(cpuinfo.array[0], 0, 7);
         core_gen_counter_num_max = extract_bits_32(cpuinfo.array[0], 8, 15);
         core_gen_counter_width = extract_bits_32(cpuinfo.array[0], 16, 23);
@@ -327,7 +342,7 @@ bool PCM::isFixedCounterSupported(unsigned c)
     if (max_cpuid >= 0xa)
     {
         PCM_CPUID_INFO cpuinfo;
-        pcm_cpuid(0xa, cpuinfo);
+        pcm_cpuid_perfmon(cpuinfo);
         return extract_bits_32(cpuinfo.reg.ecx, c, c) || (extract_bits_32(cpuinfo.reg.edx, 4, 0) > c);
     }
     return false;
@@ -391,8 +406,7 @@ int32 PCM::getMaxCustomCoreEvents()
 
 int PCM::getCPUFamilyModelFromCPUID()
 {
-    static int result = -1;
-    if (result < 0)
+    static const int result = []()
     {
         PCM_CPUID_INFO cpuinfo;
         pcm_cpuid(1, cpuinfo);
@@ -404,8 +418,8 @@ int PCM::getCPUFamilyModelFromCPUID()
         const auto cpu_family_ = (Family_ID != 0x0F) ? Family_ID : (Extended_Family_ID + Family_ID);
         const auto cpu_model_ = (Family_ID == 0x06 || Family_ID == 0x0F) ? (Model_ID + (Extended_Model_ID << 4)) : Model_ID;
 
-        result = PCM_CPU_FAMILY_MODEL(cpu_family_, cpu_model_);
-    }
+        return PCM_CPU_FAMILY_MODEL(cpu_family_, cpu_model_);
+    }();
     return result;
 }
 
@@ -485,7 +499,7 @@ bool PCM::detectModel()
     {
         std::cerr << "Linux arch_perfmon flag  : " << (linux_arch_perfmon ? "yes" : "no") << "\n";
     }
-    if (vm == true && linux_arch_perfmon == false)
+    if (vm == true && linux_arch_perfmon == false && SimulatedHardware::isEnabled() == false) // the simulated backend provides the PMU
     {
         std::cerr << "ERROR: vPMU is not enabled in the hypervisor. Please see details in https://software.intel.com/content/www/us/en/develop/documentation/vtune-help/top/set-up-analysis-target/on-virtual-machine.html \n";
         std::cerr << "       you can force-continue by setting PCM_IGNORE_ARCH_PERFMON=1 environment variable.\n";
@@ -518,10 +532,9 @@ bool PCM::detectModel()
 
 bool PCM::isRDTDisabled() const
 {
-    static int flag = -1;
-    if (flag < 0)
+    static const bool disabled = [this]()
     {
-        // flag not yet initialized
+        bool result = false;
         const char * varname = "PCM_NO_RDT";
         char* env = nullptr;
 #ifdef _MSC_VER
@@ -535,17 +548,14 @@ bool PCM::isRDTDisabled() const
             {
                 std::cout << "Disabling RDT usage because PCM_NO_RDT=1 environment variable is set.\n";
             }
-            flag = 1;
-        }
-        else
-        {
-            flag = 0;
+            result = true;
         }
 #ifdef _MSC_VER
         freeAndNullify(env);
 #endif
-    }
-    return flag > 0;
+        return result;
+    }();
+    return disabled;
 }
 
 bool PCM::QOSMetricAvailable() const
@@ -554,9 +564,14 @@ bool PCM::QOSMetricAvailable() const
 #ifndef __linux__
     if (isSecureBoot()) return false;
 #endif
-    PCM_CPUID_INFO cpuinfo;
-    pcm_cpuid(0x7,0,cpuinfo);
-    return (cpuinfo.reg.ebx & (1<<12))?true:false;
+    // the CPUID results are cached: the metric functions query them per counter state and CPUID traps to the hypervisor in VMs
+    static const bool available = []()
+    {
+        PCM_CPUID_INFO cpuinfo;
+        pcm_cpuid(0x7,0,cpuinfo);
+        return (cpuinfo.reg.ebx & (1<<12)) != 0;
+    }();
+    return available;
 }
 
 bool PCM::L3QOSMetricAvailable() const
@@ -565,49 +580,54 @@ bool PCM::L3QOSMetricAvailable() const
 #ifndef __linux__
     if (isSecureBoot()) return false;
 #endif
-    PCM_CPUID_INFO cpuinfo;
-    pcm_cpuid(0xf,0,cpuinfo);
-    return (cpuinfo.reg.edx & (1<<1))?true:false;
+    static const bool available = []()
+    {
+        PCM_CPUID_INFO cpuinfo;
+        pcm_cpuid(0xf,0,cpuinfo);
+        return (cpuinfo.reg.edx & (1<<1)) != 0;
+    }();
+    return available;
+}
+
+// L3 monitoring capabilities: CPUID.(EAX=0FH,ECX=1):EDX, cached like QOSMetricAvailable
+static uint32 getL3MonitoringCapabilities()
+{
+    static const uint32 capabilities = []()
+    {
+        PCM_CPUID_INFO cpuinfo;
+        pcm_cpuid(0xf,0x1,cpuinfo);
+        return (uint32)cpuinfo.reg.edx;
+    }();
+    return capabilities;
 }
 
 bool PCM::L3CacheOccupancyMetricAvailable() const
 {
-    PCM_CPUID_INFO cpuinfo;
     if (!(QOSMetricAvailable() && L3QOSMetricAvailable()))
         return false;
-    pcm_cpuid(0xf,0x1,cpuinfo);
-    return (cpuinfo.reg.edx & 1)?true:false;
+    return (getL3MonitoringCapabilities() & 1)?true:false;
 }
 
 bool isMBMEnforced()
 {
-    static int flag = -1;
-    if (flag < 0)
-    {
-        // flag not yet initialized
-        flag = pcm::safe_getenv("PCM_ENFORCE_MBM") == std::string("1") ? 1 : 0;
-    }
-    return flag > 0;
+    static const bool enforced = pcm::safe_getenv("PCM_ENFORCE_MBM") == std::string("1");
+    return enforced;
 }
 
 bool PCM::CoreLocalMemoryBWMetricAvailable() const
 {
     if (isMBMEnforced() == false && cpu_family_model == SKX && cpu_stepping < 5) return false; // SKZ4 errata
-    PCM_CPUID_INFO cpuinfo;
     if (!(QOSMetricAvailable() && L3QOSMetricAvailable()))
             return false;
-    pcm_cpuid(0xf,0x1,cpuinfo);
-    return (cpuinfo.reg.edx & 2)?true:false;
+    return (getL3MonitoringCapabilities() & 2)?true:false;
 }
 
 bool PCM::CoreRemoteMemoryBWMetricAvailable() const
 {
     if (isMBMEnforced() == false && cpu_family_model == SKX && cpu_stepping < 5) return false; // SKZ4 errata
-    PCM_CPUID_INFO cpuinfo;
     if (!(QOSMetricAvailable() && L3QOSMetricAvailable()))
         return false;
-    pcm_cpuid(0xf, 0x1, cpuinfo);
-    return (cpuinfo.reg.edx & 4) ? true : false;
+    return (getL3MonitoringCapabilities() & 4) ? true : false;
 }
 
 unsigned PCM::getMaxRMID() const
@@ -1122,6 +1142,48 @@ public:
     }
 };
 
+#ifdef __linux__
+// per-core CPUID results in the discovery cache, one line per online core
+static void loadCachedTopologyEntries(std::unordered_map<int32, TopologyEntry> & entries)
+{
+    DiscoveryCache::Lines lines;
+    if (!DiscoveryCache::getInstance().get("topology", lines))
+    {
+        return;
+    }
+    for (const auto & line : lines)
+    {
+        TopologyEntry entry;
+        int32 coreType = 0;
+        std::istringstream input(line);
+        input >> entry.os_id >> entry.thread_id >> entry.core_id >> entry.module_id >> entry.tile_id >> entry.die_id
+            >> entry.die_grp_id >> entry.socket_id >> entry.socket_unique_core_id >> entry.l3_cache_id >> entry.native_cpu_model >> coreType;
+        if (!input || entry.os_id < 0)
+        {
+            entries.clear(); // do not mix partial cached and discovered topology
+            return;
+        }
+        entry.core_type = (TopologyEntry::CoreType)coreType;
+        entries[entry.os_id] = entry;
+    }
+}
+
+static void storeCachedTopologyEntries(const std::vector<TopologyEntry> & topology)
+{
+    DiscoveryCache::Lines lines;
+    for (const auto & entry : topology)
+    {
+        if (entry.os_id < 0) continue; // offline
+        std::ostringstream line;
+        line << entry.os_id << " " << entry.thread_id << " " << entry.core_id << " " << entry.module_id << " " << entry.tile_id
+            << " " << entry.die_id << " " << entry.die_grp_id << " " << entry.socket_id << " " << entry.socket_unique_core_id
+            << " " << entry.l3_cache_id << " " << entry.native_cpu_model << " " << int32(entry.core_type);
+        lines.push_back(line.str());
+    }
+    DiscoveryCache::getInstance().set("topology", lines);
+}
+#endif
+
 bool PCM::discoverSystemTopology()
 {
     typedef std::map<uint32, uint32> socketIdMap_type;
@@ -1229,6 +1291,10 @@ bool PCM::discoverSystemTopology()
                 if (di != topologyDomainMap.end())
                 {
                     const auto & d = di->second;
+                    if (d.nextLevelShift <= d.levelShift)
+                    {
+                        return 0U; // empty domain, e.g. one thread per core in a VM
+                    }
                     return extract_bits_32(apic_id, d.levelShift, d.nextLevelShift - 1);
                 }
                 return 0U;
@@ -1361,53 +1427,102 @@ bool PCM::discoverSystemTopology()
     TopologyEntry entry;
 
 #ifdef __linux__
-    num_cores = readMaxFromSysFS("/sys/devices/system/cpu/present");
-    if(num_cores == -1)
-    {
-      std::cerr << "Cannot read number of present cores\n";
-      return false;
+    SimulatedHardware::Topology simulatedTopology;
+    if (SimulatedHardware::getTopology(simulatedTopology))
+    {
+        // OS ids enumerate the first threads of all cores, then the second threads as Linux does
+        const int32 numPhysCores = int32(simulatedTopology.sockets * simulatedTopology.coresPerSocket);
+        num_cores = int32(simulatedTopology.getNumThreads());
+        num_online_cores = num_cores;
+        topology.resize(num_cores);
+        for (int32 os_id = 0; os_id < num_cores; ++os_id)
+        {
+            TopologyEntry & e = topology[os_id];
+            const int32 physCore = os_id % numPhysCores;
+            e.os_id = os_id;
+            e.thread_id = os_id / numPhysCores;
+            e.core_id = physCore % int32(simulatedTopology.coresPerSocket);
+            e.socket_id = physCore / int32(simulatedTopology.coresPerSocket);
+            e.tile_id = physCore;
+            e.module_id = 0;
+            e.die_id = 0;
+            e.die_grp_id = 0;
+            e.socket_unique_core_id = e.core_id;
+            e.l3_cache_id = e.socket_id;
+            socketIdMap[e.socket_id] = 0;
+        }
     }
-    ++num_cores;
-
-    // open /proc/cpuinfo
-    FILE * f_cpuinfo = fopen("/proc/cpuinfo", "r");
-    if (!f_cpuinfo)
+    else
     {
-        std::cerr << "Cannot open /proc/cpuinfo file.\n";
-        return false;
-    }
+        num_cores = readMaxFromSysFS("/sys/devices/system/cpu/present");
+        if(num_cores == -1)
+        {
+          std::cerr << "Cannot read number of present cores\n";
+          return false;
+        }
+        ++num_cores;
 
-    // map with key=pkg_apic_id (not necessarily zero based or sequential) and
-    // associated value=socket_id that should be 0 based and sequential
-    std::map<int, int> found_pkg_ids;
-    topology.resize(num_cores);
-    char buffer[1024];
-    while (0 != fgets(buffer, 1024, f_cpuinfo))
-    {
-        if (strncmp(buffer, "processor", sizeof("processor") - 1) == 0)
+        // open /proc/cpuinfo
+        FILE * f_cpuinfo = fopen("/proc/cpuinfo", "r");
+        if (!f_cpuinfo)
         {
-            pcm_sscanf(buffer) >> s_expect("processor\t: ") >> entry.os_id;
-            DBG(3, "os_core_id: " , entry.os_id );
-            try {
-                TemporalThreadAffinity _(entry.os_id);
+            std::cerr << "Cannot open /proc/cpuinfo file.\n";
+            return false;
+        }
+
+        // map with key=pkg_apic_id (not necessarily zero based or sequential) and
+        // associated value=socket_id that should be 0 based and sequential
+        std::map<int, int> found_pkg_ids;
+        topology.resize(num_cores);
 
-                populateEntry(entry);
-                if (populateHybridEntry(entry, entry.os_id) == false)
+        // pinning to every core for CPUID dominates the startup on large systems: reuse the cached results
+        std::unordered_map<int32, TopologyEntry> cachedEntries;
+        loadCachedTopologyEntries(cachedEntries);
+        bool discovered = false;
+
+        char buffer[1024];
+        while (0 != fgets(buffer, 1024, f_cpuinfo))
+        {
+            if (strncmp(buffer, "processor", sizeof("processor") - 1) == 0)
+            {
+                pcm_sscanf(buffer) >> s_expect("processor\t: ") >> entry.os_id;
+                DBG(3, "os_core_id: " , entry.os_id );
+                const auto cached = cachedEntries.find(entry.os_id);
+                if (cached != cachedEntries.end() && entry.os_id < num_cores)
                 {
-                    return false;
+                    entry = cached->second;
+                    topology[entry.os_id] = entry;
+                    socketIdMap[entry.socket_id] = 0;
+                    ++num_online_cores;
+                    continue;
                 }
+                discovered = true;
+                try {
+                    TemporalThreadAffinity _(entry.os_id);
 
-                topology[entry.os_id] = entry;
-                socketIdMap[entry.socket_id] = 0;
-                ++num_online_cores;
-            }
-            catch (std::exception &)
-            {
-                std::cerr << "Marking core " << entry.os_id << " offline\n";
+                    populateEntry(entry);
+                    if (populateHybridEntry(entry, entry.os_id) == false)
+                    {
+                        return false;
+                    }
+
+                    topology[entry.os_id] = entry;
+                    socketIdMap[entry.socket_id] = 0;
+                    ++num_online_cores;
+                }
+                catch (std::exception &)
+                {
+                    std::cerr << "Marking core " << entry.os_id << " offline\n";
+                }
             }
         }
+        fclose(f_cpuinfo);
+
+        if (discovered)
+        {
+            storeCachedTopologyEntries(topology);
+        }
     }
-    fclose(f_cpuinfo);
 
 #elif defined(__FreeBSD__) || defined(__DragonFly__)
 
@@ -1587,6 +1702,7 @@ bool PCM::discoverSystemTopology()
     int32 i = 0;
 
     socketRefCore.resize(num_sockets, -1);
+    globalUncoreFreezeDepth.resize(num_sockets, 0);
     for(i = 0; i < num_cores; ++i)
     {
         if(isCoreOnline(i))
@@ -2204,40 +2320,69 @@ void PCM::initUncoreObjects()
 
 void PCM::globalFreezeUncoreCounters()
 {
-    globalFreezeUncoreCountersInternal(1ULL);
+    for (uint32 s = 0; s < (uint32)num_sockets; ++s)
+    {
+        globalFreezeUncoreCountersInternal(s, 1ULL);
+    }
 }
 
 void PCM::globalUnfreezeUncoreCounters()
 {
-    globalFreezeUncoreCountersInternal(0ULL);
+    for (uint32 s = 0; s < (uint32)num_sockets; ++s)
+    {
+        globalFreezeUncoreCountersInternal(s, 0ULL);
+    }
+}
+
+void PCM::globalFreezeUncoreCounters(const uint32 socket)
+{
+    globalFreezeUncoreCountersInternal(socket, 1ULL);
+}
+
+void PCM::globalUnfreezeUncoreCounters(const uint32 socket)
+{
+    globalFreezeUncoreCountersInternal(socket, 0ULL);
 }
 
 // 1 : freeze
 // 0 : unfreeze
-void PCM::globalFreezeUncoreCountersInternal(const unsigned long long int freeze)
+void PCM::globalFreezeUncoreCountersInternal(const uint32 s, const unsigned long long int freeze)
 {
-    for (uint32 s = 0; s < (uint32)num_sockets; ++s)
+    // only the outermost freeze and unfreeze are written (an unbalanced unfreeze is always written)
+    auto & depth = globalUncoreFreezeDepth[s];
+    if (freeze)
     {
-        auto& handle = MSR[socketRefCore[s]];
-        switch (cpu_family_model)
+        if (depth++ > 0)
         {
-        case SPR:
-        case EMR:
-            handle->write(SPR_MSR_UNCORE_PMON_GLOBAL_CTL, freeze);
-            break;
-        case SKX:
-        case ICX:
-            handle->write(MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 61ULL);
-            break;
-        case HASWELLX:
-        case BDX:
-            handle->write(MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 29ULL);
-            break;
-        case IVYTOWN:
-            handle->write(IVT_MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 29ULL);
-            break;
+            return;
+        }
+    }
+    else
+    {
+        if (depth > 0 && --depth > 0)
+        {
+            return;
         }
     }
+    auto& handle = MSR[socketRefCore[s]];
+    switch (cpu_family_model)
+    {
+    case SPR:
+    case EMR:
+        handle->write(SPR_MSR_UNCORE_PMON_GLOBAL_CTL, freeze);
+        break;
+    case SKX:
+    case ICX:
+        handle->write(MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 61ULL);
+        break;
+    case HASWELLX:
+    case BDX:
+        handle->write(MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 29ULL);
+        break;
+    case IVYTOWN:
+        handle->write(IVT_MSR_UNCORE_PMON_GLOBAL_CTL, (1ULL - freeze) << 29ULL);
+        break;
+    }
 }
 
 
@@ -3131,15 +3276,60 @@ void enableNMIWatchdog(const bool silent)
 
 constexpr const char* threadCreateErrorMessage = "This might be due to a too low limit for the number of threads per process. Try to increase it\n";
 
+// OS core id the current thread is pinned to by its CoreTaskQueue (-1 if it is not a core worker)
+static thread_local int32 coreTaskQueueWorkerCore = -1;
+
+//! Per-core worker pinned to its core. Producers push tasks onto a lock-free intrusive list and bump
+//! the wake word of the queue, only queues with posted work are woken.
+//! Idle workers park on their wake word (futex on Linux) without spinning, so idle cores can stay in deep C-states.
 class CoreTaskQueue
 {
-    std::queue<std::packaged_task<void()> > wQueue;
-    std::mutex m;
-    std::condition_variable condVar;
+    std::atomic<CoreTask *> pending{nullptr}; // LIFO pushed by any producer, drained at once by the worker
     std::thread worker;
+    WaitableAtomic wakeWord;
     CoreTaskQueue() = delete;
     CoreTaskQueue(CoreTaskQueue &) = delete;
     CoreTaskQueue & operator = (CoreTaskQueue &) = delete;
+
+    void run(const int32 core)
+    {
+        for (;;)
+        {
+            const auto seen = wakeWord.load();
+            CoreTask * list = pending.exchange(nullptr, std::memory_order_acquire);
+            if (list == nullptr)
+            {
+                wakeWord.wait(seen);
+                continue;
+            }
+            CoreTask * fifo = nullptr; // restore submission order
+            while (list)
+            {
+                CoreTask * next = list->next;
+                list->next = fifo;
+                fifo = list;
+                list = next;
+            }
+            while (fifo)
+            {
+                CoreTask * task = fifo;
+                fifo = task->next;
+                task->next = nullptr;
+                const bool owned = task->ownedByQueue;
+                try {
+                    CollectionStats::AttachScope attach(task->sample); // the stages of the task count towards the producer's sample
+                    task->work();
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "PCM Error. Exception in CoreTaskQueue task on core " << core << ": " << e.what() << "\n";
+                }
+                // the producer may re-post a preallocated task as soon as its latch fires
+                if (owned) delete task;
+                else if (task->latch) task->latch->countDown();
+            }
+        }
+    }
 public:
     CoreTaskQueue(int32 core)
     {
@@ -3147,16 +3337,8 @@ public:
             worker = std::thread([=]() {
                 try {
                     TemporalThreadAffinity tempThreadAffinity(core, false);
-                    std::unique_lock<std::mutex> lock(m);
-                    while (1) {
-                        while (wQueue.empty()) {
-                            condVar.wait(lock);
-                        }
-                        while (!wQueue.empty()) {
-                            wQueue.front()();
-                            wQueue.pop();
-                        }
-                    }
+                    coreTaskQueueWorkerCore = core;
+                    run(core);
                 }
                 catch (const std::exception& e)
                 {
@@ -3175,9 +3357,28 @@ public:
     }
     void push(std::packaged_task<void()> & task)
     {
-        std::unique_lock<std::mutex> lock(m);
-        wQueue.push(std::move(task));
-        condVar.notify_one();
+        auto packaged = std::make_shared<std::packaged_task<void()> >(std::move(task));
+        CoreTask * oneShot = new CoreTask();
+        oneShot->work = [packaged]() { (*packaged)(); };
+        oneShot->ownedByQueue = true;
+        post(*oneShot);
+        wake();
+    }
+    //! enqueues a preallocated task without waking the worker (see wake()).
+    //! The task must not be re-posted before its latch fires.
+    void post(CoreTask & task)
+    {
+        task.sample = CollectionStats::getCurrentSample(); // the producer waits for the task within its sample
+        CoreTask * head = pending.load(std::memory_order_relaxed);
+        do {
+            task.next = head;
+        } while (!pending.compare_exchange_weak(head, &task, std::memory_order_release, std::memory_order_relaxed));
+    }
+    //! wakes the worker to process the posted tasks
+    void wake()
+    {
+        wakeWord.fetch_add(1);
+        wakeWord.wakeAll();
     }
 };
 
@@ -3209,6 +3410,29 @@ void increaseULimit()
 }
 #endif
 
+//! \brief Wall-clock breakdown of consecutive stages (e.g. of the PCM startup) for the debug output
+class StageTimer
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start{Clock::now()};
+    Clock::time_point last{start};
+    std::ostringstream breakdown;
+public:
+    //! \brief Ends the current stage and starts the next one
+    void stage(const char * name)
+    {
+        if (debug::currentDebugLevel < 1) return;
+        const auto now = Clock::now();
+        breakdown << " " << name << "=" << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+    }
+    void print(const char * operation) const
+    {
+        DBG(1, operation, " time breakdown (ms):", breakdown.str(), " total=",
+            std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+};
+
 PCM::PCM() :
     cpu_family(-1),
     cpu_model_private(-1),
@@ -3289,18 +3513,26 @@ PCM::PCM() :
     }
 #endif
 
+    StageTimer timer;
+
     if(!detectModel()) return;
 
     if(!checkModel()) return;
 
     initCStateSupportTables();
 
+    timer.stage("model");
+
     if(!discoverSystemTopology()) return;
 
+    timer.stage("topology");
+
     if(!initMSR()) return;
 
     readCoreCounterConfig(true);
 
+    timer.stage("MSR");
+
 #ifndef PCM_SILENT
     if (!quietMode)
     {
@@ -3334,6 +3566,8 @@ PCM::PCM() :
     }
 #endif
 
+    timer.stage("frequency+energy");
+
     if (isServerCPU())
     {
         assert(topology.size());
@@ -3342,21 +3576,30 @@ PCM::PCM() :
 
     initUncoreObjects();
 
+    timer.stage("uncore");
+
     initRDT();
 
     readCPUMicrocodeLevel();
 
+    timer.stage("RDT+microcode");
+
 #ifdef PCM_USE_PERF
     canUsePerf = true;
     perfEventHandle.resize(num_cores, std::vector<int>(PERF_MAX_COUNTERS, -1));
     std::fill(perfTopDownPos.begin(), perfTopDownPos.end(), 0);
 #endif
 
+    compileMSRReadPlans();
+
     for (int32 i = 0; i < num_cores; ++i)
     {
         coreTaskQueues.push_back(std::make_shared<CoreTaskQueue>(i));
     }
 
+    timer.stage("core workers");
+    timer.print("PCM initialization");
+
 #ifndef PCM_SILENT
     std::cerr << "\n";
 #endif
@@ -3670,6 +3913,8 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
 
     if (MSR.empty()) return PCM::MSRAccessDenied;
 
+    StageTimer timer;
+
     ExtendedCustomCoreEventDescription * pExtDesc = (ExtendedCustomCoreEventDescription *)parameter_;
 
 #ifdef PCM_USE_PERF
@@ -3681,6 +3926,11 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
         canUsePerf = false;
         if (!silent) std::cerr << "Usage of Linux perf events is disabled through PCM_NO_PERF environment variable. Using direct PMU programming...\n";
     }
+    else if (SimulatedHardware::isEnabled())
+    {
+        canUsePerf = false;
+        if (!silent) std::cerr << "Using direct PMU programming with the simulated hardware backend.\n";
+    }
 /*
     if(num_online_cores < num_cores)
     {
@@ -4079,6 +4329,8 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
     std::vector<std::future<void> > asyncCoreResults;
     std::vector<PCM::ErrorCode> programmingStatuses(num_cores, PCM::Success);
 
+    timer.stage("prepare");
+
     for (int i = 0; i < (int)num_cores; ++i)
     {
         if (isCoreOnline(i) == false) continue;
@@ -4106,6 +4358,8 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
 
     programmed_core_pmu = true;
 
+    timer.stage(canUsePerf ? "core PMU (perf)" : "core PMU (MSR)");
+
     if (canUsePerf && !silent)
     {
         std::cerr << "Successfully programmed on-core PMU using Linux perf\n";
@@ -4113,6 +4367,7 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
 
     if (EXT_CUSTOM_CORE_EVENTS == mode_ && pExtDesc && pExtDesc->defaultUncoreProgramming == false)
     {
+        timer.print("PCM::program");
         return PCM::Success;
     }
 
@@ -4121,10 +4376,10 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
         std::vector<std::future<uint64>> qpi_speeds;
         for (size_t i = 0; i < (size_t)serverUncorePMUs.size(); ++i)
         {
-            serverUncorePMUs[i]->program();
             qpi_speeds.push_back(std::async(std::launch::async,
                 &ServerUncorePMUs::computeQPISpeed, serverUncorePMUs[i].get(), socketRefCore[i], cpu_family_model));
         }
+        runOnSocketRefCores([this](const size_t i) { serverUncorePMUs[i]->program(); }, serverUncorePMUs.size());
         for (size_t i = 0; i < (size_t)serverUncorePMUs.size(); ++i)
         {
             max_qpi_speed = (std::max)(qpi_speeds[i].get(), max_qpi_speed);
@@ -4152,11 +4407,47 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
         }
     }
 
+    timer.stage("uncore PMU");
+    timer.print("PCM::program");
+
     if (!silent) reportQPISpeed();
 
     return PCM::Success;
 }
 
+void PCM::runOnSocketRefCores(const std::function<void(const size_t)> & f, const size_t sockets)
+{
+    if (coreTaskQueues.empty() || sockets < 2)
+    {
+        for (size_t socket = 0; socket < sockets; ++socket)
+        {
+            TemporalThreadAffinity tempThreadAffinity(socketRefCore[socket]); // speedup trick for Linux
+            f(socket);
+        }
+        return;
+    }
+    std::vector<std::future<void> > results;
+    for (size_t socket = 0; socket < sockets; ++socket)
+    {
+        const auto refCore = socketRefCore[socket];
+        std::packaged_task<void()> task([&f, socket, refCore]()
+            {
+                TemporalThreadAffinity tempThreadAffinity(refCore, false); // speedup trick for Linux
+                f(socket);
+            });
+        results.push_back(task.get_future());
+        coreTaskQueues[refCore]->push(task);
+    }
+    for (auto & result : results)
+    {
+        result.wait(); // all tasks reference f: let them finish before an exception unwinds this frame
+    }
+    for (auto & result : results)
+    {
+        result.get();
+    }
+}
+
 void PCM::checkStatus(const PCM::ErrorCode status)
 {
     switch (status)
@@ -5521,14 +5812,13 @@ bool PCM::supportsRTM() const
 
 bool PCM::supportsRDTSCP() const
 {
-    static int supports = -1;
-    if (supports < 0)
+    static const bool supports = []()
     {
         PCM_CPUID_INFO info;
         pcm_cpuid(0x80000001, info);
-        supports = (info.reg.edx & (0x1 << 27)) ? 1 : 0;
-    }
-    return 1 == supports;
+        return (info.reg.edx & (0x1 << 27)) != 0;
+    }();
+    return supports;
 }
 
 #ifdef __APPLE__
@@ -5605,7 +5895,7 @@ CoreCounterState getCoreCounterState(uint32 core)
 }
 
 #ifdef PCM_USE_PERF
-void PCM::readPerfData(uint32 core, std::vector<uint64> & outData)
+void PCM::readPerfData(uint32 core, PerfData & outData)
 {
     if (perfEventTaskHandle.empty() == false)
     {
@@ -5618,6 +5908,7 @@ void PCM::readPerfData(uint32 core, std::vector<uint64> & outData)
                 if (fd != -1)
                 {
                     uint64 result{0ULL};
+                    CollectionStats::countSyscall();
                     const int status = ::read(fd, &result, sizeof(result));
                     if (status != sizeof(result))
                     {
@@ -5632,7 +5923,7 @@ void PCM::readPerfData(uint32 core, std::vector<uint64> & outData)
         }
         return;
     }
-    auto readPerfDataHelper = [this](const uint32 core, std::vector<uint64>& outData, const uint32 leader, const uint32 num_counters)
+    auto readPerfDataHelper = [this](const uint32 core, PerfData & outData, const uint32 leader, const uint32 num_counters)
     {
         if (perfEventHandle[core][leader] < 0)
         {
@@ -5642,6 +5933,7 @@ void PCM::readPerfData(uint32 core, std::vector<uint64> & outData)
         uint64 data[1 + PERF_MAX_COUNTERS];
         const int32 bytes2read = sizeof(uint64) * (1 + num_counters);
         assert(num_counters <= PERF_MAX_COUNTERS);
+        CollectionStats::countSyscall();
         int result = ::read(perfEventHandle[core][leader], data, bytes2read);
         // data layout: nr counters; counter 0, counter 1, counter 2,...
         if (result != bytes2read)
@@ -5671,7 +5963,7 @@ void PCM::readPerfData(uint32 core, std::vector<uint64> & outData)
     readPerfDataHelper(core, outData, PERF_GROUP_LEADER_COUNTER, core_fixed_counter_num_used + core_gen_counter_num_used);
     if (isHWTMAL1Supported() && perfSupportsTopDown())
     {
-        std::vector<uint64> outTopDownData(outData.size(), 0);
+        PerfData outTopDownData{};
         const auto topdownCtrNum = isHWTMAL2Supported() ? PERF_TOPDOWN_COUNTERS : PERF_TOPDOWN_COUNTERS_L1;
         readPerfDataHelper(core, outTopDownData, PERF_TOPDOWN_GROUP_LEADER_COUNTER, topdownCtrNum);
         std::copy(outTopDownData.begin(), outTopDownData.begin() + topdownCtrNum, outData.begin() + core_fixed_counter_num_used + core_gen_counter_num_used);
@@ -5687,7 +5979,7 @@ void BasicCounterState::readAndAggregateTSC(std::shared_ptr<SafeMsrHandle> msr)
     if (m->isAtom() == false || cpu_family_model == PCM::AVOTON)
     {
         cInvariantTSC = m->getInvariantTSC_Fast(msr->getCoreId());
-        MSRValues[IA32_TIME_STAMP_COUNTER] = cInvariantTSC;
+        MSRValues.set(m->tscMSRValueSlot, cInvariantTSC);
     }
     else
     {
@@ -5704,6 +5996,7 @@ void BasicCounterState::readAndAggregateTSC(std::shared_ptr<SafeMsrHandle> msr)
 
 void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
 {
+    CollectionStats::StageScope stageScope(CollectionStats::CoreReads);
     assert(msr.get());
     uint64 cInstRetiredAny = 0, cCpuClkUnhaltedThread = 0, cCpuClkUnhaltedRef = 0;
     uint64 cL3Occupancy = 0;
@@ -5722,7 +6015,8 @@ void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
     uint64 cBrMispredSlots = 0;
     uint64 cHeavyOpsSlots = 0;
     const int32 core_id = msr->getCoreId();
-    TemporalThreadAffinity tempThreadAffinity(core_id); // speedup trick for Linux
+    std::optional<TemporalThreadAffinity> tempThreadAffinity;
+    if (coreTaskQueueWorkerCore != core_id) tempThreadAffinity.emplace(core_id); // speedup trick for Linux
 
     PCM * m = PCM::getInstance();
     assert(m);
@@ -5737,11 +6031,18 @@ void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
     uint64 overflows = 0;
 
     const auto corruptedCountersMask = m->checkCustomCoreProgramming(msr);
+
+    // read all planned MSRs in one batch (PMU counter MSRs only if Linux perf is not used)
+    const auto & plan = m->coreMSRReadPlan;
+    static thread_local std::vector<uint64> planValues;
+    planValues.assign(plan.plan.size(), 0ULL);
+    plan.plan.execute(*msr, planValues.data(), m->canUsePerf ? plan.numCounterMSRs : 0);
+
     // reading core PMU counters
 #ifdef PCM_USE_PERF
     if(m->canUsePerf)
     {
-        std::vector<uint64> perfData(PERF_MAX_COUNTERS, 0ULL);
+        PCM::PerfData perfData{};
         m->readPerfData(msr->getCoreId(), perfData);
         cInstRetiredAny =       perfData[PCM::PERF_INST_RETIRED_POS];
         cCpuClkUnhaltedThread = perfData[PCM::PERF_CPU_CLK_UNHALTED_THREAD_POS];
@@ -5771,15 +6072,15 @@ void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
 #endif
     {
         {
-            msr->read(IA32_PERF_GLOBAL_STATUS, &overflows); // read overflows
+            overflows = planValues[plan.globalStatusPos]; // read overflows
             DBG(3,  "core_id = " , core_id , " IA32_PERF_GLOBAL_STATUS: " , overflows);
 
-            msr->read(INST_RETIRED_ADDR, &cInstRetiredAny);
-            msr->read(CPU_CLK_UNHALTED_THREAD_ADDR, &cCpuClkUnhaltedThread);
-            msr->read(CPU_CLK_UNHALTED_REF_ADDR, &cCpuClkUnhaltedRef);
+            cInstRetiredAny = planValues[plan.instRetiredPos];
+            cCpuClkUnhaltedThread = planValues[plan.cpuClkUnhaltedThreadPos];
+            cCpuClkUnhaltedRef = planValues[plan.cpuClkUnhaltedRefPos];
             for (int i = 0; i < core_gen_counter_num_max; ++i)
             {
-                msr->read(IA32_PMC0 + i, &cCustomEvents[i]);
+                cCustomEvents[i] = planValues[plan.genCounterPos[i]];
             }
         }
 
@@ -5846,23 +6147,26 @@ void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
 
     readAndAggregateTSC(msr);
 
-    // reading core C state counters
+    // core C state counters
     for (int i = 0; i <= (int)(PCM::MAX_C_STATE); ++i)
     {
         if (m->coreCStateMsr && m->coreCStateMsr[i])
         {
-            const auto index = m->coreCStateMsr[i];
-            msr->read(index, &(cCStateResidency[i]));
-            MSRValues[index] = cCStateResidency[i];
+            cCStateResidency[i] = planValues[plan.cStatePos[i]];
         }
     }
 
-    // reading temperature
-    msr->read(MSR_IA32_THERM_STATUS, &thermStatus);
-    MSRValues[MSR_IA32_THERM_STATUS] = thermStatus;
+    // temperature
+    thermStatus = planValues[plan.thermStatusPos];
+
+    cSMICount = planValues[plan.smiCountPos];
 
-    msr->read(MSR_SMI_COUNT, &cSMICount);
-    MSRValues[MSR_SMI_COUNT] = cSMICount;
+    // raw MSR values (C states, temperature, SMI count and thread_msr events)
+    MSRValues.resize(m->msrValueSlots.size());
+    for (const auto & v : plan.values)
+    {
+        MSRValues.set(v.first, planValues[v.second]);
+    }
 
     InstRetiredAny += checked_uint64(m->extractCoreFixedCounterValue(cInstRetiredAny), extract_bits(overflows, 32, 32));
     CpuClkUnhaltedThread += checked_uint64(m->extractCoreFixedCounterValue(cCpuClkUnhaltedThread), extract_bits(overflows, 33, 33));
@@ -6151,6 +6455,7 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
     if (MSR.empty())  return PCM::MSRAccessDenied;
     threadMSRConfig = RawPMUConfig{};
     packageMSRConfig = RawPMUConfig{};
+    compileMSRReadPlans();
     pcicfgConfig = RawPMUConfig{};
     mmioConfig = RawPMUConfig{};
     pmtConfig = RawPMUConfig{};
@@ -6348,10 +6653,12 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
         else if (type == "package_msr")
         {
             packageMSRConfig = pmuConfig.second;
+            compileMSRReadPlans();
         }
         else if (type == "thread_msr")
         {
             threadMSRConfig = pmuConfig.second;
+            compileMSRReadPlans();
         }
         else if (type == "pcicfg")
         {
@@ -6363,16 +6670,19 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                     {
                         // add locations
                         std::vector<PCICFGRegisterEncoding> locations;
+                        std::vector<int32> numaNodes;
                         const auto deviceID = c.first[PCICFGEventPosition::deviceID];
-                        forAllIntelDevices([&locations, &deviceID, &c](const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint32 device_id)
+                        forAllIntelDevices([&locations, &numaNodes, &deviceID, &c](const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint32 device_id)
                             {
                                 if (deviceID == device_id && PciHandleType::exists(group, bus, device, function))
                                 {
                                     // PciHandleType shared ptr, offset
                                     locations.push_back(PCICFGRegisterEncoding{ std::make_shared<PciHandleType>(group, bus, device, function), (uint32)c.first[PCICFGEventPosition::offset] });
+                                    numaNodes.push_back(locations.back().first->getNUMANode());
                                 }
                             });
                         PCICFGRegisterLocations[c.first] = locations;
+                        PCICFGRegisterSockets[c.first] = getRawRegisterSockets(numaNodes);
                     }
                 }
             };
@@ -6389,6 +6699,7 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                     {
                         // add locations
                         std::vector<TPMIRegisterEncoding> locations;
+                        std::vector<int32> numaNodes;
                         const auto tpmiID = c.first[TPMIEventPosition::ID];
                         const uint32 offset = (uint32)c.first[TPMIEventPosition::offset];
                         const auto numInstances = TPMIHandle::getNumInstances();
@@ -6396,8 +6707,10 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                         {
                             std::shared_ptr<TPMIHandle> tpmiHandle = std::make_shared<TPMIHandle>(instance, tpmiID, offset);
                             locations.push_back(TPMIRegisterEncoding{ tpmiHandle });
+                            numaNodes.push_back(tpmiHandle->getNUMANode());
                         }
                         TPMIRegisterLocations[c.first] = locations;
+                        TPMIRegisterSockets[c.first] = getRawRegisterSockets(numaNodes);
                     }
                 }
             };
@@ -6414,8 +6727,9 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                     {
                         // add locations
                         std::vector<MMIORegisterEncoding> locations;
+                        std::vector<int32> numaNodes;
                         const auto deviceID = c.first[MMIOEventPosition::deviceID];
-                        forAllIntelDevices([&locations, &deviceID, &c](const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint32 device_id)
+                        forAllIntelDevices([&locations, &numaNodes, &deviceID, &c](const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint32 device_id)
                             {
                                 if (deviceID == device_id && PciHandleType::exists(group, bus, device, function))
                                 {
@@ -6443,9 +6757,11 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                                     const size_t addr = memBar + c.first[MMIOEventPosition::offset];
                                     // MMIORange shared ptr (handle), offset
                                     locations.push_back(MMIORegisterEncoding{ std::make_shared<MMIORange>(addr & ~4095ULL, 4096), (uint32) (addr & 4095ULL) });
+                                    numaNodes.push_back(pciHandle.getNUMANode());
                                 }
                             });
                         MMIORegisterLocations[c.first] = locations;
+                        MMIORegisterSockets[c.first] = getRawRegisterSockets(numaNodes);
                     }
                 }
             };
@@ -6462,13 +6778,32 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                     {
                         // add locations
                         std::vector<PMTRegisterEncoding> locations;
+                        std::vector<int32> numaNodes;
                         const auto UID = c.first[PMTEventPosition::UID];
                         for (size_t inst = 0; inst < TelemetryArray::numInstances(UID); ++inst)
                         {
-                            locations.push_back(std::make_shared<TelemetryArray>(UID, inst));
-                            DBG(3, "PMTRegisterLocations: UID: 0x" , std::hex , UID , " inst: " , std::dec , inst);
+                            // one array per telemetry region, shared by all events of the UID
+                            auto & telemetryArray = PMTTelemetryArrays[std::make_pair(UID, inst)];
+                            if (telemetryArray.array.get() == nullptr)
+                            {
+                                telemetryArray.array = std::make_shared<TelemetryArray>(UID, inst);
+                            }
+                            locations.push_back(telemetryArray.array);
+                            numaNodes.push_back(locations.back()->getNUMANode());
+                            DBG(3, "PMTRegisterLocations: UID: 0x" , std::hex , UID , " inst: " , std::dec , inst, " NUMA node: ", numaNodes.back());
+                        }
+                        const auto sockets = getRawRegisterSockets(numaNodes);
+                        for (size_t inst = 0; inst < locations.size(); ++inst)
+                        {
+                            PMTTelemetryArrays[std::make_pair(UID, inst)].socket = sockets[inst];
                         }
                         PMTRegisterLocations[c.first] = locations;
+                        PMTRegisterSockets[c.first] = sockets;
+                    }
+                    // the telemetry arrays load only the qwords of the programmed events
+                    for (auto & location : PMTRegisterLocations[c.first])
+                    {
+                        location->addToReadSet(c.first[PMTEventPosition::offset]);
                     }
                 }
             };
@@ -6590,7 +6925,8 @@ void PCM::unfreezeServerUncoreCounters()
 void UncoreCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
 {
     const auto coreID = msr->getCoreId();
-    TemporalThreadAffinity tempThreadAffinity(coreID); // speedup trick for Linux
+    std::optional<TemporalThreadAffinity> tempThreadAffinity;
+    if (coreTaskQueueWorkerCore != coreID) tempThreadAffinity.emplace(coreID); // speedup trick for Linux
 
     auto pcm = PCM::getInstance();
     pcm->readAndAggregatePackageCStateResidencies(msr, *this);
@@ -6601,6 +6937,8 @@ SystemCounterState PCM::getSystemCounterState()
     SystemCounterState result;
     if (MSR.size())
     {
+        CollectionStats::SampleScope collectionSample;
+        TPMIHandle::SampleScope tpmiSample;
         // read core and uncore counter state
         for (int32 core = 0; core < num_cores; ++core)
             if ( isCoreOnline( core ) )
@@ -6672,22 +7010,28 @@ void PCM::readAndAggregateCXLCMCounters( CounterStateType & result)
 
     for (size_t socket = 0; socket < getNumSockets(); ++socket)
     {
-        uint64 CXLWriteMem = 0;
-        uint64 CXLWriteCache = 0;
-        for (size_t p = 0; p < getNumCXLPorts(socket); ++p)
-        {
-            CXLWriteMem += *cxlPMUs[socket][p].first.counterValue[0];
-            CXLWriteCache += *cxlPMUs[socket][p].first.counterValue[1];
-        }
-        result.CXLWriteMem[socket] = CXLWriteMem;
-        result.CXLWriteCache[socket] = CXLWriteCache;
+        readCXLCMCounters((uint32)socket, result);
+    }
+}
+
+void PCM::readCXLCMCounters(const uint32 socket, SystemCounterState & result)
+{
+    uint64 CXLWriteMem = 0;
+    uint64 CXLWriteCache = 0;
+    for (size_t p = 0; p < getNumCXLPorts(socket); ++p)
+    {
+        CXLWriteMem += *cxlPMUs[socket][p].first.counterValue[0];
+        CXLWriteCache += *cxlPMUs[socket][p].first.counterValue[1];
     }
+    result.CXLWriteMem[socket] = CXLWriteMem;
+    result.CXLWriteCache[socket] = CXLWriteCache;
 }
 
 
 template <class CounterStateType>
 void PCM::readAndAggregateUncoreMCCounters(const uint32 socket, CounterStateType & result)
 {
+    CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
     if (LLCReadMissLatencyMetricsAvailable())
     {
         result.TOROccupancyIAMiss += getUncoreCounterState(CBO_PMU_ID, socket, EventPosition::TOR_OCCUPANCY);
@@ -6718,12 +7062,13 @@ void PCM::readAndAggregateUncoreMCCounters(const uint32 socket, CounterStateType
     const bool ReadMCStatsFromServerBW = (socket < serverBW.size());
     if (ReadMCStatsFromServerBW)
     {
-        result.UncMCNormalReads += serverBW[socket]->getImcReads();
-        result.UncMCFullWrites += serverBW[socket]->getImcWrites();
+        const ServerBW::Snapshot & bw = serverBW[socket]->snapshot();
+        result.UncMCNormalReads += bw.getTotal(ServerBW::ImcReads);
+        result.UncMCFullWrites += bw.getTotal(ServerBW::ImcWrites);
         if (PMMTrafficMetricsAvailable())
         {
-            result.UncPMMReads += serverBW[socket]->getPMMReads();
-            result.UncPMMWrites += serverBW[socket]->getPMMWrites();
+            result.UncPMMReads += bw.getTotal(ServerBW::PMMReads);
+            result.UncPMMWrites += bw.getTotal(ServerBW::PMMWrites);
         }
     }
 
@@ -6818,6 +7163,7 @@ void PCM::readAndAggregateUncoreMCCounters(const uint32 socket, CounterStateType
 template <class CounterStateType>
 void PCM::readAndAggregateEnergyCounters(const uint32 socket, CounterStateType & result)
 {
+    CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
     if(socket < (uint32)energy_status.size())
         result.PackageEnergyStatus += energy_status[socket]->read();
 
@@ -6836,13 +7182,13 @@ void PCM::readAndAggregateEnergyCounters(const uint32 socket, CounterStateType &
 template <class CounterStateType>
 void PCM::readMSRs(std::shared_ptr<SafeMsrHandle> msr, const PCM::RawPMUConfig& msrConfig, CounterStateType& result)
 {
-    auto read = [&msr, &result](const RawEventConfig & cfg) {
-        const auto index = cfg.first[MSREventPosition::index];
-        if (result.MSRValues.find(index) == result.MSRValues.end())
+    auto read = [this, &msr, &result](const RawEventConfig & cfg) {
+        const auto slot = getMSRValueSlot(cfg.first[MSREventPosition::index]);
+        if (slot >= 0 && result.MSRValues.contains(slot) == false)
         {
             uint64 val{ 0 };
-            msr->read(index, &val);
-            result.MSRValues[index] = val;
+            msr->read(cfg.first[MSREventPosition::index], &val);
+            result.MSRValues.set(slot, val);
         }
     };
     for (const auto& cfg : msrConfig.programmable)
@@ -6855,6 +7201,106 @@ void PCM::readMSRs(std::shared_ptr<SafeMsrHandle> msr, const PCM::RawPMUConfig&
     }
 }
 
+size_t PCM::addMSRValueSlot(const uint64 index)
+{
+    const auto slot = getMSRValueSlot(index);
+    if (slot >= 0)
+    {
+        return (size_t)slot;
+    }
+    msrValueSlots.push_back(index);
+    return msrValueSlots.size() - 1;
+}
+
+void PCM::compileMSRReadPlans()
+{
+    auto addValue = [this](MSRValuePositions & values, const uint64 index, const size_t pos)
+    {
+        const auto slot = addMSRValueSlot(index);
+        for (const auto & v : values)
+        {
+            if (v.first == slot) return;
+        }
+        values.push_back(std::make_pair(slot, pos));
+    };
+    tscMSRValueSlot = addMSRValueSlot(IA32_TIME_STAMP_COUNTER);
+    packageThermStatusMSRValueSlot = addMSRValueSlot(MSR_PACKAGE_THERM_STATUS);
+    auto addRawConfig = [&addValue](const RawPMUConfig & msrConfig, MsrReadPlan & plan, MSRValuePositions & values)
+    {
+        for (const auto * configs : { &msrConfig.programmable, &msrConfig.fixed })
+        {
+            for (const auto & cfg : *configs)
+            {
+                const auto index = cfg.first[MSREventPosition::index];
+                addValue(values, index, plan.add(index));
+            }
+        }
+    };
+
+    auto & core = coreMSRReadPlan;
+    core = CoreMSRReadPlan{};
+    core.globalStatusPos = core.plan.add(IA32_PERF_GLOBAL_STATUS);
+    core.instRetiredPos = core.plan.add(INST_RETIRED_ADDR);
+    core.cpuClkUnhaltedThreadPos = core.plan.add(CPU_CLK_UNHALTED_THREAD_ADDR);
+    core.cpuClkUnhaltedRefPos = core.plan.add(CPU_CLK_UNHALTED_REF_ADDR);
+    for (uint32 i = 0; i < core_gen_counter_num_max && i < (uint32)PERF_MAX_CUSTOM_COUNTERS; ++i)
+    {
+        core.genCounterPos[i] = core.plan.add(IA32_PMC0 + i);
+    }
+    core.numCounterMSRs = core.plan.size();
+    for (int i = 0; i <= int(MAX_C_STATE); ++i)
+    {
+        if (coreCStateMsr && coreCStateMsr[i])
+        {
+            core.cStatePos[i] = core.plan.add(coreCStateMsr[i]);
+            addValue(core.values, coreCStateMsr[i], core.cStatePos[i]);
+        }
+    }
+    core.thermStatusPos = core.plan.add(MSR_IA32_THERM_STATUS);
+    addValue(core.values, MSR_IA32_THERM_STATUS, core.thermStatusPos);
+    core.smiCountPos = core.plan.add(MSR_SMI_COUNT);
+    addValue(core.values, MSR_SMI_COUNT, core.smiCountPos);
+    addRawConfig(threadMSRConfig, core.plan, core.values);
+
+    auto & package = packageMSRReadPlan;
+    package = PackageMSRReadPlan{};
+    for (int i = 0; i <= int(MAX_C_STATE); ++i)
+    {
+        if (pkgCStateMsr && pkgCStateMsr[i])
+        {
+            package.cStatePos[i] = package.cStatePlan.add(pkgCStateMsr[i]);
+        }
+    }
+    if (packageThermalMetricsAvailable())
+    {
+        package.thermStatusPos = package.socketPlan.add(MSR_PACKAGE_THERM_STATUS);
+        addValue(package.values, MSR_PACKAGE_THERM_STATUS, package.thermStatusPos);
+    }
+    addRawConfig(packageMSRConfig, package.socketPlan, package.values);
+
+    DBG(2, "MSR read plans: ", core.plan.size(), " MSRs per core (", core.numCounterMSRs, " PMU counters), ",
+        package.cStatePlan.size(), " package C-state MSRs, ", package.socketPlan.size(), " MSRs per socket");
+}
+
+void PCM::readPackageMSRs(const uint32 socket, SocketCounterState & result)
+{
+    CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
+    const auto & plan = packageMSRReadPlan;
+    static thread_local std::vector<uint64> planValues;
+    planValues.assign(plan.socketPlan.size(), 0ULL);
+    int32 refCore = socketRefCore[socket];
+    if (refCore < 0) refCore = 0;
+    plan.socketPlan.execute(*MSR[refCore], planValues.data());
+    result.MSRValues.resize(msrValueSlots.size());
+    for (const auto & v : plan.values)
+    {
+        result.MSRValues.set(v.first, planValues[v.second]);
+    }
+    result.ThermalHeadroom = packageThermalMetricsAvailable()
+        ? extractThermalHeadroom(planValues[plan.thermStatusPos])
+        : PCM_INVALID_THERMAL_HEADROOM;
+}
+
 template <class CounterStateType>
 void PCM::readAndAggregatePackageCStateResidencies(std::shared_ptr<SafeMsrHandle> msr, CounterStateType & result)
 {
@@ -6862,9 +7308,14 @@ void PCM::readAndAggregatePackageCStateResidencies(std::shared_ptr<SafeMsrHandle
     uint64 cCStateResidency[PCM::MAX_C_STATE + 1];
     std::fill(cCStateResidency, cCStateResidency + PCM::MAX_C_STATE + 1, 0);
 
+    const auto & plan = packageMSRReadPlan;
+    uint64 planValues[PCM::MAX_C_STATE + 1] = {};
+    assert(plan.cStatePlan.size() <= PCM::MAX_C_STATE + 1);
+    plan.cStatePlan.execute(*msr, planValues);
+
     for(int i=0; i <= int(PCM::MAX_C_STATE) ;++i)
         if(pkgCStateMsr && pkgCStateMsr[i])
-                msr->read(pkgCStateMsr[i], &(cCStateResidency[i]));
+                cCStateResidency[i] = planValues[plan.cStatePos[i]];
 
     for (int i = 0; i <= int(PCM::MAX_C_STATE); ++i)
     {
@@ -6875,16 +7326,86 @@ void PCM::readAndAggregatePackageCStateResidencies(std::shared_ptr<SafeMsrHandle
     }
 }
 
-void PCM::readPCICFGRegisters(SystemCounterState& systemState)
+std::vector<uint32> PCM::getRawRegisterSockets(const std::vector<int32> & numaNodes) const
 {
-    auto read = [this, &systemState](const RawEventConfig& cfg) {
-        const RawEventEncoding& reEnc = cfg.first;
-        systemState.PCICFGValues[reEnc].clear();
-        for (auto& reg : PCICFGRegisterLocations[reEnc])
+    const size_t n = numaNodes.size();
+    std::vector<uint32> sockets(n, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const int32 socket = (numaNodes[i] >= 0) ? mapNUMANodeToSocket(numaNodes[i]) : -1;
+        if (socket < 0 || socket >= int32(num_sockets))
         {
+            DBG(2, "Socket of NUMA node ", numaNodes[i], " is not known, assigning the register locations to sockets in location order");
+            for (size_t s = 0; s < size_t(num_sockets); ++s)
+            {
+                std::fill(sockets.begin() + (n * s) / num_sockets, sockets.begin() + (n * (s + 1)) / num_sockets, uint32(s));
+            }
+            return sockets;
+        }
+        sockets[i] = uint32(socket);
+    }
+    return sockets;
+}
+
+void PCM::prepareRawRegisterValues(SystemCounterState& systemState)
+{
+    // the arrays are refilled in place, they are only rebuilt when events were removed by a new programming
+    auto prepare = [](const RawPMUConfig & config, auto & values, auto & locations, auto numValues)
+    {
+        auto fill = [&]()
+        {
+            for (const auto * configs : { &config.programmable, &config.fixed })
+            {
+                for (const auto& cfg : *configs)
+                {
+                    const RawEventEncoding& reEnc = cfg.first;
+                    values[reEnc].assign(numValues(locations[reEnc]), ~0ULL);
+                }
+            }
+        };
+        fill();
+        if (values.size() > config.programmable.size() + config.fixed.size())
+        {
+            values.clear(); // drops the arrays of events that are no longer programmed
+            fill();
+        }
+    };
+    auto oneValuePerLocation = [](const auto & l) { return l.size(); };
+    prepare(pcicfgConfig, systemState.PCICFGValues, PCICFGRegisterLocations, oneValuePerLocation);
+    prepare(mmioConfig, systemState.MMIOValues, MMIORegisterLocations, oneValuePerLocation);
+    prepare(pmtConfig, systemState.PMTValues, PMTRegisterLocations, oneValuePerLocation);
+    prepare(tpmiConfig, systemState.TPMIValues, TPMIRegisterLocations, [](const std::vector<TPMIRegisterEncoding> & l)
+        {
+            size_t entries = 0;
+            for (const auto & h : l)
+            {
+                if (h.get()) entries += h->getNumEntries();
+            }
+            return entries;
+        });
+}
+
+void PCM::readRawRegisters(const uint32 socket, SystemCounterState& systemState)
+{
+    readPCICFGRegisters(socket, systemState);
+    readMMIORegisters(socket, systemState);
+    readPMTRegisters(socket, systemState);
+    readTPMIRegisters(socket, systemState);
+}
+
+void PCM::readPCICFGRegisters(const uint32 socket, SystemCounterState& systemState)
+{
+    auto read = [this, &systemState, &socket](const RawEventConfig& cfg) {
+        const RawEventEncoding& reEnc = cfg.first;
+        const auto & locations = PCICFGRegisterLocations.find(reEnc)->second;
+        const auto & sockets = PCICFGRegisterSockets.find(reEnc)->second;
+        auto & values = systemState.PCICFGValues.find(reEnc)->second;
+        for (size_t i = 0; i < locations.size(); ++i)
+        {
+            if (sockets[i] != socket) continue;
             const auto width = reEnc[PCICFGEventPosition::width];
-            auto& h = reg.first;
-            const auto& offset = reg.second;
+            auto& h = locations[i].first;
+            const auto& offset = locations[i].second;
             if (h.get())
             {
                 uint64 value = ~0ULL;
@@ -6905,7 +7426,7 @@ void PCM::readPCICFGRegisters(SystemCounterState& systemState)
                 default:
                     std::cerr << "ERROR: Unsupported width " << width << " for pcicfg register " << cfg.second << "\n";
                 }
-                systemState.PCICFGValues[reEnc].push_back(value);
+                values[i] = value;
             }
         }
     };
@@ -6919,19 +7440,27 @@ void PCM::readPCICFGRegisters(SystemCounterState& systemState)
     }
 }
 
-void PCM::readTPMIRegisters(SystemCounterState& systemState)
+void PCM::readTPMIRegisters(const uint32 socket, SystemCounterState& systemState)
 {
-    auto read = [this, &systemState](const RawEventConfig& cfg) {
+    CollectionStats::StageScope stageScope(CollectionStats::TPMIReads);
+    auto read = [this, &systemState, &socket](const RawEventConfig& cfg) {
         const RawEventEncoding& reEnc = cfg.first;
-        systemState.TPMIValues[reEnc].clear();
-        for (auto& h : TPMIRegisterLocations[reEnc])
+        const auto & locations = TPMIRegisterLocations.find(reEnc)->second;
+        const auto & sockets = TPMIRegisterSockets.find(reEnc)->second;
+        auto & values = systemState.TPMIValues.find(reEnc)->second;
+        size_t pos = 0; // the handles have a variable number of entries: skip the entries of the handles of other sockets
+        for (size_t i = 0; i < locations.size(); ++i)
         {
-            if (h.get())
+            auto& h = locations[i];
+            if (h.get() == nullptr) continue;
+            if (sockets[i] != socket)
             {
-                for (auto e = 0ULL; e < h->getNumEntries(); ++e)
-                {
-                    systemState.TPMIValues[reEnc].push_back(h->read64(e));
-                }
+                pos += h->getNumEntries();
+                continue;
+            }
+            for (auto e = 0ULL; e < h->getNumEntries(); ++e)
+            {
+                values[pos++] = h->read64(e);
             }
         }
     };
@@ -6945,16 +7474,19 @@ void PCM::readTPMIRegisters(SystemCounterState& systemState)
     }
 }
 
-void PCM::readMMIORegisters(SystemCounterState& systemState)
+void PCM::readMMIORegisters(const uint32 socket, SystemCounterState& systemState)
 {
-    auto read = [this, &systemState](const RawEventConfig& cfg) {
+    auto read = [this, &systemState, &socket](const RawEventConfig& cfg) {
         const RawEventEncoding& reEnc = cfg.first;
-        systemState.MMIOValues[reEnc].clear();
-        for (auto& reg : MMIORegisterLocations[reEnc])
+        const auto & locations = MMIORegisterLocations.find(reEnc)->second;
+        const auto & sockets = MMIORegisterSockets.find(reEnc)->second;
+        auto & values = systemState.MMIOValues.find(reEnc)->second;
+        for (size_t i = 0; i < locations.size(); ++i)
         {
+            if (sockets[i] != socket) continue;
             const auto width = reEnc[MMIOEventPosition::width];
-            auto& h = reg.first;
-            const auto& offset = reg.second;
+            auto& h = locations[i].first;
+            const auto& offset = locations[i].second;
             if (h.get())
             {
                 uint64 value = ~0ULL;
@@ -6975,7 +7507,7 @@ void PCM::readMMIORegisters(SystemCounterState& systemState)
                 default:
                     std::cerr << "ERROR: Unsupported width " << width << " for mmio register " << cfg.second << "\n";
                 }
-                systemState.MMIOValues[reEnc].push_back(value);
+                values[i] = value;
             }
         }
     };
@@ -6989,31 +7521,37 @@ void PCM::readMMIORegisters(SystemCounterState& systemState)
     }
 }
 
-void PCM::readPMTRegisters(SystemCounterState& systemState)
+void PCM::readPMTRegisters(const uint32 socket, SystemCounterState& systemState)
 {
-    for (auto & p: PMTRegisterLocations)
+    CollectionStats::StageScope stageScope(CollectionStats::PMTReads);
+    if (pmtConfig.programmable.empty() && pmtConfig.fixed.empty())
+    {
+        return;
+    }
+    // the events of a UID share its telemetry arrays: load each array once per sample
+    for (const auto & a : PMTTelemetryArrays)
     {
-        for (auto & t: p.second)
+        if (a.second.socket == socket)
         {
-            if (t.get())
-            {
-                t->load();
-            }
+            a.second.array->load();
         }
     }
-    auto read = [this, &systemState](const RawEventConfig& cfg) {
+    auto read = [this, &systemState, &socket](const RawEventConfig& cfg) {
         const RawEventEncoding& reEnc = cfg.first;
-        systemState.PMTValues[reEnc].clear();
+        const auto & locations = PMTRegisterLocations.find(reEnc)->second;
+        auto & values = systemState.PMTValues.find(reEnc)->second;
         const auto lsb = reEnc[PMTEventPosition::lsb];
         const auto msb = reEnc[PMTEventPosition::msb];
         const auto offset = reEnc[PMTEventPosition::offset];
-        DBG(3, "PMTValues: " , std::hex , reEnc[PMTEventPosition::UID] , std::dec);
-        for (auto& reg : PMTRegisterLocations[reEnc])
+        const auto & sockets = PMTRegisterSockets.find(reEnc)->second;
+        DBG(3, "PMTValues: " , std::hex , reEnc[PMTEventPosition::UID] , std::dec, " socket ", socket);
+        for (size_t i = 0; i < locations.size(); ++i)
         {
-            if (reg.get())
+            auto& reg = locations[i];
+            if (sockets[i] == socket && reg.get())
             {
-                systemState.PMTValues[reEnc].push_back(reg->get(offset, lsb, msb));
-                DBG(3, "PMTValues: " , std::hex , reEnc[PMTEventPosition::UID] , " " , std::dec , reg->get(offset, lsb, msb));
+                values[i] = reg->get(offset, lsb, msb);
+                DBG(3, "PMTValues: " , std::hex , reEnc[PMTEventPosition::UID] , " " , std::dec , values[i]);
             }
         }
     };
@@ -7027,8 +7565,20 @@ void PCM::readPMTRegisters(SystemCounterState& systemState)
     }
 }
 
+void PCM::readSocketUncoreCounters(const uint32 socket, SystemCounterState& systemState)
+{
+    CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
+    if (hasPCICFGUncore())
+    {
+        readServerQPICounters(socket, systemState);
+    }
+    readCXLCMCounters(socket, systemState);
+    readRawRegisters(socket, systemState);
+}
+
 void PCM::readQPICounters(SystemCounterState & result)
 {
+        CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
         // read QPI counters
         std::vector<bool> SocketProcessed(num_sockets, false);
         if (cpu_family_model == PCM::NEHALEM_EX || cpu_family_model == PCM::WESTMERE_EX)
@@ -7126,19 +7676,25 @@ void PCM::readQPICounters(SystemCounterState & result)
         {
                 for (int32 s = 0; (s < (int32)serverUncorePMUs.size()); ++s)
                 {
-                    serverUncorePMUs[s]->freezeCounters();
-                    for (uint32 port = 0; port < (uint32)getQPILinksPerSocket(); ++port)
-                    {
-                        result.incomingQPIPackets[s][port] = uint64(double(serverUncorePMUs[s]->getIncomingDataFlits(port)) / (64./getDataBytesPerFlit()));
-                        result.outgoingQPIFlits[s][port] = serverUncorePMUs[s]->getOutgoingFlits(port);
-                        result.TxL0Cycles[s][port] = serverUncorePMUs[s]->getUPIL0TxCycles(port);
-                    }
-                    serverUncorePMUs[s]->unfreezeCounters();
+                    readServerQPICounters(s, result);
                 }
         }
         // end of reading QPI counters
 }
 
+void PCM::readServerQPICounters(const uint32 s, SystemCounterState & result)
+{
+    if (s >= serverUncorePMUs.size() || serverUncorePMUs[s].get() == nullptr) return;
+    serverUncorePMUs[s]->freezeCounters();
+    for (uint32 port = 0; port < (uint32)getQPILinksPerSocket(); ++port)
+    {
+        result.incomingQPIPackets[s][port] = uint64(double(serverUncorePMUs[s]->getIncomingDataFlits(port)) / (64./getDataBytesPerFlit()));
+        result.outgoingQPIFlits[s][port] = serverUncorePMUs[s]->getOutgoingFlits(port);
+        result.TxL0Cycles[s][port] = serverUncorePMUs[s]->getUPIL0TxCycles(port);
+    }
+    serverUncorePMUs[s]->unfreezeCounters();
+}
+
 template <class CounterStateType>
 void PCM::readPackageThermalHeadroom(const uint32 socket, CounterStateType & result)
 {
@@ -7146,7 +7702,7 @@ void PCM::readPackageThermalHeadroom(const uint32 socket, CounterStateType & res
     {
         uint64 val = 0;
         MSR[socketRefCore[socket]]->read(MSR_PACKAGE_THERM_STATUS,&val);
-        result.MSRValues[MSR_PACKAGE_THERM_STATUS] = val;
+        result.MSRValues.set(packageThermStatusMSRValueSlot, val);
         result.ThermalHeadroom = extractThermalHeadroom(val);
     }
     else
@@ -7165,6 +7721,8 @@ SocketCounterState PCM::getSocketCounterState(uint32 socket)
     SocketCounterState result;
     if (MSR.size())
     {
+        CollectionStats::SampleScope collectionSample;
+        TPMIHandle::SampleScope tpmiSample;
         // reading core and uncore counter states
         for (int32 core = 0; core < num_cores; ++core)
             if (isCoreOnline(core) && (topology[core].socket_id == int32(socket)))
@@ -7180,77 +7738,175 @@ SocketCounterState PCM::getSocketCounterState(uint32 socket)
     return result;
 }
 
+std::shared_ptr<CollectionContext> PCM::createCollectionContext()
+{
+    auto context = std::make_shared<CollectionContext>((uint32)num_sockets, (uint32)num_cores);
+    CollectionContext * ctx = context.get();
+    for (int32 core = 0; core < num_cores; ++core)
+    {
+        auto & task = ctx->coreTasks[core];
+        task.latch = &ctx->latch;
+        task.work = [this, ctx, core]()
+        {
+            CollectionStats::StageScope stageScope(CollectionStats::CoreReads);
+            auto & coreState = ctx->coreStates[core];
+            coreState.readAndAggregate(MSR[core]);
+            if (ctx->readAndAggregateSocketUncoreCounters)
+            {
+                ctx->socketStates[topology[core].socket_id].UncoreCounterState::readAndAggregate(MSR[core]); // read package C state counters
+            }
+            readMSRs(MSR[core], threadMSRConfig, coreState);
+        };
+    }
+    for (int32 s = 0; s < num_sockets; ++s)
+    {
+        auto & task = ctx->socketTasks[s];
+        task.latch = &ctx->latch;
+        task.work = [this, ctx, s]()
+        {
+            const auto start = std::chrono::steady_clock::now();
+            auto & socketState = ctx->socketStates[s];
+            readAndAggregateUncoreMCCounters(s, socketState);
+            readAndAggregateEnergyCounters(s, socketState);
+            readPackageMSRs(s, socketState); // thermal headroom and package_msr events
+            readSocketUncoreCounters(s, *ctx->systemState); // writes only the entries of this socket
+            ctx->stageTimes.socketUncore[s] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        };
+    }
+    return context;
+}
+
+void PCM::getAllCounterStates(CollectionContext & context, const bool readAndAggregateSocketUncoreCounters)
+{
+    collectAllCounterStates(context, context.ownSystemState, context.ownSocketStates.data(), context.ownCoreStates.data(), readAndAggregateSocketUncoreCounters);
+}
+
 void PCM::getAllCounterStates(SystemCounterState & systemState, std::vector<SocketCounterState> & socketStates, std::vector<CoreCounterState> & coreStates, const bool readAndAggregateSocketUncoreCounters)
 {
-    // clear and zero-initialize all inputs
-    systemState = SystemCounterState();
-    socketStates.clear();
+    // the states are reset in place, so repeated calls with the same vectors do not reallocate them
     socketStates.resize(num_sockets);
-    coreStates.clear();
     coreStates.resize(num_cores);
 
-    std::vector<std::future<void> > asyncCoreResults;
+    Mutex::Scope _(defaultCollectionContextMutex);
+    if (defaultCollectionContext.get() == nullptr)
+    {
+        defaultCollectionContext = createCollectionContext();
+    }
+    collectAllCounterStates(*defaultCollectionContext, systemState, socketStates.data(), coreStates.data(), readAndAggregateSocketUncoreCounters);
+}
+
+void PCM::collectAllCounterStates(CollectionContext & context, SystemCounterState & systemState, SocketCounterState * socketStates, CoreCounterState * coreStates, const bool readAndAggregateSocketUncoreCounters)
+{
+    CollectionStats::SampleScope collectionSample;
+    typedef std::chrono::steady_clock Clock;
+    auto & stageTimes = context.stageTimes;
+    auto last = Clock::now();
+    auto endStage = [&last](uint64 & duration)
+    {
+        const auto now = Clock::now();
+        duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+    };
+
+    // zero-initialize all outputs
+    systemState.reset();
+    for (int32 s = 0; s < num_sockets; ++s)
+    {
+        socketStates[s].reset();
+    }
+    for (int32 core = 0; core < num_cores; ++core)
+    {
+        coreStates[core].reset();
+    }
+    context.systemState = &systemState;
+    context.socketStates = socketStates;
+    context.coreStates = coreStates;
+    context.readAndAggregateSocketUncoreCounters = readAndAggregateSocketUncoreCounters;
+
+    int32 numTasks = 0;
+    for (int32 core = 0; core < num_cores; ++core)
+    {
+        if (isCoreOnline(core)) ++numTasks;
+    }
+    if (readAndAggregateSocketUncoreCounters)
+    {
+        numTasks += num_sockets;
+    }
+    context.latch.reset(numTasks);
+    TPMIHandle::SampleScope tpmiSample; // the socket tasks share one parse of each TPMI mem_dump file
+    if (readAndAggregateSocketUncoreCounters)
+    {
+        prepareRawRegisterValues(systemState); // the socket tasks fill the value arrays in place
+        std::fill(stageTimes.socketUncore.begin(), stageTimes.socketUncore.end(), 0ULL);
+    }
 
     for (int32 core = 0; core < num_cores; ++core)
     {
         // read core counters
         if (isCoreOnline(core))
         {
-            std::packaged_task<void()> task([this,&coreStates,&socketStates,core,readAndAggregateSocketUncoreCounters]() -> void
-                {
-                    coreStates[core].readAndAggregate(MSR[core]);
-                    if (readAndAggregateSocketUncoreCounters)
-                    {
-                        socketStates[topology[core].socket_id].UncoreCounterState::readAndAggregate(MSR[core]); // read package C state counters
-                    }
-                    readMSRs(MSR[core], threadMSRConfig, coreStates[core]);
-                }
-            );
-            asyncCoreResults.push_back(task.get_future());
-            coreTaskQueues[core]->push(task);
+            coreTaskQueues[core]->post(context.coreTasks[core]);
         }
-        DBG(3, core , " " , coreStates[core].InstRetiredAny.getRawData_NoOverflowProtection() );
     }
-    for (uint32 s = 0; s < (uint32)num_sockets && readAndAggregateSocketUncoreCounters; ++s)
+    for (int32 s = 0; s < num_sockets && readAndAggregateSocketUncoreCounters; ++s)
     {
         int32 refCore = socketRefCore[s];
-        if (refCore<0) refCore = 0;
-        std::packaged_task<void()> task([this, s, &socketStates, refCore]() -> void
-            {
-                readAndAggregateUncoreMCCounters(s, socketStates[s]);
-                readAndAggregateEnergyCounters(s, socketStates[s]);
-                readPackageThermalHeadroom(s, socketStates[s]);
-                readMSRs(MSR[refCore], packageMSRConfig, socketStates[s]);
-            } );
-        asyncCoreResults.push_back(task.get_future());
-        coreTaskQueues[refCore]->push(task);
+        if (refCore < 0) refCore = 0;
+        coreTaskQueues[refCore]->post(context.socketTasks[s]);
+        if (isCoreOnline(refCore) == false)
+        {
+            coreTaskQueues[refCore]->wake();
+        }
     }
+    // only the queues with posted tasks are woken, after all tasks are posted
+    for (int32 core = 0; core < num_cores; ++core)
+    {
+        if (isCoreOnline(core))
+        {
+            coreTaskQueues[core]->wake();
+        }
+    }
+    endStage(stageTimes.dispatch);
 
-    if (readAndAggregateSocketUncoreCounters)
+    // the per-socket uncore reads run in the socket tasks, only the MSR-based QPI counters of old models are left here
+    if (readAndAggregateSocketUncoreCounters && hasPCICFGUncore() == false)
     {
         readQPICounters(systemState);
-        readPCICFGRegisters(systemState);
-        readMMIORegisters(systemState);
-        readPMTRegisters(systemState);
-        readTPMIRegisters(systemState);
     }
+    endStage(stageTimes.callerUncore);
 
-    for (auto & ar : asyncCoreResults)
-        ar.wait();
+    context.latch.wait();
+    endStage(stageTimes.wait);
 
-    for (int32 core = 0; core < num_cores; ++core)
-    {   // aggregate core counters into sockets
-        if(isCoreOnline(core))
-          socketStates[topology[core].socket_id] += coreStates[core];
-    }
+    {
+        CollectionStats::StageScope stageScope(CollectionStats::Aggregation);
+        for (int32 core = 0; core < num_cores; ++core)
+        {   // aggregate core counters into sockets
+            if(isCoreOnline(core))
+              socketStates[topology[core].socket_id] += coreStates[core];
+            DBG(3, core , " " , coreStates[core].InstRetiredAny.getRawData_NoOverflowProtection() );
+        }
 
-    for (int32 s = 0; s < num_sockets; ++s)
-    {   // aggregate core counters from sockets into system state and
-        // aggregate socket uncore iMC, energy and package C state counters into system
-        systemState += socketStates[s];
+        for (int32 s = 0; s < num_sockets; ++s)
+        {   // aggregate core counters from sockets into system state and
+            // aggregate socket uncore iMC, energy and package C state counters into system
+            systemState += socketStates[s];
+        }
     }
 
     readSystemEnergyStatus(systemState);
+    endStage(stageTimes.aggregate);
+
+    if (debug::currentDebugLevel >= 2)
+    {
+        std::ostringstream sockets;
+        for (const auto & t : stageTimes.socketUncore)
+        {
+            sockets << " " << t;
+        }
+        DBG(2, "getAllCounterStates time breakdown (ns): dispatch=", stageTimes.dispatch, " caller_uncore=", stageTimes.callerUncore,
+            " wait=", stageTimes.wait, " aggregate=", stageTimes.aggregate, " socket_uncore=", sockets.str());
+    }
 }
 
 void PCM::readSystemEnergyStatus(SystemCounterState & systemState)
@@ -7269,21 +7925,31 @@ void PCM::getUncoreCounterStates(SystemCounterState & systemState, std::vector<S
     socketStates.resize(num_sockets);
     std::vector<CoreCounterState> refCoreStates(num_sockets);
 
-    for (uint32 s = 0; s < (uint32)num_sockets; ++s)
+    CollectionStats::SampleScope collectionSample;
+    TPMIHandle::SampleScope tpmiSample;
+    runOnSocketRefCores([&](const size_t s)
     {
         const int32 refCore = socketRefCore[s];
         if(isCoreOnline(refCore))
         {
             refCoreStates[s].readAndAggregateTSC(MSR[refCore]);
         }
-        readAndAggregateUncoreMCCounters(s, socketStates[s]);
-        readAndAggregateEnergyCounters(s, socketStates[s]);
-        readPackageThermalHeadroom(s, socketStates[s]);
-    }
+        readAndAggregateUncoreMCCounters((uint32)s, socketStates[s]);
+        readAndAggregateEnergyCounters((uint32)s, socketStates[s]);
+        readPackageThermalHeadroom((uint32)s, socketStates[s]);
+        if (hasPCICFGUncore())
+        {
+            readServerQPICounters((uint32)s, systemState); // writes only the links of this socket
+        }
+    }, num_sockets);
 
-    readQPICounters(systemState);
+    if (hasPCICFGUncore() == false)
+    {
+        readQPICounters(systemState);
+    }
     readSystemEnergyStatus(systemState);
 
+    CollectionStats::StageScope stageScope(CollectionStats::Aggregation);
     for (int32 s = 0; s < num_sockets; ++s)
     {
         const int32 refCore = socketRefCore[s];
@@ -7589,54 +8255,155 @@ bool PCM::isSomeCoreOfflined()
     return !(getNumOnlineCores() == max_num_lcores);
 }
 
+std::shared_ptr<const ServerUncoreCounterStateLayout> PCM::getServerUncoreCounterStateLayout(const uint32 socket)
+{
+    typedef ServerUncoreCounterStateLayout Layout;
+    std::array<uint32, Layout::numUnitTypes> units{{}};
+    if (socket < serverUncorePMUs.size() && serverUncorePMUs[socket].get())
+    {
+        const auto & pmus = *serverUncorePMUs[socket];
+        units[Layout::XPI] = units[Layout::M3UPI] = (uint32)pmus.getNumQPIPorts();
+        units[Layout::MC] = units[Layout::DRAMClock] = (uint32)pmus.getNumMCChannels();
+        units[Layout::EDC] = units[Layout::HBMClock] = (uint32)pmus.getNumEDCChannels();
+        units[Layout::M2M] = units[Layout::HA] = pmus.getNumMC();
+    }
+    if (socket < serverBW.size() && serverBW[socket].get())
+    {
+        units[Layout::IMCFreeRunning] = serverBW[socket]->getNumControllers();
+    }
+    if (MSR.size())
+    {
+        units[Layout::IIO] = (socket < iioPMUs.size()) ? (uint32)(std::min)(iioPMUs[socket].size(), size_t(ServerUncoreCounterState::maxIIOStacks)) : 0;
+        units[Layout::IRP] = (socket < irpPMUs.size()) ? (uint32)(std::min)(irpPMUs[socket].size(), size_t(ServerUncoreCounterState::maxIIOStacks)) : 0;
+        units[Layout::CXLCM] = units[Layout::CXLDP] = (uint32)(std::min)(getNumCXLPorts(socket), size_t(ServerUncoreCounterState::maxCXLPorts));
+    }
+    auto sameTopology = [&](const Layout & layout)
+    {
+        for (int t = 0; t < Layout::numUnitTypes; ++t)
+        {
+            if (layout.blocks[t].units != units[t]) return false;
+        }
+        size_t block = 0;
+        for (size_t die = 0; socket < uncorePMUs.size() && die < uncorePMUs[socket].size(); ++die)
+        {
+            for (const auto & pmu : uncorePMUs[socket][die])
+            {
+                if (block >= layout.pmus.size() || layout.pmus[block].pmuID != pmu.first || layout.pmus[block].units != pmu.second.size()) return false;
+                ++block;
+            }
+        }
+        return block == layout.pmus.size();
+    };
+
+    Mutex::Scope _(serverUncoreCounterStateLayoutsMutex);
+    if (serverUncoreCounterStateLayouts.size() <= socket)
+    {
+        serverUncoreCounterStateLayouts.resize(socket + 1);
+    }
+    auto & cached = serverUncoreCounterStateLayouts[socket];
+    if (cached.get() == nullptr || sameTopology(*cached) == false)
+    {
+        auto layout = std::make_shared<Layout>();
+        for (int t = 0; t < Layout::numUnitTypes; ++t)
+        {
+            uint32 counters = ServerUncoreCounterState::maxCounters;
+            if (t == Layout::DRAMClock || t == Layout::HBMClock)
+            {
+                counters = 1;
+            }
+            else if (t == Layout::IMCFreeRunning)
+            {
+                counters = ServerBW::numCounters;
+            }
+            layout->add((Layout::UnitType)t, units[t], counters);
+        }
+        for (size_t die = 0; socket < uncorePMUs.size() && die < uncorePMUs[socket].size(); ++die)
+        {
+            for (const auto & pmu : uncorePMUs[socket][die])
+            {
+                layout->addPMU(pmu.first, (uint32)pmu.second.size());
+            }
+        }
+        DBG(2, "ServerUncoreCounterState layout for socket " , socket , ": " , layout->size , " counters");
+        cached = layout;
+    }
+    return cached;
+}
+
 ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
 {
+    CollectionStats::StageScope stageScope(CollectionStats::UncoreReads);
+    typedef ServerUncoreCounterStateLayout Layout;
     ServerUncoreCounterState result;
+    result.setLayout(getServerUncoreCounterStateLayout(socket));
     if (socket < serverBW.size() && serverBW[socket].get())
     {
-        result.freeRunningCounter[ServerUncoreCounterState::ImcReads] = serverBW[socket]->getImcReads();
-        result.freeRunningCounter[ServerUncoreCounterState::ImcWrites] = serverBW[socket]->getImcWrites();
-        result.freeRunningCounter[ServerUncoreCounterState::PMMReads] = serverBW[socket]->getPMMReads();
-        result.freeRunningCounter[ServerUncoreCounterState::PMMWrites] = serverBW[socket]->getPMMWrites();
+        const ServerBW::Snapshot & bw = serverBW[socket]->snapshot();
+        static_assert(int(ServerUncoreCounterState::ImcReads) == int(ServerBW::ImcReads) && int(ServerUncoreCounterState::PMMWrites) == int(ServerBW::PMMWrites), "free-running counter IDs differ");
+        for (uint32 i = 0; i < ServerBW::numCounters; ++i)
+        {
+            result.setFreeRunningCounter((ServerUncoreCounterState::FreeRunningCounterID)i, bw.getTotal((ServerBW::Counter)i));
+        }
+        for (uint32 c = 0; c < bw.getNumControllers(); ++c)
+        {
+            uint64 * IMCCounter = result.unitCounters(Layout::IMCFreeRunning, c);
+            assert(IMCCounter);
+            std::copy(bw.values[c].begin(), bw.values[c].end(), IMCCounter);
+        }
+    }
+    // snapshot mode: one global freeze of the socket instead of the unit freezes, all units are read in the same window
+    const bool snapshot = uncoreSnapshotAvailable() && MSR.size() && socket < globalUncoreFreezeDepth.size();
+    const auto freezeStart = std::chrono::steady_clock::now();
+    if (snapshot)
+    {
+        globalFreezeUncoreCounters(socket);
     }
     if(serverUncorePMUs.size() && serverUncorePMUs[socket].get())
     {
-        serverUncorePMUs[socket]->freezeCounters();
+        serverUncorePMUs[socket]->freezeCounters(snapshot);
         for(uint32 port=0;port < (uint32)serverUncorePMUs[socket]->getNumQPIPorts();++port)
         {
-            assert(port < result.xPICounter.size());
+            uint64 * xPICounter = result.unitCounters(Layout::XPI, port);
+            assert(xPICounter);
             for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.xPICounter[port][cnt] = serverUncorePMUs[socket]->getQPILLCounter(port, cnt);
-            assert(port < result.M3UPICounter.size());
+                xPICounter[cnt] = serverUncorePMUs[socket]->getQPILLCounter(port, cnt);
+            uint64 * M3UPICounter = result.unitCounters(Layout::M3UPI, port);
+            assert(M3UPICounter);
             for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.M3UPICounter[port][cnt] = serverUncorePMUs[socket]->getM3UPICounter(port, cnt);
+                M3UPICounter[cnt] = serverUncorePMUs[socket]->getM3UPICounter(port, cnt);
         }
         for (uint32 channel = 0; channel < (uint32)serverUncorePMUs[socket]->getNumMCChannels(); ++channel)
         {
-            assert(channel < result.DRAMClocks.size());
-            result.DRAMClocks[channel] = serverUncorePMUs[socket]->getDRAMClocks(channel);
-            assert(channel < result.MCCounter.size());
+            uint64 * DRAMClocks = result.unitCounters(Layout::DRAMClock, channel);
+            assert(DRAMClocks);
+            *DRAMClocks = serverUncorePMUs[socket]->getDRAMClocks(channel);
+            uint64 * MCCounter = result.unitCounters(Layout::MC, channel);
+            assert(MCCounter);
             for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.MCCounter[channel][cnt] = serverUncorePMUs[socket]->getMCCounter(channel, cnt);
+                MCCounter[cnt] = serverUncorePMUs[socket]->getMCCounter(channel, cnt);
         }
         for (uint32 channel = 0; channel < (uint32)serverUncorePMUs[socket]->getNumEDCChannels(); ++channel)
         {
-            assert(channel < result.HBMClocks.size());
-            result.HBMClocks[channel] = serverUncorePMUs[socket]->getHBMClocks(channel);
-            assert(channel < result.EDCCounter.size());
+            uint64 * HBMClocks = result.unitCounters(Layout::HBMClock, channel);
+            assert(HBMClocks);
+            *HBMClocks = serverUncorePMUs[socket]->getHBMClocks(channel);
+            uint64 * EDCCounter = result.unitCounters(Layout::EDC, channel);
+            assert(EDCCounter);
             for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.EDCCounter[channel][cnt] = serverUncorePMUs[socket]->getEDCCounter(channel, cnt);
+                EDCCounter[cnt] = serverUncorePMUs[socket]->getEDCCounter(channel, cnt);
         }
     for (uint32 controller = 0; controller < (uint32)serverUncorePMUs[socket]->getNumMC(); ++controller)
     {
-      assert(controller < result.M2MCounter.size());
+      uint64 * M2MCounter = result.unitCounters(Layout::M2M, controller);
+      assert(M2MCounter);
       for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-          result.M2MCounter[controller][cnt] = serverUncorePMUs[socket]->getM2MCounter(controller, cnt);
-      assert(controller < result.HACounter.size());
+          M2MCounter[cnt] = serverUncorePMUs[socket]->getM2MCounter(controller, cnt);
+      uint64 * HACounter = result.unitCounters(Layout::HA, controller);
+      assert(HACounter);
       for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-          result.HACounter[controller][cnt] = serverUncorePMUs[socket]->getHACounter(controller, cnt);
+          HACounter[cnt] = serverUncorePMUs[socket]->getHACounter(controller, cnt);
     }
-        serverUncorePMUs[socket]->unfreezeCounters();
+        serverUncorePMUs[socket]->unfreezeCounters(snapshot);
     }
     if (MSR.size())
     {
@@ -7647,42 +8414,50 @@ ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
 
         for (uint32 stack = 0; socket < iioPMUs.size() && stack < iioPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
         {
+            uint64 * IIOCounter = result.unitCounters(Layout::IIO, stack);
+            assert(IIOCounter);
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && size_t(i) < iioPMUs[socket][stack].size(); ++i)
             {
-                result.IIOCounter[stack][i] = *(iioPMUs[socket][stack].counterValue[i]);
+                IIOCounter[i] = *(iioPMUs[socket][stack].counterValue[i]);
             }
         }
         for (uint32 stack = 0; socket < irpPMUs.size() && stack < irpPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
         {
+            uint64 * IRPCounter = result.unitCounters(Layout::IRP, stack);
+            assert(IRPCounter);
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && size_t(i) < irpPMUs[socket][stack].size(); ++i)
             {
                 if (irpPMUs[socket][stack].counterValue[i].get())
                 {
-                    result.IRPCounter[stack][i] = *(irpPMUs[socket][stack].counterValue[i]);
+                    IRPCounter[i] = *(irpPMUs[socket][stack].counterValue[i]);
                 }
             }
         }
 
         result.UncClocks = getUncoreClocks(socket);
 
-        const auto numCXLPorts = getNumCXLPorts(socket);
+        const auto maxPorts = (std::min)(getNumCXLPorts(socket), size_t(ServerUncoreCounterState::maxCXLPorts));
 
-        assert(numCXLPorts <= result.CXLCMCounter.size() && "Number of CXL ports exceeds CXLCMCounter array size");
-        assert(numCXLPorts <= result.CXLDPCounter.size() && "Number of CXL ports exceeds CXLDPCounter array size");
-
-        const auto maxPorts = (std::min)(numCXLPorts, (std::min)(result.CXLCMCounter.size(), result.CXLDPCounter.size()));
-
-        for (size_t p = 0; p < maxPorts; ++p)
+        for (uint32 p = 0; p < maxPorts; ++p)
         {
+            uint64 * CXLCMCounter = result.unitCounters(Layout::CXLCM, p);
+            uint64 * CXLDPCounter = result.unitCounters(Layout::CXLDP, p);
+            assert(CXLCMCounter && CXLDPCounter);
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && socket < cxlPMUs.size() && size_t(i) < cxlPMUs[socket][p].first.size(); ++i)
             {
-                result.CXLCMCounter[p][i] = *cxlPMUs[socket][p].first.counterValue[i];
+                CXLCMCounter[i] = *cxlPMUs[socket][p].first.counterValue[i];
             }
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && socket < cxlPMUs.size() && size_t(i) < cxlPMUs[socket][p].second.size(); ++i)
             {
-                result.CXLDPCounter[p][i] = *cxlPMUs[socket][p].second.counterValue[i];
+                CXLDPCounter[i] = *cxlPMUs[socket][p].second.counterValue[i];
             }
         }
+        if (snapshot)
+        {
+            globalUnfreezeUncoreCounters(socket);
+            result.uncoreFreezeWindow = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - freezeStart).count();
+            DBG(3, "uncore freeze window of socket ", socket, ": ", result.uncoreFreezeWindow, " ns");
+        }
         uint64 val=0;
         //MSR[refCore]->read(MSR_PKG_ENERGY_STATUS,&val);
         //DBG(3, "Energy status: " , val );
@@ -7696,6 +8471,12 @@ ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
     return result;
 }
 
+void PCM::getServerUncoreCounterStates(std::vector<ServerUncoreCounterState> & states)
+{
+    states.resize(num_sockets);
+    runOnSocketRefCores([&](const size_t s) { states[s] = getServerUncoreCounterState((uint32)s); }, num_sockets);
+}
+
 #ifndef _MSC_VER
 void print_mcfg(const char * path)
 {
@@ -7873,26 +8654,30 @@ PciHandleType * ServerUncorePMUs::createIntelPerfMonDevice(uint32 groupnr_, int3
 
 bool PCM::isSecureBoot() const
 {
-    static int flag = -1;
-    if (MSR.size() > 0 && flag == -1)
+    // not a static const: the result is only known once the MSR handles exist,
+    // before that the check is repeated on the next call
+    static std::atomic<int> flag{-1};
+    if (MSR.size() > 0 && flag.load() == -1)
     {
         DBG(1, "checking MSR in isSecureBoot");
+        int result = 0;
         uint64 val = 0;
         if (MSR[0]->read(IA32_PERFEVTSEL0_ADDR, &val) != sizeof(val))
         {
-            flag = 0; // some problem with MSR read, not secure boot
+            result = 0; // some problem with MSR read, not secure boot
         }
         // read works
         if (MSR[0]->write(IA32_PERFEVTSEL0_ADDR, val) != sizeof(val)/* && errno == 1 */) // errno works only on windows
         { // write does not work -> secure boot
-            flag = 1;
+            result = 1;
         }
         else
         {
-            flag = 0; // can write MSR -> no secure boot
+            result = 0; // can write MSR -> no secure boot
         }
+        flag.store(result);
     }
-    return flag == 1;
+    return flag.load() == 1;
 }
 
 bool PCM::useLinuxPerfForUncore() const
@@ -8958,17 +9743,72 @@ bool ServerUncorePMUs::HBMAvailable() const
 
 #ifdef PCM_USE_PERF
 class PerfVirtualFilterRegister;
+class PerfVirtualControlRegister;
+
+//! \brief Linux perf event group of one uncore box
+//!
+//! The programmed events of the box are opened under a common group leader with PERF_FORMAT_GROUP,
+//! so all counters of the box are read with a single read() on the leader and are consistent with each other.
+//! Freezing the box (see PerfVirtualUnitControlRegister) takes one group snapshot that serves all counter reads
+//! until the box is unfrozen, so a sample costs one syscall per box. Outside of a freeze every counter read
+//! does its own group read and returns a current value.
+class PerfVirtualGroup
+{
+    std::vector<PerfVirtualControlRegister *> members; // members[0] is the group leader
+    std::vector<uint64> values; // values of the snapshot, in the order of members
+    bool frozen = false; // values hold the snapshot of the current freeze
+    Mutex mutex;
+    void add(PerfVirtualControlRegister * reg);
+    void remove(PerfVirtualControlRegister * reg);
+    void readGroup();
+    PerfVirtualGroup(const PerfVirtualGroup &) = delete;
+    PerfVirtualGroup & operator = (const PerfVirtualGroup &) = delete;
+public:
+    PerfVirtualGroup() = default;
+    void program(PerfVirtualControlRegister * reg);
+    void close(PerfVirtualControlRegister * reg);
+    bool read(const PerfVirtualControlRegister * reg, uint64 & value);
+    void freeze();
+    void unfreeze();
+};
+
+//! \brief Unit control register of a box counted by Linux perf: freezing the box takes the group snapshot
+class PerfVirtualUnitControlRegister : public HWRegister
+{
+    uint64 lastValue;
+    std::shared_ptr<PerfVirtualGroup> group;
+public:
+    PerfVirtualUnitControlRegister(const std::shared_ptr<PerfVirtualGroup> & group_) : lastValue(0), group(group_) {}
+    void operator = (uint64 val) override
+    {
+        lastValue = val;
+        if (UncorePMU::freezesCounters(val))
+        {
+            group->freeze();
+        }
+        else
+        {
+            group->unfreeze();
+        }
+    }
+    operator uint64 () override
+    {
+        return lastValue;
+    }
+};
 
 class PerfVirtualControlRegister : public HWRegister
 {
     friend class PerfVirtualCounterRegister;
     friend class PerfVirtualFilterRegister;
     friend class IDXPerfVirtualFilterRegister;
+    friend class PerfVirtualGroup;
     int fd;
     int socket;
     int pmuID;
     perf_event_attr event;
     bool fixed;
+    std::shared_ptr<PerfVirtualGroup> group;
     void close()
     {
         if (fd >= 0)
@@ -8977,30 +9817,49 @@ class PerfVirtualControlRegister : public HWRegister
             fd = -1;
         }
     }
+    bool open(const int groupFD, const uint64 readFormat)
+    {
+        event.read_format = readFormat;
+        const auto core = PCM::getInstance()->socketRefCore[socket];
+        if ((fd = syscall(SYS_perf_event_open, &event, -1, core, groupFD, 0)) <= 0)
+        {
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+    void reportOpenError() const
+    {
+        std::cerr << "Linux Perf: Error on programming PMU " << pmuID << ":  " << strerror(errno) << "\n";
+        std::cerr << "config: 0x" << std::hex << event.config << " config1: 0x" << event.config1 << " config2: 0x" << event.config2 << std::dec << "\n";
+        if (errno == 24) std::cerr << PCM_ULIMIT_RECOMMENDATION;
+    }
     PerfVirtualControlRegister(const PerfVirtualControlRegister &) = delete;
     PerfVirtualControlRegister & operator = (const PerfVirtualControlRegister &) = delete;
 public:
-    PerfVirtualControlRegister(int socket_, int pmuID_, bool fixed_ = false) :
+    PerfVirtualControlRegister(int socket_, int pmuID_, bool fixed_ = false, const std::shared_ptr<PerfVirtualGroup> & group_ = std::shared_ptr<PerfVirtualGroup>()) :
         fd(-1),
         socket(socket_),
         pmuID(pmuID_),
-        fixed(fixed_)
+        fixed(fixed_),
+        group(group_)
     {
         event = PCM_init_perf_event_attr(false);
         event.type = pmuID;
     }
     void operator = (uint64 val) override
     {
-        close();
         event.config = fixed ? 0xff : val;
-        const auto core = PCM::getInstance()->socketRefCore[socket];
-        if ((fd = syscall(SYS_perf_event_open, &event, -1, core, -1, 0)) <= 0)
+        if (group.get())
         {
-            std::cerr << "Linux Perf: Error on programming PMU " << pmuID << ":  " << strerror(errno) << "\n";
-            std::cerr << "config: 0x" << std::hex << event.config << " config1: 0x" << event.config1 << " config2: 0x" << event.config2 << std::dec << "\n";
-            if (errno == 24) std::cerr << PCM_ULIMIT_RECOMMENDATION;
+            group->program(this);
             return;
         }
+        close();
+        if (open(-1, 0) == false)
+        {
+            reportOpenError();
+        }
     }
     operator uint64 () override
     {
@@ -9008,12 +9867,163 @@ public:
     }
     ~PerfVirtualControlRegister()
     {
+        if (group.get())
+        {
+            group->close(this);
+        }
         close();
     }
     int getFD() const { return fd; }
     int getPMUID() const { return pmuID; }
+    uint64 read()
+    {
+        uint64 result = 0;
+        if (group.get() && group->read(this, result))
+        {
+            return result;
+        }
+        if (fd >= 0)
+        {
+            CollectionStats::countSyscall();
+            int status = ::read(fd, &result, sizeof(result));
+            if (status != sizeof(result))
+            {
+                std::cerr << "PCM Error: failed to read from Linux perf handle " << fd << " PMU " << pmuID << "\n";
+            }
+        }
+        return result;
+    }
 };
 
+void PerfVirtualGroup::add(PerfVirtualControlRegister * reg)
+{
+    const int leaderFD = members.empty() ? -1 : members[0]->fd;
+    if (reg->open(leaderFD, PERF_FORMAT_GROUP))
+    {
+        members.push_back(reg);
+        values.push_back(0);
+        frozen = false;
+        return;
+    }
+    // could not join the group (e.g. the box can not schedule all events together): count the event on its own
+    if (leaderFD >= 0 && reg->open(-1, 0))
+    {
+        DBG(1, "Linux Perf: event 0x" , std::hex , reg->event.config , std::dec , " of PMU " , reg->pmuID , " is read outside of its group");
+        return;
+    }
+    reg->reportOpenError();
+}
+
+void PerfVirtualGroup::remove(PerfVirtualControlRegister * reg)
+{
+    for (size_t i = 0; i < members.size(); ++i)
+    {
+        if (members[i] == reg)
+        {
+            members.erase(members.begin() + i);
+            values.erase(values.begin() + i);
+            return;
+        }
+    }
+}
+
+void PerfVirtualGroup::program(PerfVirtualControlRegister * reg)
+{
+    Mutex::Scope lock(mutex);
+    if (!members.empty() && members[0] == reg)
+    {
+        // the events can not be moved to another leader: rebuild the group around the reprogrammed leader
+        std::vector<PerfVirtualControlRegister *> siblings(members.begin() + 1, members.end());
+        for (auto sibling : siblings)
+        {
+            sibling->close();
+        }
+        reg->close();
+        members.clear();
+        values.clear();
+        frozen = false;
+        add(reg);
+        for (auto sibling : siblings)
+        {
+            add(sibling);
+        }
+        return;
+    }
+    remove(reg);
+    reg->close();
+    add(reg);
+}
+
+void PerfVirtualGroup::close(PerfVirtualControlRegister * reg)
+{
+    Mutex::Scope lock(mutex);
+    if (!members.empty() && members[0] == reg)
+    {
+        // closing the leader would turn the siblings into individual events with group read format
+        for (auto sibling : members)
+        {
+            sibling->close();
+        }
+        members.clear();
+        values.clear();
+        frozen = false;
+        return;
+    }
+    remove(reg);
+}
+
+void PerfVirtualGroup::readGroup()
+{
+    // PERF_FORMAT_GROUP layout: nr, value[0], ..., value[nr - 1]
+    std::array<uint64, 1 + UncorePMU::maxCounters + 1> data;
+    const size_t expected = (1 + members.size()) * sizeof(uint64);
+    CollectionStats::countSyscall();
+    const auto status = ::read(members[0]->fd, data.data(), expected);
+    const bool ok = status == (ssize_t)expected && data[0] == members.size();
+    if (!ok)
+    {
+        std::cerr << "PCM Error: failed to read from Linux perf group handle " << members[0]->fd << " PMU " << members[0]->pmuID << "\n";
+    }
+    for (size_t i = 0; i < members.size(); ++i)
+    {
+        values[i] = ok ? data[1 + i] : 0;
+    }
+}
+
+void PerfVirtualGroup::freeze()
+{
+    Mutex::Scope lock(mutex);
+    if (!members.empty())
+    {
+        readGroup();
+        frozen = true;
+    }
+}
+
+void PerfVirtualGroup::unfreeze()
+{
+    Mutex::Scope lock(mutex);
+    frozen = false;
+}
+
+bool PerfVirtualGroup::read(const PerfVirtualControlRegister * reg, uint64 & value)
+{
+    Mutex::Scope lock(mutex);
+    for (size_t i = 0; i < members.size(); ++i)
+    {
+        if (members[i] == reg)
+        {
+            if (frozen == false)
+            {
+                readGroup();
+            }
+            value = values[i];
+            return true;
+        }
+    }
+    return false; // not programmed or counted outside of the group
+}
+
 class PerfVirtualCounterRegister : public HWRegister
 {
     std::shared_ptr<PerfVirtualControlRegister> controlReg;
@@ -9027,16 +10037,7 @@ public:
     }
     operator uint64 () override
     {
-        uint64 result = 0;
-        if (controlReg.get() && (controlReg->getFD() >= 0))
-        {
-            int status = ::read(controlReg->getFD(), &result, sizeof(result));
-            if (status != sizeof(result))
-            {
-                std::cerr << "PCM Error: failed to read from Linux perf handle " << controlReg->getFD() << " PMU " << controlReg->getPMUID() << "\n";
-            }
-        }
-        return result;
+        return controlReg.get() ? controlReg->read() : 0;
     }
 };
 
@@ -9168,23 +10169,24 @@ void populatePerfPMUs(unsigned socket_, const std::vector<int> & ids, std::vecto
 {
     for (const auto & id : ids)
     {
+        auto group = std::make_shared<PerfVirtualGroup>(); // all events of the box are read with one group read
         std::array<std::shared_ptr<PerfVirtualControlRegister>, 4> controlRegs = {
-            std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id)
+            std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group)
         };
         std::shared_ptr<PerfVirtualCounterRegister> counterReg0 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[0]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg1 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[1]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg2 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[2]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg3 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[3]);
-        std::shared_ptr<PerfVirtualControlRegister> fixedControlReg = std::make_shared<PerfVirtualControlRegister>(socket_, id, true);
+        std::shared_ptr<PerfVirtualControlRegister> fixedControlReg = std::make_shared<PerfVirtualControlRegister>(socket_, id, true, group);
         std::shared_ptr<PerfVirtualCounterRegister> fixedCounterReg = std::make_shared<PerfVirtualCounterRegister>(fixedControlReg);
         std::shared_ptr<PerfVirtualFilterRegister> filterReg0 = std::make_shared<PerfVirtualFilterRegister>(controlRegs, 0);
         std::shared_ptr<PerfVirtualFilterRegister> filterReg1 = std::make_shared<PerfVirtualFilterRegister>(controlRegs, 1);
         pmus.push_back(
             UncorePMU(
-                std::make_shared<VirtualDummyRegister>(),
+                std::make_shared<PerfVirtualUnitControlRegister>(group),
                 controlRegs[0],
                 controlRegs[1],
                 controlRegs[2],
@@ -9206,23 +10208,24 @@ void populatePerfPMUs(unsigned socket_, const std::vector<int>& ids, std::vector
 {
     for (const auto& id : ids)
     {
+        auto group = std::make_shared<PerfVirtualGroup>(); // all events of the box are read with one group read
         std::array<std::shared_ptr<PerfVirtualControlRegister>, 4> controlRegs = {
-            std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id),
-                    std::make_shared<PerfVirtualControlRegister>(socket_, id)
+            std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group),
+                    std::make_shared<PerfVirtualControlRegister>(socket_, id, false, group)
         };
         std::shared_ptr<PerfVirtualCounterRegister> counterReg0 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[0]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg1 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[1]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg2 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[2]);
         std::shared_ptr<PerfVirtualCounterRegister> counterReg3 = std::make_shared<PerfVirtualCounterRegister>(controlRegs[3]);
-        std::shared_ptr<PerfVirtualControlRegister> fixedControlReg = std::make_shared<PerfVirtualControlRegister>(socket_, id, true);
+        std::shared_ptr<PerfVirtualControlRegister> fixedControlReg = std::make_shared<PerfVirtualControlRegister>(socket_, id, true, group);
         std::shared_ptr<PerfVirtualCounterRegister> fixedCounterReg = std::make_shared<PerfVirtualCounterRegister>(fixedControlReg);
         std::shared_ptr<PerfVirtualFilterRegister> filterReg0 = std::make_shared<PerfVirtualFilterRegister>(controlRegs, 0);
         std::shared_ptr<PerfVirtualFilterRegister> filterReg1 = std::make_shared<PerfVirtualFilterRegister>(controlRegs, 1);
         pmus.push_back(
             std::make_shared<UncorePMU>(
-                std::make_shared<VirtualDummyRegister>(),
+                std::make_shared<PerfVirtualUnitControlRegister>(group),
                 controlRegs[0],
                 controlRegs[1],
                 controlRegs[2],
@@ -10041,24 +11044,36 @@ void ServerUncorePMUs::programHA()
 	programHA(config);
 }
 
-void ServerUncorePMUs::freezeCounters()
+void ServerUncorePMUs::freezeCounters(const bool globallyFrozen)
 {
-    for (auto& pmuVector : allPMUs)
+    if (globallyFrozen == false)
     {
-        for (auto& pmu : *pmuVector)
+        for (auto& pmuVector : allPMUs)
         {
-            pmu.freeze((cpu_family_model == PCM::SKX) ? UNC_PMON_UNIT_CTL_RSV : UNC_PMON_UNIT_CTL_FRZ_EN);
+            for (auto& pmu : *pmuVector)
+            {
+                pmu.freeze((cpu_family_model == PCM::SKX) ? UNC_PMON_UNIT_CTL_RSV : UNC_PMON_UNIT_CTL_FRZ_EN);
+            }
         }
     }
+    frozen = true;
+    for (auto & f : frozenCounters)
+    {
+        f.valid = false;
+    }
 }
 
-void ServerUncorePMUs::unfreezeCounters()
+void ServerUncorePMUs::unfreezeCounters(const bool globallyFrozen)
 {
-    for (auto& pmuVector : allPMUs)
+    frozen = false;
+    if (globallyFrozen == false)
     {
-        for (auto& pmu : *pmuVector)
+        for (auto& pmuVector : allPMUs)
         {
-            pmu.unfreeze((cpu_family_model == PCM::SKX) ? UNC_PMON_UNIT_CTL_RSV : UNC_PMON_UNIT_CTL_FRZ_EN);
+            for (auto& pmu : *pmuVector)
+            {
+                pmu.unfreeze((cpu_family_model == PCM::SKX) ? UNC_PMON_UNIT_CTL_RSV : UNC_PMON_UNIT_CTL_FRZ_EN);
+            }
         }
     }
 }
@@ -10078,12 +11093,77 @@ uint64 ServerUncorePMUs::getQPIL1Cycles(uint32 port)
     return getQPILLCounter(port, ServerUncoreCounterState::EventPosition::xPI_L1_POWER_CYCLES);
 }
 
+const uint64 * ServerUncorePMUs::getFrozenCounters(const UncorePMUVector & pmus)
+{
+    if (!frozen)
+    {
+        return nullptr;
+    }
+    frozenCounters.resize(allPMUs.size());
+    for (size_t t = 0; t < allPMUs.size(); ++t)
+    {
+        if (allPMUs[t] != &pmus)
+        {
+            continue;
+        }
+        auto & f = frozenCounters[t];
+        if (!f.built)
+        {
+            // the register objects do not change after initialization: the read list is built once
+            f.values.assign(pmus.size() * valuesPerUnit, 0ULL);
+            auto add = [&f](const std::shared_ptr<HWRegister> & reg, uint64 * dest)
+            {
+                if (reg.get() == nullptr)
+                {
+                    return;
+                }
+                if (const auto r64 = std::dynamic_pointer_cast<PCICFGRegister64>(reg))
+                {
+                    f.pciReads.add(r64->getHandle(), r64->getOffset(), sizeof(uint64), dest);
+                }
+                else if (const auto r32 = std::dynamic_pointer_cast<PCICFGRegister32>(reg))
+                {
+                    f.pciReads.add(r32->getHandle(), r32->getOffset(), sizeof(uint32), dest);
+                }
+                else
+                {
+                    f.otherReads.push_back(std::make_pair(reg.get(), dest));
+                }
+            };
+            for (size_t unit = 0; unit < pmus.size(); ++unit)
+            {
+                uint64 * values = f.values.data() + unit * valuesPerUnit;
+                for (size_t c = 0; c < pmus[unit].counterValue.size() && c < UncorePMU::maxCounters; ++c)
+                {
+                    add(pmus[unit].counterValue[c], values + c);
+                }
+                add(pmus[unit].fixedCounterValue, values + UncorePMU::maxCounters);
+            }
+            f.built = true;
+        }
+        if (!f.valid)
+        {
+            f.pciReads.execute();
+            for (auto & r : f.otherReads)
+            {
+                *r.second = uint64(*r.first);
+            }
+            f.valid = true;
+        }
+        return f.values.data();
+    }
+    return nullptr;
+}
+
 uint64 ServerUncorePMUs::getDRAMClocks(uint32 channel)
 {
     uint64 result = 0;
 
     if (channel < (uint32)imcPMUs.size())
-        result = *(imcPMUs[channel].fixedCounterValue);
+    {
+        const uint64 * frozenValues = getFrozenCounters(imcPMUs);
+        result = frozenValues ? frozenValues[channel * valuesPerUnit + UncorePMU::maxCounters] : *(imcPMUs[channel].fixedCounterValue);
+    }
 
     DBG(3, "DRAMClocks on channel " , channel , " = " , result);
     return result;
@@ -10094,7 +11174,10 @@ uint64 ServerUncorePMUs::getHBMClocks(uint32 channel)
     uint64 result = 0;
 
     if (channel < (uint32)edcPMUs.size())
-        result = *edcPMUs[channel].fixedCounterValue;
+    {
+        const uint64 * frozenValues = getFrozenCounters(edcPMUs);
+        result = frozenValues ? frozenValues[channel * valuesPerUnit + UncorePMU::maxCounters] : *edcPMUs[channel].fixedCounterValue;
+    }
 
     DBG(3, "HBMClocks on EDC" , channel , " = " , result);
     return result;
@@ -10106,7 +11189,8 @@ uint64 ServerUncorePMUs::getPMUCounter(std::vector<UncorePMU> & pmu, const uint3
 
     if (id < (uint32)pmu.size() && counter < 4 && pmu[id].counterValue[counter].get() != nullptr)
     {
-        result = *(pmu[id].counterValue[counter]);
+        const uint64 * frozenValues = getFrozenCounters(pmu);
+        result = frozenValues ? frozenValues[id * valuesPerUnit + counter] : *(pmu[id].counterValue[counter]);
     }
     else
     {
@@ -11305,32 +12389,161 @@ void PCM::initCHARequestEvents(uint64 * config)
     }
 }
 
-CounterWidthExtender::CounterWidthExtender(AbstractRawCounter * raw_counter_, uint64 counter_width_, uint32 watchdog_delay_ms_) : raw_counter(raw_counter_), counter_width(counter_width_), watchdog_delay_ms(watchdog_delay_ms_)
+//! \brief One thread refreshing all CounterWidthExtender instances before their underlying counters can wrap around
+//!
+//! The extenders are kept in a min-heap ordered by their refresh deadlines. All extenders due within a short batch window
+//! are refreshed together, grouped by the core their counter is read on. An extender read by a regular sample
+//! since its last refresh is not polled: its deadline is just moved to the time of that read plus its delay.
+class CounterWidthExtenderWatchdog
 {
-    last_raw_value = (*raw_counter)();
-    extended_value = last_raw_value;
-    DBG(3, "Initial Value " , extended_value);
-    try {
-        UpdateThread = new std::thread(
-            [&]() {
-            while (1)
+    struct Entry
+    {
+        uint64 deadline_ms;
+        uint64 id;
+        bool operator > (const Entry & other) const { return deadline_ms > other.deadline_ms; }
+    };
+    struct DueExtender
+    {
+        int32 core;
+        uint64 id;
+        CounterWidthExtender * extender;
+    };
+    std::vector<Entry> heap; // min-heap on deadline_ms
+    std::unordered_map<uint64, CounterWidthExtender *> extenders;
+    std::vector<DueExtender> due;
+    uint64 nextId = 1;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread * thread = nullptr;
+    enum { batchWindowMs = 100 }; // refreshing a little earlier than needed is harmless and saves wakeups
+
+    void push(const uint64 deadline_ms, const uint64 id)
+    {
+        heap.push_back(Entry{ deadline_ms, id });
+        std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+    }
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            if (heap.empty())
             {
-                MySleepMs(static_cast<int>(this->watchdog_delay_ms));
-                /* uint64 dummy = */ this->read();
+                wakeup.wait(lock);
+                continue;
+            }
+            uint64 now = CounterWidthExtender::currentTimeMs();
+            if (heap.front().deadline_ms > now)
+            {
+                wakeup.wait_for(lock, std::chrono::milliseconds(heap.front().deadline_ms - now));
+                continue;
+            }
+            due.clear();
+            while (!heap.empty() && heap.front().deadline_ms <= now + batchWindowMs)
+            {
+                const auto id = heap.front().id;
+                std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                heap.pop_back();
+                const auto e = extenders.find(id);
+                if (e != extenders.end()) // skip entries of unregistered extenders
+                {
+                    due.push_back(DueExtender{ e->second->raw_counter->getCore(), id, e->second });
+                }
+            }
+            std::stable_sort(due.begin(), due.end(), [](const DueExtender & a, const DueExtender & b) { return a.core < b.core; });
+            for (auto d = due.begin(); d != due.end(); )
+            {
+                const auto core = d->core;
+                std::optional<TemporalThreadAffinity> affinity;
+                if (core >= 0)
+                {
+                    try {
+                        affinity.emplace(core, false); // one affinity switch for all counters of the core
+                    }
+                    catch (...) { }
+                }
+                now = CounterWidthExtender::currentTimeMs();
+                for (; d != due.end() && d->core == core; ++d)
+                {
+                    push(d->extender->refresh(now, batchWindowMs), d->id);
+                }
             }
         }
-        );
     }
-    catch (const std::exception& e)
+    CounterWidthExtenderWatchdog() = default;
+    CounterWidthExtenderWatchdog(const CounterWidthExtenderWatchdog &) = delete;
+    CounterWidthExtenderWatchdog & operator = (const CounterWidthExtenderWatchdog &) = delete;
+public:
+    static CounterWidthExtenderWatchdog & getInstance()
+    {
+        // never destroyed: extenders can be deleted during static destruction
+        static CounterWidthExtenderWatchdog * instance = new CounterWidthExtenderWatchdog();
+        return *instance;
+    }
+    uint64 add(CounterWidthExtender * extender)
     {
-        std::cerr << "PCM Error: caught exception " << e.what() << " while creating thread for a CounterWidthExtender\n" <<
-            threadCreateErrorMessage;
-        throw; // re-throw
+        std::unique_lock<std::mutex> lock(mutex);
+        if (thread == nullptr)
+        {
+            try {
+                thread = new std::thread([this]() { run(); });
+                thread->detach();
+            }
+            catch (const std::exception& e)
+            {
+                deleteAndNullify(thread);
+                std::cerr << "PCM Error: caught exception " << e.what() << " while creating thread for a CounterWidthExtender\n" <<
+                    threadCreateErrorMessage;
+                throw; // re-throw
+            }
+        }
+        const auto id = nextId++;
+        extenders[id] = extender;
+        const auto deadline = extender->last_read_ms + extender->watchdog_delay_ms;
+        const bool earliest = heap.empty() || deadline < heap.front().deadline_ms;
+        push(deadline, id);
+        if (earliest)
+        {
+            wakeup.notify_one();
+        }
+        return id;
     }
+    void remove(const uint64 id)
+    {
+        std::unique_lock<std::mutex> lock(mutex); // waits for a refresh in progress
+        extenders.erase(id); // the heap entry is dropped when it becomes due
+    }
+};
+
+uint64 CounterWidthExtender::currentTimeMs()
+{
+    return (uint64)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// returns the next refresh deadline
+uint64 CounterWidthExtender::refresh(const uint64 now_ms, const uint64 batch_window_ms)
+{
+    Mutex::Scope _(CounterMutex);
+    const uint64 deadline = last_read_ms + watchdog_delay_ms;
+    if (deadline > now_ms + batch_window_ms)
+    {
+        return deadline; // read by a regular sample recently: no need to poll now
+    }
+    locked_read();
+    return last_read_ms + watchdog_delay_ms;
+}
+
+CounterWidthExtender::CounterWidthExtender(AbstractRawCounter * raw_counter_, uint64 counter_width_, uint32 watchdog_delay_ms_) : raw_counter(raw_counter_), counter_width(counter_width_), watchdog_delay_ms(watchdog_delay_ms_)
+{
+    last_raw_value = (*raw_counter)();
+    last_read_ms = currentTimeMs();
+    extended_value = last_raw_value;
+    DBG(3, "Initial Value " , extended_value);
+    watchdog_id = CounterWidthExtenderWatchdog::getInstance().add(this);
 }
 CounterWidthExtender::~CounterWidthExtender()
 {
-    deleteAndNullify(UpdateThread);
+    CounterWidthExtenderWatchdog::getInstance().remove(watchdog_id);
     deleteAndNullify(raw_counter);
 }
 
@@ -11415,6 +12628,21 @@ void UncorePMU::freeze(const uint32 extra)
     }
 }
 
+bool UncorePMU::freezesCounters(const uint64 unitControlValue)
+{
+    switch (PCM::getInstance()->getCPUFamilyModel())
+    {
+    case PCM::SPR:
+    case PCM::EMR:
+    case PCM::GNR:
+    case PCM::GNR_D:
+    case PCM::GRR:
+    case PCM::SRF:
+        return (unitControlValue & SPR_UNC_PMON_UNIT_CTL_FRZ) != 0;
+    }
+    return (unitControlValue & UNC_PMON_UNIT_CTL_FRZ) != 0;
+}
+
 void UncorePMU::unfreeze(const uint32 extra)
 {
     switch (getCPUFamilyModel())
@@ -30,6 +30,7 @@
 #include "tpmi.h"
 #include "pmt.h"
 #include "bw.h"
+#include "collection_stats.h"
 #include "width_extender.h"
 #include "exceptions/unsupported_processor_exception.hpp"
 #include "uncore_pmu_discovery.h"
@@ -44,6 +45,8 @@
 #include <string.h>
 #include <assert.h>
 #include <atomic>
+#include <thread>
+#include <functional>
 #include "mutex.h"
 
 #ifdef PCM_USE_PERF
@@ -85,6 +88,7 @@ class BasicCounterState;
 class ServerUncoreCounterState;
 class PCM;
 class CoreTaskQueue;
+class CollectionContext;
 class SystemRoot;
 
 /*
@@ -111,6 +115,8 @@ public:
         offset(offset_)
     {
     }
+    const std::shared_ptr<PciHandleType> & getHandle() const { return handle; }
+    size_t getOffset() const { return offset; }
     void operator = (uint64 val) override
     {
         cvt_ds cvt;
@@ -136,6 +142,8 @@ public:
         offset(offset_)
     {
     }
+    const std::shared_ptr<PciHandleType> & getHandle() const { return handle; }
+    size_t getOffset() const { return offset; }
     void operator = (uint64 val) override
     {
         handle->write32(offset, (uint32)val);
@@ -293,6 +301,8 @@ public:
     bool initFreeze(const uint32 extra, const char* xPICheckMsg = nullptr);
     void unfreeze(const uint32 extra);
     void resetUnfreeze(const uint32 extra);
+    //! \brief Returns true if writing unitControlValue to the unit control register freezes the counters of the unit
+    static bool freezesCounters(const uint64 unitControlValue);
 };
 
 typedef std::shared_ptr<UncorePMU> UncorePMURef;
@@ -412,6 +422,21 @@ class ServerUncorePMUs
     uint64 getPMUCounter(std::vector<UncorePMU> & pmu, const uint32 id, const uint32 counter);
     bool HBMAvailable() const;
 
+    // counters of a PMU vector in allPMUs, read in one batched pass on the first access while frozen
+    struct FrozenCounters
+    {
+        PciConfigBatch pciReads;
+        std::vector<std::pair<HWRegister *, uint64 *> > otherReads; // MMIO and perf registers
+        std::vector<uint64> values; // [unit * valuesPerUnit + counter], the fixed counter is the last value of a unit
+        bool built = false;
+        bool valid = false;
+    };
+    enum { valuesPerUnit = UncorePMU::maxCounters + 1 };
+    std::vector<FrozenCounters> frozenCounters; // indexed like allPMUs
+    bool frozen = false;
+    //! \brief Returns the counter values of the PMU vector between freezeCounters() and unfreezeCounters(), nullptr otherwise
+    const uint64 * getFrozenCounters(const UncorePMUVector & pmus);
+
 public:
     enum EventPosition {
         READ=0,
@@ -530,9 +555,11 @@ public:
     uint64 getHACounter(uint32 box, uint32 counter);
 
     //! \brief Freezes event counting
-    void freezeCounters();
+    //! \param globallyFrozen the counters are already frozen by the global control: no unit control writes are needed
+    void freezeCounters(const bool globallyFrozen = false);
     //! \brief Unfreezes event counting
-    void unfreezeCounters();
+    //! \param globallyFrozen the counters were frozen by the global control: no unit control writes are needed
+    void unfreezeCounters(const bool globallyFrozen = false);
 
     //! \brief Measures/computes the maximum theoretical QPI link bandwidth speed in GByte/seconds
     uint64 computeQPISpeed(const uint32 ref_core, const int cpumodel);
@@ -590,6 +617,59 @@ inline constexpr int PCM_CPU_FAMILY_MODEL(int family_, int model_)
     return ((family_) << 8) + (model_);
 }
 
+/*! \brief Shape of the packed ServerUncoreCounterState of a socket
+
+    The counters of each uncore unit type are stored contiguously in one flat array (unit-major, counter-minor).
+    A layout is built once per socket from the discovered uncore topology and shared by all snapshots of the socket,
+    so a snapshot holds (and a copy moves) only the counters that exist on the system.
+*/
+struct ServerUncoreCounterStateLayout
+{
+    enum UnitType
+    {
+        XPI,
+        M3UPI,
+        IIO,
+        IRP,
+        CXLCM,
+        CXLDP,
+        MC,
+        M2M,
+        HA,
+        EDC,
+        DRAMClock,
+        HBMClock,
+        IMCFreeRunning, // free-running counters of the memory controllers (ServerBW)
+        numUnitTypes
+    };
+    struct Block
+    {
+        uint32 offset = 0;
+        uint32 units = 0;
+        uint32 countersPerUnit = 0;
+    };
+    struct PMUBlock // units of a generic uncore PMU type on one die
+    {
+        int pmuID;
+        uint32 offset;
+        uint32 units;
+    };
+    std::array<Block, numUnitTypes> blocks;
+    std::vector<PMUBlock> pmus; // in the die and PMU map order of PCM::uncorePMUs
+    uint32 size = 0; // total number of counters
+
+    void add(const UnitType type, const uint32 units, const uint32 countersPerUnit)
+    {
+        blocks[type] = Block{ size, units, countersPerUnit };
+        size += units * countersPerUnit;
+    }
+    void addPMU(const int pmuID, const uint32 units)
+    {
+        pmus.push_back(PMUBlock{ pmuID, size, units });
+        size += units * UncorePMU::maxCounters;
+    }
+};
+
 class PerfVirtualControlRegister;
 
 /*!
@@ -770,22 +850,22 @@ private:
     {
         if (socket < uncorePMUs.size())
         {
-            result.Counters.resize(uncorePMUs[socket].size());
+            size_t block = 0; // the generic PMU blocks of the layout follow the order of uncorePMUs
             for (size_t die = 0; die < uncorePMUs[socket].size(); ++die)
             {
                 TemporalThreadAffinity tempThreadAffinity(socketRefCore[socket]); // speedup trick for Linux
 
-                for (auto pmuIter = uncorePMUs[socket][die].begin(); pmuIter != uncorePMUs[socket][die].end(); ++pmuIter)
+                for (auto pmuIter = uncorePMUs[socket][die].begin(); pmuIter != uncorePMUs[socket][die].end(); ++pmuIter, ++block)
                 {
                     const auto & pmu_id = pmuIter->first;
-                    result.Counters[die][pmu_id].resize(pmuIter->second.size());
-                    for (size_t unit = 0; unit < pmuIter->second.size(); ++unit)
+                    uint64 * values = result.uncorePMUCounters(block, pmu_id, pmuIter->second.size());
+                    for (size_t unit = 0; values != nullptr && unit < pmuIter->second.size(); ++unit)
                     {
                         auto& pmu = pmuIter->second[unit];
                         for (size_t i = 0; pmu.get() != nullptr && i < pmu->size(); ++i)
                         {
                             DBG(4, "s " , socket , " d " , die , " pmu " , pmu_id , " unit " , unit , " ctr " , i );
-                            result.Counters[die][pmu_id][unit][i] = *(pmu->counterValue[i]);
+                            values[unit * UncorePMU::maxCounters + i] = *(pmu->counterValue[i]);
                         }
                     }
                 }
@@ -800,12 +880,11 @@ private:
     {
         if (MSR.empty()) return;
 
-        for (size_t socket = 0; socket < uncorePMUs.size(); ++socket)
+        // each control register write is a syscall (MSR or perf_event_open): program the sockets in parallel
+        runOnSocketRefCores([&](const size_t socket)
         {
             for (size_t die = 0; die < uncorePMUs[socket].size(); ++die)
             {
-                TemporalThreadAffinity tempThreadAffinity(socketRefCore[socket]); // speedup trick for Linux
-
                 for (size_t unit = 0; unit < uncorePMUs[socket][die][pmu_id].size(); ++unit)
                 {
                     auto& pmu = uncorePMUs[socket][die][pmu_id][unit];
@@ -815,9 +894,16 @@ private:
                     }
                 }
             }
-        }
+        }, uncorePMUs.size());
     }
 
+    /*! \brief Runs f(socket) for sockets 0..sockets-1 concurrently, each on the worker of the socket reference core
+
+        Falls back to the calling thread (with temporary affinity to the reference core) before the
+        core workers are created. Waits for all sockets and rethrows the first exception.
+    */
+    void runOnSocketRefCores(const std::function<void(const size_t)> & f, const size_t sockets);
+
     // TODO: gradually move other PMUs to the uncorePMUs structure
     std::vector<std::map<int32, UncorePMU> > iioPMUs;
     std::vector<std::map<int32, UncorePMU> > irpPMUs;
@@ -858,6 +944,14 @@ private:
     uint64 * pkgCStateMsr;     // MSR addresses of package C-state free-running counters
 
     std::vector<std::shared_ptr<CoreTaskQueue> > coreTaskQueues;
+    std::shared_ptr<CollectionContext> defaultCollectionContext; // backs the vector-based getAllCounterStates
+    Mutex defaultCollectionContextMutex;
+    void collectAllCounterStates(CollectionContext & context, SystemCounterState & systemState, SocketCounterState * socketStates, CoreCounterState * coreStates, const bool readAndAggregateSocketUncoreCounters);
+
+    // per socket, rebuilt when the discovered uncore topology changes
+    std::vector<std::shared_ptr<const ServerUncoreCounterStateLayout> > serverUncoreCounterStateLayouts;
+    Mutex serverUncoreCounterStateLayoutsMutex;
+    std::shared_ptr<const ServerUncoreCounterStateLayout> getServerUncoreCounterStateLayout(const uint32 socket);
 
     bool L2CacheHitRatioAvailable;
     bool L3CacheHitRatioAvailable;
@@ -1128,13 +1222,15 @@ private:
     CustomCoreEventDescription hybridAtomEventDesc[PERF_MAX_CUSTOM_COUNTERS];
 
     std::vector<int32> socketRefCore;
+    std::vector<int32> globalUncoreFreezeDepth; // per socket: nesting level of global uncore freezes
 
     bool canUsePerf;
 #ifdef PCM_USE_PERF
     typedef std::vector<std::vector<int> > PerfEventHandleContainer;
     PerfEventHandleContainer perfEventHandle;
     std::vector<PerfEventHandleContainer> perfEventTaskHandle;
-    void readPerfData(uint32 core, std::vector<uint64> & data);
+    typedef std::array<uint64, PERF_MAX_COUNTERS> PerfData;
+    void readPerfData(uint32 core, PerfData & data);
     void closePerfHandles(const bool silent = false);
 
     enum {
@@ -1235,15 +1331,34 @@ private:
     template <class CounterStateType>
     void readMSRs(std::shared_ptr<SafeMsrHandle> msr, const RawPMUConfig & msrConfig, CounterStateType & result);
     void readQPICounters(SystemCounterState & counterState);
+    void readServerQPICounters(const uint32 socket, SystemCounterState & counterState);
+    void readCXLCMCounters(const uint32 socket, SystemCounterState & counterState);
     void readSystemEnergyStatus(SystemCounterState & systemState);
-    void readPCICFGRegisters(SystemCounterState& result);
-    void readTPMIRegisters(SystemCounterState& result);
-    void readMMIORegisters(SystemCounterState& result);
-    void readPMTRegisters(SystemCounterState& result);
+    /*! \brief Sizes the value arrays of the raw pcicfg/mmio/pmt/tpmi events
+
+        Every register location of an event is assigned to a socket (see getRawRegisterSockets),
+        the per-socket readers (see readRawRegisters) fill the values of their locations in place.
+    */
+    void prepareRawRegisterValues(SystemCounterState& result);
+    /*! \brief Returns the socket whose reference core reads each of the register locations with the given NUMA nodes
+
+        The socket of a location is the socket of its device's NUMA node. If a NUMA node is unknown (-1 or
+        without CPUs), the locations are split into one contiguous range per socket in location order
+        (PCI bus resp. instance order, which follows the sockets).
+    */
+    std::vector<uint32> getRawRegisterSockets(const std::vector<int32> & numaNodes) const;
+    //! \brief Reads the raw pcicfg/mmio/pmt/tpmi register locations assigned to the socket
+    void readRawRegisters(const uint32 socket, SystemCounterState& result);
+    void readPCICFGRegisters(const uint32 socket, SystemCounterState& result);
+    void readTPMIRegisters(const uint32 socket, SystemCounterState& result);
+    void readMMIORegisters(const uint32 socket, SystemCounterState& result);
+    void readPMTRegisters(const uint32 socket, SystemCounterState& result);
+    //! \brief Reads all system-wide uncore counters of one socket: xPI links, CXL and raw registers
+    void readSocketUncoreCounters(const uint32 socket, SystemCounterState& result);
     void reportQPISpeed() const;
     void readCoreCounterConfig(const bool complainAboutMSR = false);
     void readCPUMicrocodeLevel();
-    void globalFreezeUncoreCountersInternal(const unsigned long long int freeze);
+    void globalFreezeUncoreCountersInternal(const uint32 socket, const unsigned long long int freeze);
 
     uint64 CX_MSR_PMON_CTRY(uint32 Cbo, uint32 Ctr) const;
     uint64 CX_MSR_PMON_BOX_FILTER(uint32 Cbo) const;
@@ -1698,6 +1813,18 @@ private:
     std::unordered_map<RawEventEncoding, std::vector<PCICFGRegisterEncoding>, PCICFGRegisterEncodingHash, PCICFGRegisterEncodingCmp> PCICFGRegisterLocations{};
     std::unordered_map<RawEventEncoding, std::vector<MMIORegisterEncoding>, MMIORegisterEncodingHash, MMIORegisterEncodingCmp> MMIORegisterLocations{};
     std::unordered_map<RawEventEncoding, std::vector<PMTRegisterEncoding>, PMTRegisterEncodingHash, PMTRegisterEncodingCmp> PMTRegisterLocations{};
+    // socket reading each register location (same order as the locations), see getRawRegisterSockets
+    std::unordered_map<RawEventEncoding, std::vector<uint32>, TPMIRegisterEncodingHash, TPMIRegisterEncodingCmp> TPMIRegisterSockets{};
+    std::unordered_map<RawEventEncoding, std::vector<uint32>, PCICFGRegisterEncodingHash, PCICFGRegisterEncodingCmp> PCICFGRegisterSockets{};
+    std::unordered_map<RawEventEncoding, std::vector<uint32>, MMIORegisterEncodingHash, MMIORegisterEncodingCmp> MMIORegisterSockets{};
+    std::unordered_map<RawEventEncoding, std::vector<uint32>, PMTRegisterEncodingHash, PMTRegisterEncodingCmp> PMTRegisterSockets{};
+    struct PMTTelemetryArray
+    {
+        PMTRegisterEncoding array;
+        uint32 socket = 0; // socket reading the array
+    };
+    // telemetry arrays by (UID, instance), the PMT register locations of all events of a UID refer to them
+    std::map<std::pair<uint64, size_t>, PMTTelemetryArray> PMTTelemetryArrays{};
 public:
 
     TopologyEntry::CoreType getCoreType(const unsigned coreID) const
@@ -1776,6 +1903,44 @@ public:
     //! \brief Unfreezes uncore event counting using global control MSR
     void globalUnfreezeUncoreCounters();
 
+    /*! \brief Freezes uncore event counting of one socket using global control MSR
+
+        The freezes nest: the counters stay frozen until the matching number of unfreezes
+        (also of the all-socket globalFreezeUncoreCounters) for the socket.
+    */
+    void globalFreezeUncoreCounters(const uint32 socket);
+
+    //! \brief Unfreezes uncore event counting of one socket using global control MSR
+    void globalUnfreezeUncoreCounters(const uint32 socket);
+
+    //! \brief Returns true if getServerUncoreCounterState reads all uncore units of a socket in one global freeze window
+    bool uncoreSnapshotAvailable() const
+    {
+        return uncoreSnapshotAvailable(cpu_family_model, useLinuxPerfForUncore());
+    }
+
+    /*! \brief Returns true if the uncore units of a socket can be read in one global freeze window
+
+        \param cpuFamilyModel processor model
+        \param perfUncore the uncore PMUs are programmed through Linux perf (PCM_USE_UNCORE_PERF=1, secure boot):
+               the kernel driver owns the global control and the boxes are frozen by their perf group snapshots
+    */
+    static bool uncoreSnapshotAvailable(const int cpuFamilyModel, const bool perfUncore)
+    {
+        if (perfUncore)
+        {
+            return false;
+        }
+        switch (cpuFamilyModel)
+        {
+        case SPR:
+        case EMR:
+            // the global control freezes all units; on older models only the units with the freeze enable bit
+            return true;
+        }
+        return false;
+    }
+
     //! \brief Freezes uncore event counting
     void freezeServerUncoreCounters();
 
@@ -1811,6 +1976,23 @@ public:
     */
     void getAllCounterStates(SystemCounterState & systemState, std::vector<SocketCounterState> & socketStates, std::vector<CoreCounterState> & coreStates, const bool readAndAggregateSocketUncoreCounters = true);
 
+    /*! \brief Creates a reusable collection context for getAllCounterStates
+
+        The context owns preallocated system, socket and core counter states and one work slot per core/socket.
+        Use one context per before/after state and swap the pointers between samples.
+    */
+    std::shared_ptr<CollectionContext> createCollectionContext();
+
+    /*! \brief Reads all counter states (including system, sockets and cores) into a collection context
+
+        Unlike the vector-based overload, this one does not allocate memory: the states are reset in place and
+        the preallocated per-core work slots are dispatched to the core workers and awaited with one latch.
+
+        \param context collection context created by createCollectionContext() (return parameter)
+        \param readAndAggregateSocketUncoreCounters read and aggregate socket uncore counters
+    */
+    void getAllCounterStates(CollectionContext & context, const bool readAndAggregateSocketUncoreCounters = true);
+
     /*! \brief Reads uncore counter states (including system and sockets) but no core counters
 
     \param systemState system counter state (return parameter)
@@ -1819,6 +2001,22 @@ public:
     */
     void getUncoreCounterStates(SystemCounterState & systemState, std::vector<SocketCounterState> & socketStates);
 
+    /*! \brief Returns the self-overhead profile of counter collection
+
+        Per-sample histograms of the TSC cycles and system calls spent in each collection stage
+        (core, uncore, PMT, TPMI, resctrl reads and aggregation) since the start of the process.
+    */
+    CollectionStats::Snapshot getCollectionStats() const { return CollectionStats::getSnapshot(); }
+
+    /*! \brief Reads the server uncore counter states of all sockets
+
+        Equivalent to calling getServerUncoreCounterState for every socket, but the sockets are read
+        in parallel, each on a worker thread of its reference core.
+
+    \param states server uncore counter states indexed by socket id (return parameter)
+    */
+    void getServerUncoreCounterStates(std::vector<ServerUncoreCounterState> & states);
+
     /*! \brief Return true if the core in online
 
         \param os_core_id OS core id
@@ -2036,8 +2234,44 @@ private:
         return false;
     }
     RawPMUConfig threadMSRConfig{}, packageMSRConfig{}, tpmiConfig{}, pcicfgConfig{}, mmioConfig{}, pmtConfig{};
+
+    // MSR read plans compiled by compileMSRReadPlans() for the current configuration
+    typedef std::vector<std::pair<size_t, size_t> > MSRValuePositions; // MSRValues slot -> plan position stored in it
+    std::vector<uint64> msrValueSlots; // MSR address of each MSRValues slot, only grows so that slots of old states stay valid
+    size_t tscMSRValueSlot = 0, packageThermStatusMSRValueSlot = 0;
+    size_t addMSRValueSlot(const uint64 index);
+    struct CoreMSRReadPlan
+    {
+        MsrReadPlan plan;
+        size_t numCounterMSRs = 0; // leading PMU counter MSRs, skipped when Linux perf reads the counters
+        size_t globalStatusPos = 0, instRetiredPos = 0, cpuClkUnhaltedThreadPos = 0, cpuClkUnhaltedRefPos = 0;
+        size_t genCounterPos[PERF_MAX_CUSTOM_COUNTERS]{};
+        size_t cStatePos[MAX_C_STATE + 1]{};
+        size_t thermStatusPos = 0, smiCountPos = 0;
+        MSRValuePositions values;
+    } coreMSRReadPlan;
+    struct PackageMSRReadPlan
+    {
+        MsrReadPlan cStatePlan;  // read on every core
+        size_t cStatePos[MAX_C_STATE + 1]{};
+        MsrReadPlan socketPlan;  // read on the socket reference core
+        size_t thermStatusPos = 0;
+        MSRValuePositions values;
+    } packageMSRReadPlan;
+    void compileMSRReadPlans();
+    void readPackageMSRs(const uint32 socket, SocketCounterState & result);
 public:
 
+    //! \brief Returns the slot of an MSR in the MSRValues of counter states, -1 if the MSR is not read into counter states
+    int32 getMSRValueSlot(const uint64 index) const
+    {
+        for (size_t i = 0; i < msrValueSlots.size(); ++i)
+        {
+            if (msrValueSlots[i] == index) return (int32)i;
+        }
+        return -1;
+    }
+
     //! \brief Reads CPU family
     //! \return CPU family
     uint32 getCPUFamily() const { return (uint32)cpu_family; }
@@ -2942,6 +3176,23 @@ public:
                ;
     }
 
+    //! L3 snoop hits are derived as LLC references minus L3 misses on these models
+    bool useArchLLCRefForL3CacheHitsSnoop() const
+    {
+        return cpu_family_model == SNOWRIDGE
+            || cpu_family_model == GRR
+            || cpu_family_model == ELKHART_LAKE
+            || cpu_family_model == JASPER_LAKE
+            || cpu_family_model == SRF
+            || cpu_family_model == ADL
+            || cpu_family_model == RPL
+            || cpu_family_model == MTL
+            || cpu_family_model == LNL
+            || cpu_family_model == ARL
+            || cpu_family_model == PTL
+            ;
+    }
+
     bool hasClientMCCounters() const
     {
         return cpu_family_model == SANDY_BRIDGE
@@ -3050,6 +3301,56 @@ public:
     ~PCM();
 };
 
+/*! \brief Raw MSR values of a counter state
+
+    The values are addressed by the slot PCM assigns to each MSR address when it compiles its MSR read plans
+    (see PCM::getMSRValueSlot), so storing, copying and looking up values needs no hashing or node allocations.
+*/
+class MSRValueArray
+{
+    struct Entry
+    {
+        uint64 value;
+        bool valid;
+    };
+    std::vector<Entry> entries;
+public:
+    //! Makes room for numSlots values (no-op if already sized)
+    void resize(const size_t numSlots)
+    {
+        if (entries.size() < numSlots)
+        {
+            entries.resize(numSlots, Entry{ 0ULL, false });
+        }
+    }
+    void set(const size_t slot, const uint64 value)
+    {
+        resize(slot + 1);
+        entries[slot] = Entry{ value, true };
+    }
+    bool get(const int32 slot, uint64 & value) const
+    {
+        if (slot >= 0 && size_t(slot) < entries.size() && entries[slot].valid)
+        {
+            value = entries[slot].value;
+            return true;
+        }
+        return false;
+    }
+    bool contains(const int32 slot) const
+    {
+        return slot >= 0 && size_t(slot) < entries.size() && entries[slot].valid;
+    }
+    //! Invalidates all values but keeps the storage
+    void clear()
+    {
+        for (auto & e : entries)
+        {
+            e.valid = false;
+        }
+    }
+};
+
 //! \brief Basic core counter state
 //!
 //! Intended only for derivation, but not for the direct use
@@ -3057,6 +3358,7 @@ class BasicCounterState
 {
     friend class PCM;
     friend class JSONPrinter;
+    friend class CoreCounterColumns;
     template <class CounterStateType>
     friend double getExecUsage(const CounterStateType & before, const CounterStateType & after);
     template <class CounterStateType>
@@ -3170,7 +3472,7 @@ protected:
     uint64 SMICount;
     uint64 FrontendBoundSlots, BadSpeculationSlots, BackendBoundSlots, RetiringSlots, AllSlotsRaw;
     uint64 MemBoundSlots, FetchLatSlots, BrMispredSlots, HeavyOpsSlots;
-    std::unordered_map<uint64, uint64> MSRValues;
+    MSRValueArray MSRValues;
 
 public:
     BasicCounterState() :
@@ -3216,7 +3518,15 @@ public:
         MemoryBWTotal += o.MemoryBWTotal;
         SMICount += o.SMICount;
         DBG(4, "before PCM debug aggregate ", FrontendBoundSlots , " " , BadSpeculationSlots , " " , BackendBoundSlots , " " , RetiringSlots );
-        BasicCounterState old = *this;
+        // the slot counters must not wrap around
+        assert(FrontendBoundSlots + o.FrontendBoundSlots >= FrontendBoundSlots);
+        assert(BadSpeculationSlots + o.BadSpeculationSlots >= BadSpeculationSlots);
+        assert(BackendBoundSlots + o.BackendBoundSlots >= BackendBoundSlots);
+        assert(RetiringSlots + o.RetiringSlots >= RetiringSlots);
+        assert(MemBoundSlots + o.MemBoundSlots >= MemBoundSlots);
+        assert(FetchLatSlots + o.FetchLatSlots >= FetchLatSlots);
+        assert(BrMispredSlots + o.BrMispredSlots >= BrMispredSlots);
+        assert(HeavyOpsSlots + o.HeavyOpsSlots >= HeavyOpsSlots);
         FrontendBoundSlots += o.FrontendBoundSlots;
         BadSpeculationSlots += o.BadSpeculationSlots;
         BackendBoundSlots += o.BackendBoundSlots;
@@ -3227,17 +3537,28 @@ public:
         BrMispredSlots += o.BrMispredSlots;
         HeavyOpsSlots += o.HeavyOpsSlots;
         DBG(4, "after PCM debug aggregate ", FrontendBoundSlots , " " , BadSpeculationSlots , " " , BackendBoundSlots , " " ,RetiringSlots);
-        assert(FrontendBoundSlots >= old.FrontendBoundSlots);
-        assert(BadSpeculationSlots >= old.BadSpeculationSlots);
-        assert(BackendBoundSlots >= old.BackendBoundSlots);
-        assert(RetiringSlots >= old.RetiringSlots);
-        assert(MemBoundSlots >= old.MemBoundSlots);
-        assert(FetchLatSlots >= old.FetchLatSlots);
-        assert(BrMispredSlots >= old.BrMispredSlots);
-        assert(HeavyOpsSlots >= old.HeavyOpsSlots);
         return *this;
     }
 
+    //! Resets to the default-constructed state but keeps allocated storage
+    void reset()
+    {
+        InstRetiredAny = checked_uint64();
+        CpuClkUnhaltedThread = checked_uint64();
+        CpuClkUnhaltedRef = checked_uint64();
+        std::fill(Event, Event + PERF_MAX_CUSTOM_COUNTERS, checked_uint64());
+        InvariantTSC = 0;
+        std::fill(CStateResidency, CStateResidency + PCM::MAX_C_STATE + 1, 0);
+        ThermalHeadroom = PCM_INVALID_THERMAL_HEADROOM;
+        L3Occupancy = 0;
+        MemoryBWLocal = 0;
+        MemoryBWTotal = 0;
+        SMICount = 0;
+        FrontendBoundSlots = BadSpeculationSlots = BackendBoundSlots = RetiringSlots = AllSlotsRaw = 0;
+        MemBoundSlots = FetchLatSlots = BrMispredSlots = HeavyOpsSlots = 0;
+        MSRValues.clear();
+    }
+
     void readAndAggregate(std::shared_ptr<SafeMsrHandle>);
     void readAndAggregateTSC(std::shared_ptr<SafeMsrHandle>);
 
@@ -3323,7 +3644,7 @@ double getNormalizedQPIL1Cycles(uint32 port, const CounterStateType & before, co
 template <class CounterStateType>
 uint64 getDRAMClocks(uint32 channel, const CounterStateType & before, const CounterStateType & after)
 {
-    const auto clk = after.DRAMClocks[channel] - before.DRAMClocks[channel];
+    const auto clk = after.get(ServerUncoreCounterStateLayout::DRAMClock, channel, 0) - before.get(ServerUncoreCounterStateLayout::DRAMClock, channel, 0);
     const auto cpu_family_model = PCM::getInstance()->getCPUFamilyModel();
     if (cpu_family_model == PCM::ICX || cpu_family_model == PCM::SNOWRIDGE)
     {
@@ -3340,7 +3661,7 @@ uint64 getDRAMClocks(uint32 channel, const CounterStateType & before, const Coun
 template <class CounterStateType>
 uint64 getHBMClocks(uint32 channel, const CounterStateType & before, const CounterStateType & after)
 {
-    return after.HBMClocks[channel] - before.HBMClocks[channel];
+    return after.get(ServerUncoreCounterStateLayout::HBMClock, channel, 0) - before.get(ServerUncoreCounterStateLayout::HBMClock, channel, 0);
 }
 
 
@@ -3353,7 +3674,19 @@ uint64 getHBMClocks(uint32 channel, const CounterStateType & before, const Count
 template <class CounterStateType>
 uint64 getMCCounter(uint32 channel, uint32 counter, const CounterStateType & before, const CounterStateType & after)
 {
-    return after.MCCounter[channel][counter] - before.MCCounter[channel][counter];
+    return after.get(ServerUncoreCounterStateLayout::MC, channel, counter) - before.get(ServerUncoreCounterStateLayout::MC, channel, counter);
+}
+
+/*! \brief Returns a free-running counter of one memory controller (does not require PMU programming)
+    \param controller memory controller number
+    \param counter counter name
+    \param before CPU counter state before the experiment
+    \param after CPU counter state after the experiment
+*/
+template <class CounterStateType>
+uint64 getIMCFreeRunningCounter(uint32 controller, const typename CounterStateType::FreeRunningCounterID & counter, const CounterStateType & before, const CounterStateType & after)
+{
+    return after.get(ServerUncoreCounterStateLayout::IMCFreeRunning, controller, counter) - before.get(ServerUncoreCounterStateLayout::IMCFreeRunning, controller, counter);
 }
 
 /*! \brief Direct read of CXLCM PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3365,7 +3698,7 @@ uint64 getMCCounter(uint32 channel, uint32 counter, const CounterStateType & bef
 template <class CounterStateType>
 uint64 getCXLCMCounter(uint32 port, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.CXLCMCounter[port][counter] - before.CXLCMCounter[port][counter];
+    return after.get(ServerUncoreCounterStateLayout::CXLCM, port, counter) - before.get(ServerUncoreCounterStateLayout::CXLCM, port, counter);
 }
 
 /*! \brief Direct read of CXLDP PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3377,7 +3710,7 @@ uint64 getCXLCMCounter(uint32 port, uint32 counter, const CounterStateType& befo
 template <class CounterStateType>
 uint64 getCXLDPCounter(uint32 port, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.CXLDPCounter[port][counter] - before.CXLDPCounter[port][counter];
+    return after.get(ServerUncoreCounterStateLayout::CXLDP, port, counter) - before.get(ServerUncoreCounterStateLayout::CXLDP, port, counter);
 }
 
 /*! \brief Direct read of M3UPI PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3389,7 +3722,7 @@ uint64 getCXLDPCounter(uint32 port, uint32 counter, const CounterStateType& befo
 template <class CounterStateType>
 uint64 getM3UPICounter(uint32 port, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.M3UPICounter[port][counter] - before.M3UPICounter[port][counter];
+    return after.get(ServerUncoreCounterStateLayout::M3UPI, port, counter) - before.get(ServerUncoreCounterStateLayout::M3UPI, port, counter);
 }
 
 /*! \brief Direct read of uncore PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3402,22 +3735,7 @@ uint64 getM3UPICounter(uint32 port, uint32 counter, const CounterStateType& befo
 template <class CounterStateType>
 uint64 getUncoreCounter(const int pmu_id, uint32 unit, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    for (size_t die = 0; counter < UncorePMU::maxCounters && die < after.Counters.size(); ++die)
-    {
-        assert(die < before.Counters.size());
-        const auto afterIter = after.Counters[die].find(pmu_id);
-        const auto beforeIter = before.Counters[die].find(pmu_id);
-        if (afterIter != after.Counters[die].end() && beforeIter != before.Counters[die].end())
-        {
-            assert(afterIter->second.size() == beforeIter->second.size());
-            if (unit < afterIter->second.size())
-            {
-                return afterIter->second[unit][counter] - beforeIter->second[unit][counter];
-            }
-            unit -= afterIter->second.size();
-        }
-    }
-    return 0ULL;
+    return after.getUncorePMUCounter(pmu_id, unit, counter) - before.getUncorePMUCounter(pmu_id, unit, counter);
 }
 
 /*! \brief Direct read of IIO PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3429,7 +3747,7 @@ uint64 getUncoreCounter(const int pmu_id, uint32 unit, uint32 counter, const Cou
 template <class CounterStateType>
 uint64 getIIOCounter(uint32 stack, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.IIOCounter[stack][counter] - before.IIOCounter[stack][counter];
+    return after.get(ServerUncoreCounterStateLayout::IIO, stack, counter) - before.get(ServerUncoreCounterStateLayout::IIO, stack, counter);
 }
 
 /*! \brief Direct read of IRP PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3441,7 +3759,7 @@ uint64 getIIOCounter(uint32 stack, uint32 counter, const CounterStateType& befor
 template <class CounterStateType>
 uint64 getIRPCounter(uint32 stack, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.IRPCounter[stack][counter] - before.IRPCounter[stack][counter];
+    return after.get(ServerUncoreCounterStateLayout::IRP, stack, counter) - before.get(ServerUncoreCounterStateLayout::IRP, stack, counter);
 }
 
 /*! \brief Direct read of UPI or QPI PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3453,7 +3771,7 @@ uint64 getIRPCounter(uint32 stack, uint32 counter, const CounterStateType& befor
 template <class CounterStateType>
 uint64 getXPICounter(uint32 port, uint32 counter, const CounterStateType& before, const CounterStateType& after)
 {
-    return after.xPICounter[port][counter] - before.xPICounter[port][counter];
+    return after.get(ServerUncoreCounterStateLayout::XPI, port, counter) - before.get(ServerUncoreCounterStateLayout::XPI, port, counter);
 }
 
 /*! \brief Direct read of Memory2Mesh controller PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3465,7 +3783,7 @@ uint64 getXPICounter(uint32 port, uint32 counter, const CounterStateType& before
 template <class CounterStateType>
 uint64 getM2MCounter(uint32 controller, uint32 counter, const CounterStateType & before, const CounterStateType & after)
 {
-    return after.M2MCounter[controller][counter] - before.M2MCounter[controller][counter];
+    return after.get(ServerUncoreCounterStateLayout::M2M, controller, counter) - before.get(ServerUncoreCounterStateLayout::M2M, controller, counter);
 }
 
 /*! \brief Direct read of HA controller PMU counter (counter meaning depends on the programming: power/performance/etc)
@@ -3477,7 +3795,7 @@ uint64 getM2MCounter(uint32 controller, uint32 counter, const CounterStateType &
 template <class CounterStateType>
 uint64 getHACounter(uint32 controller, uint32 counter, const CounterStateType & before, const CounterStateType & after)
 {
-    return after.HACounter[controller][counter] - before.HACounter[controller][counter];
+    return after.get(ServerUncoreCounterStateLayout::HA, controller, counter) - before.get(ServerUncoreCounterStateLayout::HA, controller, counter);
 }
 
 /*! \brief Direct read of embedded DRAM memory controller counter (counter meaning depends on the programming: power/performance/etc)
@@ -3490,7 +3808,7 @@ template <class CounterStateType>
 uint64 getEDCCounter(uint32 channel, uint32 counter, const CounterStateType & before, const CounterStateType & after)
 {
     if (PCM::getInstance()->HBMmemoryTrafficMetricsAvailable())
-        return after.EDCCounter[channel][counter] - before.EDCCounter[channel][counter];
+        return after.get(ServerUncoreCounterStateLayout::EDC, channel, counter) - before.get(ServerUncoreCounterStateLayout::EDC, channel, counter);
     return 0ULL;
 }
 
@@ -3564,12 +3882,10 @@ uint64 getDRAMConsumedEnergy(const CounterStateType & before, const CounterState
 template <class CounterStateType>
 int64 getFreeRunningCounter(const typename CounterStateType::FreeRunningCounterID & counter, const CounterStateType & before, const CounterStateType & after)
 {
-    const auto beforeIt = before.freeRunningCounter.find(counter);
-    const auto afterIt = after.freeRunningCounter.find(counter);
-    if (beforeIt != before.freeRunningCounter.end() &&
-        afterIt != after.freeRunningCounter.end())
+    const uint32 mask = 1U << counter;
+    if ((before.freeRunningCounterMask & mask) && (after.freeRunningCounterMask & mask))
     {
-        return afterIt->second - beforeIt->second;
+        return after.freeRunningCounter[counter] - before.freeRunningCounter[counter];
     }
     return -1;
 }
@@ -3838,6 +4154,24 @@ public:
             CStateResidency[i] += o.CStateResidency[i];
         return *this;
     }
+
+    //! Resets to the default-constructed state but keeps allocated storage
+    void reset()
+    {
+        UFSStatus.clear();
+        UncMCFullWrites = UncMCNormalReads = 0;
+        UncHARequests = UncHALocalRequests = 0;
+        UncNMMiss = UncNMHit = 0;
+        UncPMMWrites = UncPMMReads = 0;
+        UncEDCFullWrites = UncEDCNormalReads = 0;
+        UncMCGTRequests = UncMCIARequests = UncMCIORequests = 0;
+        PackageEnergyStatus = 0;
+        std::fill(PPEnergyStatus, PPEnergyStatus + PCM::MAX_PP + 1, 0);
+        DRAMEnergyStatus = 0;
+        TOROccupancyIAMiss = TORInsertsIAMiss = 0;
+        UncClocks = 0;
+        std::fill(CStateResidency, CStateResidency + PCM::MAX_C_STATE + 1, 0);
+    }
 };
 
 
@@ -3852,7 +4186,8 @@ public:
         maxXPILinks = 6,
         maxIIOStacks = 16,
         maxCXLPorts = 16,
-        maxCounters = UncorePMU::maxCounters
+        maxCounters = UncorePMU::maxCounters,
+        maxFreeRunningCounters = 4
     };
     enum EventPosition
     {
@@ -3868,42 +4203,16 @@ public:
         PMMWrites
     };
 
-    // typedef std::array<uint64, maxCounters> CounterArrayType;
-    class CounterArrayType
-    {
-        std::array<uint64, maxCounters> data;
-    public:
-        CounterArrayType() : data{{}}
-        {
-            std::fill(data.begin(), data.end(), 0ULL);
-        }
-        const uint64& operator [] (size_t i) const
-        {
-            return data[i];
-        }
-        uint64& operator [] (size_t i)
-        {
-            return data[i];
-        }
-    };
-    typedef std::vector<CounterArrayType> PMUCounterArrayType;
-    typedef std::unordered_map<int, PMUCounterArrayType> PMUMapCounterArrayType;
-    // die -> pmu map -> PMUs -> counters
-    std::vector<PMUMapCounterArrayType>  Counters;
-
-    std::array<std::array<uint64, maxCounters>, maxXPILinks> xPICounter;
-    std::array<std::array<uint64, maxCounters>, maxXPILinks> M3UPICounter;
-    std::array<std::array<uint64, maxCounters>, maxIIOStacks> IIOCounter;
-    std::array<std::array<uint64, maxCounters>, maxIIOStacks> IRPCounter;
-    std::array<std::array<uint64, maxCounters>, maxCXLPorts> CXLCMCounter;
-    std::array<std::array<uint64, maxCounters>, maxCXLPorts> CXLDPCounter;
-    std::array<uint64, maxChannels> DRAMClocks;
-    std::array<uint64, maxChannels> HBMClocks;
-    std::array<std::array<uint64, maxCounters>, maxChannels> MCCounter; // channel X counter
-    std::array<std::array<uint64, maxCounters>, maxControllers> M2MCounter; // M2M/iMC boxes x counter
-    std::array<std::array<uint64, maxCounters>, maxControllers> HACounter; // HA boxes x counter
-    std::array<std::array<uint64, maxCounters>, maxChannels> EDCCounter; // EDC controller X counter
-    std::unordered_map<int, uint64> freeRunningCounter;
+    typedef ServerUncoreCounterStateLayout Layout;
+
+private:
+    std::shared_ptr<const Layout> layout;
+    std::vector<uint64> counters; // all unit counters of the socket, packed according to layout
+    std::array<uint64, maxFreeRunningCounters> freeRunningCounter;
+    uint32 freeRunningCounterMask; // bit i: freeRunningCounter[i] is valid
+    uint64 uncoreFreezeWindow; // in ns
+
+public:
     int32 PackageThermalHeadroom;
     uint64 InvariantTSC;    // invariant time stamp counter
     friend class PCM;
@@ -3947,23 +4256,79 @@ public:
 public:
     //! Returns current thermal headroom below TjMax
     int32 getPackageThermalHeadroom() const { return PackageThermalHeadroom; }
+    //! Returns the time in ns all uncore units of the socket were read in one global freeze window, 0 if the units were frozen separately
+    uint64 getUncoreFreezeWindow() const { return uncoreFreezeWindow; }
     ServerUncoreCounterState() :
-        xPICounter{{}},
-        M3UPICounter{{}},
-        IIOCounter{{}},
-        IRPCounter{{}},
-        CXLCMCounter{{}},
-        CXLDPCounter{{}},
-        DRAMClocks{{}},
-        HBMClocks{{}},
-        MCCounter{{}},
-        M2MCounter{{}},
-        HACounter{{}},
-        EDCCounter{{}},
+        freeRunningCounter{{}},
+        freeRunningCounterMask(0),
+        uncoreFreezeWindow(0),
         PackageThermalHeadroom(0),
         InvariantTSC(0)
     {
     }
+    //! Returns a counter of an uncore unit, 0 if the unit or counter does not exist
+    uint64 get(const Layout::UnitType type, const uint32 unit, const uint32 counter) const
+    {
+        if (layout.get())
+        {
+            const auto & block = layout->blocks[type];
+            if (unit < block.units && counter < block.countersPerUnit)
+            {
+                return counters[block.offset + size_t(unit) * block.countersPerUnit + counter];
+            }
+        }
+        return 0ULL;
+    }
+    //! Returns a counter of a generic uncore PMU unit (units are numbered across dies), 0 if it does not exist
+    uint64 getUncorePMUCounter(const int pmu_id, uint32 unit, const uint32 counter) const
+    {
+        if (layout.get() && counter < UncorePMU::maxCounters)
+        {
+            for (const auto & pmu : layout->pmus)
+            {
+                if (pmu.pmuID != pmu_id)
+                {
+                    continue;
+                }
+                if (unit < pmu.units)
+                {
+                    return counters[pmu.offset + size_t(unit) * UncorePMU::maxCounters + counter];
+                }
+                unit -= pmu.units;
+            }
+        }
+        return 0ULL;
+    }
+    //! Returns the number of unit counters held by the snapshot
+    size_t getNumCounters() const { return counters.size(); }
+
+private:
+    void setLayout(const std::shared_ptr<const Layout> & layout_)
+    {
+        layout = layout_;
+        counters.assign(layout.get() ? layout->size : 0, 0ULL);
+    }
+    uint64 * unitCounters(const Layout::UnitType type, const uint32 unit)
+    {
+        if (layout.get() && unit < layout->blocks[type].units)
+        {
+            return counters.data() + layout->blocks[type].offset + size_t(unit) * layout->blocks[type].countersPerUnit;
+        }
+        return nullptr;
+    }
+    uint64 * uncorePMUCounters(const size_t block, const int pmu_id, const size_t units)
+    {
+        if (layout.get() && block < layout->pmus.size() && layout->pmus[block].pmuID == pmu_id && layout->pmus[block].units == units)
+        {
+            return counters.data() + layout->pmus[block].offset;
+        }
+        return nullptr;
+    }
+    void setFreeRunningCounter(const FreeRunningCounterID counter, const uint64 value)
+    {
+        freeRunningCounter[counter] = value;
+        freeRunningCounterMask |= 1U << counter;
+    }
 };
 
 /*! \brief Returns QPI LL clock ticks
@@ -4042,6 +4407,13 @@ public:
         return *this;
     }
 
+    // cppcheck-suppress duplInheritedMember
+    void reset()
+    {
+        BasicCounterState::reset();
+        UncoreCounterState::reset();
+    }
+
     SocketCounterState() = default;
     SocketCounterState( const SocketCounterState& ) = default;
     SocketCounterState( SocketCounterState&& ) = default;
@@ -4118,6 +4490,41 @@ public:
     SystemCounterState( SystemCounterState&& ) = default;
     SystemCounterState & operator = ( SystemCounterState&& ) = default;
 
+    // cppcheck-suppress duplInheritedMember
+    void reset()
+    {
+        SocketCounterState::reset();
+        PCM * m = PCM::getInstance();
+        const auto zeroQPI = [m](std::vector<std::vector<uint64> > & v)
+        {
+            v.resize(m->getNumSockets());
+            for (auto & links : v)
+            {
+                links.assign((uint32)m->getQPILinksPerSocket(), 0);
+            }
+        };
+        zeroQPI(incomingQPIPackets);
+        zeroQPI(outgoingQPIFlits);
+        zeroQPI(TxL0Cycles);
+        uncoreTSC = 0;
+        systemEnergyStatus = 0;
+        // the raw register value arrays keep their keys and capacity, prepareRawRegisterValues refills them
+        const auto zeroValues = [](auto & valuesMap)
+        {
+            for (auto & values : valuesMap)
+            {
+                std::fill(values.second.begin(), values.second.end(), 0ULL);
+            }
+        };
+        zeroValues(TPMIValues);
+        zeroValues(PCICFGValues);
+        zeroValues(MMIOValues);
+        zeroValues(PMTValues);
+        accel_counters.assign(m->getNumberofAccelCounters(), SimpleCounterState());
+        CXLWriteMem.assign(m->getNumSockets(), 0);
+        CXLWriteCache.assign(m->getNumSockets(), 0);
+    }
+
     // cppcheck-suppress duplInheritedMember
     SystemCounterState & operator += ( const SocketCounterState& scs )
     {
@@ -4138,6 +4545,110 @@ public:
     virtual ~ SystemCounterState() {}
 };
 
+//! \brief Countdown barrier for a fan-out of core tasks
+//!
+//! The waiter spins briefly and then parks on the counter, the last countDown() wakes it. The latch may be destroyed
+//! as soon as wait() returns, so wait() also waits for the last countDown() to finish the wake-up: its final access
+//! to the latch is the store of the finished flag.
+class CountdownLatch
+{
+    WaitableAtomic remaining;
+    std::atomic<uint32> finished{1};
+public:
+    enum { spinIterations = 4096 };
+    void reset(const int32 n)
+    {
+        finished.store(n > 0 ? 0 : 1);
+        remaining.store((uint32)n);
+    }
+    void countDown()
+    {
+        if (remaining.fetch_sub(1) == 1)
+        {
+            remaining.wakeAll();
+            finished.store(1, std::memory_order_release);
+        }
+    }
+    void wait()
+    {
+        uint32 n;
+        while ((n = remaining.load()) != 0)
+        {
+            remaining.wait(n, spinIterations);
+        }
+        // the last countDown() is between its decrement and the end of wakeAll(), that is at most one syscall
+        while (finished.load(std::memory_order_acquire) == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+};
+
+//! \brief Preallocated work slot executed by a core task queue worker
+//!
+//! Unlike std::packaged_task the slot is not consumed by the execution and can be re-submitted every sample.
+struct CoreTask
+{
+    std::function<void()> work;
+    CountdownLatch * latch = nullptr; // counted down after work() completes
+    CoreTask * next = nullptr;        // intrusive link of the core task queue
+    bool ownedByQueue = false;        // one-shot task deleted by the worker after execution
+    CollectionStats::Sample * sample = nullptr; // collection sample of the producer, set when posted
+};
+
+/*! \brief Reusable counter states and per-core work slots for PCM::getAllCounterStates
+
+    Created with PCM::createCollectionContext(). The system, socket and core states are sized once
+    and the per-core and per-socket read tasks are bound once, so repeated sampling does not allocate.
+*/
+class PCM_API CollectionContext
+{
+    friend class PCM;
+
+    SystemCounterState ownSystemState;
+    std::vector<SocketCounterState> ownSocketStates;
+    std::vector<CoreCounterState> ownCoreStates;
+
+    // targets of the sample in flight: own states or the vectors passed to the vector-based getAllCounterStates
+    SystemCounterState * systemState = nullptr;
+    SocketCounterState * socketStates = nullptr;
+    CoreCounterState * coreStates = nullptr;
+    bool readAndAggregateSocketUncoreCounters = true;
+
+    std::vector<CoreTask> coreTasks;   // indexed by OS core id
+    std::vector<CoreTask> socketTasks; // indexed by socket id
+    CountdownLatch latch;
+public:
+    //! \brief Wall-clock durations (in nanoseconds) of the stages of the last getAllCounterStates call
+    struct StageTimes
+    {
+        uint64 dispatch = 0;              // resetting the states and posting the core and socket tasks
+        uint64 callerUncore = 0;          // uncore reads left on the calling thread, overlapped with the tasks
+        uint64 wait = 0;                  // waiting for the remaining core and socket tasks
+        uint64 aggregate = 0;             // aggregation of core and socket states into the system state
+        std::vector<uint64> socketUncore; // per socket: uncore task on the socket reference core
+    };
+    const StageTimes & getStageTimes() const { return stageTimes; }
+private:
+    StageTimes stageTimes;
+
+    CollectionContext(const CollectionContext &) = delete;
+    CollectionContext & operator = (const CollectionContext &) = delete;
+public:
+    CollectionContext(const uint32 numSockets, const uint32 numCores) :
+        ownSocketStates(numSockets),
+        ownCoreStates(numCores),
+        coreTasks(numCores),
+        socketTasks(numSockets)
+    {
+        stageTimes.socketUncore.resize(numSockets, 0);
+    }
+
+    const SystemCounterState & getSystemCounterState() const { return ownSystemState; }
+    const std::vector<SocketCounterState> & getSocketCounterStates() const { return ownSocketStates; }
+    const std::vector<CoreCounterState> & getCoreCounterStates() const { return ownCoreStates; }
+};
+
 /*! \brief Reads the counter state of the system
 
         Helper function. Uses PCM object to access counters.
@@ -4625,19 +5136,7 @@ uint64 getL3CacheHitsSnoop(const CounterStateType & before, const CounterStateTy
 {
     auto pcm = PCM::getInstance();
     if (!pcm->isL3CacheHitsSnoopAvailable()) return 0;
-    const auto cpu_family_model = pcm->getCPUFamilyModel();
-    if (cpu_family_model == PCM::SNOWRIDGE
-        || cpu_family_model == PCM::GRR
-        || cpu_family_model == PCM::ELKHART_LAKE
-        || cpu_family_model == PCM::JASPER_LAKE
-        || cpu_family_model == PCM::SRF
-        || cpu_family_model == PCM::ADL
-        || cpu_family_model == PCM::RPL
-        || cpu_family_model == PCM::MTL
-        || cpu_family_model == PCM::LNL
-        || cpu_family_model == PCM::ARL
-        || cpu_family_model == PCM::PTL
-        )
+    if (pcm->useArchLLCRefForL3CacheHitsSnoop())
     {
         const int64 misses = getL3CacheMisses(before, after);
         const int64 refs = after.Event[BasicCounterState::ArchLLCRefPos] - before.Event[BasicCounterState::ArchLLCRefPos];
@@ -5475,27 +5974,22 @@ inline std::vector<uint64> getPMTEvent(const PCM::RawEventEncoding& eventEnc, co
 template <class CounterStateType>
 uint64 getMSREvent(const uint64& index, const PCM::MSRType& type, const CounterStateType& before, const CounterStateType& after)
 {
+    const int32 slot = PCM::getInstance()->getMSRValueSlot(index);
+    uint64 beforeValue = 0, afterValue = 0;
     switch (type)
     {
     case PCM::MSRType::Freerun:
+        if (before.MSRValues.get(slot, beforeValue) && after.MSRValues.get(slot, afterValue))
         {
-            const auto beforeIt = before.MSRValues.find(index);
-            const auto afterIt = after.MSRValues.find(index);
-            if (beforeIt != before.MSRValues.end() && afterIt != after.MSRValues.end())
-            {
-                return afterIt->second - beforeIt->second;
-            }
-            break;
+            return afterValue - beforeValue;
         }
+        break;
     case PCM::MSRType::Static:
+        if (after.MSRValues.get(slot, afterValue))
         {
-            const auto result = after.MSRValues.find(index);
-            if (result != after.MSRValues.end())
-            {
-                return result->second;
-            }
-            break;
+            return afterValue;
         }
+        break;
     }
     return 0ULL;
 }
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+//
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include "discovery_cache.h"
+#include "debug.h"
+#include "pci.h"
+#include "utils.h"
+#include "simulated_hw.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#endif
+
+namespace pcm {
+
+static const char * discoveryCacheHeader = "PCM discovery cache v2";
+
+#ifdef __linux__
+static uint64 fnv1a(const void * data, const size_t size, uint64 hash = 14695981039346656037ULL)
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string trimmed(std::string s)
+{
+    while (!s.empty() && (s.back() == '\n' || s.back() == ' ')) s.pop_back();
+    return s;
+}
+
+static std::string getPlatformKey()
+{
+    std::ostringstream key;
+    // a reboot can change firmware-assigned bus numbers and PMU discovery tables without changing anything else of the key
+    key << "boot=" << trimmed(readSysFS("/proc/sys/kernel/random/boot_id", true)) << " ";
+    PCM_CPUID_INFO cpuinfo;
+    pcm_cpuid(1, cpuinfo);
+    key << "cpuid=" << std::hex << cpuinfo.array[0] << std::dec;
+    key << " microcode=" << trimmed(readSysFS("/sys/devices/system/cpu/cpu0/microcode/version", true));
+    struct utsname sys_info;
+    if (uname(&sys_info) == 0)
+    {
+        std::string kernel = std::string(sys_info.release) + " " + sys_info.version;
+        std::replace(kernel.begin(), kernel.end(), ' ', '_');
+        key << " kernel=" << kernel;
+    }
+    key << " cpus=" << trimmed(readSysFS("/sys/devices/system/cpu/online", true));
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+    {
+        key << " affinity=" << std::hex << fnv1a(&affinity, sizeof(affinity)) << std::dec;
+    }
+    const auto pciFunctions = getPresentPCIFunctions();
+    key << " pci=" << pciFunctions->size() << ":" << std::hex
+        << fnv1a(pciFunctions->data(), pciFunctions->size() * sizeof(uint32)) << std::dec;
+    return key.str();
+}
+#endif
+
+DiscoveryCache & DiscoveryCache::getInstance()
+{
+    static DiscoveryCache instance;
+    return instance;
+}
+
+DiscoveryCache::DiscoveryCache()
+{
+#ifdef __linux__
+    if (safe_getenv("PCM_NO_DISCOVERY_CACHE") == std::string("1") || SimulatedHardware::isEnabled())
+    {
+        return; // the results of a simulated machine must not be reused on the host and vice versa
+    }
+    path = safe_getenv("PCM_DISCOVERY_CACHE");
+    if (path.empty())
+    {
+        path = "/var/cache/pcm/discovery.cache";
+    }
+    key = getPlatformKey();
+    enabled = true;
+    DBG(1, "Discovery cache ", path, " key: ", key);
+    if (safe_getenv("PCM_REDISCOVER") == std::string("1"))
+    {
+        DBG(1, "PCM_REDISCOVER=1: ignoring cached discovery results");
+        return;
+    }
+    load();
+#endif
+}
+
+void DiscoveryCache::load()
+{
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    // the results are trusted only from a file that nobody else could have written
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        std::cerr << "PCM Warning: ignoring discovery cache " << path << " (not a regular file owned and only writable by the current user)\n";
+        ::close(fd);
+        return;
+    }
+    std::string content;
+    char buffer[4096];
+    ssize_t bytes = 0;
+    while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        content.append(buffer, bytes);
+    }
+    ::close(fd);
+
+    if (!parse(content, key, sections))
+    {
+        DBG(1, "Discovery cache ", path, " is stale or has unknown format");
+        return;
+    }
+    DBG(1, "Loaded ", sections.size(), " sections from discovery cache ", path);
+#endif
+}
+
+void DiscoveryCache::save() const
+{
+#ifdef __linux__
+    const std::string content = format(key, sections);
+
+    const auto slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+    {
+        ::mkdir(path.substr(0, slash).c_str(), 0755); // the last path component only
+    }
+    // write a private temporary file and rename it: concurrent readers see the old or the new file
+    const std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd < 0)
+    {
+        DBG(1, "Can not write discovery cache ", tmpPath, ": ", strerror(errno));
+        return;
+    }
+    const bool written = ::write(fd, content.data(), content.size()) == (ssize_t)content.size();
+    ::close(fd);
+    if (!written || ::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        DBG(1, "Can not write discovery cache ", path, ": ", strerror(errno));
+        ::unlink(tmpPath.c_str());
+    }
+#endif
+}
+
+std::string DiscoveryCache::format(const std::string & key, const Sections & sections)
+{
+    std::ostringstream output;
+    output << discoveryCacheHeader << "\n" << "key " << key << "\n";
+    for (const auto & section : sections)
+    {
+        output << "[" << section.first << "]\n";
+        for (const auto & line : section.second)
+        {
+            output << line << "\n";
+        }
+    }
+    return output.str();
+}
+
+bool DiscoveryCache::parse(const std::string & content, const std::string & key, Sections & sections)
+{
+    sections.clear();
+    std::istringstream input(content);
+    std::string line;
+    if (!std::getline(input, line) || line != discoveryCacheHeader
+        || !std::getline(input, line) || line != "key " + key)
+    {
+        return false;
+    }
+    Lines * current = nullptr;
+    while (std::getline(input, line))
+    {
+        if (!line.empty() && line.front() == '[' && line.back() == ']')
+        {
+            current = &sections[line.substr(1, line.size() - 2)];
+        }
+        else if (current)
+        {
+            current->push_back(line);
+        }
+    }
+    return true;
+}
+
+bool DiscoveryCache::get(const std::string & section, Lines & lines) const
+{
+    Mutex::Scope _(mutex);
+    const auto s = sections.find(section);
+    if (!enabled || s == sections.end())
+    {
+        return false;
+    }
+    lines = s->second;
+    return true;
+}
+
+void DiscoveryCache::set(const std::string & section, const Lines & lines)
+{
+    Mutex::Scope _(mutex);
+    if (!enabled)
+    {
+        return;
+    }
+    sections[section] = lines;
+    save();
+}
+
+} // namespace pcm
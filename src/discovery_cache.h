@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+//
+
+#pragma once
+
+/*!     \file discovery_cache.h
+        \brief Persistent on-disk cache of system topology and uncore PMU discovery results
+
+*/
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "mutex.h"
+#include "types.h"
+
+namespace pcm {
+
+/*! \brief Results of expensive platform discovery steps kept across runs of the pcm tools
+
+    The cache file holds named sections of text lines and is valid only for the exact platform
+    state it was written on: boot (kernel boot_id), CPUID signature (family/model/stepping),
+    microcode, kernel, online CPUs, process CPU affinity and the list of PCI functions. Any difference discards the whole
+    file and the discovery runs again.
+
+    Environment variables:
+        PCM_DISCOVERY_CACHE=<file>  cache location (default /var/cache/pcm/discovery.cache)
+        PCM_REDISCOVER=1            ignore the cached results and store freshly discovered ones
+        PCM_NO_DISCOVERY_CACHE=1    neither read nor write the cache
+
+    The cache is currently implemented for Linux only.
+*/
+class DiscoveryCache
+{
+public:
+    typedef std::vector<std::string> Lines;
+    typedef std::map<std::string, Lines> Sections;
+
+    static DiscoveryCache & getInstance();
+
+    //! \brief Returns true and the lines of the section if the section is cached for this platform
+    bool get(const std::string & section, Lines & lines) const;
+
+    //! \brief Stores the section and rewrites the cache file
+    void set(const std::string & section, const Lines & lines);
+
+    //! \brief Returns the platform key the cache is validated with
+    const std::string & getKey() const { return key; }
+
+    //! \brief Returns the content of a cache file with the sections for the platform key
+    static std::string format(const std::string & key, const Sections & sections);
+
+    //! \brief Parses the content of a cache file, returns false if its format is unknown or it was written for another platform key
+    static bool parse(const std::string & content, const std::string & key, Sections & sections);
+
+private:
+    DiscoveryCache();
+    DiscoveryCache(const DiscoveryCache &) = delete;
+    DiscoveryCache & operator = (const DiscoveryCache &) = delete;
+
+    void load();
+    void save() const;
+
+    bool enabled = false;
+    std::string path;
+    std::string key;
+    Sections sections;
+    mutable Mutex mutex;
+};
+
+} // namespace pcm
@@ -24,6 +24,7 @@
 #endif
 
 #include "utils.h"
+#include "simulated_hw.h"
 #include <exception>
 #include <assert.h>
 
@@ -238,12 +239,17 @@ MMIORange::~MMIORange()
 
 MMIORange::MMIORange(const uint64 baseAddr_, const uint64 size_, const bool readonly_, const bool silent_, const int core_) :
     fd(-1),
+    baseAddr(baseAddr_),
     mmapAddr(NULL),
     size(size_),
     readonly(readonly_),
     silent(silent_),
     core(core_)
 {
+    if (SimulatedHardware::isEnabled())
+    {
+        return;
+    }
     // SDL330: Use O_NOFOLLOW to reject symlinks
     const int oflag = (readonly ? O_RDONLY : O_RDWR) | O_NOFOLLOW;
     int handle = ::open("/dev/mem", oflag);
@@ -284,6 +290,10 @@ MMIORange::MMIORange(const uint64 baseAddr_, const uint64 size_, const bool read
 uint32 MMIORange::read32(uint64 offset)
 {
     warnAlignment<4>("MMIORange::read32", silent, offset);
+    if (mmapAddr == NULL)
+    {
+        return (uint32)SimulatedHardware::readMMIO(baseAddr + offset, sizeof(uint32));
+    }
     CoreAffinityScope _(core);
     return *((uint32 *)(mmapAddr + offset));
 }
@@ -291,6 +301,10 @@ uint32 MMIORange::read32(uint64 offset)
 uint64 MMIORange::read64(uint64 offset)
 {
     warnAlignment<8>("MMIORange::read64", silent, offset);
+    if (mmapAddr == NULL)
+    {
+        return SimulatedHardware::readMMIO(baseAddr + offset, sizeof(uint64));
+    }
     CoreAffinityScope _(core);
     return *((uint64 *)(mmapAddr + offset));
 }
@@ -304,6 +318,11 @@ void MMIORange::write32(uint64 offset, uint32 val)
         std::cerr << "PCM Error: attempting to write to a read-only MMIORange\n";
         return;
     }
+    if (mmapAddr == NULL)
+    {
+        SimulatedHardware::writeMMIO(baseAddr + offset, sizeof(uint32), val);
+        return;
+    }
     *((uint32 *)(mmapAddr + offset)) = val;
 }
 void MMIORange::write64(uint64 offset, uint64 val)
@@ -315,6 +334,11 @@ void MMIORange::write64(uint64 offset, uint64 val)
         std::cerr << "PCM Error: attempting to write to a read-only MMIORange\n";
         return;
     }
+    if (mmapAddr == NULL)
+    {
+        SimulatedHardware::writeMMIO(baseAddr + offset, sizeof(uint64), val);
+        return;
+    }
     *((uint64 *)(mmapAddr + offset)) = val;
 }
 
@@ -166,6 +166,7 @@ class MMIORange
 {
 #ifndef __APPLE__
     int32 fd;
+    const uint64 baseAddr; // physical address, used by the simulated backend
 #endif
     char * mmapAddr;
     const uint64 size;
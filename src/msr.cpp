@@ -14,6 +14,8 @@
 #include "types.h"
 #include "msr.h"
 #include "utils.h"
+#include "collection_stats.h"
+#include "simulated_hw.h"
 #include <assert.h>
 
 #ifdef _MSC_VER
@@ -31,6 +33,13 @@
 #endif
 
 #include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#endif
 
 namespace pcm {
 
@@ -220,7 +229,7 @@ bool noMSRMode()
 
 MsrHandle::MsrHandle(uint32 cpu) : fd(-1), cpu_id(cpu)
 {
-    if (noMSRMode()) return;
+    if (noMSRMode() || SimulatedHardware::isEnabled()) return;
     constexpr auto allowWritesPath = "/sys/module/msr/parameters/allow_writes";
     static bool writesEnabled = false;
     if (writesEnabled == false)
@@ -268,25 +277,140 @@ int32 MsrHandle::write(uint64 msr_number, uint64 value)
     std::lock_guard<std::mutex> g(m);
     std::cout << "DEBUG: writing MSR 0x" << std::hex << msr_number << " value 0x" << value << " on cpu " << std::dec << cpu_id << std::endl;
 #endif
+    if (SimulatedHardware::isEnabled())
+    {
+        SimulatedHardware::writeMSR(cpu_id, msr_number, value);
+        return sizeof(uint64);
+    }
     if (fd < 0) return 0;
     DBG(4, "core_id = ", cpu_id, " writing MSR 0x", std::hex, msr_number, " value 0x", value, std::dec);
+    CollectionStats::countSyscall();
     return ::pwrite(fd, (const void *)&value, sizeof(uint64), msr_number);
 }
 
 int32 MsrHandle::read(uint64 msr_number, uint64 * value)
 {
+    if (SimulatedHardware::isEnabled())
+    {
+        *value = SimulatedHardware::readMSR(cpu_id, msr_number);
+        return sizeof(uint64);
+    }
     if (fd < 0) return 0;
     assert(value);
+    CollectionStats::countSyscall();
     const auto ret = ::pread(fd, (void *)value, sizeof(uint64), msr_number);
     DBG(4, "core_id = ", cpu_id, " reading MSR 0x", std::hex, msr_number, " value 0x", *value, std::dec);
     return ret;
 }
 
+// batch interface of the msr-safe driver (https://github.com/LLNL/msr-safe)
+struct MsrBatchOp
+{
+    __u16 cpu;      // CPU to execute rdmsr/wrmsr on
+    __u16 isrdmsr;  // 0 = wrmsr, non-zero = rdmsr
+    __s32 err;      // set if this operation failed
+    __u32 msr;      // MSR address
+    __u64 msrdata;  // input/result of the operation
+    __u64 wmask;    // write mask applied to wrmsr
+};
+
+struct MsrBatchArray
+{
+    __u32 numops;
+    MsrBatchOp * ops;
+};
+
+#define PCM_X86_IOC_MSR_BATCH _IOWR('c', 0xA2, MsrBatchArray)
+
+static std::atomic<bool> msrBatchUnsupported{false};
+
+static int getMsrBatchHandle()
+{
+    static const int handle = []() -> int
+    {
+        if (safe_getenv("PCM_NO_MSR_BATCH") == std::string("1"))
+        {
+            return -1;
+        }
+        const int h = ::open("/dev/cpu/msr_batch", O_RDWR | O_NOFOLLOW);
+        DBG(1, "msr-safe batch device /dev/cpu/msr_batch is ", (h < 0 ? "not available" : "available"));
+        return h;
+    }();
+    return handle;
+}
+
+int32 MsrHandle::read(const uint64 * msr_numbers, uint64 * values, const size_t n)
+{
+    if (fd < 0 && SimulatedHardware::isEnabled() == false) return 0;
+    int32 result = 0;
+    size_t done = 0;
+    const int batchHandle = (msrBatchUnsupported || SimulatedHardware::isEnabled()) ? -1 : getMsrBatchHandle();
+    if (batchHandle >= 0)
+    {
+        constexpr size_t maxOps = 64;
+        MsrBatchOp ops[maxOps];
+        while (done < n)
+        {
+            const size_t numOps = (std::min)(maxOps, n - done);
+            for (size_t i = 0; i < numOps; ++i)
+            {
+                ops[i] = MsrBatchOp{};
+                ops[i].cpu = (__u16)cpu_id;
+                ops[i].isrdmsr = 1;
+                ops[i].msr = (__u32)msr_numbers[done + i];
+            }
+            MsrBatchArray batch{ (__u32)numOps, ops };
+            CollectionStats::countSyscall();
+            const int ret = ::ioctl(batchHandle, PCM_X86_IOC_MSR_BATCH, &batch);
+            if (ret < 0 && (errno == ENOTTY || errno == EINVAL || errno == EFAULT))
+            {
+                DBG(1, "msr-safe batch ioctl is not usable (", strerror(errno), "), falling back to single MSR reads");
+                msrBatchUnsupported = true;
+                break;
+            }
+            if (ret < 0)
+            {
+                // the batch was rejected as a whole (e.g. EACCES from the allowlist validation), the ops were not
+                // executed and their values are not valid: read the MSRs of this chunk one by one
+                DBG(2, "msr-safe batch ioctl failed (", strerror(errno), "), reading ", numOps, " MSRs one by one");
+            }
+            for (size_t i = 0; i < numOps; ++i)
+            {
+                if (ret == 0 && ops[i].err == 0)
+                {
+                    values[done + i] = ops[i].msrdata;
+                    ++result;
+                }
+                else if (read(msr_numbers[done + i], values + done + i) == sizeof(uint64)) // e.g. not in the msr-safe allowlist
+                {
+                    ++result;
+                }
+            }
+            done += numOps;
+        }
+    }
+    for (; done < n; ++done)
+    {
+        if (read(msr_numbers[done], values + done) == sizeof(uint64)) ++result;
+    }
+    return result;
+}
+
 #endif
 
 
 #ifndef __linux__
 bool noMSRMode() { return false; }
+
+int32 MsrHandle::read(const uint64 * msr_numbers, uint64 * values, const size_t n)
+{
+    int32 result = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (read(msr_numbers[i], values + i) > 0) ++result;
+    }
+    return result;
+}
 #endif
 
 } // namespace pcm
@@ -22,6 +22,8 @@
 
 #include "mutex.h"
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 namespace pcm {
 
@@ -45,6 +47,8 @@ class MsrHandle
 public:
     MsrHandle(uint32 cpu);
     int32 read(uint64 msr_number, uint64 * value);
+    //! reads n MSRs, through one msr-safe batch ioctl where available; returns the number of successful reads
+    int32 read(const uint64 * msr_numbers, uint64 * values, const size_t n);
     int32 write(uint64 msr_number, uint64 value);
     int32 getCoreId() { return (int32)cpu_id; }
 #ifdef __APPLE__
@@ -80,6 +84,16 @@ public:
         return (int32)sizeof(uint64);
     }
 
+    int32 read(const uint64 * msr_numbers, uint64 * values, const size_t n)
+    {
+        if (pHandle)
+            return pHandle->read(msr_numbers, values, n);
+
+        std::fill(values, values + n, 0ULL);
+
+        return (int32)n;
+    }
+
     int32 write(uint64 msr_number, uint64 value)
     {
         if (pHandle)
@@ -140,6 +154,37 @@ public:
     { }
 };
 
+//! \brief A list of MSRs read together on one core
+//!
+//! Compiled once per counter configuration and executed as one batch per core and sample
+class MsrReadPlan
+{
+    std::vector<uint64> msrs;
+public:
+    //! adds an MSR (unless already present) and returns its position in the value array
+    size_t add(const uint64 msr_number)
+    {
+        const auto it = std::find(msrs.begin(), msrs.end(), msr_number);
+        if (it != msrs.end())
+        {
+            return size_t(it - msrs.begin());
+        }
+        msrs.push_back(msr_number);
+        return msrs.size() - 1;
+    }
+    size_t size() const { return msrs.size(); }
+    void clear() { msrs.clear(); }
+    const std::vector<uint64> & getMSRs() const { return msrs; }
+
+    //! reads MSRs [first, size()) into values[first, size())
+    template <class HandleType>
+    int32 execute(HandleType & msr, uint64 * values, const size_t first = 0) const
+    {
+        if (first >= msrs.size()) return 0;
+        return msr.read(msrs.data() + first, values + first, msrs.size() - first);
+    }
+};
+
 } // namespace pcm
 
 #endif
@@ -8,6 +8,24 @@
 #endif
 
 #include <stdlib.h>
+#include <cstdint>
+#include <atomic>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace pcm
 {
@@ -70,6 +88,69 @@ namespace pcm
             }
         };
     };
+
+    inline void cpuRelax()
+    {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    //! \brief 32-bit atomic word threads can block on until it changes (futex on Linux, condition variable elsewhere)
+    class WaitableAtomic {
+        WaitableAtomic(const WaitableAtomic&) = delete;
+        WaitableAtomic& operator = (const WaitableAtomic&) = delete;
+        std::atomic<uint32_t> value;
+        std::atomic<uint32_t> waiters{0}; // lets wake() skip the syscall if nobody is parked
+#ifndef __linux__
+        std::mutex m;
+        std::condition_variable condVar;
+#endif
+    public:
+        explicit WaitableAtomic(const uint32_t v = 0) : value(v) {}
+
+        uint32_t load() const { return value.load(); }
+        void store(const uint32_t v) { value.store(v); }
+        uint32_t fetch_add(const uint32_t v) { return value.fetch_add(v); }
+        uint32_t fetch_sub(const uint32_t v) { return value.fetch_sub(v); }
+
+        //! spins up to spinIterations and then parks while the value equals expected
+        void wait(const uint32_t expected, const int spinIterations = 0)
+        {
+            for (int i = 0; i < spinIterations; ++i)
+            {
+                if (value.load(std::memory_order_acquire) != expected) return;
+                cpuRelax();
+            }
+            waiters.fetch_add(1);
+#ifdef __linux__
+            while (value.load() == expected)
+            {
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+            }
+#else
+            {
+                std::unique_lock<std::mutex> lock(m);
+                condVar.wait(lock, [this, expected]() { return value.load() != expected; });
+            }
+#endif
+            waiters.fetch_sub(1);
+        }
+
+        //! wakes all parked waiters, call after changing the value
+        void wakeAll()
+        {
+            if (waiters.load() == 0) return;
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+            {
+                std::unique_lock<std::mutex> lock(m);
+            }
+            condVar.notify_all();
+#endif
+        }
+    };
 }
 
 #endif
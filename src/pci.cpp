@@ -18,8 +18,11 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <memory>
+#include <chrono>
 #include "pci.h"
 #include "cpucounters.h"
+#include "simulated_hw.h"
 
 #ifndef _MSC_VER
 #include <sys/mman.h>
@@ -27,6 +30,11 @@
 #include <strings.h>
 #endif
 
+#ifdef __linux__
+#include <dirent.h>
+#include <algorithm>
+#endif
+
 #ifdef _MSC_VER
 
 #include <windows.h>
@@ -857,6 +865,16 @@ PciHandle::PciHandle(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 functi
     function(function_),
     numaNode(-1)
 {
+    if (SimulatedHardware::isEnabled())
+    {
+        if (SimulatedHardware::isPCIFunctionPresent(groupnr_, bus_, device_, function_) == false)
+        {
+            throw std::runtime_error(std::string("PCM error: simulated PCI function does not exist ")
+                + std::to_string(groupnr_) + ":" + std::to_string(bus_) + ":" + std::to_string(device_) + ":" + std::to_string(function_));
+        }
+        numaNode = 0;
+        return;
+    }
     int handle = openHandle(groupnr_, bus_, device_, function_);
     if (handle < 0)
     {
@@ -879,6 +897,10 @@ int32 PciHandle::getNUMANode() const
 
 bool PciHandle::exists(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 function_)
 {
+    if (!isPCIFunctionPresent(groupnr_, bus_, device_, function_)) return false;
+
+    if (SimulatedHardware::isEnabled()) return true;
+
     int handle = openHandle(groupnr_, bus_, device_, function_);
 
     if (handle < 0) return false;
@@ -891,18 +913,36 @@ bool PciHandle::exists(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 func
 int32 PciHandle::read32(uint64 offset, uint32 * value)
 {
     warnAlignment<4>("PciHandle::read32", false, offset);
+    if (SimulatedHardware::isEnabled())
+    {
+        *value = (uint32)SimulatedHardware::readPCI(groupnr, bus, device, function, offset, sizeof(uint32));
+        return sizeof(uint32);
+    }
+    CollectionStats::countSyscall();
     return ::pread(fd, (void *)value, sizeof(uint32), offset);
 }
 
 int32 PciHandle::write32(uint64 offset, uint32 value)
 {
     warnAlignment<4>("PciHandle::write32", false, offset);
+    if (SimulatedHardware::isEnabled())
+    {
+        SimulatedHardware::writePCI(groupnr, bus, device, function, offset, sizeof(uint32), value);
+        return sizeof(uint32);
+    }
+    CollectionStats::countSyscall();
     return ::pwrite(fd, (const void *)&value, sizeof(uint32), offset);
 }
 
 int32 PciHandle::read64(uint64 offset, uint64 * value)
 {
     warnAlignment<4>("PciHandle::read64", false, offset);
+    if (SimulatedHardware::isEnabled())
+    {
+        *value = SimulatedHardware::readPCI(groupnr, bus, device, function, offset, sizeof(uint64));
+        return sizeof(uint64);
+    }
+    CollectionStats::countSyscall();
     size_t res = ::pread(fd, (void *)value, sizeof(uint64), offset);
     if(res != sizeof(uint64))
     {
@@ -957,6 +997,15 @@ void PciHandleMM::readMCFG()
     if (mcfgRecords.size() > 0)
         return; // already initialized
 
+    if (SimulatedHardware::isEnabled())
+    {
+        // the simulated PCI functions live in one segment
+        MCFGRecord record;
+        record.endBusNumber = 0xff;
+        mcfgRecords.push_back(record);
+        return;
+    }
+
     int mcfg_handle = PciHandle::openMcfgTable();
     if (mcfg_handle < 0) throw std::runtime_error("cannot open any of /[pcm]/sys/firmware/acpi/tables/MCFG* files!");
 
@@ -1120,4 +1169,327 @@ PciHandleMM::~PciHandleMM()
 
 #endif
 
+#ifdef __linux__
+static std::vector<uint32> readProcBusPCIFunctions()
+{
+    std::vector<uint32> result;
+    std::string root = "/proc/bus/pci";
+    DIR * rootDir = opendir(root.c_str());
+    if (rootDir == nullptr)
+    {
+        root = "/pcm" + root;
+        rootDir = opendir(root.c_str());
+    }
+    if (rootDir == nullptr)
+    {
+        return result;
+    }
+    struct dirent * busEntry{nullptr};
+    while ((busEntry = readdir(rootDir)) != nullptr)
+    {
+        // bus directories are "bb" (segment group 0) or "gggg:bb"
+        uint32 group = 0, bus = 0;
+        char tail = 0;
+        if (sscanf(busEntry->d_name, "%x:%x%c", &group, &bus, &tail) != 2)
+        {
+            group = 0;
+            if (sscanf(busEntry->d_name, "%x%c", &bus, &tail) != 1 || strlen(busEntry->d_name) != 2)
+            {
+                continue; // ".", ".." or the "devices" file
+            }
+        }
+        DIR * busDir = opendir((root + "/" + busEntry->d_name).c_str());
+        if (busDir == nullptr)
+        {
+            continue;
+        }
+        struct dirent * functionEntry{nullptr};
+        while ((functionEntry = readdir(busDir)) != nullptr)
+        {
+            uint32 device = 0, function = 0;
+            if (sscanf(functionEntry->d_name, "%x.%x%c", &device, &function, &tail) == 2 && device < 32 && function < 8)
+            {
+                result.push_back(getPCIFunctionKey(group, bus, device, function));
+            }
+        }
+        closedir(busDir);
+    }
+    closedir(rootDir);
+    std::sort(result.begin(), result.end());
+    DBG(2, "Found ", result.size(), " PCI functions in ", root);
+    return result;
+}
+#endif
+
+#ifdef __linux__
+namespace {
+struct PresentPCIFunctions
+{
+    std::mutex mutex;
+    std::shared_ptr<const std::vector<uint32>> functions;
+    std::chrono::steady_clock::time_point readAt;
+};
+
+PresentPCIFunctions & presentPCIFunctions()
+{
+    static PresentPCIFunctions instance;
+    return instance;
+}
+
+// minimal age of the list before a lookup miss re-reads /proc/bus/pci (picks up hot-added functions
+// without re-reading the directory tree for every probe of a bus scan)
+constexpr auto presentPCIFunctionsMaxAge = std::chrono::seconds(1);
+
+std::shared_ptr<const std::vector<uint32>> readPresentPCIFunctions(const bool onlyIfOlderThanMaxAge)
+{
+    auto & present = presentPCIFunctions();
+    std::lock_guard<std::mutex> _(present.mutex);
+    const auto now = std::chrono::steady_clock::now();
+    if (present.functions.get() == nullptr || (onlyIfOlderThanMaxAge && now - present.readAt >= presentPCIFunctionsMaxAge))
+    {
+        present.functions = std::make_shared<const std::vector<uint32>>(readProcBusPCIFunctions());
+        present.readAt = now;
+    }
+    return present.functions;
+}
+} // namespace
+#endif
+
+std::shared_ptr<const std::vector<uint32>> getPresentPCIFunctions()
+{
+#ifdef __linux__
+    return readPresentPCIFunctions(false);
+#else
+    static const auto functions = std::make_shared<const std::vector<uint32>>();
+    return functions;
+#endif
+}
+
+void invalidatePresentPCIFunctions()
+{
+#ifdef __linux__
+    auto & present = presentPCIFunctions();
+    std::lock_guard<std::mutex> _(present.mutex);
+    present.functions.reset();
+#endif
+}
+
+bool isPCIFunctionPresent(const uint32 group, const uint32 bus, const uint32 device, const uint32 function)
+{
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+    if (SimulatedHardware::isEnabled())
+    {
+        return SimulatedHardware::isPCIFunctionPresent(group, bus, device, function);
+    }
+    // PciHandle can only open functions listed in /proc/bus/pci
+    const auto key = getPCIFunctionKey(group, bus, device, function);
+    auto isListed = [key](const std::vector<uint32> & functions)
+    {
+        return functions.empty() || std::binary_search(functions.begin(), functions.end(), key);
+    };
+    if (isListed(*getPresentPCIFunctions()))
+    {
+        return true;
+    }
+    // the function may have been hot-added after the list was read
+    return isListed(*readPresentPCIFunctions(true));
+#else
+    (void)group; (void)bus; (void)device; (void)function;
+    return true;
+#endif
+}
+
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+//! \brief Returns the mapped 4 KB configuration space of a function or nullptr if the ECAM window can't be mapped
+//!
+//! The 1 MB window of a bus is mapped on first use and kept until the process exits.
+static const volatile char * getECAMFunctionWindow(const uint32 group, const uint32 bus, const uint32 device, const uint32 function)
+{
+    static Mutex mutex;
+    static bool disabled = false;
+    static int fd = -1;
+    static std::unordered_map<uint32, const volatile char *> busWindows; // key: group << 8 | bus, nullptr if not mappable
+    Mutex::Scope _(mutex);
+    if (disabled)
+    {
+        return nullptr;
+    }
+    if (fd < 0)
+    {
+        if (safe_getenv("PCM_NO_PCI_ECAM_MMAP") == std::string("1"))
+        {
+            disabled = true;
+            return nullptr;
+        }
+        fd = ::open("/dev/mem", O_RDONLY | O_NOFOLLOW);
+        if (fd < 0)
+        {
+            DBG(1, "PCI ECAM mapping is not available (can't open /dev/mem: ", strerror(errno), "), using pread");
+            disabled = true;
+            return nullptr;
+        }
+    }
+    const uint32 key = (group << 8) | bus;
+    auto it = busWindows.find(key);
+    if (it == busWindows.end())
+    {
+        const volatile char * window = nullptr;
+        try
+        {
+            for (const auto & record : PciHandleMM::getMCFGRecords())
+            {
+                if (record.PCISegmentGroupNumber == group && record.startBusNumber <= bus && bus <= record.endBusNumber)
+                {
+                    const uint64 busWindowSize = 1024ULL * 1024ULL;
+                    void * addr = mmap(nullptr, busWindowSize, PROT_READ, MAP_SHARED, fd, record.baseAddress + bus * busWindowSize);
+                    if (addr == MAP_FAILED)
+                    {
+                        DBG(1, "PCI ECAM mapping of bus ", std::hex, group, ":", bus, std::dec, " failed (", strerror(errno), "), using pread");
+                    }
+                    else
+                    {
+                        window = (const volatile char *)addr;
+                    }
+                    break;
+                }
+            }
+        }
+        catch (const std::exception & e)
+        {
+            DBG(1, "PCI ECAM mapping is not available (", e.what(), "), using pread");
+            disabled = true;
+            return nullptr;
+        }
+        it = busWindows.insert(std::make_pair(key, window)).first;
+    }
+    if (it->second == nullptr)
+    {
+        return nullptr;
+    }
+    return it->second + device * 32ULL * 1024ULL + function * 4ULL * 1024ULL;
+}
+#endif
+
+void PciConfigBatch::add(const std::shared_ptr<PciHandleType> & handle, const uint64 offset, const uint32 size, uint64 * dest)
+{
+    assert(size == sizeof(uint32) || size == sizeof(uint64));
+    reads.push_back(Read{ handle, offset, size, dest });
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+    compiled = false;
+#endif
+}
+
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+void PciConfigBatch::compile()
+{
+    order.resize(reads.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](const size_t a, const size_t b)
+        {
+            const auto fdA = reads[a].handle->fd, fdB = reads[b].handle->fd;
+            return (fdA != fdB) ? (fdA < fdB) : (reads[a].offset < reads[b].offset);
+        });
+    ranges.clear();
+    size_t maxLength = 0;
+    const volatile char * ecam = nullptr;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const Read & read = reads[order[i]];
+        const PciHandle & h = *read.handle;
+        if (ranges.empty() || ranges.back().fd != h.fd || read.offset > ranges.back().offset + ranges.back().length)
+        {
+            if (ranges.empty() || ranges.back().fd != h.fd) // a new function: find its ECAM window
+            {
+                ecam = getECAMFunctionWindow(h.groupnr, h.bus, h.device, h.function);
+                uint32 id = 0;
+                if (ecam && (::pread(h.fd, &id, sizeof(id), 0) != sizeof(id) || id != *(const volatile uint32 *)ecam))
+                {
+                    DBG(1, "PCI ECAM window of ", std::hex, h.groupnr, ":", h.bus, ":", h.device, ".", h.function, std::dec, " does not match its configuration space, using pread");
+                    ecam = nullptr;
+                }
+            }
+            ranges.push_back(Range{ ecam, h.fd, read.offset, 0, i, i });
+        }
+        Range & range = ranges.back();
+        range.length = (uint32)(std::max)(uint64(range.length), read.offset + read.size - range.offset);
+        range.endRead = i + 1;
+        maxLength = (std::max)(maxLength, size_t(range.length));
+        if (range.ecam && read.offset + read.size > 4096)
+        {
+            range.ecam = nullptr;
+        }
+    }
+    buffer.resize(maxLength);
+    compiled = true;
+    DBG(2, "PciConfigBatch: ", reads.size(), " registers in ", ranges.size(), " ranges");
+}
+#endif
+
+void PciConfigBatch::execute()
+{
+    auto readOne = [](const Read & read)
+    {
+        uint64 value = 0;
+        if (read.size == sizeof(uint64))
+        {
+            read.handle->read64(read.offset, &value);
+        }
+        else
+        {
+            uint32 value32 = 0;
+            read.handle->read32(read.offset, &value32);
+            value = value32;
+        }
+        *read.dest = value;
+    };
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+    if (SimulatedHardware::isEnabled() == false) // simulated handles have no files to coalesce the reads of
+    {
+        if (!compiled)
+        {
+            compile();
+        }
+        for (const auto & range : ranges)
+        {
+            if (range.ecam)
+            {
+                for (size_t i = range.firstRead; i < range.endRead; ++i)
+                {
+                    const Read & read = reads[order[i]];
+                    // configuration space is accessed with aligned 32-bit loads (see PciHandleMM)
+                    const volatile uint32 * reg = (const volatile uint32 *)(range.ecam + read.offset);
+                    *read.dest = (read.size == sizeof(uint64)) ? ((uint64(reg[1]) << 32) | reg[0]) : uint64(reg[0]);
+                }
+                continue;
+            }
+            CollectionStats::countSyscall();
+            if (::pread(range.fd, buffer.data(), range.length, range.offset) == ssize_t(range.length))
+            {
+                for (size_t i = range.firstRead; i < range.endRead; ++i)
+                {
+                    const Read & read = reads[order[i]];
+                    uint64 value = 0;
+                    memcpy(&value, buffer.data() + (read.offset - range.offset), read.size);
+                    *read.dest = value;
+                }
+                continue;
+            }
+            // read the registers of the failed range one by one (with the error reporting of PciHandle)
+            for (size_t i = range.firstRead; i < range.endRead; ++i)
+            {
+                readOne(reads[order[i]]);
+            }
+        }
+        return;
+    }
+#endif
+    for (const auto & read : reads)
+    {
+        readOne(read);
+    }
+}
+
 } // namespace pcm
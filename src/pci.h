@@ -28,6 +28,7 @@
 #endif
 
 #include <vector>
+#include <memory>
 
 namespace pcm {
 
@@ -51,6 +52,7 @@ class PciHandle
     int32 numaNode;
 
     friend class PciHandleMM;
+    friend class PciConfigBatch;
 
     PciHandle();                                // forbidden
     PciHandle(const PciHandle &);               // forbidden
@@ -140,6 +142,75 @@ public:
 int32 getNUMANodeLinux(uint32 groupnr, uint32 bus, uint32 device, uint32 function);
 #endif
 
+inline uint32 getPCIFunctionKey(const uint32 group, const uint32 bus, const uint32 device, const uint32 function)
+{
+    return (group << 16) | (bus << 8) | (device << 3) | function;
+}
+
+/*! \brief Returns the sorted keys (see getPCIFunctionKey) of the PCI functions present in the system
+
+    On Linux the list is read from /proc/bus/pci (the files PciHandle opens) on first use and kept
+    until invalidatePresentPCIFunctions() is called or isPCIFunctionPresent() re-reads it.
+    Empty if the list is not available on this platform.
+*/
+std::shared_ptr<const std::vector<uint32>> getPresentPCIFunctions();
+
+//! \brief Drops the list of present PCI functions, the next lookup reads it again (e.g. after PCI hotplug)
+void invalidatePresentPCIFunctions();
+
+//! \brief Returns false only if the function is known not to exist (probing it can be skipped)
+//!
+//! A function missing in a list older than one second triggers a re-read of the list, so
+//! hot-added functions are found.
+bool isPCIFunctionPresent(const uint32 group, const uint32 bus, const uint32 device, const uint32 function);
+
+/*! \brief List of PCI configuration space register reads executed in one pass
+
+    The reads are registered once (e.g. all counters of the uncore PMUs of a socket) and executed
+    many times. On Linux the functions are read through a memory mapping of their ECAM window
+    (PCI Express enhanced configuration space, located with the ACPI MCFG table), the bus window
+    is mapped once per process and shared by all batches. If /dev/mem cannot be mapped (no
+    permission, kernel lockdown) the reads are coalesced instead: adjacent registers of a function
+    are read with one pread. Set PCM_NO_PCI_ECAM_MMAP=1 to disable the mapping.
+    Other platforms execute the reads one by one through the handle.
+*/
+class PciConfigBatch
+{
+public:
+    //! \brief Registers the read of a 32-bit (size 4) or 64-bit (size 8) register, execute() stores the value into *dest
+    void add(const std::shared_ptr<PciHandleType> & handle, const uint64 offset, const uint32 size, uint64 * dest);
+
+    //! \brief Reads all registered registers
+    void execute();
+
+    size_t size() const { return reads.size(); }
+
+private:
+    struct Read
+    {
+        std::shared_ptr<PciHandleType> handle;
+        uint64 offset;
+        uint32 size;
+        uint64 * dest;
+    };
+    std::vector<Read> reads;
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+    struct Range // registers of one function read at once
+    {
+        const volatile char * ecam; // mapped configuration space of the function or nullptr to use pread
+        int32 fd;
+        uint64 offset;
+        uint32 length;
+        size_t firstRead, endRead;  // reads served by the range in the sorted order
+    };
+    std::vector<Range> ranges;
+    std::vector<size_t> order;      // read indices sorted by function and offset
+    std::vector<char> buffer;
+    bool compiled = false;
+    void compile();
+#endif
+};
+
 template <class F>
 inline void forAllDevices(F f, const int requestedVendorID = -1, const int requestedDevice = -1, const int requestedFunction = -1)
 {
@@ -148,6 +219,10 @@ inline void forAllDevices(F f, const int requestedVendorID = -1, const int reque
 
     auto probe = [&f, &requestedVendorID](const uint32 group, const uint32 bus, const uint32 device, const uint32 function)
     {
+        if (!isPCIFunctionPresent(group, bus, device, function))
+        {
+            return; // skip the failing open() of a non-existent function
+        }
         DBG(3, "Probing " , std::hex , group , ":" , bus , ":" , device , ":" , function , " " , std::dec);
         uint32 value = 0;
         try
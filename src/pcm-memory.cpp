@@ -1213,8 +1213,7 @@ void readState(std::vector<ServerUncoreCounterState>& state)
 {
     auto* pcm = PCM::getInstance();
     assert(pcm);
-    for (uint32 i = 0; i < pcm->getNumSockets(); ++i)
-        state[i] = pcm->getServerUncoreCounterState(i);
+    pcm->getServerUncoreCounterStates(state);
 };
 
 class CHAEventCollector
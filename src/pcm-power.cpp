@@ -723,10 +723,7 @@ int mainThrows(int argc, char * argv[])
     std::vector<std::vector<uint64>> PERF_LIMIT_REASON_TPMI_dies_data;
     std::vector<std::vector<std::vector<uint64>>> PERF_LIMIT_REASON_TPMI_modules_data;
 
-    uint32 i = 0;
-
-    for (i = 0; i < numSockets; ++i)
-        BeforeState[i] = m->getServerUncoreCounterState(i);
+    m->getServerUncoreCounterStates(BeforeState);
 
     m->getAllCounterStates(dummySystemState, beforeSocketState, dummyCoreStates, false);
 
@@ -1056,8 +1053,7 @@ int mainThrows(int argc, char * argv[])
         const auto delay_ms = calibratedSleep(delay, sysCmd, mainLoop, m);
 
         AfterTime = m->getTickCount();
-        for (i = 0; i < numSockets; ++i)
-            AfterState[i] = m->getServerUncoreCounterState(i);
+        m->getServerUncoreCounterStates(AfterState);
 
         m->getAllCounterStates(dummySystemState, afterSocketState, dummyCoreStates, false);
 
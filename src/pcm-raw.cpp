@@ -2475,6 +2475,8 @@ void printAll(const PCM::RawPMUConfigs& curPMUConfigs,
     displayHeader = false;
 }
 
+#ifndef UNIT_TEST
+
 PCM_MAIN_NOTHROW;
 
 int mainThrows(int argc, char * argv[])
@@ -2823,10 +2825,7 @@ int mainThrows(int argc, char * argv[])
         programPMUs(group);
         m->globalFreezeUncoreCounters();
         m->getAllCounterStates(SysBeforeState, BeforeSocketState, BeforeState);
-        for (uint32 s = 0; s < m->getNumSockets(); ++s)
-        {
-            BeforeUncoreState[s] = m->getServerUncoreCounterState(s);
-        }
+        m->getServerUncoreCounterStates(BeforeUncoreState);
         m->globalUnfreezeUncoreCounters();
     };
 
@@ -2851,10 +2850,7 @@ int mainThrows(int argc, char * argv[])
 
                 m->globalFreezeUncoreCounters();
                 m->getAllCounterStates(SysAfterState, AfterSocketState, AfterState);
-                for (uint32 s = 0; s < m->getNumSockets(); ++s)
-                {
-                    AfterUncoreState[s] = m->getServerUncoreCounterState(s);
-                }
+                m->getServerUncoreCounterStates(AfterUncoreState);
                 m->globalUnfreezeUncoreCounters();
 
                 printAll(group, m, SysBeforeState, SysAfterState, BeforeState, AfterState, BeforeUncoreState, AfterUncoreState, BeforeSocketState, AfterSocketState, PMUConfigs, groupNr == nGroups);
@@ -2874,3 +2870,5 @@ int mainThrows(int argc, char * argv[])
     });
     exit(EXIT_SUCCESS);
 }
+
+#endif // UNIT_TEST
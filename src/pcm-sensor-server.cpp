@@ -41,6 +41,13 @@ inline int close(SOCKET s) { return closesocket(s); }
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sched.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#endif
 typedef int socket_t;
 #define INVALID_SOCKET (-1)
 // PCM errno values mapped to POSIX errors
@@ -54,7 +61,13 @@ typedef int socket_t;
 #include <ctime>
 #include <limits>
 #include <vector>
+#include <map>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
 
 #include "cpucounters.h"
 #include "debug.h"
@@ -86,6 +99,77 @@ using namespace pcm;
 std::string const HTTP_EOL( "\r\n" );
 std::string const PROM_EOL( "\n" );
 
+// Growable output buffer of the JSON and Prometheus printers. Numbers are formatted with std::to_chars straight
+// into the buffer instead of going through a stringstream, the finished text is moved into the response body
+class OutputBuffer {
+public:
+    explicit OutputBuffer( size_t capacity ) {
+        buffer_.reserve( capacity );
+    }
+    OutputBuffer( OutputBuffer const & ) = delete;
+    OutputBuffer & operator = ( OutputBuffer const & ) = delete;
+
+    OutputBuffer& operator<<( std::string_view s ) {
+        buffer_.append( s.data(), s.size() );
+        return *this;
+    }
+    OutputBuffer& operator<<( char c ) {
+        buffer_.push_back( c );
+        return *this;
+    }
+    template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    OutputBuffer& operator<<( T value ) {
+        appendNumber( value );
+        return *this;
+    }
+
+    // Appends s with '-' and ' ' replaced by '_', as required for Prometheus metric names
+    void appendMetricName( std::string_view s ) {
+        size_t const pos = buffer_.size();
+        buffer_.append( s.data(), s.size() );
+        std::replace_if( buffer_.begin() + pos, buffer_.end(), []( char c ) { return c == '-' || c == ' '; }, '_' );
+    }
+
+    bool endsWith( std::string_view s ) const {
+        return buffer_.size() >= s.size() && std::string_view( buffer_ ).substr( buffer_.size() - s.size() ) == s;
+    }
+    void truncate( size_t size ) {
+        buffer_.resize( size );
+    }
+    size_t size() const {
+        return buffer_.size();
+    }
+
+    // Hands over the text, the buffer is empty afterwards
+    std::string release() {
+        return std::move( buffer_ );
+    }
+
+private:
+    template <typename T>
+    void appendNumber( T value ) {
+        if constexpr ( std::is_same<T, bool>::value ) {
+            buffer_.push_back( value ? '1' : '0' );
+        } else if constexpr ( std::is_floating_point<T>::value ) {
+            // fixed notation with 3 decimals like the std::fixed << std::setprecision(3) stream format used before
+            char digits[std::numeric_limits<double>::max_exponent10 + 16];
+#if defined(__cpp_lib_to_chars)
+            auto const result = std::to_chars( digits, digits + sizeof( digits ), double( value ), std::chars_format::fixed, 3 );
+            buffer_.append( digits, result.ptr );
+#else
+            int const len = snprintf( digits, sizeof( digits ), "%.3f", double( value ) );
+            buffer_.append( digits, (std::min)( size_t( len ), sizeof( digits ) - 1 ) );
+#endif
+        } else {
+            char digits[24];
+            auto const result = std::to_chars( digits, digits + sizeof( digits ), value );
+            buffer_.append( digits, result.ptr );
+        }
+    }
+
+    std::string buffer_;
+};
+
 class Indent {
     public:
         explicit Indent( std::string const & is = std::string("    ") ) : indstr_(is), indent_(""), len_(0), indstrlen_(is.length())
@@ -96,11 +180,8 @@ class Indent {
         Indent & operator = (Indent const &) = delete;
         ~Indent() = default;
 
-        friend std::stringstream& operator <<( std::stringstream& stream, Indent in );
+        friend OutputBuffer& operator <<( OutputBuffer& buffer, Indent const & in );
 
-        void printIndentationString(std::stringstream& s) {
-            s << indent_;
-        }
         // We only need post inc und pre dec
         Indent& operator--() {
             if ( len_ > 0 )
@@ -124,9 +205,8 @@ class Indent {
         size_t const indstrlen_;
 };
 
-std::stringstream& operator <<( std::stringstream& stream, Indent in ) {
-    in.printIndentationString( stream );
-    return stream;
+OutputBuffer& operator <<( OutputBuffer& buffer, Indent const & in ) {
+    return buffer << in.indent_;
 }
 
 class datetime {
@@ -334,7 +414,7 @@ public:
         LineEndAction_Spare = 255
     };
 
-    JSONPrinter( std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggregatorPair ) : indentation("  "), aggPair_( aggregatorPair ) {
+    JSONPrinter( std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggregatorPair ) : out_( sizeHint_ ), indentation("  "), aggPair_( aggregatorPair ) {
         if ( nullptr == aggPair_.second.get() )
             throw std::runtime_error("BUG: second Aggregator == nullptr!");
         DBG( 2, "Constructor: before=", std::hex, aggPair_.first.get(), ", after=", std::hex, aggPair_.second.get() );
@@ -439,6 +519,10 @@ public:
 
         startObject( "PCIe Bandwidth", BEGIN_OBJECT );
         printPCIeCounterState();
+        endObject( JSONPrinter::LineEndAction::DelimiterAndNewLine, END_OBJECT );
+
+        startObject( "Collection Overhead", BEGIN_OBJECT );
+        printCollectionStats();
         endObject( JSONPrinter::LineEndAction::NewLineOnly, END_OBJECT );
 
         endObject( JSONPrinter::LineEndAction::NewLineOnly, END_OBJECT );
@@ -463,11 +547,26 @@ public:
         endObject( JSONPrinter::LineEndAction::NewLineOnly, END_OBJECT );
     }
 
+    // Hands over the serialized text, the printer is empty afterwards
     std::string str( void ) {
-        return ss.str();
+        std::string text = out_.release();
+        // the next printer starts with enough capacity, the output only grows when counter values get wider
+        sizeHint_ = text.size() + text.size() / 16;
+        return text;
     }
 
 private:
+    // "CStateResidency[i]" for all C-states, built once
+    static std::vector<std::string> const & cStateResidencyNames() {
+        static std::vector<std::string> const names = []() {
+            std::vector<std::string> v;
+            for ( int i = 0; i <= PCM::MAX_C_STATE; ++i )
+                v.push_back( "CStateResidency[" + std::to_string( i ) + "]" );
+            return v;
+        }();
+        return names;
+    }
+
     void printBasicCounterState( BasicCounterState const& before, BasicCounterState const& after ) {
         startObject( "Core Counters", BEGIN_OBJECT );
         printCounter( "Instructions Retired Any", getInstructionsRetired( before, after ) );
@@ -501,16 +600,9 @@ private:
 
         startObject( "Energy Counters", BEGIN_OBJECT );
         printCounter( "Thermal Headroom", after.getThermalHeadroom() );
-        uint32 i = 0;
-        for ( ; i < ( PCM::MAX_C_STATE ); ++i ) {
-            std::stringstream s;
-            s << "CStateResidency[" << i << "]";
-            printCounter( s.str(), getCoreCStateResidency( i, before, after ) );
+        for ( int i = 0; i <= PCM::MAX_C_STATE; ++i ) {
+            printCounter( cStateResidencyNames()[i], getCoreCStateResidency( i, before, after ) );
         }
-        // Here i == PCM::MAX_STATE so no need to type so many characters ;-)
-        std::stringstream s;
-        s << "CStateResidency[" << i << "]";
-        printCounter( s.str(), getCoreCStateResidency( i, before, after ) );
         endObject( JSONPrinter::DelimiterAndNewLine, END_OBJECT );
 
         startObject( "Core Memory Bandwidth Counters", BEGIN_OBJECT );
@@ -549,16 +641,9 @@ private:
         const auto localRatio = int(100.* getLocalMemoryRequestRatio(before, after));
         printCounter( "Local Memory Request Ratio",  int(100.* getLocalMemoryRequestRatio(before, after)) );
         printCounter( "Remote Memory Request Ratio", 100 - localRatio);
-        uint32 i = 0;
-        for ( ; i < ( PCM::MAX_C_STATE ); ++i ) {
-            std::stringstream s;
-            s << "CStateResidency[" << i << "]";
-            printCounter( s.str(), getPackageCStateResidency( i, before, after ) );
+        for ( int i = 0; i <= PCM::MAX_C_STATE; ++i ) {
+            printCounter( cStateResidencyNames()[i], getPackageCStateResidency( i, before, after ) );
         }
-        // Here i == PCM::MAX_STATE so no need to type so many characters ;-)
-        std::stringstream s;
-        s << "CStateResidency[" << i << "]";
-        printCounter( s.str(), getPackageCStateResidency( i, before, after ) );
         endObject( JSONPrinter::NewLineOnly, END_OBJECT );
     }
 
@@ -587,6 +672,26 @@ private:
         endObject( JSONPrinter::NewLineOnly, END_OBJECT );
     }
 
+    void printCollectionStats() {
+        const auto stats = PCM::getInstance()->getCollectionStats();
+        printCounter( "Samples", stats.samples );
+        printCounter( "Sample Cycles Median", stats.sampleCycles.getQuantile( 0.5 ) );
+        printCounter( "Sample Cycles P99", stats.sampleCycles.getQuantile( 0.99 ) );
+        printCounter( "Sample Cycles Max", stats.sampleCycles.max );
+        for ( size_t i = 0; i < CollectionStats::numStages; ++i ) {
+            const auto & stage = stats.stages[i];
+            startObject( std::string( "Stage " ) + CollectionStats::getStageName( CollectionStats::Stage( i ) ), BEGIN_OBJECT );
+            printCounter( "Samples", stage.cycles.count );
+            printCounter( "Cycles Total", stage.cycles.total );
+            printCounter( "Cycles Median", stage.cycles.getQuantile( 0.5 ) );
+            printCounter( "Cycles P99", stage.cycles.getQuantile( 0.99 ) );
+            printCounter( "Cycles Max", stage.cycles.max );
+            printCounter( "Syscalls Total", stage.syscalls.total );
+            printCounter( "Syscalls P99", stage.syscalls.getQuantile( 0.99 ) );
+            endObject( JSONPrinter::DelimiterAndNewLine, END_OBJECT );
+        }
+    }
+
     void printAccelCounterState( SystemCounterState const& before, SystemCounterState const& after ) {
         AcceleratorCounterState* accs_ = AcceleratorCounterState::getInstance();
         uint32 devs = accs_->getNumOfAccelDevs();
@@ -624,46 +729,44 @@ private:
     }
 
     template <typename Counter>
-    void printCounter( std::string const & name, Counter c );
+    void printCounter( std::string_view name, Counter c );
 
     template <typename Vector>
     void iterateVectorAndCallAccept( Vector const& v );
 
-    void startObject(std::string const& s, char const ch ) {
-        std::string name;
-        if ( s.size() != 0 )
-            name = "\"" + s + "\" : ";
-        ss << (indentation++) << name << ch << HTTP_EOL;
+    void startObject( std::string_view name, char const ch ) {
+        out_ << (indentation++);
+        if ( name.size() != 0 )
+            out_ << '"' << name << "\" : ";
+        out_ << ch << HTTP_EOL;
     }
 
     void endObject( enum JSONPrinter::LineEndAction lea, char const ch ) {
-        // look 3 chars back, if it is a ',' then delete it.
-        // make read same as write position - 3
-        std::stringstream::pos_type oldReadPos = ss.tellg();
-        ss.seekg( -3, std::ios_base::end );
-        if ( ss.peek() == ',' ) {
-            ss.seekp( ss.tellg() ); // Make write same as read position
-            ss << HTTP_EOL;
+        // the last element of the object has a ',' delimiter, delete it
+        if ( out_.endsWith( ",\r\n" ) ) {
+            out_.truncate( out_.size() - 3 );
+            out_ << HTTP_EOL;
         }
-        ss.seekg( oldReadPos );// Just making sure the readpointer is set back to where it was
 
-        ss << (--indentation) << ch;
+        out_ << (--indentation) << ch;
 
         if ( lea == LineEndAction::NewLineOnly )
-            ss << HTTP_EOL;
+            out_ << HTTP_EOL;
         else if ( lea == LineEndAction::DelimiterAndNewLine )
-            ss << "," << HTTP_EOL;
+            out_ << "," << HTTP_EOL;
         else if ( lea == LineEndAction::DelimiterOnly )
-            ss << ",";
+            out_ << ",";
         else
             throw std::runtime_error( "Unknown LineEndAction enum" );
     }
 
     void insertListDelimiter() {
-        ss << "," << HTTP_EOL;
+        out_ << "," << HTTP_EOL;
     }
 
 private:
+    inline static std::atomic<size_t> sizeHint_{ 64 * 1024 }; // size of the last output
+    OutputBuffer      out_;
     Indent            indentation;
     std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggPair_;
 
@@ -674,11 +777,11 @@ private:
 };
 
 template <typename Counter>
-void JSONPrinter::printCounter( std::string const & name, Counter c ) {
-    if ( std::is_same<Counter, std::string>::value || std::is_same<Counter, char const*>::value )
-        ss << indentation << "\"" << name << "\" : \"" << c << "\"," << HTTP_EOL;
+void JSONPrinter::printCounter( std::string_view name, Counter c ) {
+    if constexpr ( std::is_same<Counter, std::string>::value || std::is_same<Counter, char const*>::value )
+        out_ << indentation << '"' << name << "\" : \"" << c << "\"," << HTTP_EOL;
     else
-        ss << indentation << "\"" << name << "\" : " << c << "," << HTTP_EOL;
+        out_ << indentation << '"' << name << "\" : " << c << "," << HTTP_EOL;
 }
 
 template <typename Vector>
@@ -694,7 +797,7 @@ void JSONPrinter::iterateVectorAndCallAccept(Vector const& v) {
 class PrometheusPrinter : Visitor
 {
 public:
-    PrometheusPrinter( std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggregatorPair ) : aggPair_( aggregatorPair ) {
+    PrometheusPrinter( std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggregatorPair ) : out_( sizeHint_ ), aggPair_( aggregatorPair ) {
         if ( nullptr == aggPair_.second.get() )
             throw std::runtime_error("BUG: second Aggregator == nullptr!");
         DBG( 2, "Constructor: before=", std::hex, aggPair_.first.get(), ", after=", std::hex, aggPair_.second.get() );
@@ -781,6 +884,8 @@ public:
         printComment( "PCIe Bandwidth Counters" );
         printPCIeCounterState();
         removeFromHierarchy(); // aggregate=system
+        printComment( "PCM Collection Overhead" );
+        printCollectionStats();
     }
 
     virtual void dispatch( Socket* s ) override {
@@ -800,11 +905,25 @@ public:
         removeFromHierarchy(); // socket=x
     }
 
+    // Hands over the serialized text, the printer is empty afterwards
     std::string str( void ) {
-        return ss.str();
+        std::string text = out_.release();
+        sizeHint_ = text.size() + text.size() / 16;
+        return text;
     }
 
 private:
+    // index="i" labels for all C-states, built once
+    static std::vector<std::string> const & cStateIndexLabels() {
+        static std::vector<std::string> const labels = []() {
+            std::vector<std::string> v;
+            for ( int i = 0; i <= PCM::MAX_C_STATE; ++i )
+                v.push_back( "index=\"" + std::to_string( i ) + "\"" );
+            return v;
+        }();
+        return labels;
+    }
+
     void printBasicCounterState( BasicCounterState const& before, BasicCounterState const& after ) {
         addToHierarchy( "source=\"core\"" );
         printCounter( "Instructions Retired Any", getInstructionsRetired( before, after ) );
@@ -824,11 +943,8 @@ private:
         //DBG( 2, "Invariant TSC before=", before.InvariantTSC, ", after=", after.InvariantTSC, ", difference=", after.InvariantTSC-before.InvariantTSC );
 
         printCounter( "Thermal Headroom", after.getThermalHeadroom() );
-        uint32 i = 0;
-        for ( ; i <= ( PCM::MAX_C_STATE ); ++i ) {
-            std::stringstream s;
-            s << "index=\"" << i << "\"";
-            addToHierarchy( s.str() );
+        for ( int i = 0; i <= PCM::MAX_C_STATE; ++i ) {
+            addToHierarchy( cStateIndexLabels()[i] );
             printCounter( "CStateResidency", getCoreCStateResidency( i, before, after ) );
             // need a raw CStateResidency metric because the precision is lost to unacceptable levels when trying
             // to compute CStateResidency for the last second using the existing CStateResidency metric
@@ -871,11 +987,8 @@ private:
             printCounter( std::string("Uncore Frequency Die ") + std::to_string(i), uncoreFrequencies[i]);
         }
 #endif
-        uint32 i = 0;
-        for ( ; i <= ( PCM::MAX_C_STATE ); ++i ) {
-            std::stringstream s;
-            s << "index=\"" << i << "\"";
-            addToHierarchy( s.str() );
+        for ( int i = 0; i <= PCM::MAX_C_STATE; ++i ) {
+            addToHierarchy( cStateIndexLabels()[i] );
             printCounter( "CStateResidency", getPackageCStateResidency( i, before, after ) );
             // need a CStateResidency raw metric because the precision is lost to unacceptable levels when trying
             // to compute CStateResidency for the last second using the existing CStateResidency metric
@@ -913,6 +1026,26 @@ private:
         removeFromHierarchy();
     }
 
+    void printCollectionStats() {
+        const auto stats = PCM::getInstance()->getCollectionStats();
+        printCounter( "PCM Collection Samples", stats.samples );
+        printCounter( "PCM Collection Sample Cycles Median", stats.sampleCycles.getQuantile( 0.5 ) );
+        printCounter( "PCM Collection Sample Cycles P99", stats.sampleCycles.getQuantile( 0.99 ) );
+        printCounter( "PCM Collection Sample Cycles Max", stats.sampleCycles.max );
+        for ( size_t i = 0; i < CollectionStats::numStages; ++i ) {
+            const auto & stage = stats.stages[i];
+            addToHierarchy( std::string( "stage=\"" ) + CollectionStats::getStageName( CollectionStats::Stage( i ) ) + "\"" );
+            printCounter( "PCM Collection Stage Samples", stage.cycles.count );
+            printCounter( "PCM Collection Stage Cycles Total", stage.cycles.total );
+            printCounter( "PCM Collection Stage Cycles Median", stage.cycles.getQuantile( 0.5 ) );
+            printCounter( "PCM Collection Stage Cycles P99", stage.cycles.getQuantile( 0.99 ) );
+            printCounter( "PCM Collection Stage Cycles Max", stage.cycles.max );
+            printCounter( "PCM Collection Stage Syscalls Total", stage.syscalls.total );
+            printCounter( "PCM Collection Stage Syscalls P99", stage.syscalls.getQuantile( 0.99 ) );
+            removeFromHierarchy();
+        }
+    }
+
     void printAccelCounterState( SystemCounterState const& before, SystemCounterState const& after )
     {
         addToHierarchy( "source=\"accel\"" );
@@ -951,58 +1084,45 @@ private:
         removeFromHierarchy();
     }
 
-    std::string replaceIllegalCharsWithUnderbar( std::string const& s ) {
-        size_t pos = 0;
-        std::string str(s);
-        while ( ( pos = str.find( '-', pos ) ) != std::string::npos ) {
-            str.replace( pos, 1, "_" );
-        }
-        pos = 0;
-        while ( ( pos = str.find( ' ', pos ) ) != std::string::npos ) {
-            str.replace( pos, 1, "_" );
-        }
-        return str;
-    }
-
-    void addToHierarchy( std::string const& s ) {
-        hierarchy_.push_back( s );
+    // The label set of the current topology node is kept rendered, "{label,label" without the closing brace,
+    // and written as is for every counter of the node
+    void addToHierarchy( std::string_view s ) {
+        labelSetEnds_.push_back( labelSet_.size() );
+        labelSet_ += labelSet_.empty() ? '{' : ',';
+        labelSet_ += s;
     }
 
     void removeFromHierarchy() {
-        hierarchy_.pop_back();
-    }
-
-    std::string printHierarchy() {
-        std::string s(" ");
-        if (hierarchy_.size() == 0 )
-            return s;
-        s = "{";
-        for(const auto & level : hierarchy_ ) {
-            s += level + ',';
-        }
-        s.pop_back();
-        s += "} ";
-        return s;
+        labelSet_.resize( labelSetEnds_.back() );
+        labelSetEnds_.pop_back();
     }
 
     template <typename Counter>
-    void printCounter( std::string const & name, Counter c );
+    void printCounter( std::string_view name, Counter c );
 
-    void printComment( std::string const &comment ) {
-        ss << "# " << comment << PROM_EOL;
+    void printComment( std::string_view comment ) {
+        out_ << "# " << comment << PROM_EOL;
     }
 
     template <typename Vector>
     void iterateVectorAndCallAccept( Vector const& v );
 
 private:
+    inline static std::atomic<size_t> sizeHint_{ 64 * 1024 }; // size of the last output
+    OutputBuffer out_;
     std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggPair_;
-    std::vector<std::string> hierarchy_;
+    std::string labelSet_;
+    std::vector<size_t> labelSetEnds_;
 };
 
 template <typename Counter>
-void PrometheusPrinter::printCounter( std::string const & name, Counter c ) {
-        ss << replaceIllegalCharsWithUnderbar(name) << printHierarchy() << c << PROM_EOL;
+void PrometheusPrinter::printCounter( std::string_view name, Counter c ) {
+    out_.appendMetricName( name );
+    if ( labelSet_.empty() )
+        out_ << ' ';
+    else
+        out_ << labelSet_ << "} ";
+    out_ << c << PROM_EOL;
 }
 
 template <typename Vector>
@@ -2524,11 +2644,21 @@ protected:
 public:
     // Data manipulators/extractors
     std::string const & body() const {
-        return body_;
+        static const std::string empty;
+        return body_ ? *body_ : empty;
     }
 
     void addBody( std::string const& body ) {
-        body_ = body;
+        body_ = std::make_shared<std::string const>( body );
+    }
+
+    // Shares an immutable body (e.g. a cached serialized response) instead of copying it
+    void addBody( std::shared_ptr<std::string const> body ) {
+        body_ = std::move( body );
+    }
+
+    std::shared_ptr<std::string const> sharedBody() const {
+        return body_;
     }
 
     void addHeader( std::string const & name, std::string const & value ) {
@@ -2647,7 +2777,7 @@ protected:
 protected:
     enum HTTPProtocol protocol_;
     std::unordered_map<std::string, HTTPHeader> headers_;
-    std::string body_;
+    std::shared_ptr<std::string const> body_;
     std::unordered_map<enum HTTPProtocol, std::string, std::hash<int>> protocol_map_ = {
         { HTTPProtocol::HTTP_0_9, "HTTP/0.9" },
         { HTTPProtocol::HTTP_1_0, "HTTP/1.0" },
@@ -2667,6 +2797,9 @@ public:
     template <typename CharT, typename Traits>
     friend basic_socketstream<CharT,Traits>& operator>>(basic_socketstream<CharT,Traits>&, HTTPRequest& );
 
+    template <typename Stream>
+    friend void readRequestHead( Stream&, HTTPRequest& );
+
 public:
     enum HTTPRequestMethod method() const {
         return method_;
@@ -2683,7 +2816,7 @@ public:
         DBG( 3, "Protocol: \"", protocol_, "\"" );
         for ( auto& header: headers_ )
             DBG( 3, "Header : \"", header.first, "\" ==> \"", header.second.headerValueAsString(), "\"" );
-        DBG( 3, "Body    : \"", body_, "\"" );
+        DBG( 3, "Body    : \"", body(), "\"" );
     }
 
 private:
@@ -2743,14 +2876,32 @@ public:
         for ( auto& header: headers_ )
             DBG( 3, "Header: \"", header.first, "\" ==> \"", header.second.headerValueAsString(), "\"" );
         // Leaving body at 3, too large and spams the output
-        DBG( 3, "Body: \"", body_, "\"" );
+        DBG( 3, "Body: \"", body(), "\"" );
     }
 
     void createResponse( enum MimeType mimeType, std::string body, enum HTTPResponseCode rc ) {
+        createResponse( mimeType, std::make_shared<std::string const>( std::move( body ) ), rc );
+    }
+
+    // Status line and headers including the empty line that separates them from the body
+    std::string head() const {
+        std::string head = protocolAsString() + " " + std::to_string( (int)responseCode_ ) + " " + responseCodeAsString() + HTTP_EOL;
+        for( auto& header : headers_ ) {
+            DBG( 3, header.first, ": ", header.second.headerValueAsString() );
+            head += header.first + ": " + header.second.headerValueAsString();
+            if ( header.first == "Content-Type" )
+                head += "; charset=UTF-8";
+            head += HTTP_EOL;
+        }
+        head += HTTP_EOL;
+        return head;
+    }
+
+    void createResponse( enum MimeType mimeType, std::shared_ptr<std::string const> body, enum HTTPResponseCode rc ) {
         // mimetype validity checking?
         addHeader( HTTPHeader( "Content-Type", mimeTypeMap[mimeType] ) );
-        addHeader( HTTPHeader( "Content-Length", std::to_string( body.size() ) ) );
-        addBody( body );
+        addHeader( HTTPHeader( "Content-Length", std::to_string( body->size() ) ) );
+        addBody( std::move( body ) );
         setResponseCode( rc );
     }
 
@@ -2850,9 +3001,9 @@ std::string& compressLWSAndRemoveCR( std::string& line ) {
     return line;
 }
 
-// This method is for a server reading a request from the client
-template <class CharT, class Traits>
-basic_socketstream<CharT, Traits>& operator>>( basic_socketstream<CharT, Traits>& rs, HTTPRequest& m ) {
+// Reads the request line and the headers of a request, shared by the socket stream and the event loop
+template <class Stream>
+void readRequestHead( Stream& rs, HTTPRequest& m ) {
     DBG( 3, "Reading from the socket" );
 
     // Read something like: GET /persecond/10 HTTP/1.1\r\n
@@ -2939,6 +3090,12 @@ basic_socketstream<CharT, Traits>& operator>>( basic_socketstream<CharT, Traits>
         concatLine.clear();
     }
     DBG( 3, "Done parsing headers" );
+}
+
+// This method is for a server reading a request from the client
+template <class CharT, class Traits>
+basic_socketstream<CharT, Traits>& operator>>( basic_socketstream<CharT, Traits>& rs, HTTPRequest& m ) {
+    readRequestHead( rs, m );
 
     enum HTTPRequestHasBody hasBody = HTTPMethodProperties::requestHasBody( m.method_ );
     DBG( 3, "Request has Body (0 No, 1 Optional, 2 Yes): ", (int)hasBody );
@@ -3008,7 +3165,7 @@ basic_socketstream<CharT, Traits>& operator>>( basic_socketstream<CharT, Traits>
 
             // now load the body
             if ( chunkedTE ) {
-                m.body_ = m.readChunkedData( rs );
+                m.addBody( m.readChunkedData( rs ) );
                 // There is now either a \r\n pair in the stream, or footers/trailers, lets see:
                 std::string remainder;
                 size_t numHeadersAdded = 0;
@@ -3124,19 +3281,8 @@ basic_socketstream<CharT, Traits>& operator<<( basic_socketstream<CharT, Traits>
     m.debugPrint();
 
     DBG( 3, m.protocolAsString(), " ", (int)m.responseCode(), " ", m.responseCodeAsString() );
-    ws << m.protocolAsString() << " " << (int)m.responseCode() << " " << m.responseCodeAsString() << HTTP_EOL;
-
     DBG( 3, "Headers:" );
-    // write headers
-    for( auto& header : m.headers_ ) {
-        DBG( 3, header.first, ": ", header.second.headerValueAsString() );
-        if ( header.first == "Content-Type" )
-            ws << header.first << ": " << header.second.headerValueAsString() << "; charset=UTF-8" << HTTP_EOL;
-        else
-            ws << header.first << ": " << header.second.headerValueAsString() << HTTP_EOL;
-    }
-
-    ws << HTTP_EOL;
+    ws << m.head();
 
     DBG( 3, "Body:", m.body() );
     ws << m.body();
@@ -3148,6 +3294,74 @@ basic_socketstream<CharT, Traits>& operator<<( basic_socketstream<CharT, Traits>
 
 typedef void (*http_callback)( HTTPServer *, HTTPRequest const &, HTTPResponse & );
 
+// Request limit and idle timeout of persistent connections, announced in the Keep-Alive header
+int const keepAliveRequestLimit = 100;
+int const keepAliveTimeout = 10; // seconds
+
+// Runs the callback of the request method and adds the server specific headers to the response.
+// keepAlive returns whether the connection stays open for the next request: on request of the client
+// or, if persistentByDefault, for every HTTP/1.1 request without "Connection: close"
+void processRequest( HTTPServer* hs, std::vector<http_callback> const & callbackList, HTTPRequest const & request, HTTPResponse & response,
+                     int numRequests, bool persistentByDefault, bool & keepAlive ) {
+    keepAlive = false;
+    response.setProtocol( request.protocol() );
+
+    // Check for protocol conformity
+    if ( request.protocol() == HTTPProtocol::HTTP_1_1 ) {
+        if ( ! request.hasHeader( "Host" ) ) {
+            DBG( 3, "Mandatory Host header not found." );
+            std::string body( "400 Bad Request. HTTP 1.1: Mandatory Host header is missing." );
+            response.createResponse( TextPlain, body, RC_400_BadRequest );
+            return;
+        }
+    }
+
+    // Do processing of the request here
+    auto callback = callbackList[request.method()];
+    if ( callback ) {
+        (*callback)( hs, request, response );
+    } else {
+        std::string body( "501 Not Implemented." );
+        body += " Method \"" + HTTPMethodProperties::getMethodAsString(request.method()) + "\" is not implemented (yet).";
+        response.createResponse( TextPlain, body, RC_501_NotImplemented );
+    }
+
+    // Post-processing, adding some server specific response headers
+    response.addHeader( HTTPHeader( "Server", std::string( "PCMWebServer " ) + PCMWebServerVersion ) );
+    response.addHeader( HTTPHeader( "Date", datetime().toString() ) );
+    if ( numRequests < keepAliveRequestLimit ) {
+        std::string connection;
+        if ( request.hasHeader( "Connection" ) ) {
+            HTTPHeader const h = request.getHeader( "Connection" );
+            connection = h.headerValueAsString();
+            // the parsed header value keeps the whitespace after the colon
+            connection.erase( 0, connection.find_first_not_of( " \t" ) );
+            connection.erase( connection.find_last_not_of( " \t" ) + 1 );
+            std::transform( connection.begin(), connection.end(), connection.begin(), ::tolower );
+        } else {
+            DBG( 3, "Connection: header not found, this is not an error" );
+            connection = "";
+        }
+        if ( connection == "keep-alive" || ( persistentByDefault && request.protocol() == HTTPProtocol::HTTP_1_1 && connection != "close" ) ) {
+            DBG( 3, "processRequest: keeping the connection alive" );
+            response.addHeader( HTTPHeader( "Connection", "keep-alive" ) );
+            std::string tmp = "timeout=" + std::to_string( keepAliveTimeout ) + ", max=" + std::to_string( keepAliveRequestLimit );
+            HTTPHeader header2( "Keep-Alive", tmp );
+            response.addHeader( header2 );
+            keepAlive = true;
+        }
+    } else {
+        DBG( 3, "Keep-Alive connection request limit (", keepAliveRequestLimit, ") reached" );
+        // Now respond with the answer
+        response.addHeader( HTTPHeader( "Connection", "close" ) );
+    }
+    // Remove body if method is HEAD, it is using the same callback as GET but does not need the body
+    if ( request.method() == HEAD ) {
+        DBG( 1, "Method HEAD, removing body" );
+        response.addBody( "" );
+    }
+}
+
 class HTTPConnection : public Work {
 public:
     HTTPConnection() = delete;
@@ -3193,63 +3407,7 @@ public:
             // Debug:
             // request.debugPrint();
 
-            response.setProtocol( request.protocol() );
-
-            // Check for protocol conformity
-            if ( request.protocol() == HTTPProtocol::HTTP_1_1 ) {
-                if ( ! request.hasHeader( "Host" ) ) {
-                    DBG( 3, "Mandatory Host header not found." );
-                    std::string body( "400 Bad Request. HTTP 1.1: Mandatory Host header is missing." );
-                    response.createResponse( TextPlain, body, RC_400_BadRequest );
-                    socketStream_ << response;
-                    break;
-                }
-            }
-
-            // Do processing of the request here
-            auto callback = callbackList_[request.method()];
-            if ( callback ) {
-                (*callback)( hs_, request, response );
-            } else {
-                std::string body( "501 Not Implemented." );
-                body += " Method \"" + HTTPMethodProperties::getMethodAsString(request.method()) + "\" is not implemented (yet).";
-                response.createResponse( TextPlain, body, RC_501_NotImplemented );
-            }
-
-            // Post-processing, adding some server specific response headers
-            int const requestLimit = 100;
-            int const connectionTimeout = 10;
-            response.addHeader( HTTPHeader( "Server", std::string( "PCMWebServer " ) + PCMWebServerVersion ) );
-            response.addHeader( HTTPHeader( "Date", datetime().toString() ) );
-            if ( numRequests < requestLimit ) {
-                std::string connection;
-                if ( request.hasHeader( "Connection" ) ) {
-                    HTTPHeader const h = request.getHeader( "Connection" );
-                    connection = h.headerValueAsString();
-                } else {
-                    DBG( 3, "Connection: header not found, this is not an error" );
-                    connection = "";
-                }
-                // FIXME: case insensitive compare
-                if ( connection == "keep-alive" ) {
-                    DBG( 3, "HTTPConnection::execute: keep-alive header found" );
-                    response.addHeader( HTTPHeader( "Connection", "keep-alive" ) );
-                    std::string tmp = "timeout=" + std::to_string(connectionTimeout) + ", max=" + std::to_string( requestLimit );
-                    HTTPHeader header2( "Keep-Alive", tmp );
-                    response.addHeader( header2 );
-                    keepListening = true;
-                }
-            } else {
-                DBG( 3, "Keep-Alive connection request limit (", requestLimit, ") reached" );
-                // Now respond with the answer
-                response.addHeader( HTTPHeader( "Connection", "close" ) );
-                keepListening = false;
-            }
-            // Remove body if method is HEAD, it is using the same callback as GET but does not need the body
-            if ( request.method() == HEAD ) {
-                DBG( 1, "Method HEAD, removing body" );
-                response.addBody( "" );
-            }
+            processRequest( hs_, callbackList_, request, response, numRequests, false, keepListening );
             response.debugPrint();
             DBG( 3, "Writing back the response to the client" );
             socketStream_ << response;
@@ -3302,9 +3460,479 @@ private:
     std::atomic<bool> exit_;
 };
 
+// Serialized counter responses shared by all connections asking for the same endpoint and format
+// within one sample epoch (the dispatch time of the newest Aggregator of the response)
+class ResponseCache {
+public:
+    typedef std::shared_ptr<std::string const> Body;
+
+    // Endpoints kept at most, beyond that the least recently requested one is dropped: the clients choose the
+    // windows of /rate/X, every distinct window is an endpoint
+    static constexpr size_t maxEntries = 32;
+
+    ResponseCache() = default;
+    ResponseCache( ResponseCache const & ) = delete;
+    ResponseCache & operator = ( ResponseCache const & ) = delete;
+
+    // Returns the cached body or serializes it with serialize() once for the epoch, concurrent requests wait for the result
+    template <class Serializer>
+    Body get( std::string const & endpoint, int format, std::chrono::steady_clock::time_point epoch, Serializer serialize ) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            auto const key = std::make_pair( endpoint, format );
+            auto slot = entries_.find( key );
+            if ( slot == entries_.end() ) {
+                if ( entries_.size() >= maxEntries ) {
+                    entries_.erase( std::min_element( entries_.begin(), entries_.end(), []( Slots::value_type const & a, Slots::value_type const & b ) {
+                        return a.second.lastUse < b.second.lastUse;
+                    } ) );
+                }
+                slot = entries_.emplace( key, Slot() ).first;
+            }
+            slot->second.lastUse = ++uses_;
+            auto & e = slot->second.entry;
+            if ( nullptr == e.get() || e->epoch != epoch ) {
+                // a new epoch replaces the entry, connections still sending the old body keep their reference
+                e = std::make_shared<Entry>();
+                e->epoch = epoch;
+            }
+            entry = e;
+        }
+        bool built = false;
+        std::call_once( entry->once, [&]() {
+            entry->body = std::make_shared<std::string const>( serialize() );
+            built = true;
+        } );
+        DBG( 3, "ResponseCache: ", endpoint, " format ", format, built ? " serialized" : " served from cache", ", size ", entry->body->size() );
+        return entry->body;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return entries_.size();
+    }
+
+private:
+    struct Entry {
+        std::chrono::steady_clock::time_point epoch;
+        std::once_flag once;
+        Body body;
+    };
+    struct Slot {
+        std::shared_ptr<Entry> entry;
+        uint64 lastUse = 0;
+    };
+    typedef std::map<std::pair<std::string, int>, Slot> Slots;
+    std::mutex mutex_;
+    Slots entries_;
+    uint64 uses_ = 0;
+};
+
+// Sampling of the PeriodicCounterFetcher: the period between two samples and how far back the rate history reaches
+struct SamplingOptions {
+    static constexpr std::chrono::milliseconds minPeriod{ 100 };
+    static constexpr std::chrono::milliseconds maxPeriod{ 1000 };
+
+    // The period has to divide a second: every 1000 / period samples one of them goes into the ring of /persecond,
+    // so that its entries are exactly a second apart
+    static bool isValidPeriod( std::chrono::milliseconds period ) {
+        return period >= minPeriod && period <= maxPeriod && 0 == 1000 % period.count();
+    }
+
+    std::chrono::milliseconds period{ 1000 };
+    std::chrono::seconds history{ 3600 };
+    bool historyGiven = false; // set by --history, the default history is shortened to what fits into CounterHistory::maxBytes
+};
+
+// Rate history of the periodic samples. Each sample is reduced to a compact snapshot, one row of cumulative counter
+// values: coreCounterNames for every thread (indexed by OS ID), then core and uncore counters for every socket and
+// for the system. The rows live in a ring of fixed capacity, so the rate over any window within the history is the
+// difference of two rows found by index. The ring is allocated once and not initialized, pages are only touched
+// as the history fills up
+class CounterHistory {
+public:
+    static constexpr char const * coreCounterNames[] = {
+        "Instructions Retired Any", "Clock Unhalted Thread", "Clock Unhalted Ref", "L3 Cache Misses", "L3 Cache Hits",
+        "L2 Cache Misses", "L2 Cache Hits", "Invariant TSC", "SMI Count", "Local Memory Bandwidth", "Remote Memory Bandwidth"
+    };
+    static constexpr char const * uncoreCounterNames[] = {
+        "DRAM Writes", "DRAM Reads", "Persistent Memory Writes", "Persistent Memory Reads", "Embedded DRAM Writes",
+        "Embedded DRAM Reads", "Memory Controller IA Requests", "Memory Controller GT Requests", "Memory Controller IO Requests",
+        "Package Joules Consumed", "PP0 Joules Consumed", "PP1 Joules Consumed", "DRAM Joules Consumed"
+    };
+    static constexpr size_t numCoreCounters = sizeof( coreCounterNames ) / sizeof( coreCounterNames[0] );
+    static constexpr size_t numUncoreCounters = sizeof( uncoreCounterNames ) / sizeof( uncoreCounterNames[0] );
+    static constexpr size_t firstJoulesCounter = 9; // energy is stored in millijoules
+
+    // Per-second rates of all counters between two snapshots, in the layout of a row
+    struct Rates {
+        std::chrono::steady_clock::time_point epoch; // dispatch time of the newer snapshot
+        int64 intervalUs = 0;
+        std::vector<double> values;
+    };
+
+    // Upper bound of the memory of the snapshots, a longer history or a larger system has to sample less often
+    static constexpr size_t maxBytes = size_t( 1 ) << 30;
+
+    CounterHistory( size_t capacity, size_t numThreads, size_t numSockets )
+        : numThreads_( numThreads ), numSockets_( numSockets ), rowSize_( rowSize( numThreads, numSockets ) ),
+          capacity_( checkedCapacity( (std::max)( capacity, size_t( 2 ) ), rowSize_ ) ), values_( new uint64[ capacity_ * rowSize_ ] ),
+          times_( new std::chrono::steady_clock::time_point[ capacity_ ] ) {}
+
+    CounterHistory( CounterHistory const & ) = delete;
+    CounterHistory & operator = ( CounterHistory const & ) = delete;
+
+    static size_t rowSize( size_t numThreads, size_t numSockets ) {
+        return numThreads * numCoreCounters + ( numSockets + 1 ) * ( numCoreCounters + numUncoreCounters );
+    }
+
+    // Memory of the snapshots of a history of capacity samples, saturates instead of overflowing
+    static size_t bytes( size_t capacity, size_t numThreads, size_t numSockets ) {
+        size_t const row = rowSize( numThreads, numSockets ) * sizeof( uint64 );
+        if ( capacity > (std::numeric_limits<size_t>::max)() / row )
+            return (std::numeric_limits<size_t>::max)();
+        return capacity * row;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    size_t threadOffset( uint32 osID ) const {
+        return osID * numCoreCounters;
+    }
+    size_t socketOffset( uint32 socketID ) const {
+        return numThreads_ * numCoreCounters + socketID * ( numCoreCounters + numUncoreCounters );
+    }
+    size_t systemOffset() const {
+        return socketOffset( uint32( numSockets_ ) );
+    }
+
+    // Overwrites the oldest snapshot with the counters of ag
+    void record( Aggregator const & ag ) {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        uint64 * row = values_.get() + head_ * rowSize_;
+        auto const & ccs = ag.coreCounterStates();
+        for ( size_t t = 0; t < numThreads_ && t < ccs.size(); ++t )
+            storeCoreCounters( ccs[t], row + threadOffset( uint32( t ) ) );
+        auto const & socs = ag.socketCounterStates();
+        for ( size_t s = 0; s < numSockets_ && s < socs.size(); ++s ) {
+            storeCoreCounters( socs[s], row + socketOffset( uint32( s ) ) );
+            storeUncoreCounters( socs[s], row + socketOffset( uint32( s ) ) + numCoreCounters );
+        }
+        storeCoreCounters( ag.systemCounterState(), row + systemOffset() );
+        storeUncoreCounters( ag.systemCounterState(), row + systemOffset() + numCoreCounters );
+        times_[ head_ ] = ag.dispatchedAt();
+        head_ = ( head_ + 1 ) % capacity_;
+        count_ = (std::min)( count_ + 1, capacity_ );
+    }
+
+    // Rates between the newest snapshot and the one periods sampling periods before it; until the history has filled
+    // up the window is shortened to the oldest snapshot. Returns false while there are less than two snapshots
+    bool getRates( size_t periods, Rates & rates ) const {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if ( count_ < 2 )
+            return false;
+        periods = (std::min)( (std::max)( periods, size_t( 1 ) ), count_ - 1 );
+        size_t const newest = ( head_ + capacity_ - 1 ) % capacity_;
+        size_t const oldest = ( newest + capacity_ - periods ) % capacity_;
+        rates.epoch = times_[ newest ];
+        rates.intervalUs = std::chrono::duration_cast<std::chrono::microseconds>( times_[ newest ] - times_[ oldest ] ).count();
+        double const seconds = (std::max)( double( rates.intervalUs ) / 1e6, 1e-6 );
+        uint64 const * after = values_.get() + newest * rowSize_;
+        uint64 const * before = values_.get() + oldest * rowSize_;
+        rates.values.resize( rowSize_ );
+        for ( size_t i = 0; i < rowSize_; ++i )
+            rates.values[i] = after[i] >= before[i] ? double( after[i] - before[i] ) / seconds : 0.;
+        return true;
+    }
+
+private:
+    // Cumulative values, the counters are taken against a zero state like for the absolute endpoints
+    template <class State>
+    static void storeCoreCounters( State const & s, uint64 * row ) {
+        static State const zero{};
+        uint64 const values[] = {
+            getInstructionsRetired( zero, s ), getCycles( zero, s ), getRefCycles( zero, s ), getL3CacheMisses( zero, s ),
+            getL3CacheHits( zero, s ), getL2CacheMisses( zero, s ), getL2CacheHits( zero, s ), getInvariantTSC( zero, s ),
+            getSMICount( zero, s ), getLocalMemoryBW( zero, s ), getRemoteMemoryBW( zero, s )
+        };
+        static_assert( sizeof( values ) / sizeof( values[0] ) == numCoreCounters, "coreCounterNames and values differ" );
+        std::copy( std::begin( values ), std::end( values ), row );
+    }
+
+    static void storeUncoreCounters( SocketCounterState const & s, uint64 * row ) {
+        static SocketCounterState const zero{};
+        auto const mJ = []( double joules ) { return uint64( joules * 1000. + 0.5 ); };
+        uint64 const values[] = {
+            getBytesWrittenToMC( zero, s ), getBytesReadFromMC( zero, s ), getBytesWrittenToPMM( zero, s ),
+            getBytesReadFromPMM( zero, s ), getBytesWrittenToEDC( zero, s ), getBytesReadFromEDC( zero, s ),
+            getIARequestBytesFromMC( zero, s ), getGTRequestBytesFromMC( zero, s ), getIORequestBytesFromMC( zero, s ),
+            mJ( getConsumedJoules( zero, s ) ), mJ( getConsumedJoules( 0, zero, s ) ), mJ( getConsumedJoules( 1, zero, s ) ),
+            mJ( getDRAMConsumedJoules( zero, s ) )
+        };
+        static_assert( sizeof( values ) / sizeof( values[0] ) == numUncoreCounters, "uncoreCounterNames and values differ" );
+        std::copy( std::begin( values ), std::end( values ), row );
+    }
+
+    size_t const numThreads_;
+    size_t const numSockets_;
+    static size_t checkedCapacity( size_t capacity, size_t rowSize ) {
+        if ( capacity > maxBytes / ( rowSize * sizeof( uint64 ) ) )
+            throw std::length_error( "CounterHistory: the history of " + std::to_string( capacity ) + " samples needs more than "
+                + std::to_string( maxBytes >> 20 ) + " MiB" );
+        return capacity;
+    }
+
+    size_t const rowSize_;
+    size_t const capacity_;
+    std::unique_ptr<uint64[]> values_;
+    std::unique_ptr<std::chrono::steady_clock::time_point[]> times_;
+    size_t head_ = 0;  // next row to write
+    size_t count_ = 0; // valid rows
+    mutable std::mutex mutex_;
+};
+
+// Serializes the rates of the /rate endpoints as JSON or Prometheus text, with the counter names and labels of the
+// absolute endpoints
+class RatePrinter {
+public:
+    RatePrinter( CounterHistory const & history, CounterHistory::Rates const & rates ) : history_( history ), rates_( rates ) {}
+
+    RatePrinter( RatePrinter const & ) = delete;
+    RatePrinter & operator = ( RatePrinter const & ) = delete;
+
+    std::string json( SystemRoot const & s ) {
+        OutputBuffer out( sizeHint_ );
+        auto const printCounters = [&]( std::string_view object, size_t offset, bool uncore, std::string_view indent ) {
+            size_t const num = uncore ? CounterHistory::numUncoreCounters : CounterHistory::numCoreCounters;
+            out << indent << '"' << object << "\" : {" << HTTP_EOL;
+            for ( size_t i = 0; i < num; ++i )
+                out << indent << "  \"" << name( uncore, i ) << "\" : " << rate( offset, uncore, i ) << ( i + 1 < num ? "," : "" ) << HTTP_EOL;
+            out << indent << '}';
+        };
+        out << '{' << HTTP_EOL;
+        out << "  \"Interval us\" : " << rates_.intervalUs << ',' << HTTP_EOL;
+        out << "  \"Number of sockets\" : " << s.sockets().size() << ',' << HTTP_EOL;
+        out << "  \"Sockets\" : [" << HTTP_EOL;
+        for ( size_t si = 0; si < s.sockets().size(); ++si ) {
+            Socket * socket = s.sockets()[si];
+            out << "    {" << HTTP_EOL << "      \"Socket ID\" : " << socket->socketID() << ',' << HTTP_EOL;
+            out << "      \"Threads\" : [";
+            char const * delimiter = "";
+            for ( auto * core : socket->cores() ) {
+                for ( auto * ht : core->threads() ) {
+                    out << delimiter << HTTP_EOL << "        {" << HTTP_EOL;
+                    delimiter = ",";
+                    out << "          \"Core ID\" : " << core->socketUniqueCoreID() << ',' << HTTP_EOL;
+                    out << "          \"Thread ID\" : " << ht->threadID() << ',' << HTTP_EOL;
+                    out << "          \"OS ID\" : " << ht->osID() << ',' << HTTP_EOL;
+                    printCounters( "Core Counters", history_.threadOffset( ht->osID() ), false, "          " );
+                    out << HTTP_EOL << "        }";
+                }
+            }
+            out << HTTP_EOL << "      ]," << HTTP_EOL;
+            size_t const offset = history_.socketOffset( socket->socketID() );
+            printCounters( "Core Aggregate", offset, false, "      " );
+            out << ',' << HTTP_EOL;
+            printCounters( "Uncore Counters", offset, true, "      " );
+            out << HTTP_EOL << "    }" << ( si + 1 < s.sockets().size() ? "," : "" ) << HTTP_EOL;
+        }
+        out << "  ]," << HTTP_EOL;
+        printCounters( "Core Aggregate", history_.systemOffset(), false, "  " );
+        out << ',' << HTTP_EOL;
+        printCounters( "Uncore Aggregate", history_.systemOffset(), true, "  " );
+        out << HTTP_EOL << '}' << HTTP_EOL;
+        return release( out );
+    }
+
+    std::string prometheus( SystemRoot const & s ) {
+        OutputBuffer out( sizeHint_ );
+        auto const printCounters = [&]( std::string_view labels, size_t offset, bool uncore ) {
+            size_t const num = uncore ? CounterHistory::numUncoreCounters : CounterHistory::numCoreCounters;
+            for ( size_t i = 0; i < num; ++i ) {
+                out.appendMetricName( name( uncore, i ) );
+                out << '{' << labels << "} " << rate( offset, uncore, i ) << PROM_EOL;
+            }
+        };
+        out << "Measurement_Interval_in_us " << rates_.intervalUs << PROM_EOL;
+        out << "Number_of_sockets " << s.sockets().size() << PROM_EOL;
+        std::string labels;
+        for ( auto * socket : s.sockets() ) {
+            std::string const socketLabel = "socket=\"" + std::to_string( socket->socketID() ) + "\"";
+            out << "# Core Counters Socket " << socket->socketID() << PROM_EOL;
+            for ( auto * core : socket->cores() ) {
+                for ( auto * ht : core->threads() ) {
+                    labels = socketLabel + ",core=\"" + std::to_string( core->socketUniqueCoreID() ) + "\",thread=\"" + std::to_string( ht->threadID() ) + "\",source=\"core\"";
+                    printCounters( labels, history_.threadOffset( ht->osID() ), false );
+                }
+            }
+            size_t const offset = history_.socketOffset( socket->socketID() );
+            out << "# Uncore Counters Socket " << socket->socketID() << PROM_EOL;
+            printCounters( socketLabel + ",source=\"uncore\"", offset, true );
+            out << "# Core Counters Aggregate Socket " << socket->socketID() << PROM_EOL;
+            printCounters( socketLabel + ",aggregate=\"socket\",source=\"core\"", offset, false );
+        }
+        out << "# Core Counters Aggregate System" << PROM_EOL;
+        printCounters( "aggregate=\"system\",source=\"core\"", history_.systemOffset(), false );
+        out << "# Uncore Counters Aggregate System" << PROM_EOL;
+        printCounters( "aggregate=\"system\",source=\"uncore\"", history_.systemOffset(), true );
+        return release( out );
+    }
+
+private:
+    static char const * name( bool uncore, size_t i ) {
+        return uncore ? CounterHistory::uncoreCounterNames[i] : CounterHistory::coreCounterNames[i];
+    }
+
+    // offset is the row offset of the thread, socket or system; the uncore counters follow its core counters
+    double rate( size_t offset, bool uncore, size_t i ) const {
+        if ( ! uncore )
+            return rates_.values[ offset + i ];
+        double const value = rates_.values[ offset + CounterHistory::numCoreCounters + i ];
+        return i >= CounterHistory::firstJoulesCounter ? value / 1000. : value;
+    }
+
+    static std::string release( OutputBuffer & out ) {
+        std::string text = out.release();
+        sizeHint_ = text.size() + text.size() / 16;
+        return text;
+    }
+
+    inline static std::atomic<size_t> sizeHint_{ 64 * 1024 }; // size of the last output
+    CounterHistory const & history_;
+    CounterHistory::Rates const & rates_;
+};
+
+#ifdef __linux__
+// Connection state of the epoll event loop, owned by the I/O thread that accepted the connection
+struct EventLoopConnection {
+    struct PendingResponse {
+        std::string head;
+        std::shared_ptr<std::string const> body; // shared with the response cache, never copied
+        size_t sent;                             // bytes of head and body written so far
+    };
+    socket_t fd;
+    std::string input;                   // received bytes not consumed by a request yet
+    std::deque<PendingResponse> output;  // responses in request order, pipelined requests queue up here
+    int numRequests = 0;
+    bool firstByteChecked = false;
+    bool closeAfterWrite = false;        // no more requests are read, close when the output is written
+    bool peerClosed = false;
+    bool readable = false;               // the socket may have unread data (edge-triggered: until recv returns EAGAIN)
+    bool requestInFlight = false;        // a worker runs the handler of the oldest unanswered request
+    bool closed = false;                 // the socket is closed, the object waits for the response in flight
+    std::chrono::steady_clock::time_point lastActivity;
+
+    explicit EventLoopConnection( socket_t fd_ ) : fd( fd_ ), lastActivity( std::chrono::steady_clock::now() ) {}
+};
+
+// Responses of the request handlers for the connections of one I/O thread, posting one wakes up its epoll_wait
+class CompletedRequests {
+public:
+    struct Completion {
+        EventLoopConnection * connection;
+        EventLoopConnection::PendingResponse response;
+        bool keepAlive;
+    };
+
+    CompletedRequests() : eventFD_( ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) {
+        if ( eventFD_ < 0 )
+            throw std::runtime_error( std::string( "HTTPServer: can't create an eventfd: " ) + strerror( errno ) );
+    }
+    CompletedRequests( CompletedRequests const & ) = delete;
+    CompletedRequests & operator = ( CompletedRequests const & ) = delete;
+    ~CompletedRequests() {
+        ::close( eventFD_ );
+    }
+
+    int eventFD() const {
+        return eventFD_;
+    }
+
+    void post( Completion completion ) {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            completions_.push_back( std::move( completion ) );
+        }
+        uint64_t const one = 1;
+        if ( ::write( eventFD_, &one, sizeof( one ) ) < 0 && errno != EAGAIN )
+            DBG( 0, "HTTPServer: writing the eventfd failed: ", strerror( errno ) );
+    }
+
+    std::vector<Completion> take() {
+        uint64_t count = 0;
+        if ( ::read( eventFD_, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+            DBG( 0, "HTTPServer: reading the eventfd failed: ", strerror( errno ) );
+        std::vector<Completion> completions;
+        std::lock_guard<std::mutex> lock( mutex_ );
+        completions.swap( completions_ );
+        return completions;
+    }
+
+private:
+    int const eventFD_;
+    std::mutex mutex_;
+    std::vector<Completion> completions_;
+};
+
+// Threads running the request handlers of the event loop. Handlers wait for samples (up to maxPersecondSeconds
+// for /persecond/X after startup) or read all counters (?fresh=1), the I/O threads never run them
+class RequestWorkers {
+public:
+    explicit RequestWorkers( unsigned numThreads ) {
+        for ( unsigned i = 0; i < numThreads; ++i )
+            threads_.emplace_back( &RequestWorkers::run, this );
+    }
+    RequestWorkers( RequestWorkers const & ) = delete;
+    RequestWorkers & operator = ( RequestWorkers const & ) = delete;
+
+    // Runs the queued jobs and joins the threads
+    ~RequestWorkers() {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for ( auto & t : threads_ )
+            t.join();
+    }
+
+    void post( std::function<void()> job ) {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            jobs_.push( std::move( job ) );
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void run() {
+        while ( true ) {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            cv_.wait( lock, [this]() { return stopping_ || ! jobs_.empty(); } );
+            if ( jobs_.empty() )
+                return;
+            auto job = std::move( jobs_.front() );
+            jobs_.pop();
+            lock.unlock();
+            job();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::queue<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
+#endif
+
 class HTTPServer : public Server {
 public:
-    HTTPServer() : Server( "", 80 ), stopped_( false ){
+    HTTPServer() : Server( "", 80 ), persecondRing_( maxPersecondSeconds + 1 ), history_( historyCapacity( sampling_ ),
+        PCM::getInstance()->getNumCores(), PCM::getInstance()->getNumSockets() ), stopped_( false ) {
         DBG( 3, "HTTPServer::HTTPServer()" );
         callbackList_.resize( 256 );
         createPeriodicCounterFetcher();
@@ -3312,8 +3940,10 @@ public:
         SignalHandler::getInstance()->setHTTPServer( this );
     }
 
-    HTTPServer( std::string const & ip, uint16_t port, bool useIPv4 = false ) : Server( ip, port, useIPv4 ), stopped_( false ) {
-        DBG( 3, "HTTPServer::HTTPServer( ip=", ip, ", port=", port, " )" );
+    HTTPServer( std::string const & ip, uint16_t port, bool useIPv4 = false, SamplingOptions const & sampling = SamplingOptions() )
+        : Server( ip, port, useIPv4 ), sampling_( sampling ), persecondRing_( maxPersecondSeconds + 1 ), history_( historyCapacity( sampling ),
+        PCM::getInstance()->getNumCores(), PCM::getInstance()->getNumSockets() ), stopped_( false ) {
+        DBG( 3, "HTTPServer::HTTPServer( ip=", ip, ", port=", port, ", sampling period=", sampling.period.count(), "ms )" );
         callbackList_.resize( 256 );
         createPeriodicCounterFetcher();
         pcf_->start();
@@ -3357,30 +3987,116 @@ public:
         callbackList_[rm] = nullptr;
     }
 
+    // /persecond/X serves full samples, at most this many seconds apart
+    static constexpr size_t maxPersecondSeconds = 30;
+
+    static size_t historyCapacity( SamplingOptions const & sampling ) {
+        return size_t( std::chrono::duration_cast<std::chrono::milliseconds>( sampling.history ).count() / sampling.period.count() ) + 1;
+    }
+
+    // Longest history (whole seconds) of the sampling period whose snapshots fit into CounterHistory::maxBytes
+    static std::chrono::seconds maxHistory( std::chrono::milliseconds period, size_t numThreads, size_t numSockets ) {
+        size_t const samples = CounterHistory::maxBytes / CounterHistory::bytes( 1, numThreads, numSockets );
+        return std::chrono::seconds( samples > 1 ? ( samples - 1 ) * size_t( period.count() ) / 1000 : 0 );
+    }
+
+    SamplingOptions const & samplingOptions() const {
+        return sampling_;
+    }
+
+    CounterHistory const & counterHistory() const {
+        return history_;
+    }
+
     void addAggregator( std::shared_ptr<Aggregator> agp ) {
         DBG( 4, "HTTPServer::addAggregator( agp=", std::hex, agp.get(), " ) called" );
 
-        agVectorMutex_.lock();
-        agVector_.insert( agVector_.begin(), agp );
-        if ( agVector_.size() > 30 ) {
-            DBG( 4, "HTTPServer::addAggregator(): Removing last Aggegator" );
-            agVector_.pop_back();
+        history_.record( *agp );
+        std::lock_guard<std::mutex> lock( aggregatorsMutex_ );
+        latest_ = agp;
+        // the ring of /persecond keeps one sample per second, the one that is closest to a multiple of a second
+        if ( 0 == ( numSamples_++ % samplesPerSecond() ) ) {
+            persecondRing_[ persecondHead_ ] = agp;
+            persecondHead_ = ( persecondHead_ + 1 ) % persecondRing_.size();
+            persecondCount_ = (std::min)( persecondCount_ + 1, persecondRing_.size() );
         }
-        agVectorMutex_.unlock();
     }
 
+    // Samples index and index2 seconds before the newest sample of the /persecond ring
     std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> getAggregators( size_t index, size_t index2 ) {
         if ( index == index2 )
             throw std::runtime_error("BUG: getAggregator: both indices are equal. Fix the code!" );
+        if ( (std::max)( index, index2 ) > maxPersecondSeconds )
+            throw std::runtime_error("BUG: getAggregator: index is larger than the /persecond ring. Fix the code!" );
 
+        std::unique_lock<std::mutex> lock( aggregatorsMutex_ );
         // simply wait until we have enough samples to return
-        while( agVector_.size() < ( (std::max)( index, index2 ) + 1 ) )
+        while ( persecondCount_ < ( (std::max)( index, index2 ) + 1 ) ) {
+            throwIfStopped();
+            lock.unlock();
             std::this_thread::sleep_for(std::chrono::seconds(1));
+            lock.lock();
+        }
+        auto const at = [this]( size_t i ) {
+            return persecondRing_[ ( persecondHead_ + persecondRing_.size() - 1 - i ) % persecondRing_.size() ];
+        };
+        return std::make_pair( at( index ), at( index2 ) );
+    }
+
+    // Latest sample of the PeriodicCounterFetcher, waits for the first sample after startup
+    std::shared_ptr<Aggregator> getLatestAggregator() {
+        std::unique_lock<std::mutex> lock( aggregatorsMutex_ );
+        while ( nullptr == latest_.get() ) {
+            throwIfStopped();
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            lock.lock();
+        }
+        return latest_;
+    }
+
+    // Rates over the last periods sampling periods, waits for the first two samples after startup
+    CounterHistory::Rates getRates( size_t periods ) {
+        CounterHistory::Rates rates;
+        while ( ! history_.getRates( periods, rates ) ) {
+            throwIfStopped();
+            std::this_thread::sleep_for( sampling_.period );
+        }
+        return rates;
+    }
+
+    // Reads all counters now; requests arriving while a read is in flight share its result instead of reading again
+    std::shared_ptr<Aggregator> getFreshAggregator() {
+        std::shared_future<std::shared_ptr<Aggregator>> read;
+        std::promise<std::shared_ptr<Aggregator>> promise;
+        bool owner = false;
+        {
+            std::lock_guard<std::mutex> lock( freshReadMutex_ );
+            if ( ! freshRead_.valid() ) {
+                freshRead_ = promise.get_future().share();
+                owner = true;
+            }
+            read = freshRead_;
+        }
+        if ( owner ) {
+            DBG( 3, "HTTPServer::getFreshAggregator: reading all counters" );
+            try {
+                auto agp = std::make_shared<Aggregator>();
+                agp->dispatch( PCM::getInstance()->getSystemTopology() );
+                promise.set_value( agp );
+            } catch ( ... ) {
+                promise.set_exception( std::current_exception() );
+            }
+            std::lock_guard<std::mutex> lock( freshReadMutex_ );
+            freshRead_ = std::shared_future<std::shared_ptr<Aggregator>>();
+        } else {
+            DBG( 3, "HTTPServer::getFreshAggregator: joining the read in flight" );
+        }
+        return read.get();
+    }
 
-        agVectorMutex_.lock();
-        auto ret = std::make_pair( agVector_[ index ], agVector_[ index2 ] );
-        agVectorMutex_.unlock();
-        return ret;
+    ResponseCache & responseCache() {
+        return responseCache_;
     }
 
     bool checkForIncomingSSLConnection( socket_t fd ) {
@@ -3413,6 +4129,25 @@ public:
     }
 
 private:
+    // The waits for samples end when the server stops, the handlers waiting in them are answered with an error
+    void throwIfStopped() const {
+        if ( stopped_ )
+            throw std::runtime_error( "HTTPServer is stopping" );
+    }
+
+#ifdef __linux__
+    // epoll event loop: a few I/O threads with edge-triggered non-blocking sockets, persistent connections and pipelining.
+    // The requests of a connection are handled one at a time on the RequestWorkers, in request order
+    void runEventLoop();
+    void eventLoopThread( RequestWorkers & workers );
+    void acceptConnections( int epollFD, std::unordered_set<EventLoopConnection*> & connections );
+    bool serviceConnection( EventLoopConnection & c, RequestWorkers & workers, std::shared_ptr<CompletedRequests> const & completed );
+    bool readInput( EventLoopConnection & c );
+    void processInput( EventLoopConnection & c, RequestWorkers & workers, std::shared_ptr<CompletedRequests> const & completed );
+    void queueResponse( EventLoopConnection & c, HTTPResponse const & response );
+    bool writeOutput( EventLoopConnection & c );
+#endif
+
     void createPeriodicCounterFetcher() {
         // We keep a pointer to pcf to start and stop execution
         // not to delete it when done with it, that is up to threadpool/workqueue
@@ -3421,12 +4156,26 @@ private:
         pcf_->start();
     }
 
+    // exact, the period divides a second (SamplingOptions::isValidPeriod)
+    size_t samplesPerSecond() const {
+        return size_t( 1000 / sampling_.period.count() );
+    }
+
 protected:
     std::vector<http_callback>               callbackList_;
-    std::vector<std::shared_ptr<Aggregator>> agVector_;
-    std::mutex agVectorMutex_;
+    SamplingOptions const                    sampling_;
+    std::mutex aggregatorsMutex_;
+    std::shared_ptr<Aggregator>              latest_;
+    std::vector<std::shared_ptr<Aggregator>> persecondRing_; // newest sample at persecondHead_ - 1
+    size_t persecondHead_ = 0;
+    size_t persecondCount_ = 0;
+    size_t numSamples_ = 0;
+    CounterHistory history_;
+    std::mutex freshReadMutex_;
+    std::shared_future<std::shared_ptr<Aggregator>> freshRead_;
+    ResponseCache responseCache_;
     PeriodicCounterFetcher* pcf_;
-    bool stopped_;
+    std::atomic<bool> stopped_;
 };
 
 // Here to break dependency on HTTPServer
@@ -3464,8 +4213,9 @@ void SignalHandler::handleSignal( int signum )
 
 void PeriodicCounterFetcher::execute() {
     using namespace std::chrono;
+    auto const period = hs_->samplingOptions().period;
     system_clock::time_point now = system_clock::now();
-    now = now + std::chrono::seconds(1);
+    now = now + period;
     std::this_thread::sleep_until( now );
     while( 1 ) {
         if ( exit_ )
@@ -3484,12 +4234,21 @@ void PeriodicCounterFetcher::execute() {
             auto elapsed = duration_cast<std::chrono::milliseconds>(after - before);
             DBG( 4, "Aggregation Duration: ", elapsed.count(), "ms." );
         }
-        now = now + std::chrono::seconds(1);
+        now = now + period;
+        // a sample that took longer than the period is followed by the next one right away, missed samples are not caught up
+        if ( now < system_clock::now() )
+            now = system_clock::now();
         std::this_thread::sleep_until( now );
     }
 }
 
 void HTTPServer::run() {
+#ifdef __linux__
+    if ( safe_getenv( "PCM_SENSOR_SERVER_BLOCKING_IO" ) != std::string( "1" ) ) {
+        runEventLoop();
+        return;
+    }
+#endif
     struct sockaddr_in clientAddress;
     clientAddress.sin_family = AF_INET;
     socket_t clientSocketFD = INVALID_SOCKET;
@@ -3563,11 +4322,375 @@ void HTTPServer::run() {
     }
 }
 
+#ifdef __linux__
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0 // before Linux 4.5 all I/O threads wake up on a new connection, all but one find nothing to accept
+#endif
+
+namespace {
+// Requests (line, headers and body) larger than this are rejected
+size_t const maxRequestSize = 64 * 1024;
+// Received bytes kept per connection, the rest stays in the socket until the buffered requests are handled
+size_t const maxBufferedInput = maxRequestSize + 16 * 1024;
+// A connection is not read while this many responses wait to be written, e.g. for a client that pipelines without reading
+size_t const maxQueuedResponses = 16;
+
+// Position after the empty line that ends the request line and headers, npos if it has not been received completely
+size_t findEndOfHead( std::string const & input ) {
+    size_t const crlf = input.find( "\n\r\n" );
+    size_t const lf   = input.find( "\n\n" );
+    if ( crlf != std::string::npos && ( lf == std::string::npos || crlf < lf ) )
+        return crlf + 3;
+    if ( lf != std::string::npos )
+        return lf + 2;
+    return std::string::npos;
+}
+}
+
+void HTTPServer::runEventLoop() {
+    // accept() returns EAGAIN instead of blocking when another I/O thread took the connection
+    int const flags = ::fcntl( serverSocket_, F_GETFL, 0 );
+    if ( flags < 0 || ::fcntl( serverSocket_, F_SETFL, flags | O_NONBLOCK ) < 0 )
+        throw std::runtime_error( std::string( "HTTPServer: can't make the server socket non-blocking: " ) + strerror( errno ) );
+
+    unsigned const numIOThreads = (std::max)( 1U, (std::min)( 4U, std::thread::hardware_concurrency() ) );
+    // the handlers mostly wait for samples, more workers than I/O threads keep a slow request from delaying the others
+    unsigned const numWorkers = 16;
+    DBG( 1, "HTTPServer: starting the event loop with ", numIOThreads, " I/O threads and ", numWorkers, " request workers" );
+    RequestWorkers workers( numWorkers );
+    std::vector<std::thread> ioThreads;
+    for ( unsigned i = 0; i < numIOThreads; ++i )
+        ioThreads.emplace_back( &HTTPServer::eventLoopThread, this, std::ref( workers ) );
+    for ( auto & t : ioThreads )
+        t.join();
+}
+
+void HTTPServer::eventLoopThread( RequestWorkers & workers ) {
+    int const epollFD = ::epoll_create1( EPOLL_CLOEXEC );
+    if ( epollFD < 0 ) {
+        DBG( 0, "HTTPServer: epoll_create1 failed: ", strerror( errno ) );
+        return;
+    }
+    // Every I/O thread waits for new connections, EPOLLEXCLUSIVE wakes only one of them. The server socket is
+    // level-triggered, connections are edge-triggered and owned by the thread that accepted them (no locking)
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = nullptr;
+    if ( ::epoll_ctl( epollFD, EPOLL_CTL_ADD, serverSocket_, &ev ) < 0 ) {
+        DBG( 0, "HTTPServer: adding the server socket to epoll failed: ", strerror( errno ) );
+        ::close( epollFD );
+        return;
+    }
+    // The workers post the responses for the connections of this thread here, shared with the jobs still queued
+    // when the thread ends
+    std::shared_ptr<CompletedRequests> completed;
+    try {
+        completed = std::make_shared<CompletedRequests>();
+    } catch ( std::exception const & e ) {
+        DBG( 0, e.what() );
+        ::close( epollFD );
+        return;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = completed.get();
+    if ( ::epoll_ctl( epollFD, EPOLL_CTL_ADD, completed->eventFD(), &ev ) < 0 ) {
+        DBG( 0, "HTTPServer: adding the eventfd to epoll failed: ", strerror( errno ) );
+        ::close( epollFD );
+        return;
+    }
+
+    std::unordered_set<EventLoopConnection*> connections;
+    auto closeConnection = [&connections]( EventLoopConnection * c ) {
+        DBG( 3, "HTTPServer: closing connection ", c->fd, " after ", c->numRequests, " requests" );
+        ::close( c->fd ); // also removes it from the epoll set
+        if ( c->requestInFlight ) {
+            c->closed = true; // deleted when the worker posts the response
+            return;
+        }
+        connections.erase( c );
+        delete c;
+    };
+
+    std::vector<struct epoll_event> events( 64 );
+    auto lastIdleCheck = std::chrono::steady_clock::now();
+    while ( ! stopped_ ) {
+        // The timeout bounds the reaction time to stop() and the idle check
+        int const n = ::epoll_wait( epollFD, events.data(), (int)events.size(), 1000 );
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            DBG( 0, "HTTPServer: epoll_wait failed: ", strerror( errno ) );
+            break;
+        }
+        auto const now = std::chrono::steady_clock::now();
+        bool responsesPosted = false;
+        for ( int i = 0; i < n; ++i ) {
+            void * const source = events[i].data.ptr;
+            if ( nullptr == source ) {
+                acceptConnections( epollFD, connections );
+                continue;
+            }
+            if ( completed.get() == source ) {
+                responsesPosted = true; // after the connection events: those may refer to connections closed by a response
+                continue;
+            }
+            auto * c = static_cast<EventLoopConnection*>( source );
+            c->lastActivity = now;
+            if ( events[i].events & EPOLLERR ) {
+                closeConnection( c );
+                continue;
+            }
+            if ( events[i].events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP ) )
+                c->readable = true;
+            if ( ! serviceConnection( *c, workers, completed ) )
+                closeConnection( c );
+        }
+        if ( responsesPosted ) {
+            for ( auto & done : completed->take() ) {
+                auto * c = done.connection;
+                c->requestInFlight = false;
+                if ( c->closed ) {
+                    connections.erase( c );
+                    delete c;
+                    continue;
+                }
+                c->lastActivity = now;
+                c->output.push_back( std::move( done.response ) );
+                if ( ! done.keepAlive )
+                    c->closeAfterWrite = true;
+                if ( ! serviceConnection( *c, workers, completed ) )
+                    closeConnection( c );
+            }
+        }
+        if ( now - lastIdleCheck >= std::chrono::seconds( 1 ) ) {
+            lastIdleCheck = now;
+            std::vector<EventLoopConnection*> idle;
+            for ( auto * c : connections ) {
+                if ( ! c->closed && ! c->requestInFlight && c->output.empty() && now - c->lastActivity >= std::chrono::seconds( keepAliveTimeout ) )
+                    idle.push_back( c );
+            }
+            for ( auto * c : idle )
+                closeConnection( c );
+        }
+    }
+    // responses posted after this are dropped with the last reference to completed
+    for ( auto * c : connections ) {
+        if ( ! c->closed )
+            ::close( c->fd );
+        delete c;
+    }
+    ::close( epollFD );
+}
+
+void HTTPServer::acceptConnections( int epollFD, std::unordered_set<EventLoopConnection*> & connections ) {
+    while ( ! stopped_ ) {
+        socket_t const fd = ::accept4( serverSocket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( INVALID_SOCKET == fd ) {
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                DBG( 3, "accept4 returned -1, errno: ", strerror( errno ) );
+            return;
+        }
+        // Responses are written in one writev call, there is nothing to coalesce
+        int const one = 1;
+        ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+        auto * c = new EventLoopConnection( fd );
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if ( ::epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &ev ) < 0 ) {
+            DBG( 0, "HTTPServer: adding a connection to epoll failed: ", strerror( errno ) );
+            ::close( fd );
+            delete c;
+            continue;
+        }
+        connections.insert( c );
+        DBG( 3, "HTTPServer: accepted connection ", fd );
+    }
+}
+
+bool HTTPServer::serviceConnection( EventLoopConnection & c, RequestWorkers & workers, std::shared_ptr<CompletedRequests> const & completed ) {
+    // Written output makes room in the output queue, the queue and the input buffer bound reading: the unread data
+    // stays in the socket (readable stays set) until a response or an EPOLLOUT event calls this again
+    if ( ! writeOutput( c ) )
+        return false;
+    if ( c.readable && c.output.size() < maxQueuedResponses ) {
+        if ( ! readInput( c ) )
+            return false;
+    }
+    processInput( c, workers, completed );
+    if ( ! writeOutput( c ) )
+        return false;
+    // keep the connection until the request in flight is answered and all queued responses are written
+    return c.requestInFlight || ! c.output.empty() || ! ( c.closeAfterWrite || c.peerClosed );
+}
+
+bool HTTPServer::readInput( EventLoopConnection & c ) {
+    // Edge-triggered: read until the socket is drained, otherwise no new event arrives for the remaining data
+    char buffer[16384];
+    while ( true ) {
+        size_t room = sizeof( buffer );
+        if ( ! c.closeAfterWrite ) {
+            if ( c.input.size() >= maxBufferedInput )
+                return true;
+            room = (std::min)( room, maxBufferedInput - c.input.size() );
+        }
+        ssize_t const bytes = ::recv( c.fd, buffer, room, 0 );
+        if ( bytes > 0 ) {
+            if ( ! c.closeAfterWrite )
+                c.input.append( buffer, (size_t)bytes );
+            continue;
+        }
+        if ( bytes == 0 ) {
+            c.peerClosed = true;
+            c.readable = false;
+            return true;
+        }
+        if ( errno == EINTR )
+            continue;
+        if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+            c.readable = false;
+            return true;
+        }
+        DBG( 3, "recv on connection ", c.fd, " failed: ", strerror( errno ) );
+        return false;
+    }
+}
+
+void HTTPServer::processInput( EventLoopConnection & c, RequestWorkers & workers, std::shared_ptr<CompletedRequests> const & completed ) {
+    if ( ! c.firstByteChecked && ! c.input.empty() ) {
+        c.firstByteChecked = true;
+        char const ch = c.input[0];
+        // for SSLv2 bit 7 is set and for SSLv3 and up the first ClientHello Message is 0x16
+        if ( ( ch & 0x80 ) || ( ch == 0x16 ) ) {
+            DBG( 0, "Client wants SSL but we can't speak SSL ourselves" );
+            c.input.clear();
+            c.closeAfterWrite = true;
+            return;
+        }
+    }
+    // Requests are answered in order: the next pipelined request is taken when the response of the previous one is queued
+    if ( c.closeAfterWrite || c.requestInFlight || c.output.size() >= maxQueuedResponses )
+        return;
+    HTTPRequest  request;
+    HTTPResponse response;
+    size_t const headEnd = findEndOfHead( c.input );
+    if ( std::string::npos == headEnd ) {
+        if ( c.input.size() > maxRequestSize ) {
+            response.setProtocol( HTTPProtocol::HTTP_1_1 );
+            response.createResponse( TextPlain, std::string( "431 Request Header Fields Too Large" ), RC_431_RequestHeaderFieldsTooLarge );
+            queueResponse( c, response );
+            c.closeAfterWrite = true;
+        }
+        return; // wait for the rest of the request
+    }
+    size_t requestSize = headEnd;
+    try {
+        std::istringstream head( c.input.substr( 0, headEnd ) );
+        readRequestHead( head, request );
+        if ( HTTPMethodProperties::requestHasBody( request.method() ) != HTTPRequestHasBody::No ) {
+            if ( request.hasHeader( "Transfer-Encoding" ) )
+                throw std::runtime_error( "Chunked request bodies are not supported" );
+            if ( request.hasHeader( "Content-Length" ) ) {
+                size_t const contentLength = request.getHeader( "Content-Length" ).headerValueAsNumber();
+                if ( contentLength > maxRequestSize - headEnd )
+                    throw std::runtime_error( "Request body too large" );
+                if ( c.input.size() < headEnd + contentLength )
+                    return; // wait for the rest of the body
+                request.addBody( c.input.substr( headEnd, contentLength ) );
+                requestSize += contentLength;
+            } else if ( HTTPMethodProperties::requestHasBody( request.method() ) == HTTPRequestHasBody::Required ) {
+                throw std::runtime_error( "Bad Request received" );
+            }
+        }
+    } catch( std::exception& e ) {
+        DBG( 3, "Reading request from connection ", c.fd, ": Exception caught: ", e.what() );
+        // Use the protocol that the client used or simply respond with HTTP/1.1 if it could not be determined
+        response.setProtocol( request.isInitialized() ? request.protocol() : HTTPProtocol::HTTP_1_1 );
+        response.createResponse( TextPlain, std::string( "400 Bad Request" ), RC_400_BadRequest );
+        queueResponse( c, response );
+        c.closeAfterWrite = true;
+        return;
+    }
+    c.input.erase( 0, requestSize );
+    ++c.numRequests;
+    c.requestInFlight = true;
+    // The job does not touch the connection, the I/O thread keeps it until the response arrives (closing it while
+    // the request is in flight only marks it closed) or drops the response when the thread ends
+    workers.post( [this, connection = &c, fd = c.fd, numRequests = c.numRequests, request, completed]() {
+        HTTPResponse response;
+        bool keepAlive = false;
+        try {
+            processRequest( this, callbackList_, request, response, numRequests, true, keepAlive );
+        } catch( std::exception& e ) {
+            DBG( 3, "Handling request ", numRequests, " of connection ", fd, ": Exception caught: ", e.what() );
+            response = HTTPResponse();
+            response.setProtocol( request.protocol() );
+            response.createResponse( TextPlain, std::string( "503 Service Unavailable" ), RC_503_ServiceUnavailable );
+            keepAlive = false;
+        }
+        completed->post( CompletedRequests::Completion{ connection, EventLoopConnection::PendingResponse{ response.head(), response.sharedBody(), 0 }, keepAlive } );
+    } );
+}
+
+void HTTPServer::queueResponse( EventLoopConnection & c, HTTPResponse const & response ) {
+    c.output.push_back( EventLoopConnection::PendingResponse{ response.head(), response.sharedBody(), 0 } );
+}
+
+bool HTTPServer::writeOutput( EventLoopConnection & c ) {
+    while ( ! c.output.empty() ) {
+        // gather the unsent parts of the queued responses into one system call
+        struct iovec iov[64];
+        int numIov = 0;
+        for ( auto it = c.output.begin(); it != c.output.end() && numIov + 2 <= 64; ++it ) {
+            size_t const headSize = it->head.size();
+            size_t const bodySize = it->body ? it->body->size() : 0;
+            if ( it->sent < headSize ) {
+                iov[numIov].iov_base = const_cast<char*>( it->head.data() + it->sent );
+                iov[numIov].iov_len  = headSize - it->sent;
+                ++numIov;
+            }
+            size_t const bodySent = it->sent > headSize ? it->sent - headSize : 0;
+            if ( bodySent < bodySize ) {
+                iov[numIov].iov_base = const_cast<char*>( it->body->data() + bodySent );
+                iov[numIov].iov_len  = bodySize - bodySent;
+                ++numIov;
+            }
+        }
+        ssize_t written = ::writev( c.fd, iov, numIov );
+        if ( written < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return true; // EPOLLOUT resumes the write
+            DBG( 3, "writev on connection ", c.fd, " failed: ", strerror( errno ) );
+            return false;
+        }
+        while ( written > 0 && ! c.output.empty() ) {
+            auto & front = c.output.front();
+            size_t const total = front.head.size() + ( front.body ? front.body->size() : 0 );
+            size_t const step = (std::min)( (size_t)written, total - front.sent );
+            front.sent += step;
+            written -= step;
+            if ( front.sent == total )
+                c.output.pop_front();
+        }
+        // responses without body
+        while ( ! c.output.empty() && c.output.front().sent == c.output.front().head.size() + ( c.output.front().body ? c.output.front().body->size() : 0 ) )
+            c.output.pop_front();
+    }
+    return true;
+}
+#endif // __linux__
+
 #if defined (USE_SSL)
 class HTTPSServer : public HTTPServer {
 public:
     HTTPSServer() : HTTPServer( "", 443 ) {}
-    HTTPSServer( std::string const & ip, uint16_t port, bool useIPv4 = false ) : HTTPServer( ip, port, useIPv4 ), sslCTX_( nullptr ) {}
+    HTTPSServer( std::string const & ip, uint16_t port, bool useIPv4 = false, SamplingOptions const & sampling = SamplingOptions() )
+        : HTTPServer( ip, port, useIPv4, sampling ), sslCTX_( nullptr ) {}
     HTTPSServer( HTTPSServer const & ) = delete;
     HTTPSServer & operator = ( HTTPSServer const & ) = delete;
     virtual ~HTTPSServer() {
@@ -3769,14 +4892,24 @@ inline constexpr signed char operator "" _uc( unsigned long long arg ) noexcept
 
 #include "favicon.ico.h"
 
-std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> getNullAndCurrentAggregator() {
-    std::shared_ptr<Aggregator> current = std::make_shared<Aggregator>();
-    std::shared_ptr<Aggregator> null    = std::make_shared<Aggregator>();
+// Absolute counters: the null Aggregator is never dispatched, its counters and dispatch time are zero.
+// The current Aggregator is the latest periodic sample or, if the client asked for it, a fresh (coalesced) read
+std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> getNullAndCurrentAggregator( HTTPServer* hs, bool fresh ) {
+    static const std::shared_ptr<Aggregator> null = std::make_shared<Aggregator>();
+    std::shared_ptr<Aggregator> current = fresh ? hs->getFreshAggregator() : hs->getLatestAggregator();
     assert(current.get());
-    current->dispatch( PCM::getInstance()->getSystemTopology() );
     return std::make_pair( null, current );
 }
 
+// "?fresh=1" asks for a read of all counters at request time instead of the latest periodic sample
+bool freshReadRequested( URL const & url ) {
+    for ( auto const & argument : url.arguments_ ) {
+        if ( argument.first == "fresh" )
+            return argument.second == "1" || argument.second == "true";
+    }
+    return false;
+}
+
 enum OutputFormat {
     Prometheus_0_0_4 = 1,
     JSON,
@@ -3866,6 +4999,8 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
     }
 
     std::pair<std::shared_ptr<Aggregator>,std::shared_ptr<Aggregator>> aggregatorPair;
+    // endpoint name of the response cache, /persecond variants are normalized to /persecond/X
+    std::string endpoint = url.path_;
 
     if ( (1 == url.path_.size()) && (url.path_ == "/") ) {
         DBG( 3, "my_get_callback: client requesting '/'" );
@@ -3883,12 +5018,14 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
   <body>\n\
     <h1>PCM Sensor Server</h1>\n\
     <p>PCM Sensor Server provides performance counter data through an HTTP interface. By default this text is served when requesting the endpoint \"/\".</p>\n\
-    <p>The endpoints for retrieving counter data, /, /persecond and /persecond/X, support returning data in JSON or prometheus format. For JSON have your client send the HTTP header \"Accept: application/json\" and for prometheus \"Accept: text/plain; version=0.0.4\" along with the request, PCM Sensor Server will then return the counter data in the requested format.</p>\n\
+    <p>The endpoints for retrieving counter data, /, /persecond, /persecond/X, /rate and /rate/X, support returning data in JSON or prometheus format. For JSON have your client send the HTTP header \"Accept: application/json\" and for prometheus \"Accept: text/plain; version=0.0.4\" along with the request, PCM Sensor Server will then return the counter data in the requested format.</p>\n\
     <p>Endpoints you can call are:</p>\n\
     <ul>\n\
-      <li>/ : This will fetch the counter values since start of the daemon, minus overflow so should be considered absolute numbers and should be used for further processing by yourself.</li>\n\
-      <li>/persecond : This will fetch data from the internal sample thread which samples every second and returns the difference between the last 2 samples.</li>\n\
-      <li>/persecond/X : This will fetch data from the internal sample thread which samples every second and returns the difference between the last 2 samples which are X seconds apart. X can be at most 30 seconds without changing the source code.</li>\n\
+      <li>/ : This will fetch the counter values since start of the daemon, minus overflow so should be considered absolute numbers and should be used for further processing by yourself. The values come from the latest sample of the internal sample thread, add \"?fresh=1\" to read the counters at the time of the request.</li>\n\
+      <li>/persecond : This will fetch data from the internal sample thread which samples every second (or every --sampling-period) and returns the difference between the last 2 samples one second apart.</li>\n\
+      <li>/persecond/X : This will fetch data from the internal sample thread and returns the difference between the last 2 samples which are X seconds apart. X can be at most 30 seconds without changing the source code.</li>\n\
+      <li>/rate : This will return the per second rates of the core, memory and energy counters over the last sampling period.</li>\n\
+      <li>/rate/X : Same as /rate but over the last X seconds, X can have a fraction and can be as long as the history kept by the internal sample thread (--history, default one hour). Rates are taken from the history without reading the counters, early after start the window is as long as the history available and the actual window is returned in Measurement_Interval_in_us.</li>\n\
       <li>/metrics : The Prometheus server does not send an Accept header to decide what format to return so it got its own endpoint that will always return data in the Prometheus format. pcm-sensor-server is sending the header \"Content-Type: text/plain; version=0.0.4\" as required. This /metrics endpoints mimics the same behavior as / and data is thus absolute, not relative.</li>\n\
       <li>/dashboard/influxdb : This will return JSON for a Grafana dashboard with InfluxDB backend that holds all counters. Please see the documentation for more information.</li>\n\
       <li>/dashboard/prometheus : This will return JSON for a Grafana dashboard with Prometheus backend that holds all counters. Please see the documentation for more information.</li>\n\
@@ -3902,13 +5039,7 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
             return;
         }
 
-        //std::shared_ptr<Aggregator> current;
-        //std::shared_ptr<Aggregator> null;
-        //current = std::make_shared<Aggregator>();
-        //null    = std::make_shared<Aggregator>();
-        //current->dispatch( PCM::getInstance()->getSystemTopology() );
-        //aggregatorPair = std::make_pair( null, current );
-        aggregatorPair = getNullAndCurrentAggregator();
+        aggregatorPair = getNullAndCurrentAggregator( hs, freshReadRequested( url ) );
     } else if ( url.path_ == "/dashboard" || url.path_ == "/dashboard/influxdb") {
         DBG( 3, "client requesting /dashboard path: '", url.path_, "'" );
         resp.createResponse( ApplicationJSON, getPCMDashboardJSON(InfluxDB), RC_200_OK );
@@ -3929,6 +5060,7 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
             DBG( 3, "size == 10 or 11" );
             // path looks like /persecond or /persecond/
             aggregatorPair = hs->getAggregators( 1, 0 );
+            endpoint = "/persecond/1";
         } else {
             DBG( 3, "size > 11: size = ", url.path_.size() );
             // We're looking for value X after /persecond/X and possibly a trailing / anything else not
@@ -3947,8 +5079,9 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
                         DBG( 3, "Error during conversion of /persecond/ seconds: ", e.what() );
                         seconds = 0;
                     }
-                    if ( 1 <= seconds && 30 >= seconds ) {
+                    if ( 1 <= seconds && HTTPServer::maxPersecondSeconds >= seconds ) {
                         aggregatorPair = hs->getAggregators( seconds, 0 );
+                        endpoint = "/persecond/" + std::to_string( seconds );
                     } else {
                         DBG( 3, "seconds equals 0 or seconds larger than 30 is not allowed" );
                         std::string body( "400 Bad Request. seconds equals 0 or seconds larger than 30 is not allowed" );
@@ -3968,10 +5101,42 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
                 return;
             }
         }
+    } else if ( url.path_ == "/rate" || url.path_ == "/rate/" || 0 == url.path_.rfind( "/rate/", 0 ) ) {
+        DBG( 3, "client requesting /rate path: '", url.path_, "'" );
+        // /rate is the last sampling period, /rate/X the last X seconds, X may have a fraction
+        auto const period = hs->samplingOptions().period;
+        size_t periods = 1;
+        std::string window = url.path_.size() > 6 ? url.path_.substr( 6 ) : std::string();
+        if ( ! window.empty() && window.back() == '/' )
+            window.pop_back();
+        if ( ! window.empty() ) {
+            double seconds = 0.;
+            if ( std::all_of( window.begin(), window.end(), []( char c ) { return ::isdigit( c ) || c == '.'; } )
+                && std::count( window.begin(), window.end(), '.' ) <= 1 && window != "." ) {
+                seconds = std::atof( window.c_str() );
+            }
+            double const samples = seconds * 1000. / double( period.count() );
+            if ( samples < 0.5 || samples > double( hs->counterHistory().capacity() - 1 ) ) {
+                DBG( 3, "/rate/ window '", window, "' is not within the sampling period and the history" );
+                std::string body( "400 Bad Request. The window of /rate/X must be a number of seconds between the sampling period and the length of the history." );
+                resp.createResponse( TextPlain, body, RC_400_BadRequest );
+                return;
+            }
+            periods = size_t( samples + 0.5 );
+        }
+        if ( format != JSON )
+            format = Prometheus_0_0_4;
+        auto const rates = hs->getRates( periods );
+        auto body = hs->responseCache().get( "/rate/" + std::to_string( periods ), format, rates.epoch, [hs, &rates, format]() {
+            RatePrinter rp( hs->counterHistory(), rates );
+            return format == JSON ? rp.json( PCM::getInstance()->getSystemTopology() ) : rp.prometheus( PCM::getInstance()->getSystemTopology() );
+        } );
+        resp.createResponse( format == JSON ? ApplicationJSON : TextPlainProm_0_0_4, body, RC_200_OK );
+        return;
     } else if ( 8 == url.path_.size() && 0 == url.path_.find( "/metrics", 0 ) ) {
         DBG( 3, "Special snowflake prometheus wants a /metrics URL, it can't be bothered to use its own mimetype in the Accept header" );
         format = Prometheus_0_0_4;
-        aggregatorPair = getNullAndCurrentAggregator();
+        aggregatorPair = getNullAndCurrentAggregator( hs, freshReadRequested( url ) );
     } else {
         DBG( 3, "Unknown path requested: \"", url.path_, "\"" );
         std::string body( "404 Unknown path." );
@@ -3979,19 +5144,26 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
         return;
     }
 
+    const auto epoch = aggregatorPair.second->dispatchedAt();
     switch ( format ) {
     case JSON:
     {
-        JSONPrinter jp( aggregatorPair );
-        jp.dispatch( PCM::getInstance()->getSystemTopology() );
-        resp.createResponse( ApplicationJSON, jp.str(), RC_200_OK );
+        auto body = hs->responseCache().get( endpoint, format, epoch, [&aggregatorPair]() {
+            JSONPrinter jp( aggregatorPair );
+            jp.dispatch( PCM::getInstance()->getSystemTopology() );
+            return jp.str();
+        } );
+        resp.createResponse( ApplicationJSON, body, RC_200_OK );
         break;
     }
     case Prometheus_0_0_4:
     {
-        PrometheusPrinter pp( aggregatorPair );
-        pp.dispatch( PCM::getInstance()->getSystemTopology() );
-        resp.createResponse( TextPlainProm_0_0_4, pp.str(), RC_200_OK );
+        auto body = hs->responseCache().get( endpoint, format, epoch, [&aggregatorPair]() {
+            PrometheusPrinter pp( aggregatorPair );
+            pp.dispatch( PCM::getInstance()->getSystemTopology() );
+            return pp.str();
+        } );
+        resp.createResponse( TextPlainProm_0_0_4, body, RC_200_OK );
         break;
     }
     default:
@@ -4001,8 +5173,8 @@ void my_get_callback( HTTPServer* hs, HTTPRequest const & req, HTTPResponse & re
     }
 }
 
-int startHTTPServer( const std::string& listenAddr, unsigned short port, bool useIPv4 = false ) {
-    HTTPServer server( listenAddr, port, useIPv4 );
+int startHTTPServer( const std::string& listenAddr, unsigned short port, bool useIPv4 = false, SamplingOptions const & sampling = SamplingOptions() ) {
+    HTTPServer server( listenAddr, port, useIPv4, sampling );
     try {
         // HEAD is GET without body, we will remove the body in execute()
         server.registerCallback( HTTPRequestMethod::GET,  my_get_callback );
@@ -4016,8 +5188,8 @@ int startHTTPServer( const std::string& listenAddr, unsigned short port, bool us
 }
 
 #if defined (USE_SSL)
-int startHTTPSServer( const std::string& listenAddr, unsigned short port, std::string const & cFile, std::string const & pkFile, bool useIPv4 = false ) {
-    HTTPSServer server( listenAddr, port, useIPv4 );
+int startHTTPSServer( const std::string& listenAddr, unsigned short port, std::string const & cFile, std::string const & pkFile, bool useIPv4 = false, SamplingOptions const & sampling = SamplingOptions() ) {
+    HTTPSServer server( listenAddr, port, useIPv4, sampling );
     try {
         server.setPrivateKeyFile ( pkFile );
         server.setCertificateFile( cFile );
@@ -4071,6 +5243,9 @@ void printHelpText( std::string const & programName ) {
 #endif
     std::cout << "    -r|--reset           : Reset programming of the performance counters.\n";
     std::cout << "    -D|--debug level     : level = 0: no debug info, > 0 increase verbosity.\n";
+    std::cout << "    --sampling-period s  : Sample the counters every <s> seconds, 0.1, 0.125, 0.2, 0.25, 0.5 or 1 (default 1)\n";
+    std::cout << "    --history s          : Keep <s> seconds of samples for the /rate/X endpoint\n";
+    std::cout << "                           (default 3600)\n";
 #if !defined(__APPLE__) && !defined(_WIN32)
     std::cout << "    -R|--real-time       : If possible the daemon will run with real time\n";
     std::cout << "                           priority, could be useful under heavy load to \n";
@@ -4113,6 +5288,7 @@ int mainThrows(int argc, char * argv[]) {
     std::string listenAddress = "";  // Empty string means listen on all interfaces
     std::string certificateFile;
     std::string privateKeyFile;
+    SamplingOptions sampling;
     AcceleratorCounterState *accs_ = AcceleratorCounterState::getInstance();
     null_stream nullStream;
     check_and_set_silent(argc, argv, nullStream);
@@ -4209,6 +5385,50 @@ int mainThrows(int argc, char * argv[]) {
                     throw std::runtime_error( "main: Error no debug level argument given" );
                 }
             }
+            else if ( check_argument_equals( argv[i], {"--sampling-period"} ) )
+            {
+                if ( (++i) < argc ) {
+                    std::size_t pos = 0;
+                    double seconds = 0.;
+                    try {
+                        seconds = std::stod( argv[i], &pos );
+                    } catch ( const std::exception& ) {
+                        pos = 0;
+                    }
+                    auto const period = std::chrono::milliseconds( std::llround( seconds * 1000. ) );
+                    if ( pos != std::strlen( argv[i] ) || std::fabs( seconds * 1000. - double( period.count() ) ) > 1e-6
+                         || ! SamplingOptions::isValidPeriod( period ) ) {
+                        std::cerr << "main: invalid sampling period '" << argv[i] << "', must be 0.1, 0.125, 0.2, 0.25, 0.5 or 1 seconds\n";
+                        ::exit( 2 );
+                    }
+                    sampling.period = period;
+                } else {
+                    throw std::runtime_error( "main: Error no sampling period argument given" );
+                }
+            }
+            else if ( check_argument_equals( argv[i], {"--history"} ) )
+            {
+                if ( (++i) < argc ) {
+                    try {
+                        std::size_t pos = 0;
+                        unsigned long val = std::stoul( argv[i], &pos );
+                        if ( pos != std::strlen( argv[i] ) || val == 0 )
+                            throw std::invalid_argument( "invalid history length" );
+                        if ( val > 7 * 24 * 3600 )
+                            throw std::out_of_range( "history longer than a week" );
+                        sampling.history = std::chrono::seconds( val );
+                        sampling.historyGiven = true;
+                    } catch ( const std::invalid_argument& e ) {
+                        std::cerr << "main: invalid history length '" << argv[i] << "': " << e.what() << "\n";
+                        ::exit( 2 );
+                    } catch ( const std::out_of_range& e ) {
+                        std::cerr << "main: history length '" << argv[i] << "' is out of range: " << e.what() << "\n";
+                        ::exit( 2 );
+                    }
+                } else {
+                    throw std::runtime_error( "main: Error no history length argument given" );
+                }
+            }
 #ifndef __APPLE__
             else if ( check_argument_equals( argv[i], {"-R", "--real-time"} ) )
             {
@@ -4382,6 +5602,20 @@ int mainThrows(int argc, char * argv[]) {
         PCM * pcmInstance = PCM::getInstance();
         pcmInstance->setAccel(accel);
         assert(pcmInstance);
+        if ( CounterHistory::bytes( HTTPServer::historyCapacity( sampling ), pcmInstance->getNumCores(), pcmInstance->getNumSockets() ) > CounterHistory::maxBytes )
+        {
+            auto const fits = HTTPServer::maxHistory( sampling.period, pcmInstance->getNumCores(), pcmInstance->getNumSockets() );
+            if ( sampling.historyGiven || fits.count() < 1 )
+            {
+                std::cerr << "main: the rate history of " << sampling.history.count() << " s sampled every " << sampling.period.count()
+                          << " ms needs more than " << ( CounterHistory::maxBytes >> 20 ) << " MiB on this system, use a shorter --history (at most "
+                          << fits.count() << " s) or a longer --sampling-period\n";
+                ::exit( 2 );
+            }
+            std::cerr << "The default rate history of " << sampling.history.count() << " s sampled every " << sampling.period.count()
+                      << " ms needs more than " << ( CounterHistory::maxBytes >> 20 ) << " MiB on this system, keeping " << fits.count() << " s\n";
+            sampling.history = fits;
+        }
         if (forceRTMAbortMode)
         {
             pcmInstance->enableForceRTMAbortMode();
@@ -4473,6 +5707,13 @@ int mainThrows(int argc, char * argv[]) {
             std::cerr << "PCIe bandwidth collector: not supported on this platform\n";
         }
 
+        {
+            size_t const samples = HTTPServer::historyCapacity( sampling );
+            size_t const bytes = CounterHistory::bytes( samples, pcmInstance->getNumCores(), pcmInstance->getNumSockets() );
+            std::cerr << "Sampling the counters every " << sampling.period.count() << " ms, the rate history holds " << samples
+                      << " samples (" << sampling.history.count() << " s, up to " << ( bytes >> 20 ) << " MiB)\n";
+        }
+
         // Now that everything is set we can start the http(s) server
 #if defined (USE_SSL)
         if ( useSSL ) {
@@ -4480,7 +5721,7 @@ int mainThrows(int argc, char * argv[]) {
                 port = DEFAULT_HTTPS_PORT;
             std::string displayAddr = listenAddress.empty() ? "localhost" : listenAddress;
             std::cerr << "Starting SSL enabled server on https://" << displayAddr << ":" << port << "/\n";
-            startHTTPSServer( listenAddress, port, certificateFile, privateKeyFile, useIPv4 );
+            startHTTPSServer( listenAddress, port, certificateFile, privateKeyFile, useIPv4, sampling );
         } else
 #endif
         {
@@ -4488,7 +5729,7 @@ int mainThrows(int argc, char * argv[]) {
                 port = DEFAULT_HTTP_PORT;
             std::string displayAddr = listenAddress.empty() ? "localhost" : listenAddress;
             std::cerr << "Starting plain HTTP server on http://" << displayAddr << ":" << port << "/\n";
-            startHTTPServer( listenAddress, port, useIPv4 );
+            startHTTPServer( listenAddress, port, useIPv4, sampling );
         }
 
         if (pcieCol) pcieCol->stop();
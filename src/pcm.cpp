@@ -28,6 +28,7 @@
 #include <bitset>
 #include <map>
 #include "cpucounters.h"
+#include "core_metrics.h"
 #include "utils.h"
 
 #define SIZE (10000000)
@@ -109,9 +110,25 @@ void print_help(const string & prog_name)
 }
 
 
+// returns the metric precomputed for all cores by CoreMetrics or evaluates it for the state pair
 template <class State>
-void print_basic_metrics(const PCM * m, const State & state1, const State & state2, const int metricVersion)
+double get_metric(const CoreMetrics * metrics, const uint32 core, const CoreMetrics::Metric id,
+                  double (*f)(const State &, const State &), const State & state1, const State & state2)
 {
+    return metrics ? metrics->get(id, core) : f(state1, state2);
+}
+
+template <class State>
+uint64 get_l3_cache_misses(const CoreMetrics * metrics, const uint32 core, const State & state1, const State & state2)
+{
+    return metrics ? uint64(metrics->get(CoreMetrics::L3CacheMisses, core)) : getL3CacheMisses(state1, state2);
+}
+
+template <class State>
+void print_basic_metrics(const PCM * m, const State & state1, const State & state2, const int metricVersion,
+                         const CoreMetrics * metrics = nullptr, const uint32 core = 0)
+{
+    const double ipc = get_metric(metrics, core, CoreMetrics::IPC, &getIPC<State>, state1, state2);
     switch (metricVersion)
     {
         case 2:
@@ -119,30 +136,31 @@ void print_basic_metrics(const PCM * m, const State & state1, const State & stat
             {
                 cout << setNextColor() << "     " << getCoreCStateResidency(0, state1, state2);
             }
-            cout << setNextColor() <<  "   " << getIPC(state1, state2);
+            cout << setNextColor() <<  "   " << ipc;
             if (m->isActiveRelativeFrequencyAvailable())
             {
-                cout << setNextColor() <<  "    " << getActiveAverageFrequency(state1, state2)/1e9;
+                cout << setNextColor() <<  "    " << get_metric(metrics, core, CoreMetrics::ActiveAverageFrequency, &getActiveAverageFrequency<State>, state1, state2)/1e9;
             }
             break;
         default:
             cout << setNextColor() << "     " << getExecUsage(state1, state2) <<
-                setNextColor() << "   " << getIPC(state1, state2) <<
+                setNextColor() << "   " << ipc <<
                 setNextColor() << "   " << getRelativeFrequency(state1, state2);
             if (m->isActiveRelativeFrequencyAvailable())
                 cout << setNextColor() << "    " << getActiveRelativeFrequency(state1, state2);
     }
+    const uint64 l3Misses = get_l3_cache_misses(metrics, core, state1, state2);
     if (m->isL3CacheMissesAvailable())
-        cout << setNextColor() << "    " << unit_format(getL3CacheMisses(state1, state2));
+        cout << setNextColor() << "    " << unit_format(l3Misses);
     if (m->isL2CacheMissesAvailable())
         cout << setNextColor() << "   " << unit_format(getL2CacheMisses(state1, state2));
     if (m->isL3CacheHitRatioAvailable())
-        cout << setNextColor() << "    " << getL3CacheHitRatio(state1, state2);
+        cout << setNextColor() << "    " << get_metric(metrics, core, CoreMetrics::L3CacheHitRatio, &getL3CacheHitRatio<State>, state1, state2);
     if (m->isL2CacheHitRatioAvailable())
         cout << setNextColor() << "    " << getL2CacheHitRatio(state1, state2);
     cout.precision(4);
     if (m->isL3CacheMissesAvailable())
-        cout << setNextColor() << "  " << double(getL3CacheMisses(state1, state2)) / getInstructionsRetired(state1, state2);
+        cout << setNextColor() << "  " << double(l3Misses) / getInstructionsRetired(state1, state2);
     if (m->isL2CacheMissesAvailable())
         cout << setNextColor() << "  " << double(getL2CacheMisses(state1, state2)) / getInstructionsRetired(state1, state2);
     cout.precision(2);
@@ -287,6 +305,9 @@ void print_output(PCM * m,
 
     if (show_core_output)
     {
+        // all per-core metrics of the sample in one pass per metric
+        static CoreMetrics coreMetrics;
+        coreMetrics.compute(cstates1, cstates2);
         for (uint32 i = 0; i < m->getNumCores(); ++i)
         {
             if (m->isCoreOnline(i) == false || (show_partial_core_output && ycores.test(i) == false))
@@ -299,7 +320,7 @@ void print_output(PCM * m,
             else
                 cout << " " << setw(3) << i << "   " << setw(2) << m->getSocketId(i);
 
-            print_basic_metrics(m, cstates1[i], cstates2[i], metricVersion);
+            print_basic_metrics(m, cstates1[i], cstates2[i], metricVersion, &coreMetrics, i);
             print_other_metrics(m, cstates1[i], cstates2[i]);
             cout << resetColor();
         }
@@ -1158,45 +1179,51 @@ void print_csv_header(PCM * m,
 }
 
 template <class State>
-void print_basic_metrics_csv(const PCM * m, const State & state1, const State & state2, const bool print_last_semicolon = true)
+void print_basic_metrics_csv(const PCM * m, const State & state1, const State & state2, const bool print_last_semicolon = true,
+                             const CoreMetrics * metrics = nullptr, const uint32 core = 0)
 {
+    auto metric = [&](const CoreMetrics::Metric id, double (*f)(const State &, const State &))
+    {
+        return get_metric(metrics, core, id, f, state1, state2);
+    };
     cout << getExecUsage(state1, state2) <<
-        ',' << getIPC(state1, state2) <<
+        ',' << metric(CoreMetrics::IPC, &getIPC<State>) <<
         ',' << getRelativeFrequency(state1, state2);
 
     if (m->isActiveRelativeFrequencyAvailable())
-        cout << ',' << getActiveRelativeFrequency(state1, state2) << ',' << getActiveAverageFrequency(state1, state2)/1e9;
+        cout << ',' << getActiveRelativeFrequency(state1, state2) << ',' << metric(CoreMetrics::ActiveAverageFrequency, &getActiveAverageFrequency<State>)/1e9;
+    const uint64 l3Misses = get_l3_cache_misses(metrics, core, state1, state2);
     if (m->isL3CacheMissesAvailable())
-        cout << ',' << float_format(getL3CacheMisses(state1, state2));
+        cout << ',' << float_format(l3Misses);
     if (m->isL2CacheMissesAvailable())
         cout << ',' << float_format(getL2CacheMisses(state1, state2));
     if (m->isL3CacheHitRatioAvailable())
-        cout << ',' << getL3CacheHitRatio(state1, state2);
+        cout << ',' << metric(CoreMetrics::L3CacheHitRatio, &getL3CacheHitRatio<State>);
     if (m->isL2CacheHitRatioAvailable())
         cout << ',' << getL2CacheHitRatio(state1, state2);
     cout.precision(4);
     if (m->isL3CacheMissesAvailable())
-        cout << ',' << double(getL3CacheMisses(state1, state2)) / getInstructionsRetired(state1, state2);
+        cout << ',' << double(l3Misses) / getInstructionsRetired(state1, state2);
     if (m->isL2CacheMissesAvailable())
         cout << ',' << double(getL2CacheMisses(state1, state2)) / getInstructionsRetired(state1, state2);
     cout.precision(2);
     if (m->isHWTMAL1Supported())
     {
-        cout << ',' << int(100. * getFrontendBound(state1, state2));
-        cout << ',' << int(100. * getBadSpeculation(state1, state2));
-        cout << ',' << int(100. * getBackendBound(state1, state2));
-        cout << ',' << int(100. * getRetiring(state1, state2));
+        cout << ',' << int(100. * metric(CoreMetrics::FrontendBound, &getFrontendBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::BadSpeculation, &getBadSpeculation<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::BackendBound, &getBackendBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::Retiring, &getRetiring<State>));
     }
     if (m->isHWTMAL2Supported())
     {
-        cout << ',' << int(100. * getFetchLatencyBound(state1, state2));
-        cout << ',' << int(100. * getFetchBandwidthBound(state1, state2));
-        cout << ',' << int(100. * getBranchMispredictionBound(state1, state2));
-        cout << ',' << int(100. * getMachineClearsBound(state1, state2));
-        cout << ',' << int(100. * getMemoryBound(state1, state2));
-        cout << ',' << int(100. * getCoreBound(state1, state2));
-        cout << ',' << int(100. * getHeavyOperationsBound(state1, state2));
-        cout << ',' << int(100. * getLightOperationsBound(state1, state2));
+        cout << ',' << int(100. * metric(CoreMetrics::FetchLatencyBound, &getFetchLatencyBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::FetchBandwidthBound, &getFetchBandwidthBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::BranchMispredictionBound, &getBranchMispredictionBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::MachineClearsBound, &getMachineClearsBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::MemoryBound, &getMemoryBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::CoreBound, &getCoreBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::HeavyOperationsBound, &getHeavyOperationsBound<State>));
+        cout << ',' << int(100. * metric(CoreMetrics::LightOperationsBound, &getLightOperationsBound<State>));
     }
     if (print_last_semicolon)
         cout << ",";
@@ -1429,12 +1456,14 @@ void print_csv(PCM * m,
 
     if (show_core_output)
     {
+        static CoreMetrics coreMetrics;
+        coreMetrics.compute(cstates1, cstates2);
         for (uint32 i = 0; i < m->getNumCores(); ++i)
         {
             if (show_partial_core_output && ycores.test(i) == false)
                 continue;
 
-            print_basic_metrics_csv(m, cstates1[i], cstates2[i], false);
+            print_basic_metrics_csv(m, cstates1[i], cstates2[i], false, &coreMetrics, i);
             print_other_metrics_csv(m, cstates1[i], cstates2[i]);
             cout << ',';
 
@@ -3,6 +3,8 @@
 
 #include "pmt.h"
 #include "utils.h"
+#include "collection_stats.h"
+#include "simulated_hw.h"
 #include <assert.h>
 #include <vector>
 #include <unordered_map>
@@ -16,6 +18,9 @@
 
 #ifdef __linux__
 #include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <cstring>
 #endif
 
 namespace pcm {
@@ -24,7 +29,14 @@ namespace pcm {
 class TelemetryArrayLinux : public TelemetryArrayInterface
 {
     TelemetryArrayLinux() = delete;
-    typedef std::vector<std::FILE *> FileVector;
+    TelemetryArrayLinux(const TelemetryArrayLinux &) = delete;
+    TelemetryArrayLinux & operator = (const TelemetryArrayLinux &) = delete;
+    struct TelemetryFile
+    {
+        std::FILE * file;
+        std::string path; // sysfs directory of the telemetry region
+    };
+    typedef std::vector<TelemetryFile> FileVector;
     typedef std::unordered_map<uint64, FileVector> FileMap;
     static std::shared_ptr<FileMap> TelemetryFiles;
     static FileMap & getTelemetryFiles()
@@ -32,7 +44,12 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
         if (!TelemetryFiles.get())
         {
             std::shared_ptr<FileMap> TelemetryFilesTemp = std::make_shared<FileMap>();
-            auto paths = findPathsFromPattern("/sys/class/intel_pmt/telem*");
+            std::string root = safe_getenv("PCM_PMT_SYSFS_PATH");
+            if (root.empty())
+            {
+                root = "/sys/class/intel_pmt";
+            }
+            auto paths = findPathsFromPattern((root + "/telem*").c_str());
             for (auto & path : paths)
             {
                 const auto guid = read_number(readSysFS((path + "/guid").c_str()).c_str());
@@ -46,7 +63,7 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
                     std::cerr << "Error: failed to open " << path << "/telem" << std::endl;
                     continue;
                 }
-                TelemetryFilesTemp->operator[](guid).push_back(file);
+                TelemetryFilesTemp->operator[](guid).push_back(TelemetryFile{file, path});
             }
             
             // print the telemetry files
@@ -55,12 +72,12 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
                 auto & files = guid.second;
                 for (auto & file : files)
                 {
-                    if (!file)
+                    if (!file.file)
                     {
                         std::cerr << "Error: file is null" << std::endl;
                         continue;
                     }
-                    // std::cout << "guid: 0x" << std::hex << guid.first << " file: " << file << std::endl;
+                    // std::cout << "guid: 0x" << std::hex << guid.first << " file: " << file.file << std::endl;
                 }
             }
 
@@ -70,15 +87,90 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
     }
     std::vector<unsigned char> data;
     size_t uid, instance;
+    int fd;
+    int32 numaNode = -1;
+    // mapping of the telemetry file, the region starts at mappedData
+    void * mapping = nullptr;
+    size_t mappingSize = 0;
+    const volatile unsigned char * mappedData = nullptr;
+    std::vector<size_t> readSet; // sorted qword offsets, empty: load() reads the whole region
+    std::vector<std::pair<size_t, size_t> > readRanges; // [begin, end) qword offsets read by one pread
+    // reading a few unused qwords is cheaper than an extra pread system call
+    enum { maxReadGapQWords = 8 };
+
+    void map(const std::string & path)
+    {
+        if (safe_getenv("PCM_NO_PMT_MMAP") == std::string("1"))
+        {
+            return;
+        }
+        // the mapping starts at the page of the region, the "offset" attribute is the position of the region in it
+        const auto offsetStr = readSysFS((path + "/offset").c_str(), true);
+        if (offsetStr.empty())
+        {
+            return;
+        }
+        const size_t offset = read_number(offsetStr.c_str());
+        mappingSize = offset + data.size();
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            DBG(1, "Can't map ", path, "/telem (", strerror(errno), "), using pread");
+            mapping = nullptr;
+            return;
+        }
+        mappedData = (const volatile unsigned char *)mapping + offset;
+    }
+    void readBytes(const size_t begin, const size_t length)
+    {
+        if (mappedData)
+        {
+            // telemetry is read with aligned 64-bit loads
+            for (size_t pos = begin; pos + sizeof(uint64) <= begin + length; pos += sizeof(uint64))
+            {
+                const uint64 value = *(const volatile uint64 *)(mappedData + pos);
+                memcpy(&data[pos], &value, sizeof(uint64));
+            }
+            return;
+        }
+        CollectionStats::countSyscall();
+        const ssize_t bytesRead = ::pread(fd, &data[begin], length, begin);
+        if (bytesRead != ssize_t(length))
+        {
+            std::cerr << "Error: failed to read " << length << " bytes at offset " << begin << " from telemetry file" << std::endl;
+        }
+    }
 public:
     TelemetryArrayLinux(const size_t uid_, const size_t instance_): uid(uid_), instance(instance_)
     {
         assert(instance < numInstances(uid));
+        const auto & telemetryFile = getTelemetryFiles().at(uid).at(instance);
+        assert(telemetryFile.file);
+        fd = fileno(telemetryFile.file);
+        // get the file size
+        const auto pos = ::lseek(fd, 0, SEEK_END);
+        if (pos < 0)
+        {
+            std::cerr << "Error: failed to get file size" << std::endl;
+            return;
+        }
+        data.resize(pos);
+        map(telemetryFile.path);
+        // "device" links to the intel_vsec device, its parent is the PCI device
+        const auto numaNodeStr = readSysFS((telemetryFile.path + "/device/../numa_node").c_str(), true);
+        if (numaNodeStr.empty() == false)
+        {
+            numaNode = atoi(numaNodeStr.c_str());
+        }
         TelemetryArrayLinux::load();
     }
+    int32 getNUMANode() override
+    {
+        return numaNode;
+    }
     static size_t numInstances(const size_t uid)
     {
-        auto t = getTelemetryFiles();
+        auto & t = getTelemetryFiles();
         if (t.find(uid) == t.end())
         {
             return 0;
@@ -87,7 +179,7 @@ public:
     }
     static std::vector<size_t> getUIDs()
     {
-        auto t = getTelemetryFiles();
+        auto & t = getTelemetryFiles();
         std::vector<size_t> result;
         for (auto & guid : t)
         {
@@ -97,30 +189,56 @@ public:
     }
     virtual ~TelemetryArrayLinux() override
     {
+        if (mapping)
+        {
+            munmap(mapping, mappingSize);
+        }
     }
     size_t size() override
     {
         return data.size();
     }
+    void addToReadSet(size_t qWordOffset) override
+    {
+        if (qWordOffset >= numQWords())
+        {
+            std::cerr << "Error: qword offset " << qWordOffset << " is outside of the telemetry region (" << numQWords() << " qwords)" << std::endl;
+            return;
+        }
+        const auto it = std::lower_bound(readSet.begin(), readSet.end(), qWordOffset);
+        if (it != readSet.end() && *it == qWordOffset)
+        {
+            return;
+        }
+        readSet.insert(it, qWordOffset);
+        readRanges.clear();
+        for (const auto q : readSet)
+        {
+            if (readRanges.empty() || readRanges.back().second + maxReadGapQWords < q)
+            {
+                readRanges.push_back(std::make_pair(q, q));
+            }
+            readRanges.back().second = q + 1;
+        }
+    }
     void load() override
     {
-        FILE * file = getTelemetryFiles().at(uid).at(instance);
-        assert(file);
-        // get the file size
-        fseek(file, 0, SEEK_END);
-        const auto pos = ftell(file);
-        if (pos < 0)
+        if (readSet.empty())
         {
-            std::cerr << "Error: failed to get file size" << std::endl;
+            readBytes(0, data.size());
+            return;
+        }
+        if (mappedData)
+        {
+            for (const auto q : readSet)
+            {
+                readBytes(q * sizeof(uint64), sizeof(uint64));
+            }
             return;
         }
-        const size_t fileSize = pos;
-        fseek(file, 0, SEEK_SET);
-        data.resize(fileSize);
-        const size_t bytesRead = fread(data.data(), 1, fileSize, file);
-        if (bytesRead != fileSize)
+        for (const auto & range : readRanges)
         {
-            std::cerr << "Error: failed to read " << fileSize << " bytes from telemetry file" << std::endl;
+            readBytes(range.first * sizeof(uint64), (range.second - range.first) * sizeof(uint64));
         }
     }
     uint64 get(size_t qWordOffset, size_t lsb, size_t msb) override
@@ -132,6 +250,73 @@ public:
 
 std::shared_ptr<TelemetryArrayLinux::FileMap> TelemetryArrayLinux::TelemetryFiles;
 
+// telemetry regions of the simulated hardware backend, unless a synthetic sysfs tree is given
+class TelemetryArraySimulated : public TelemetryArrayInterface
+{
+    TelemetryArraySimulated() = delete;
+    const uint32 uid, instance;
+    std::vector<uint64> data;
+    std::vector<size_t> readSet; // sorted qword offsets, empty: load() reads the whole region
+public:
+    static bool isEnabled()
+    {
+        return SimulatedHardware::isEnabled() && safe_getenv("PCM_PMT_SYSFS_PATH").empty();
+    }
+    TelemetryArraySimulated(const size_t uid_, const size_t instance_): uid((uint32)uid_), instance((uint32)instance_)
+    {
+        assert(instance < numInstances(uid));
+        data.resize(SimulatedHardware::getPMTRegions()[uid][instance] / sizeof(uint64), 0);
+        TelemetryArraySimulated::load();
+    }
+    static size_t numInstances(const size_t uid)
+    {
+        const auto regions = SimulatedHardware::getPMTRegions();
+        const auto it = regions.find((uint32)uid);
+        return (it == regions.end()) ? 0 : it->second.size();
+    }
+    static std::vector<size_t> getUIDs()
+    {
+        std::vector<size_t> result;
+        for (const auto & region : SimulatedHardware::getPMTRegions())
+        {
+            result.push_back(region.first);
+        }
+        return result;
+    }
+    size_t size() override
+    {
+        return data.size() * sizeof(uint64);
+    }
+    void addToReadSet(size_t qWordOffset) override
+    {
+        const auto it = std::lower_bound(readSet.begin(), readSet.end(), qWordOffset);
+        if (qWordOffset < data.size() && (it == readSet.end() || *it != qWordOffset))
+        {
+            readSet.insert(it, qWordOffset);
+        }
+    }
+    void load() override
+    {
+        if (readSet.empty())
+        {
+            for (size_t q = 0; q < data.size(); ++q)
+            {
+                data[q] = SimulatedHardware::readPMT(uid, instance, q);
+            }
+            return;
+        }
+        for (const auto q : readSet)
+        {
+            data[q] = SimulatedHardware::readPMT(uid, instance, q);
+        }
+    }
+    uint64 get(size_t qWordOffset, size_t lsb, size_t msb) override
+    {
+        assert(qWordOffset < data.size());
+        return extract_bits(data[qWordOffset], lsb, msb);
+    }
+};
+
 #else
 
 class TelemetryArrayDummy : public TelemetryArrayInterface
@@ -152,6 +337,11 @@ public:
 TelemetryArray::TelemetryArray(const size_t uid, const size_t instance)
 {
 #ifdef __linux__
+    if (TelemetryArraySimulated::isEnabled())
+    {
+        impl = std::make_shared<TelemetryArraySimulated>(uid, instance);
+        return;
+    }
     impl = std::make_shared<TelemetryArrayLinux>(uid, instance);
 #else
     impl = std::make_shared<TelemetryArrayDummy>(uid, instance);
@@ -161,6 +351,10 @@ TelemetryArray::TelemetryArray(const size_t uid, const size_t instance)
 size_t TelemetryArray::numInstances(const size_t uid)
 {
 #ifdef __linux__
+    if (TelemetryArraySimulated::isEnabled())
+    {
+        return TelemetryArraySimulated::numInstances(uid);
+    }
     return TelemetryArrayLinux::numInstances(uid);
 #else
     return TelemetryArrayDummy::numInstances(uid);
@@ -170,6 +364,10 @@ size_t TelemetryArray::numInstances(const size_t uid)
 std::vector<size_t> TelemetryArray::getUIDs()
 {
 #ifdef __linux__
+    if (TelemetryArraySimulated::isEnabled())
+    {
+        return TelemetryArraySimulated::getUIDs();
+    }
     return TelemetryArrayLinux::getUIDs();
 #else
     return TelemetryArrayDummy::getUIDs();
@@ -184,6 +382,18 @@ size_t TelemetryArray::size()
     return impl->size();
 }
 
+void TelemetryArray::addToReadSet(size_t qWordOffset)
+{
+    assert(impl.get());
+    impl->addToReadSet(qWordOffset);
+}
+
+int32 TelemetryArray::getNUMANode()
+{
+    assert(impl.get());
+    return impl->getNUMANode();
+}
+
 void TelemetryArray::load()
 {
     assert(impl.get());
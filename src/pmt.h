@@ -17,8 +17,12 @@ public:
     {
         return size() / sizeof(uint64);
     }
+    // declares a qword accessed by get(): if the read set is not empty load() reads only its qwords
+    virtual void addToReadSet(size_t /* qWordOffset */) {}
     virtual void load() = 0;
     virtual uint64 get(size_t qWordOffset, size_t lsb, size_t msb) = 0;
+    // NUMA node of the device providing the telemetry, -1 if not known
+    virtual int32 getNUMANode() { return -1; }
     virtual ~TelemetryArrayInterface() {};
 };
 
@@ -32,8 +36,10 @@ public:
     static std::vector<size_t> getUIDs();
     virtual ~TelemetryArray() override;
     size_t size() override; // in bytes
+    void addToReadSet(size_t qWordOffset) override;
     void load() override;
     uint64 get(size_t qWordOffset, size_t lsb, size_t msb) override;
+    int32 getNUMANode() override;
 };
 
 class TelemetryDB
@@ -8,6 +8,8 @@
 #include "cpucounters.h"
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string>
 #include <iostream>
 #include <cstdlib>
@@ -23,6 +25,57 @@ namespace pcm
         }
         return true;
     }
+    bool Resctrl::createMonGroup(std::string & dir, const std::string & cpus)
+    {
+        struct stat st;
+        if (stat(dir.c_str(), &st) < 0 && mkdir(dir.c_str(), 0700) < 0)
+        {
+            std::cerr << "INFO: can't create directory " << dir << " error: " << strerror(errno) << "\n";
+            const auto containerDir = std::string("/pcm") + dir;
+            if (stat(containerDir.c_str(), &st) < 0 && mkdir(containerDir.c_str(), 0700) < 0)
+            {
+                std::cerr << "INFO: can't create directory " << containerDir << " error: " << strerror(errno) << "\n";
+                std::cerr << "ERROR: RDT metrics (L3OCC,LMB,RMB) will not be available\n";
+                return false;
+            }
+            dir = containerDir;
+        }
+        createdDirs.push_back(dir);
+        const auto cpus_listFilename = dir + "/cpus_list";
+        writeSysFS(cpus_listFilename.c_str(), cpus, false);
+        return true;
+    }
+    void Resctrl::addMetricFiles(const std::string & dir, const int core, const int domain)
+    {
+        auto add = [&dir, &core, &domain](const std::string & metric, FileMapType & fileMap)
+        {
+            std::ostringstream ostr;
+            ostr << dir << "/mon_data/mon_L3_" << std::setfill('0') << std::setw(2) << domain << "/" << metric;
+            MetricFile file{ostr.str(), ::open(ostr.str().c_str(), O_RDONLY)};
+            if (file.fd < 0 && errno == EMFILE)
+            {
+                static bool reported = false;
+                if (!reported)
+                {
+                    std::cerr << "WARNING: too many open files, resctrl metric files will be opened for each read: " << PCM_ULIMIT_RECOMMENDATION;
+                    reported = true;
+                }
+            }
+            fileMap[core].push_back(file);
+        };
+        if (pcm.L3CacheOccupancyMetricAvailable())
+        {
+            add("llc_occupancy", L3OCC);
+        }
+        if (pcm.CoreLocalMemoryBWMetricAvailable())
+        {
+            add("mbm_local_bytes", MBL);
+        }
+        if (pcm.CoreRemoteMemoryBWMetricAvailable())
+        {
+            add("mbm_total_bytes", MBT);
+        }
+    }
     void Resctrl::init()
     {
         if (isMounted() == false)
@@ -32,71 +85,127 @@ namespace pcm
             std::cerr << "Mount it to make it work: mount -t resctrl resctrl /sys/fs/resctrl\n";
             return;
         }
+        const auto mode = safe_getenv("PCM_RESCTRL_MONITORING");
+        if (mode == "socket")
+        {
+            grouping = Grouping::Socket;
+        }
+        else if (mode == "clos")
+        {
+            grouping = Grouping::CLOS;
+        }
+        else if (mode.empty() == false && mode != "core")
+        {
+            std::cerr << "WARNING: unknown PCM_RESCTRL_MONITORING value " << mode << ", monitoring each core\n";
+        }
         const auto numCores = pcm.getNumCores();
-        for (unsigned int c = 0; c < numCores; ++c)
+        const auto numSockets = pcm.getNumSockets();
+        if (grouping == Grouping::Core)
         {
-            if (pcm.isCoreOnline(c))
+            for (unsigned int c = 0; c < numCores; ++c)
             {
-                const auto C = std::to_string(c);
-                const auto dir = std::string(PCMPath) + C;
-                struct stat st;
-                if (stat(dir.c_str(), &st) < 0 && mkdir(dir.c_str(), 0700) < 0)
+                if (pcm.isCoreOnline(c))
                 {
-                    std::cerr << "INFO: can't create directory " << dir << " error: " << strerror(errno) << "\n";
-                    const auto containerDir = std::string("/pcm") + dir;
-                    if (stat(containerDir.c_str(), &st) < 0 && mkdir(containerDir.c_str(), 0700) < 0)
+                    const auto C = std::to_string(c);
+                    auto dir = std::string(PCMPath) + C;
+                    if (createMonGroup(dir, C) == false)
                     {
-                        std::cerr << "INFO: can't create directory " << containerDir << " error: " << strerror(errno) << "\n";
-                        std::cerr << "ERROR: RDT metrics (L3OCC,LMB,RMB) will not be available\n";
                         break;
                     }
-                }
-                const auto cpus_listFilename = dir + "/cpus_list";
-                writeSysFS(cpus_listFilename.c_str(), C, false);
-                auto generateMetricFiles = [&dir, c] (PCM & pcm, const std::string & metric, FileMapType & fileMap)
-                {
-                    auto getMetricFilename = [] (const std::string & dir, const uint64 s, const std::string & metric)
-                    {
-                        std::ostringstream ostr;
-                        ostr << dir << "/mon_data/mon_L3_" << std::setfill('0') << std::setw(2) << s << "/" << metric;
-                        return ostr.str();
-                    };
-                    for (uint64 s = 0; s < pcm.getNumSockets(); ++s)
+                    for (unsigned int s = 0; s < numSockets; ++s)
                     {
-                        fileMap[c].push_back(getMetricFilename(dir, s, metric));
+                        addMetricFiles(dir, c, s);
                     }
-                };
-                if (pcm.L3CacheOccupancyMetricAvailable())
+                }
+            }
+            return;
+        }
+        // the values of the L3 domain of a socket are reported on the first online core of the socket
+        std::vector<int> socketCore(numSockets, -1);
+        std::vector<std::string> socketCPUs(numSockets);
+        for (unsigned int c = 0; c < numCores; ++c)
+        {
+            if (pcm.isCoreOnline(c))
+            {
+                const auto s = pcm.getSocketId(c);
+                if (socketCore[s] < 0)
                 {
-                    generateMetricFiles(pcm, "llc_occupancy", L3OCC);
+                    socketCore[s] = c;
                 }
-                if (pcm.CoreLocalMemoryBWMetricAvailable())
+                socketCPUs[s] += (socketCPUs[s].empty() ? "" : ",") + std::to_string(c);
+            }
+        }
+        std::vector<std::string> dirs;
+        if (grouping == Grouping::Socket)
+        {
+            for (unsigned int s = 0; s < numSockets; ++s)
+            {
+                if (socketCore[s] < 0)
                 {
-                    generateMetricFiles(pcm, "mbm_local_bytes", MBL);
+                    continue;
                 }
-                if (pcm.CoreRemoteMemoryBWMetricAvailable())
+                auto dir = std::string(PCMPath) + "_socket" + std::to_string(s);
+                if (createMonGroup(dir, socketCPUs[s]) == false)
                 {
-                    generateMetricFiles(pcm, "mbm_total_bytes", MBT);
+                    return;
+                }
+                dirs.push_back(dir);
+            }
+        }
+        else
+        {
+            // the default control group and all other control groups (with their mon groups) cover all tasks
+            dirs.push_back("/sys/fs/resctrl");
+            const std::string suffix = "/mon_data";
+            for (const auto & path : findPathsFromPattern("/sys/fs/resctrl/*/mon_data"))
+            {
+                dirs.push_back(path.substr(0, path.size() - suffix.size()));
+            }
+        }
+        for (const auto & dir : dirs)
+        {
+            for (unsigned int s = 0; s < numSockets; ++s)
+            {
+                if (socketCore[s] >= 0)
+                {
+                    addMetricFiles(dir, socketCore[s], s);
                 }
             }
         }
     }
-    void Resctrl::cleanup()
+    void Resctrl::closeFiles()
     {
-        const auto numCores = pcm.getNumCores();
-        for (unsigned int c = 0; c < numCores; ++c)
+        for (auto * fileMap : { &L3OCC, &MBL, &MBT })
         {
-            if (pcm.isCoreOnline(c))
+            for (auto & files : *fileMap)
             {
-                const auto dir = std::string(PCMPath) + std::to_string(c);
-                rmdir(dir.c_str());
-                const auto containerDir = std::string("/pcm") + dir;
-                rmdir(containerDir.c_str());
+                for (auto & f : files.second)
+                {
+                    if (f.fd >= 0)
+                    {
+                        ::close(f.fd);
+                    }
+                }
             }
+            fileMap->clear();
+        }
+    }
+    Resctrl::~Resctrl()
+    {
+        closeFiles();
+    }
+    void Resctrl::cleanup()
+    {
+        closeFiles();
+        for (const auto & dir : createdDirs)
+        {
+            rmdir(dir.c_str());
         }
+        createdDirs.clear();
     }
     size_t Resctrl::getMetric(const Resctrl::FileMapType & fileMap, int core)
     {
+        CollectionStats::StageScope stageScope(CollectionStats::ResctrlReads);
         auto files = fileMap.find(core);
         if (files == fileMap.end())
         {
@@ -105,16 +214,33 @@ namespace pcm
         size_t result = 0;
         for (auto& f : files->second)
         {
-            const auto data = readSysFS(f.c_str(), false);
-            if (data.empty() == false)
+            bool ok = false;
+            if (f.fd >= 0)
             {
-                result += atoll(data.c_str());
+                char buffer[64];
+                CollectionStats::countSyscall();
+                const auto n = ::pread(f.fd, buffer, sizeof(buffer) - 1, 0);
+                if (n > 0)
+                {
+                    buffer[n] = 0;
+                    result += atoll(buffer);
+                    ok = true;
+                }
             }
             else
+            {
+                const auto data = readSysFS(f.path.c_str(), false);
+                if (data.empty() == false)
+                {
+                    result += atoll(data.c_str());
+                    ok = true;
+                }
+            }
+            if (!ok)
             {
                 static std::mutex lock;
                 std::lock_guard<std::mutex> _(lock);
-                std::cerr << "Error reading " << f << ". Error: " << strerror(errno) << "\n";
+                std::cerr << "Error reading " << f.path << ". Error: " << strerror(errno) << "\n";
                 if (errno == 24)
                 {
                     std::cerr << PCM_ULIMIT_RECOMMENDATION;
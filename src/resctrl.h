@@ -16,6 +16,7 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <string>
 
 namespace pcm
 {
@@ -24,13 +25,32 @@ namespace pcm
     class Resctrl
     {
         PCM & pcm;
-        typedef std::unordered_map<int, std::vector<std::string> > FileMapType;
+        struct MetricFile
+        {
+            std::string path;
+            int fd; // kept open and read with pread, -1: the file is opened for each read
+        };
+        typedef std::unordered_map<int, std::vector<MetricFile> > FileMapType;
         FileMapType L3OCC, MBL, MBT;
+        /*  Monitoring groups (PCM_RESCTRL_MONITORING environment variable):
+            Core:   one mon group (RMID) per core (default)
+            Socket: one mon group per socket, the values are reported on the first online core of the socket
+            CLOS:   no new RMIDs, the existing control groups are read and their sum is reported on the first online core of each socket
+        */
+        enum class Grouping { Core, Socket, CLOS };
+        Grouping grouping = Grouping::Core;
+        std::vector<std::string> createdDirs; // mon groups created by init(), removed by cleanup()
         Resctrl() = delete;
+        Resctrl(const Resctrl &) = delete;
+        Resctrl & operator = (const Resctrl &) = delete;
         size_t getMetric(const FileMapType & fileMap, int core);
+        bool createMonGroup(std::string & dir, const std::string & cpus);
+        void addMetricFiles(const std::string & dir, const int core, const int domain);
+        void closeFiles();
         static constexpr auto PCMPath = "/sys/fs/resctrl/mon_groups/pcm";
     public:
         Resctrl(PCM & m) : pcm(m) {}
+        ~Resctrl();
         bool isMounted();
         void init();
         size_t getL3OCC(int core);
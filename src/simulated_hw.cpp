@@ -0,0 +1,538 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+#include "simulated_hw.h"
+#include "pci.h"
+#include "utils.h"
+#include "mutex.h"
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+
+namespace pcm {
+
+namespace {
+
+struct Register
+{
+    uint64 value = 0;
+    uint64 step = 0;
+};
+
+inline uint64 mix(uint64 x) // splitmix64 finalizer
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// registers are sharded by key so that the per-core workers rarely contend
+class RegisterFile
+{
+    enum { numShards = 64 };
+    struct Shard
+    {
+        Mutex mutex;
+        std::unordered_map<uint64, Register> registers;
+    };
+    Shard shards[numShards];
+    Shard & shard(const uint64 key) { return shards[mix(key) % numShards]; }
+public:
+    //! reads and advances the register; a missing register is created with makeDefault(key, register) unless it returns false
+    template <class MakeDefault>
+    bool read(const uint64 key, uint64 & value, MakeDefault makeDefault)
+    {
+        auto & s = shard(key);
+        Mutex::Scope _(s.mutex);
+        auto it = s.registers.find(key);
+        if (it == s.registers.end())
+        {
+            Register r;
+            if (makeDefault(key, r) == false)
+            {
+                return false;
+            }
+            it = s.registers.insert(std::make_pair(key, r)).first;
+        }
+        value = it->second.value;
+        it->second.value += it->second.step;
+        return true;
+    }
+    //! stores the value, a counter keeps advancing from it
+    template <class MakeDefault>
+    void write(const uint64 key, const uint64 value, MakeDefault makeDefault)
+    {
+        auto & s = shard(key);
+        Mutex::Scope _(s.mutex);
+        auto it = s.registers.find(key);
+        if (it == s.registers.end())
+        {
+            Register r;
+            makeDefault(key, r);
+            it = s.registers.insert(std::make_pair(key, r)).first;
+        }
+        it->second.value = value;
+    }
+    bool peek(const uint64 key, uint64 & value)
+    {
+        auto & s = shard(key);
+        Mutex::Scope _(s.mutex);
+        const auto it = s.registers.find(key);
+        if (it == s.registers.end())
+        {
+            return false;
+        }
+        value = it->second.value;
+        return true;
+    }
+    void set(const uint64 key, const uint64 value, const uint64 step)
+    {
+        auto & s = shard(key);
+        Mutex::Scope _(s.mutex);
+        auto & r = s.registers[key];
+        r.value = value;
+        r.step = step;
+    }
+    void clear()
+    {
+        for (auto & s : shards)
+        {
+            Mutex::Scope _(s.mutex);
+            s.registers.clear();
+        }
+    }
+};
+
+// the model is never destroyed: PCM cleanup writes registers from static destructors and exit handlers
+struct Model
+{
+    RegisterFile msrs, pci, mmio, pmt;
+    Mutex pciFunctionsMutex;
+    std::vector<uint32> pciFunctions; // sorted PCI function keys
+    Mutex layoutMutex; // guards the telemetry regions, TPMI features and the topology
+    std::map<uint32, std::vector<size_t> > pmtRegions; // [uid][instance] -> size in bytes
+    std::vector<std::map<uint32, uint32> > tpmiFeatures; // [instance][TPMI ID] -> number of entries
+    SimulatedHardware::Topology topology;
+};
+
+Model & model()
+{
+    static Model * m = new Model();
+    return *m;
+}
+
+std::atomic<bool> enabledByCall{false};
+std::atomic<bool> topologySet{false};
+
+inline uint64 msrKey(const uint32 cpu, const uint64 msr)
+{
+    return (uint64(cpu) << 32) | (msr & 0xFFFFFFFFULL);
+}
+
+inline uint64 pmtKey(const uint32 uid, const uint32 instance, const size_t qWordOffset)
+{
+    return (uint64(uid) << 32) | (uint64(instance & 0xFFF) << 20) | (qWordOffset & 0xFFFFFULL);
+}
+
+// simulated physical address space of the TPMI entries, above the MMIO of real platforms
+constexpr uint64 TPMIBaseAddress = 0x7F0000000000ULL;
+
+inline uint64 pciKey(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset)
+{
+    return (uint64(getPCIFunctionKey(group, bus, device, function)) << 12) | (offset & 0xFFFULL);
+}
+
+// MSRs that advance in the synthetic model
+struct CounterRange
+{
+    uint64 first, last;
+    uint64 minStep;
+};
+
+const CounterRange syntheticMSRCounters[] =
+{
+    { 0x10, 0x10, 2000000 },    // TSC
+    { 0x34, 0x34, 0 },          // SMI count
+    { 0xC1, 0xC8, 1000 },       // general purpose counters
+    { 0xE7, 0xE8, 1000000 },    // MPERF, APERF
+    { 0x309, 0x30F, 1000000 },  // fixed counters
+    { 0x3F8, 0x3FE, 10000 },    // package and core C-state residencies
+    { 0x4C1, 0x4C8, 1000 },     // full-width general purpose counters
+    { 0x60D, 0x60D, 10000 },    // package C2 residency
+    { 0x611, 0x611, 1000 },     // package energy
+    { 0x619, 0x619, 100 },      // DRAM energy
+    { 0x630, 0x632, 10000 },    // package C8-C10 residencies
+    { 0x639, 0x639, 100 },      // PP0 energy
+    { 0x641, 0x641, 100 },      // PP1 energy
+    { 0x64D, 0x64D, 1000 },     // platform energy
+};
+
+bool makeDefaultMSR(const uint64 key, Register & r)
+{
+    const uint64 msr = key & 0xFFFFFFFFULL;
+    for (const auto & range : syntheticMSRCounters)
+    {
+        if (range.first <= msr && msr <= range.last)
+        {
+            const uint64 h = mix(key);
+            r.value = h & 0xFFFFFFULL;
+            r.step = range.minStep ? (range.minStep + (h >> 40) % (range.minStep * 10)) : ((h >> 40) % 2);
+            return true;
+        }
+    }
+    r = Register();
+    return true;
+}
+
+bool noDefault(const uint64, Register &)
+{
+    return false;
+}
+
+void addPCIFunction(const uint32 key)
+{
+    auto & m = model();
+    Mutex::Scope _(m.pciFunctionsMutex);
+    const auto it = std::lower_bound(m.pciFunctions.begin(), m.pciFunctions.end(), key);
+    if (it == m.pciFunctions.end() || *it != key)
+    {
+        m.pciFunctions.insert(it, key);
+    }
+}
+
+uint64 readSized(RegisterFile & file, const uint64 key, const uint32 size)
+{
+    uint64 value = 0;
+    if (file.read(key, value, noDefault))
+    {
+        return (size == sizeof(uint32)) ? (value & 0xFFFFFFFFULL) : value;
+    }
+    if (size == sizeof(uint32) && (key & 7) == 4 && file.peek(key - sizeof(uint32), value))
+    {
+        return value >> 32; // upper half of a 64-bit register
+    }
+    return 0;
+}
+
+void writeSized(RegisterFile & file, const uint64 key, const uint32 size, const uint64 value)
+{
+    if (size == sizeof(uint32))
+    {
+        uint64 old = 0;
+        if (file.peek(key, old))
+        {
+            file.write(key, (old & ~0xFFFFFFFFULL) | (value & 0xFFFFFFFFULL), noDefault);
+            return;
+        }
+    }
+    file.write(key, value, noDefault);
+}
+
+uint64 parseNumber(const std::string & s, bool & ok)
+{
+    char * end = nullptr;
+    const uint64 result = strtoull(s.c_str(), &end, 0);
+    ok = ok && end && *end == 0 && s.empty() == false;
+    return result;
+}
+
+// parses numbers separated by dots, e.g. <uid>.<instance>
+std::vector<uint64> parseDotted(const std::string & s, const size_t count, bool & ok)
+{
+    std::vector<uint64> result;
+    for (const auto & field : split(s, '.'))
+    {
+        result.push_back(parseNumber(field, ok));
+    }
+    ok = ok && result.size() == count;
+    result.resize(count);
+    return result;
+}
+
+bool loadModel(const std::string & path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "PCM Error: can't open simulated hardware model " << path << "\n";
+        return false;
+    }
+    std::string line;
+    size_t lineNumber = 0;
+    size_t numRegisters = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        const auto comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.resize(comment);
+        }
+        std::istringstream fields(line);
+        std::string kind, a, b, c, d;
+        if (!(fields >> kind))
+        {
+            continue; // empty line
+        }
+        bool ok = true;
+        if (kind == "msr" && (fields >> a >> b >> c))
+        {
+            fields >> d;
+            const uint32 cpu = (uint32)parseNumber(a, ok);
+            const uint64 msr = parseNumber(b, ok);
+            const uint64 value = parseNumber(c, ok);
+            const uint64 step = d.empty() ? 0 : parseNumber(d, ok);
+            if (ok) SimulatedHardware::setMSR(cpu, msr, value, step);
+        }
+        else if (kind == "pci" && (fields >> a >> b >> c))
+        {
+            fields >> d;
+            uint32 group = 0, bus = 0, device = 0, function = 0;
+            ok = sscanf(a.c_str(), "%x:%x:%x.%x", &group, &bus, &device, &function) == 4;
+            const uint64 offset = parseNumber(b, ok);
+            const uint64 value = parseNumber(c, ok);
+            const uint64 step = d.empty() ? 0 : parseNumber(d, ok);
+            if (ok) SimulatedHardware::setPCI(group, bus, device, function, offset, value, step);
+        }
+        else if (kind == "mmio" && (fields >> a >> b))
+        {
+            fields >> c;
+            const uint64 address = parseNumber(a, ok);
+            const uint64 value = parseNumber(b, ok);
+            const uint64 step = c.empty() ? 0 : parseNumber(c, ok);
+            if (ok) SimulatedHardware::setMMIO(address, value, step);
+        }
+        else if (kind == "pmt" && (fields >> a >> b >> c))
+        {
+            fields >> d;
+            const auto region = parseDotted(a, 2, ok);
+            const uint64 qWordOffset = parseNumber(b, ok);
+            const uint64 value = parseNumber(c, ok);
+            const uint64 step = d.empty() ? 0 : parseNumber(d, ok);
+            if (ok) SimulatedHardware::setPMT((uint32)region[0], (uint32)region[1], (size_t)qWordOffset, value, step);
+        }
+        else if (kind == "tpmi" && (fields >> a >> b >> c))
+        {
+            fields >> d;
+            const auto entry = parseDotted(a, 3, ok);
+            const uint64 offset = parseNumber(b, ok);
+            const uint64 value = parseNumber(c, ok);
+            const uint64 step = d.empty() ? 0 : parseNumber(d, ok);
+            if (ok) SimulatedHardware::setTPMI((uint32)entry[0], (uint32)entry[1], (uint32)entry[2], offset, value, step);
+        }
+        else if (kind == "topology" && (fields >> a >> b >> c))
+        {
+            const uint64 sockets = parseNumber(a, ok);
+            const uint64 coresPerSocket = parseNumber(b, ok);
+            const uint64 threadsPerCore = parseNumber(c, ok);
+            ok = ok && sockets && coresPerSocket && threadsPerCore;
+            if (ok) SimulatedHardware::setTopology((uint32)sockets, (uint32)coresPerSocket, (uint32)threadsPerCore);
+        }
+        else
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            std::cerr << "PCM Error: can't parse line " << lineNumber << " of simulated hardware model " << path << "\n";
+            return false;
+        }
+        ++numRegisters;
+    }
+    DBG(1, "Loaded ", numRegisters, " registers of simulated hardware model ", path);
+    return true;
+}
+
+} // namespace
+
+bool SimulatedHardware::isEnabled()
+{
+    static const bool fromEnvironment = []()
+    {
+        const auto model = safe_getenv("PCM_SIMULATED_HW_MODEL");
+        if (model.empty() == false)
+        {
+            if (loadModel(model) == false)
+            {
+                // running on the host instead of the requested model would silently produce wrong results
+                exit(EXIT_FAILURE);
+            }
+            return true;
+        }
+        return safe_getenv("PCM_SIMULATED_HW") == std::string("1");
+    }();
+    return fromEnvironment || enabledByCall.load(std::memory_order_relaxed);
+}
+
+void SimulatedHardware::enable()
+{
+    enabledByCall = true;
+}
+
+bool SimulatedHardware::load(const std::string & path)
+{
+    enable();
+    return loadModel(path);
+}
+
+uint64 SimulatedHardware::readMSR(const uint32 cpu, const uint64 msr)
+{
+    uint64 value = 0;
+    model().msrs.read(msrKey(cpu, msr), value, makeDefaultMSR);
+    return value;
+}
+
+void SimulatedHardware::writeMSR(const uint32 cpu, const uint64 msr, const uint64 value)
+{
+    model().msrs.write(msrKey(cpu, msr), value, makeDefaultMSR);
+}
+
+void SimulatedHardware::setMSR(const uint32 cpu, const uint64 msr, const uint64 value, const uint64 step)
+{
+    model().msrs.set(msrKey(cpu, msr), value, step);
+}
+
+uint64 SimulatedHardware::readPCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint32 size)
+{
+    return readSized(model().pci, pciKey(group, bus, device, function, offset), size);
+}
+
+void SimulatedHardware::writePCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint32 size, const uint64 value)
+{
+    writeSized(model().pci, pciKey(group, bus, device, function, offset), size, value);
+}
+
+void SimulatedHardware::setPCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint64 value, const uint64 step)
+{
+    addPCIFunction(getPCIFunctionKey(group, bus, device, function));
+    model().pci.set(pciKey(group, bus, device, function, offset), value, step);
+}
+
+bool SimulatedHardware::isPCIFunctionPresent(const uint32 group, const uint32 bus, const uint32 device, const uint32 function)
+{
+    auto & m = model();
+    Mutex::Scope _(m.pciFunctionsMutex);
+    return std::binary_search(m.pciFunctions.begin(), m.pciFunctions.end(), getPCIFunctionKey(group, bus, device, function));
+}
+
+uint64 SimulatedHardware::readMMIO(const uint64 address, const uint32 size)
+{
+    return readSized(model().mmio, address, size);
+}
+
+void SimulatedHardware::writeMMIO(const uint64 address, const uint32 size, const uint64 value)
+{
+    writeSized(model().mmio, address, size, value);
+}
+
+void SimulatedHardware::setMMIO(const uint64 address, const uint64 value, const uint64 step)
+{
+    model().mmio.set(address, value, step);
+}
+
+uint64 SimulatedHardware::readPMT(const uint32 uid, const uint32 instance, const size_t qWordOffset)
+{
+    return readSized(model().pmt, pmtKey(uid, instance, qWordOffset), sizeof(uint64));
+}
+
+void SimulatedHardware::setPMT(const uint32 uid, const uint32 instance, const size_t qWordOffset, const uint64 value, const uint64 step)
+{
+    auto & m = model();
+    {
+        Mutex::Scope _(m.layoutMutex);
+        auto & region = m.pmtRegions[uid];
+        if (region.size() <= instance)
+        {
+            region.resize(instance + 1, 0);
+        }
+        region[instance] = (std::max)(region[instance], (qWordOffset + 1) * sizeof(uint64));
+    }
+    m.pmt.set(pmtKey(uid, instance, qWordOffset), value, step);
+}
+
+std::map<uint32, std::vector<size_t> > SimulatedHardware::getPMTRegions()
+{
+    auto & m = model();
+    Mutex::Scope _(m.layoutMutex);
+    return m.pmtRegions;
+}
+
+uint64 SimulatedHardware::getTPMIAddress(const uint32 instance, const uint32 ID, const uint32 entry)
+{
+    return TPMIBaseAddress + (uint64(instance & 0xFF) << 32) + (uint64(ID & 0xFF) << 24) + (uint64(entry & 0xFF) << 16);
+}
+
+void SimulatedHardware::setTPMI(const uint32 instance, const uint32 ID, const uint32 entry, const uint64 offset, const uint64 value, const uint64 step)
+{
+    auto & m = model();
+    {
+        Mutex::Scope _(m.layoutMutex);
+        if (m.tpmiFeatures.size() <= instance)
+        {
+            m.tpmiFeatures.resize(instance + 1);
+        }
+        auto & numEntries = m.tpmiFeatures[instance][ID];
+        numEntries = (std::max)(numEntries, entry + 1);
+    }
+    setMMIO(getTPMIAddress(instance, ID, entry) + (offset & 0xFFFFULL), value, step);
+}
+
+std::vector<std::map<uint32, uint32> > SimulatedHardware::getTPMIFeatures()
+{
+    auto & m = model();
+    Mutex::Scope _(m.layoutMutex);
+    return m.tpmiFeatures;
+}
+
+void SimulatedHardware::setTopology(const uint32 sockets, const uint32 coresPerSocket, const uint32 threadsPerCore)
+{
+    auto & m = model();
+    Mutex::Scope _(m.layoutMutex);
+    m.topology.sockets = sockets;
+    m.topology.coresPerSocket = coresPerSocket;
+    m.topology.threadsPerCore = threadsPerCore;
+    topologySet = true;
+}
+
+bool SimulatedHardware::simulatesTopology()
+{
+    return topologySet.load(std::memory_order_relaxed) && isEnabled();
+}
+
+bool SimulatedHardware::getTopology(Topology & topology)
+{
+    if (simulatesTopology() == false)
+    {
+        return false;
+    }
+    auto & m = model();
+    Mutex::Scope _(m.layoutMutex);
+    topology = m.topology;
+    return true;
+}
+
+void SimulatedHardware::reset()
+{
+    auto & m = model();
+    m.msrs.clear();
+    m.pci.clear();
+    m.mmio.clear();
+    m.pmt.clear();
+    {
+        Mutex::Scope _(m.layoutMutex);
+        m.pmtRegions.clear();
+        m.tpmiFeatures.clear();
+    }
+    Mutex::Scope _(m.pciFunctionsMutex);
+    m.pciFunctions.clear();
+}
+
+} // namespace pcm
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+#pragma once
+
+/*!     \file simulated_hw.h
+        \brief Deterministic simulated register backend for MSR, PCI configuration space and MMIO access
+
+        When enabled (PCM_SIMULATED_HW=1, PCM_SIMULATED_HW_MODEL=<file> or SimulatedHardware::enable()
+        before the first handle is created), MsrHandle, PciHandle, PciConfigBatch, MMIORange, TelemetryArray
+        and TPMIHandle on Linux serve register accesses from an in-memory model instead of the devices.
+        PCI enumeration sees one segment with buses 0-0xff. TelemetryArray can instead be pointed to a
+        synthetic sysfs tree (PCM_PMT_SYSFS_PATH). The processor model comes from the host (CPUID), the
+        topology too unless the model sets one (setTopology) before PCM is instantiated.
+
+        Each register has a value and a step: a read returns the value and then advances it by the step,
+        so counters grow deterministically with the number of samples. Writes store the value.
+        Without a recorded model the well-known core, C-state and energy counter MSRs advance, all other
+        registers read as zero until written.
+
+        Recorded model file, one register per line (numbers are decimal or 0x-prefixed hex, # starts a comment):
+            msr  <cpu> <msr> <value> [step]
+            pci  <group>:<bus>:<device>.<function> <offset> <value> [step]
+            mmio <physical address> <value> [step]
+            pmt  <uid>.<instance> <qword offset> <value> [step]
+            tpmi <instance>.<TPMI ID>.<entry> <offset> <value> [step]
+            topology <sockets> <cores per socket> <threads per core>
+        A pci line also makes its function visible to PciHandle::exists, pmt and tpmi lines create the
+        telemetry region and the TPMI entry (both extend to the highest register set).
+*/
+
+#include "types.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pcm {
+
+class SimulatedHardware
+{
+public:
+    //! \brief Returns true if register accesses are served by the simulated backend
+    static bool isEnabled();
+    //! \brief Enables the simulated backend; must be called before the first handle is created
+    static void enable();
+    //! \brief Loads a recorded model (and enables the backend); returns false if the file can't be parsed
+    static bool load(const std::string & path);
+
+    static uint64 readMSR(const uint32 cpu, const uint64 msr);
+    static void writeMSR(const uint32 cpu, const uint64 msr, const uint64 value);
+    static void setMSR(const uint32 cpu, const uint64 msr, const uint64 value, const uint64 step = 0);
+
+    static uint64 readPCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint32 size);
+    static void writePCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint32 size, const uint64 value);
+    static void setPCI(const uint32 group, const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const uint64 value, const uint64 step = 0);
+    static bool isPCIFunctionPresent(const uint32 group, const uint32 bus, const uint32 device, const uint32 function);
+
+    static uint64 readMMIO(const uint64 address, const uint32 size);
+    static void writeMMIO(const uint64 address, const uint32 size, const uint64 value);
+    static void setMMIO(const uint64 address, const uint64 value, const uint64 step = 0);
+
+    static uint64 readPMT(const uint32 uid, const uint32 instance, const size_t qWordOffset);
+    static void setPMT(const uint32 uid, const uint32 instance, const size_t qWordOffset, const uint64 value, const uint64 step = 0);
+    //! \brief Returns the sizes in bytes of the simulated telemetry regions of each UID, indexed by instance
+    static std::map<uint32, std::vector<size_t> > getPMTRegions();
+
+    //! \brief Returns the (simulated MMIO) address of an entry of a TPMI feature
+    static uint64 getTPMIAddress(const uint32 instance, const uint32 ID, const uint32 entry);
+    static void setTPMI(const uint32 instance, const uint32 ID, const uint32 entry, const uint64 offset, const uint64 value, const uint64 step = 0);
+    //! \brief Returns the number of entries of the simulated TPMI features, indexed by instance and TPMI ID
+    static std::vector<std::map<uint32, uint32> > getTPMIFeatures();
+
+    struct Topology
+    {
+        uint32 sockets = 0;
+        uint32 coresPerSocket = 0;
+        uint32 threadsPerCore = 0;
+        uint32 getNumThreads() const { return sockets * coresPerSocket * threadsPerCore; }
+    };
+    //! \brief Replaces the host topology: OS CPU ids enumerate the first threads of all cores (socket by socket), then the second threads, etc.
+    static void setTopology(const uint32 sockets, const uint32 coresPerSocket, const uint32 threadsPerCore);
+    //! \brief Returns true and the topology if the backend is enabled and simulates the topology
+    static bool getTopology(Topology & topology);
+    //! \brief Returns true if the backend is enabled and simulates the topology (thread affinity is not changed then)
+    static bool simulatesTopology();
+
+    //! \brief Drops all registers, PCI functions, telemetry regions and TPMI entries of the model (the backend and the topology stay)
+    static void reset();
+};
+
+} // namespace pcm
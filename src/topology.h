@@ -521,6 +521,12 @@ public:
         ucsFutures_.resize( pcm->getNumSockets() );
     }
 
+    // A sample that was not collected by walking the topology, e.g. restored from stored counter states.
+    // It only serves the accessors, it can not be dispatched.
+    Aggregator( std::vector<CoreCounterState> ccs, std::vector<SocketCounterState> socs, SystemCounterState const & sycs,
+                std::chrono::steady_clock::time_point dispatchedAt )
+        : wq_( nullptr ), ccsVector_( std::move( ccs ) ), socsVector_( std::move( socs ) ), sycs_( sycs ), dispatchedAt_( dispatchedAt ) {}
+
     virtual ~Aggregator() {
         wq_ = nullptr;
     }
@@ -7,11 +7,19 @@
 #include "pci.h"
 #include "utils.h"
 #include "debug.h"
+#include "mutex.h"
+#include "collection_stats.h"
+#include "simulated_hw.h"
 #include <vector>
 #include <unordered_map>
 #include <assert.h>
-#ifdef __linux__
+#include <atomic>
 #include <algorithm>
+#include <cstring>
+#include <cctype>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 namespace pcm {
@@ -43,6 +51,26 @@ public:
         // PFSInstancesSingleton not initialized, let us initialize it
         auto PFSInstancesSingletonInit = std::make_shared<PFSInstancesType>();
 
+        if (SimulatedHardware::isEnabled())
+        {
+            // the entries of the simulated features are served by the simulated MMIO
+            for (const auto & features : SimulatedHardware::getTPMIFeatures())
+            {
+                PFSInstancesSingletonInit->push_back(PFSInstance());
+                const uint32 instance = uint32(PFSInstancesSingletonInit->size() - 1);
+                for (const auto & feature : features)
+                {
+                    auto & addrs = PFSInstancesSingletonInit->back().pfsMap[feature.first];
+                    for (uint32 entry = 0; entry < feature.second; ++entry)
+                    {
+                        addrs.push_back(SimulatedHardware::getTPMIAddress(instance, feature.first, entry));
+                    }
+                }
+            }
+            PFSInstancesSingleton = PFSInstancesSingletonInit;
+            return *PFSInstancesSingleton.get();
+        }
+
         processDVSEC([](const VSEC & vsec)
         {
             return vsec.fields.cap_id == 0xb // Vendor Specific DVSEC
@@ -213,6 +241,97 @@ void TPMIHandleMMIO::write64(size_t entryPos, uint64 val)
     entries[entryPos].range->write64(entries[entryPos].offset, val);
 }
 
+static inline int hexDigit(const char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void parseTPMIMemDump(const char * text, const size_t length, std::vector<uint32> & values, std::vector<TPMIMemDumpEntry> & validEntries)
+{
+    values.clear();
+    validEntries.clear();
+    /*  The format is
+        TPMI Instance:<n> offset:<hex>
+         <hex address>: <hex register> <hex register> ...
+        Entries without registers are skipped, an entry with the first register ~0 is invalid.
+    */
+    const char * p = text;
+    const char * const end = p + length;
+    static const char instanceTag[] = "TPMI Instance:";
+    size_t entryIndex = 0;
+    size_t entryBegin = 0;
+    bool inEntry = false;
+    auto finishEntry = [&]()
+    {
+        if (inEntry && values.size() > entryBegin)
+        {
+            if (values[entryBegin] != TPMIInvalidValue)
+            {
+                validEntries.push_back(TPMIMemDumpEntry{entryIndex, entryBegin, values.size() - entryBegin});
+            }
+            ++entryIndex;
+        }
+        else
+        {
+            values.resize(entryBegin);
+        }
+        entryBegin = values.size();
+    };
+    while (p < end)
+    {
+        const char * lineEnd = (const char *)memchr(p, '\n', end - p);
+        if (lineEnd == nullptr)
+        {
+            lineEnd = end;
+        }
+        const size_t lineLength = lineEnd - p;
+        const char * tag = (lineLength >= sizeof(instanceTag) - 1) ? std::search(p, lineEnd, instanceTag, instanceTag + sizeof(instanceTag) - 1) : lineEnd;
+        if (tag != lineEnd)
+        {
+            finishEntry();
+            inEntry = true;
+        }
+        else
+        {
+            const char * c = p;
+            while (c < lineEnd && isspace((unsigned char)*c)) ++c;
+            while (c < lineEnd && !isspace((unsigned char)*c)) ++c; // skip the address
+            while (c < lineEnd)
+            {
+                while (c < lineEnd && isspace((unsigned char)*c)) ++c;
+                if (c == lineEnd)
+                {
+                    break;
+                }
+                if (c + 1 < lineEnd && c[0] == '0' && (c[1] == 'x' || c[1] == 'X'))
+                {
+                    c += 2;
+                }
+                uint64 value = 0;
+                int digits = 0;
+                int d = 0;
+                while (c < lineEnd && (d = hexDigit(*c)) >= 0)
+                {
+                    value = (value << 4) | uint64(d);
+                    ++digits;
+                    ++c;
+                }
+                if (digits == 0 || digits > 8 || (c < lineEnd && !isspace((unsigned char)*c)))
+                {
+                    break; // not a register value
+                }
+                values.push_back((uint32)value);
+            }
+            inEntry = true;
+        }
+        p = lineEnd + 1;
+    }
+    finishEntry();
+}
+
 #ifdef __linux__
 
 int32 getNUMANodeLinux(uint32 groupnr, uint32 bus, uint32 device, uint32 function);
@@ -232,75 +351,44 @@ class TPMIHandleDriver : public TPMIHandleInterface
     int32 numaNode{ -1 };
     // const bool readonly; // not used
     size_t nentries;
-    struct TPMIEntry {
-        unsigned int offset{0};
-        std::vector<uint32> data;
-    };
 
-    size_t findValidIndex(const std::vector<TPMIEntry> & entries, const size_t & entryPos)
+    /*  Parsed content of a mem_dump file, shared by all handles of the TPMI ID of the instance.
+        Outside of a sample epoch every read parses the file again. Inside of an epoch (TPMIHandle::beginSample)
+        the file is parsed once per epoch and the mem_write commands are queued until TPMIHandle::endSample.
+    */
+    struct MemDump
     {
-        size_t validIndex = 0;
-        for (size_t i = 0; i < entries.size(); ++i)
+        std::string path;
+        Mutex mutex;
+        uint64 epoch{0}; // epoch of the values, 0: not valid
+        std::vector<uint32> values; // the registers of all entries
+        std::vector<TPMIMemDumpEntry> validEntries;
+        std::vector<char> text;
+        std::vector<std::string> pendingWrites;
+
+        void parse();
+        void update(const uint64 currentEpoch)
         {
-            if (entries[i].data.empty() || entries[i].data[0] == TPMIInvalidValue)
+            if (pendingWrites.empty() == false)
             {
-                // invalid, skip it
-                continue;
+                flushWrites();
             }
-            if (validIndex == entryPos)
+            if (currentEpoch == 0 || epoch != currentEpoch)
             {
-                // found the right instance
-                return i;
+                parse();
+                epoch = currentEpoch;
             }
-            ++validIndex;
         }
-        assert(0 && "TPMIHandleDriver: entryPos not found");
-        return 0;
-    }
-    std::vector<TPMIEntry> readTPMIFile(std::string filePath)
+        void flushWrites();
+    };
+    std::shared_ptr<MemDump> memDump;
+    static Mutex memDumpsMutex;
+    static std::unordered_map<std::string, std::shared_ptr<MemDump> > memDumps;
+    static std::atomic<uint64> sampleEpoch;
+    static std::atomic<int> samplingDepth;
+    static uint64 currentEpoch()
     {
-        filePath += "/mem_dump";
-        std::vector<TPMIEntry> entries;
-        std::ifstream file(filePath);
-        std::string line;
-
-        if (!file.is_open()) {
-            std::cerr << "Error opening file: " << filePath << std::endl;
-            return entries;
-        }
-
-        TPMIEntry currentEntry;
-        while (getline(file, line)) {
-            if (line.find("TPMI Instance:") != std::string::npos) {
-                // If we have a previous instance, push it back to the vector
-                if (!currentEntry.data.empty()) {
-                    entries.push_back(currentEntry);
-                    currentEntry.data.clear();
-                }
-
-                std::istringstream iss(line);
-                std::string temp;
-                iss >> temp >> temp >> temp; // Skip "TPMI Instance:"
-                iss >> temp; // Skip entry number
-                iss >> temp >> std::hex >> currentEntry.offset; // Read offset
-            } else {
-                std::istringstream iss(line);
-                std::string address;
-                iss >> address; // Skip the address part
-
-                uint32_t value;
-                while (iss >> std::hex >> value) {
-                    currentEntry.data.push_back(value);
-                }
-            }
-        }
-
-        // Push the last instance if it exists
-        if (!currentEntry.data.empty()) {
-            entries.push_back(currentEntry);
-        }
-
-        return entries;
+        return (samplingDepth.load() > 0) ? sampleEpoch.load() : 0;
     }
 public:
     static size_t getNumInstances();
@@ -314,14 +402,20 @@ public:
         assert(available > 0);
         assert(instance < getNumInstances());
         const auto path = AllIDPaths[instance][ID];
-        const auto entries = readTPMIFile(path);
-        for (auto & e: entries)
         {
-            if (e.data.empty() == false && e.data[0] != TPMIInvalidValue)
+            Mutex::Scope _(memDumpsMutex);
+            auto & m = memDumps[path];
+            if (m.get() == nullptr)
             {
-                // count valid entries
-                ++nentries;
+                m = std::make_shared<MemDump>();
+                m->path = path;
             }
+            memDump = m;
+        }
+        {
+            Mutex::Scope _(memDump->mutex);
+            memDump->update(currentEpoch());
+            nentries = memDump->validEntries.size();
         }
         // path is like /sys/kernel/debug/tpmi-0000:80:03.1/tpmi-id-0a
         // extract the 0000:80:03.1 part:
@@ -357,26 +451,67 @@ public:
     {
         assert(available > 0);
         assert(instance < getNumInstances());
-        const auto entries = readTPMIFile(AllIDPaths[instance][ID]);
-        size_t i = findValidIndex(entries, entryPos);
+        Mutex::Scope _(memDump->mutex);
+        memDump->update(currentEpoch());
+        if (entryPos >= memDump->validEntries.size())
+        {
+            assert(0 && "TPMIHandleDriver: entryPos not found");
+            return 0;
+        }
+        const auto & e = memDump->validEntries[entryPos];
         cvt_ds result;
         const auto i4 = offset / 4;
-        assert(i4 + 1 < entries[i].data.size());
-        result.ui32.low = entries[i].data[i4];
-        result.ui32.high = entries[i].data[i4 + 1];
+        assert(i4 + 1 < e.size);
+        result.ui32.low = memDump->values[e.begin + i4];
+        result.ui32.high = memDump->values[e.begin + i4 + 1];
         return result.ui64;
     }
     void write64(size_t entryPos, uint64 val) override
     {
         assert(available > 0);
         assert(instance < getNumInstances());
-        const auto entries = readTPMIFile(AllIDPaths[instance][ID]);
-        size_t i = findValidIndex(entries, entryPos);
+        const auto epoch = currentEpoch();
+        Mutex::Scope _(memDump->mutex);
+        if (memDump->epoch == 0 || epoch == 0)
+        {
+            memDump->update(epoch); // entry numbers are needed for the commands
+        }
+        if (entryPos >= memDump->validEntries.size())
+        {
+            assert(0 && "TPMIHandleDriver: entryPos not found");
+            return;
+        }
+        const auto i = memDump->validEntries[entryPos].index;
         cvt_ds out;
         out.ui64 = val;
-        const auto path = AllIDPaths[instance][ID] + "/mem_write";
-        writeSysFS(path.c_str(), std::to_string(i) + "," + std::to_string(offset) + "," + std::to_string(out.ui32.low));
-        writeSysFS(path.c_str(), std::to_string(i) + "," + std::to_string(offset + 4) + "," + std::to_string(out.ui32.high));
+        memDump->pendingWrites.push_back(std::to_string(i) + "," + std::to_string(offset) + "," + std::to_string(out.ui32.low));
+        memDump->pendingWrites.push_back(std::to_string(i) + "," + std::to_string(offset + 4) + "," + std::to_string(out.ui32.high));
+        memDump->epoch = 0; // the next read must see the written values
+        if (epoch == 0)
+        {
+            memDump->flushWrites();
+        }
+    }
+    static void beginSample()
+    {
+        ++sampleEpoch;
+        ++samplingDepth;
+    }
+    static void endSample()
+    {
+        if (--samplingDepth > 0)
+        {
+            return;
+        }
+        Mutex::Scope _(memDumpsMutex);
+        for (auto & m : memDumps)
+        {
+            Mutex::Scope __(m.second->mutex);
+            if (m.second->pendingWrites.empty() == false)
+            {
+                m.second->flushWrites();
+            }
+        }
     }
     int32 getNUMANode() override
     {
@@ -387,6 +522,68 @@ public:
 int TPMIHandleDriver::available = -1;
 std::vector<std::string> TPMIHandleDriver::instancePaths;
 std::vector<TPMIHandleDriver::TPMI_IDPathMap> TPMIHandleDriver::AllIDPaths;
+Mutex TPMIHandleDriver::memDumpsMutex;
+std::unordered_map<std::string, std::shared_ptr<TPMIHandleDriver::MemDump> > TPMIHandleDriver::memDumps;
+std::atomic<uint64> TPMIHandleDriver::sampleEpoch{0};
+std::atomic<int> TPMIHandleDriver::samplingDepth{0};
+
+void TPMIHandleDriver::MemDump::parse()
+{
+    values.clear();
+    validEntries.clear();
+    const auto filePath = path + "/mem_dump";
+    CollectionStats::countSyscall(2); // open and close
+    const int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Error opening file: " << filePath << std::endl;
+        return;
+    }
+    // debugfs files have no size: read until the end of file
+    size_t length = 0;
+    for (;;)
+    {
+        if (text.size() < length + 65536)
+        {
+            text.resize(length + 65536);
+        }
+        CollectionStats::countSyscall();
+        const ssize_t n = ::read(fd, text.data() + length, text.size() - length);
+        if (n <= 0)
+        {
+            break;
+        }
+        length += n;
+    }
+    ::close(fd);
+
+    parseTPMIMemDump(text.data(), length, values, validEntries);
+}
+
+void TPMIHandleDriver::MemDump::flushWrites()
+{
+    const auto filePath = path + "/mem_write";
+    CollectionStats::countSyscall(2 + pendingWrites.size()); // open, writes and close
+    const int fd = ::open(filePath.c_str(), O_WRONLY);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Can not open " << filePath << " file.\n";
+    }
+    else
+    {
+        // the driver parses one command per write
+        for (const auto & command : pendingWrites)
+        {
+            if (::write(fd, command.c_str(), command.size()) != ssize_t(command.size()))
+            {
+                std::cerr << "ERROR: Can not write " << command << " to " << filePath << ".\n";
+            }
+        }
+        ::close(fd);
+    }
+    pendingWrites.clear();
+    epoch = 0;
+}
 
 bool TPMIHandleDriver::isAvailable()
 {
@@ -418,7 +615,7 @@ bool TPMIHandleDriver::isAvailable()
         {
             available = 0;
         }
-        if (safe_getenv("PCM_NO_TPMI_DRIVER") == std::string("1"))
+        if (safe_getenv("PCM_NO_TPMI_DRIVER") == std::string("1") || SimulatedHardware::isEnabled())
         {
             available = 0;
         }
@@ -463,6 +660,20 @@ TPMIHandle::TPMIHandle(const size_t instance_, const size_t ID_, const size_t re
     impl = std::make_shared<TPMIHandleMMIO>(instance_, ID_, requestedRelativeOffset, readonly_);
 }
 
+void TPMIHandle::beginSample()
+{
+    #ifdef __linux__
+    TPMIHandleDriver::beginSample();
+    #endif
+}
+
+void TPMIHandle::endSample()
+{
+    #ifdef __linux__
+    TPMIHandleDriver::endSample();
+    #endif
+}
+
 size_t TPMIHandle::getNumEntries() const
 {
     assert(impl.get());;
@@ -33,6 +33,23 @@ class TPMIHandle : public TPMIHandleInterface
 public:
     static size_t getNumInstances();
     static void setVerbose(const bool);
+    /*! \brief Starts a sample epoch (may be nested and called from several threads)
+
+        Until the matching endSample() the Linux TPMI driver backend parses each mem_dump file
+        only once per epoch and serves all read64 calls from the parsed values. write64 commands
+        are queued and written to mem_write in one batch by endSample() or before the next read
+        of the same file. The MMIO backend is not affected.
+    */
+    static void beginSample();
+    static void endSample();
+    //! \brief Calls beginSample() and endSample() for the lifetime of the object
+    struct SampleScope
+    {
+        SampleScope() { beginSample(); }
+        ~SampleScope() { endSample(); }
+        SampleScope(const SampleScope &) = delete;
+        SampleScope & operator = (const SampleScope &) = delete;
+    };
     TPMIHandle(const size_t instance_, const size_t ID_, const size_t offset_, const bool readonly_ = true);
     size_t getNumEntries() const override;
     uint64 read64(size_t entryPos) override;
@@ -40,4 +57,19 @@ public:
     int32 getNUMANode() override;
 };
 
+//! \brief A valid entry of a parsed mem_dump file of the Linux TPMI debugfs interface
+struct TPMIMemDumpEntry
+{
+    size_t index;   // entry number in mem_write commands
+    size_t begin;   // position of the first register in the register array
+    size_t size;    // number of registers
+};
+
+/*! \brief Parses the text of a mem_dump file of the Linux TPMI debugfs interface
+
+    \param values the 32-bit registers of all entries
+    \param validEntries the entries with registers whose first register is not ~0
+*/
+void parseTPMIMemDump(const char * text, const size_t length, std::vector<uint32> & values, std::vector<TPMIMemDumpEntry> & validEntries);
+
 } // namespace pcm
@@ -1,15 +1,89 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // Copyright (c) 2021-2022, Intel Corporation
 
+#include <cstring>
+#include <sstream>
 #include "uncore_pmu_discovery.h"
 #include "pci.h"
 #include "mmio.h"
 #include "iostream"
 #include "utils.h"
 #include "cpucounters.h"
+#include "discovery_cache.h"
 
 namespace pcm {
 
+// discovery cache lines: "G <socket> <table>" starts a die of the socket, "B <table>" adds a unit PMU to it
+template <class T>
+static std::string discoveryTableToString(const std::string & tag, const T & table)
+{
+    uint64 raw[3];
+    std::memcpy(raw, &table, sizeof(raw));
+    std::ostringstream line;
+    line << tag << std::hex << " " << raw[0] << " " << raw[1] << " " << raw[2];
+    return line.str();
+}
+
+template <class T>
+static bool discoveryTableFromStream(std::istream & input, T & table)
+{
+    uint64 raw[3];
+    input >> std::hex >> raw[0] >> raw[1] >> raw[2];
+    std::memcpy(&table, raw, sizeof(raw));
+    return bool(input);
+}
+
+bool UncorePMUDiscovery::loadFromCache()
+{
+    static_assert(sizeof(GlobalPMU) == 3 * sizeof(uint64), "GlobalPMU must be a raw 3x64-bit discovery table");
+    static_assert(sizeof(BoxPMU) == 3 * sizeof(uint64), "BoxPMU must be a raw 3x64-bit discovery table");
+    DiscoveryCache::Lines lines;
+    if (!DiscoveryCache::getInstance().get("uncore_pmu_discovery", lines))
+    {
+        return false;
+    }
+    size_t socket = 0;
+    for (const auto & line : lines)
+    {
+        std::istringstream input(line);
+        std::string tag;
+        input >> tag;
+        if (tag == "G")
+        {
+            GlobalPMU global;
+            input >> std::dec >> socket;
+            if (!discoveryTableFromStream(input, global)) break;
+            globalPMUs.resize((std::max)(socket + 1, globalPMUs.size()));
+            globalPMUs[socket].push_back(global);
+            boxPMUs.resize((std::max)(socket + 1, boxPMUs.size()));
+            boxPMUs[socket].push_back(BoxPMUMap());
+        }
+        else if (tag == "B" && socket < boxPMUs.size() && !boxPMUs[socket].empty())
+        {
+            BoxPMU unit;
+            if (!discoveryTableFromStream(input, unit)) break;
+            boxPMUs[socket].back()[unit.boxType].push_back(unit);
+        }
+        else
+        {
+            break;
+        }
+        if (&line == &lines.back())
+        {
+            DBG(1, "Uncore PMU discovery loaded from the discovery cache");
+            return true;
+        }
+    }
+    if (lines.empty())
+    {
+        return true; // no discovery tables on this platform
+    }
+    std::cerr << "PCM Warning: invalid uncore PMU discovery cache entry, rediscovering\n";
+    boxPMUs.clear();
+    globalPMUs.clear();
+    return false;
+}
+
 UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
 {
     if (safe_getenv("PCM_NO_UNCORE_PMU_DISCOVERY") == std::string("1"))
@@ -17,8 +91,10 @@ UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
         return;
     }
     const auto debug = (safe_getenv("PCM_DEBUG_PMU_DISCOVERY") == std::string("1"));
-    
-    auto processTables = [this, &debug, &m](const uint64 bar, const VSEC & vsec, const int32 NUMANode)
+    bool complete = true;
+    DiscoveryCache::Lines cacheLines;
+
+    auto processTables = [this, &debug, &m, &complete, &cacheLines](const uint64 bar, const VSEC & vsec, const int32 NUMANode)
     {
         try {
             DBG(1, "Uncore discovery detection. Reading from bar 0x", std::hex, bar, std::dec,
@@ -43,6 +119,7 @@ UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
             globalPMUs.resize((std::max)(socket + 1, globalPMUs.size()));
             assert(socket < globalPMUs.size());
             globalPMUs[socket].push_back(global.pmu);
+            cacheLines.push_back(discoveryTableToString("G " + std::to_string(socket), global.pmu));
             if (debug)
             {
                 std::cerr << "Read global.pmu from 0x" << std::hex << bar << std::dec << "\n";
@@ -76,6 +153,7 @@ UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
                 }
                 // unit.pmu.print();
                 boxPMUMap[unit.pmu.boxType].push_back(unit.pmu);
+                cacheLines.push_back(discoveryTableToString("B", unit.pmu));
             }
             boxPMUs.resize((std::max)(socket + 1, boxPMUs.size()));
             assert(socket < boxPMUs.size());
@@ -83,6 +161,7 @@ UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
         }
         catch (const std::exception & e)
         {
+            complete = false;
             std::cerr << "WARNING: enumeration of devices in UncorePMUDiscovery failed on bar 0x"
                 << std::hex << bar << "\n" << e.what() << "\n" <<
                 " CAP_ID: 0x" << vsec.fields.cap_id << "\n" <<
@@ -100,16 +179,24 @@ UncorePMUDiscovery::UncorePMUDiscovery(PCM & m)
             std::cerr << "INFO: discovery has " << boxPMUs.size() << " entries\n";
         }
     };
-    try {
-        processDVSEC([](const VSEC & vsec)
-        {
-            return vsec.fields.cap_id == 0x23 // UNCORE_EXT_CAP_ID_DISCOVERY
-                && vsec.fields.entryID == 1; // UNCORE_DISCOVERY_DVSEC_ID_PMON
-        }, processTables);
-
-    } catch (...)
+    if (loadFromCache() == false)
     {
-        std::cerr << "WARNING: enumeration of devices in UncorePMUDiscovery failed\n";
+        try {
+            processDVSEC([](const VSEC & vsec)
+            {
+                return vsec.fields.cap_id == 0x23 // UNCORE_EXT_CAP_ID_DISCOVERY
+                    && vsec.fields.entryID == 1; // UNCORE_DISCOVERY_DVSEC_ID_PMON
+            }, processTables);
+
+        } catch (...)
+        {
+            complete = false;
+            std::cerr << "WARNING: enumeration of devices in UncorePMUDiscovery failed\n";
+        }
+        if (complete)
+        {
+            DiscoveryCache::getInstance().set("uncore_pmu_discovery", cacheLines);
+        }
     }
 
     if (safe_getenv("PCM_PRINT_UNCORE_PMU_DISCOVERY") == std::string("1"))
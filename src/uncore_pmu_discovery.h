@@ -133,6 +133,8 @@ protected:
     std::vector<std::vector<BoxPMUMap> > boxPMUs; // socket -> die -> BoxPMUs
     std::vector<std::vector<GlobalPMU> > globalPMUs; // socket -> die -> GlobalPMU
 
+    bool loadFromCache(); // restores boxPMUs and globalPMUs from the discovery cache
+
     bool validBox(const size_t boxType, const size_t socket, const size_t die, const size_t pos)
     {
         return socket < boxPMUs.size() && die < boxPMUs[socket].size() && pos < boxPMUs[socket][die][boxType].size();
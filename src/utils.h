@@ -15,6 +15,7 @@
 #include <time.h>
 #include "types.h"
 #include "debug.h"
+#include "simulated_hw.h"
 #include <vector>
 #include <list>
 #include <chrono>
@@ -779,6 +780,11 @@ public:
         : set_size(CPU_ALLOC_SIZE(maxCPUs)), restore(restore_)
     {
         assert(core_id < maxCPUs);
+        if (SimulatedHardware::simulatesTopology())
+        {
+            restore = false; // the simulated cores do not exist on the host
+            return;
+        }
         old_affinity = CPU_ALLOC(maxCPUs);
         assert(old_affinity);
         auto res = pthread_getaffinity_np(pthread_self(), set_size, old_affinity);
@@ -16,14 +16,6 @@
 #include "bw.h"
 #include "mutex.h"
 #include <memory>
-#ifndef _MSC_VER
-// the header can not be included into code using CLR
-#include <thread>
-#else
-namespace std {
-     class thread;
- }
-#endif
 
 namespace pcm {
 
@@ -33,6 +25,8 @@ public:
     struct AbstractRawCounter
     {
         virtual uint64 operator () () = 0;
+        //! \brief core on which the counter is read most cheaply (-1: any core)
+        virtual int32 getCore() { return -1; }
         virtual ~AbstractRawCounter() { }
     };
 
@@ -55,6 +49,7 @@ public:
             msr->read(msr_addr, &value);
             return value & msr_mask;
         }
+        int32 getCore() { return msr->getCoreId(); }
     };
 
     template <uint64 (FreeRunningBWCounters::*F)()>
@@ -75,6 +70,7 @@ public:
     {
         std::shared_ptr<SafeMsrHandle> msr;
         MBLCounter(std::shared_ptr<SafeMsrHandle> msr_) : msr(msr_) { }
+        int32 getCore() { return msr->getCoreId(); }
         uint64 operator () ()
         {
             msr->lock();
@@ -98,6 +94,7 @@ public:
     {
         std::shared_ptr<SafeMsrHandle> msr;
         MBTCounter(std::shared_ptr<SafeMsrHandle> msr_) : msr(msr_) { }
+        int32 getCore() { return msr->getCoreId(); }
         uint64 operator () ()
         {
             msr->lock();
@@ -118,7 +115,7 @@ public:
     };
 
 private:
-    std::thread * UpdateThread;
+    friend class CounterWidthExtenderWatchdog;
 
     Mutex CounterMutex;
 
@@ -127,6 +124,11 @@ private:
     uint64 last_raw_value;
     uint64 counter_width;
     uint32 watchdog_delay_ms;
+    uint64 last_read_ms;  // time of the last raw counter read
+    uint64 watchdog_id;   // registration in the shared watchdog
+
+    static uint64 currentTimeMs();
+    uint64 refresh(const uint64 now_ms, const uint64 batch_window_ms);
 
     CounterWidthExtender();                                           // forbidden
     CounterWidthExtender(CounterWidthExtender &);                     // forbidden
@@ -135,10 +137,16 @@ private:
 
     uint64 internal_read()
     {
-        uint64 result = 0, new_raw_value = 0;
         CounterMutex.lock();
+        const uint64 result = locked_read();
+        CounterMutex.unlock();
+        return result;
+    }
 
-        new_raw_value = (*raw_counter)();
+    uint64 locked_read()
+    {
+        uint64 new_raw_value = (*raw_counter)();
+        last_read_ms = currentTimeMs();
         if (new_raw_value < last_raw_value)
         {
             extended_value += ((1ULL << counter_width) - last_raw_value) + new_raw_value;
@@ -150,14 +158,17 @@ private:
 
         last_raw_value = new_raw_value;
 
-        result = extended_value;
-
-        CounterMutex.unlock();
-        return result;
+        return extended_value;
     }
 
 public:
 
+    /*! \brief Creates the extender and registers it in the shared watchdog
+        \param raw_counter_ underlying counter (owned by the extender)
+        \param counter_width_ width of the underlying counter in bits
+        \param watchdog_delay_ms_ maximum time between two reads of the underlying counter that can not miss a wraparound
+                                  (derived from the counter width and the maximum increment rate of the counter)
+    */
     CounterWidthExtender(AbstractRawCounter * raw_counter_, uint64 counter_width_, uint32 watchdog_delay_ms_);
     virtual ~CounterWidthExtender();
 
@@ -169,6 +180,7 @@ public:
     {
         CounterMutex.lock();
         extended_value = last_raw_value = (*raw_counter)();
+        last_read_ms = currentTimeMs();
         CounterMutex.unlock();
     }
 };
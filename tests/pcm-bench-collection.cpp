@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+// pcm-bench suites of the register access paths: getAllCounterStates on simulated machines, MSR read plans and PMT telemetry loads
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../src/cpucounters.h"
+#include "../src/simulated_hw.h"
+#include "../src/pmt.h"
+#include "pcm-bench.h"
+
+namespace pcm {
+
+namespace {
+
+// per socket: memory controller channel counters in PCI configuration space, a TPMI feature with one entry
+// per channel and a telemetry region, all read as raw events next to the core and uncore PMUs
+enum
+{
+    channelsPerSocket = 8,
+    countersPerChannel = 5,
+    pmtEventsPerSocket = 16
+};
+constexpr uint32 channelDeviceID = 0x3250; // of the simulated channel functions
+constexpr uint32 tpmiID = 0x5;
+constexpr uint32 pmtUID = 0x1a067102;
+
+PCM::RawPMUConfigs simulateRawRegisters(const uint32 sockets)
+{
+    PCM::RawPMUConfigs configs;
+    for (uint32 s = 0; s < sockets; ++s)
+    {
+        const uint32 bus = 0x10 + s * 0x20;
+        for (uint32 ch = 0; ch < channelsPerSocket; ++ch)
+        {
+            const uint32 device = 0x1a + ch / 2, function = 2 + (ch % 2) * 4;
+            SimulatedHardware::setPCI(0, bus, device, function, 0, (uint64(channelDeviceID) << 16) | PCM_INTEL_PCI_VENDOR_ID);
+            for (uint32 c = 0; c < countersPerChannel; ++c)
+            {
+                SimulatedHardware::setPCI(0, bus, device, function, 0xA0 + c * 8, (uint64)c << 32, 100 + c);
+            }
+            SimulatedHardware::setTPMI(s, tpmiID, ch, 0x10, 0, 1000 + ch);
+        }
+        for (uint32 q = 0; q < pmtEventsPerSocket; ++q)
+        {
+            SimulatedHardware::setPMT(pmtUID, s, q * 4, 0, 10 + q);
+        }
+    }
+    for (uint32 c = 0; c < countersPerChannel; ++c)
+    {
+        PCM::RawEventEncoding e{};
+        e[PCM::PCICFGEventPosition::deviceID] = channelDeviceID;
+        e[PCM::PCICFGEventPosition::offset] = 0xA0 + c * 8;
+        e[PCM::PCICFGEventPosition::width] = 64;
+        configs["pcicfg"].programmable.push_back(std::make_pair(e, "channel counter " + std::to_string(c)));
+    }
+    {
+        PCM::RawEventEncoding e{};
+        e[PCM::TPMIEventPosition::ID] = tpmiID;
+        e[PCM::TPMIEventPosition::offset] = 0x10;
+        configs["tpmi"].programmable.push_back(std::make_pair(e, std::string("channel activity")));
+    }
+    for (uint32 q = 0; q < pmtEventsPerSocket; ++q)
+    {
+        PCM::RawEventEncoding e{};
+        e[PCM::PMTEventPosition::UID] = pmtUID;
+        e[PCM::PMTEventPosition::offset] = q * 4;
+        e[PCM::PMTEventPosition::lsb] = 0;
+        e[PCM::PMTEventPosition::msb] = 63;
+        configs["pmt"].programmable.push_back(std::make_pair(e, "telemetry " + std::to_string(q)));
+    }
+    return configs;
+}
+
+// runs in the child process of the machine, returns its exit code
+int benchMachine(BenchRunner & runner, const uint32 sockets, const uint32 coresPerSocket)
+{
+    SimulatedHardware::enable();
+    SimulatedHardware::setTopology(sockets, coresPerSocket, 2);
+    const auto configs = simulateRawRegisters(sockets);
+    null_stream nullStream;
+    std::streambuf * const coutBuffer = std::cout.rdbuf(&nullStream); // initialization messages, the CSV goes to stdout
+    std::streambuf * const cerrBuffer = std::cerr.rdbuf(&nullStream);
+    PCM * m = PCM::getInstance();
+    const bool programmed = m->program() == PCM::Success && m->program(configs, true) == PCM::Success;
+    std::cout.rdbuf(coutBuffer);
+    std::cerr.rdbuf(cerrBuffer);
+    if (!programmed)
+    {
+        std::cerr << "Error: can't program the simulated " << sockets << " socket machine\n";
+        return 1;
+    }
+
+    const std::string suffix = "_" + std::to_string(sockets) + "s_" + std::to_string(m->getNumCores()) + "t";
+    const size_t threads = m->getNumCores();
+    SystemCounterState systemState;
+    std::vector<SocketCounterState> socketStates;
+    std::vector<CoreCounterState> coreStates;
+    auto context = m->createCollectionContext();
+    // without uncore reads only the per-core fan-out/fan-in cost is measured
+    runner.run("collection", "vector_no_uncore" + suffix, threads, [&]()
+        {
+            m->getAllCounterStates(systemState, socketStates, coreStates, false);
+            return coreStates.size();
+        });
+    runner.run("collection", "context_no_uncore" + suffix, threads, [&]()
+        {
+            m->getAllCounterStates(*context, false);
+            return threads;
+        });
+    runner.run("collection", "vector" + suffix, threads, [&]()
+        {
+            m->getAllCounterStates(systemState, socketStates, coreStates);
+            return coreStates.size();
+        });
+    runner.run("collection", "context" + suffix, threads, [&]()
+        {
+            m->getAllCounterStates(*context);
+            return threads;
+        });
+
+    // the raw events must have been read on every socket
+    SystemCounterState before, after;
+    m->getAllCounterStates(before, socketStates, coreStates);
+    m->getAllCounterStates(after, socketStates, coreStates);
+    auto advances = [](const std::vector<uint64> & values)
+    {
+        return values.empty() == false && std::find(values.begin(), values.end(), 0ULL) == values.end();
+    };
+    const bool read = getInstructionsRetired(before, after) != 0
+        && advances(getPCICFGEvent(configs.at("pcicfg").programmable[0].first, before, after))
+        && advances(getTPMIEvent(configs.at("tpmi").programmable[0].first, before, after))
+        && advances(getPMTEvent(configs.at("pmt").programmable[0].first, before, after));
+    m->cleanup(true);
+    std::cout.flush();
+    if (!read)
+    {
+        std::cerr << "Error: the simulated counters of the " << sockets << " socket machine do not advance\n";
+        return 1;
+    }
+    return 0;
+}
+
+// a directory laid out like /sys/class/intel_pmt with one telemetry region, removed on destruction
+class TelemetryTree
+{
+    std::string root, telem;
+    bool created = false;
+public:
+    TelemetryTree(const size_t uid, const size_t regionSize)
+    {
+        char dirTemplate[] = "/tmp/pcm-bench-pmt-XXXXXX";
+        if (mkdtemp(dirTemplate) == nullptr)
+        {
+            return;
+        }
+        root = dirTemplate;
+        telem = root + "/telem0";
+        if (mkdir(telem.c_str(), 0700) != 0)
+        {
+            rmdir(root.c_str());
+            return;
+        }
+        std::ofstream(telem + "/guid") << "0x" << std::hex << uid << "\n";
+        std::ofstream(telem + "/size") << regionSize << "\n";
+        std::ofstream(telem + "/offset") << "0\n";
+        std::ofstream data(telem + "/telem", std::ios::binary);
+        for (uint64 q = 0; q < regionSize / sizeof(uint64); ++q)
+        {
+            data.write((const char *)&q, sizeof(q));
+        }
+        created = true;
+    }
+    ~TelemetryTree()
+    {
+        if (created)
+        {
+            for (const char * file : { "/telem", "/offset", "/size", "/guid" })
+            {
+                unlink((telem + file).c_str());
+            }
+            rmdir(telem.c_str());
+            rmdir(root.c_str());
+        }
+    }
+    bool isCreated() const { return created; }
+    const std::string & getRoot() const { return root; }
+};
+
+} // namespace
+
+bool benchCollectionScaling(BenchRunner & runner)
+{
+    const std::pair<uint32, uint32> machines[] = { {1, 8}, {1, 30}, {2, 60}, {4, 120}, {8, 120} };
+    for (const auto & machine : machines)
+    {
+        std::cout.flush(); // the child inherits the unwritten buffer otherwise
+        const pid_t child = fork();
+        if (child < 0)
+        {
+            std::cerr << "Error: fork failed\n";
+            return false;
+        }
+        if (child == 0)
+        {
+            _exit(benchMachine(runner, machine.first, machine.second));
+        }
+        int status = 0;
+        if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void benchMsrReads(BenchRunner & runner)
+{
+    // the registers of a typical core sample: status, fixed and general counters, C-states, thermal status, SMI count
+    SafeMsrHandle msr(0);
+    MsrReadPlan plan;
+    for (const uint64 index : { (uint64)IA32_PERF_GLOBAL_STATUS, (uint64)INST_RETIRED_ADDR, (uint64)CPU_CLK_UNHALTED_THREAD_ADDR,
+                                (uint64)CPU_CLK_UNHALTED_REF_ADDR, (uint64)MSR_IA32_THERM_STATUS, (uint64)MSR_SMI_COUNT,
+                                (uint64)0x3FC, (uint64)0x3FD, (uint64)0x3FE })
+    {
+        plan.add(index);
+    }
+    for (uint64 i = 0; i < 4; ++i)
+    {
+        plan.add(IA32_PMC0 + i);
+    }
+    std::vector<uint64> values(plan.size(), 0ULL);
+    runner.run("msr", "single_reads", plan.size(), [&]()
+        {
+            for (size_t i = 0; i < plan.size(); ++i)
+            {
+                msr.read(plan.getMSRs()[i], &values[i]);
+            }
+            return values[1];
+        });
+    runner.run("msr", "read_plan", plan.size(), [&]()
+        {
+            plan.execute(msr, values.data());
+            return values[1];
+        });
+}
+
+void benchPMTLoads(BenchRunner & runner)
+{
+    // the Linux telemetry file backend on a synthetic sysfs tree
+    const size_t uid = 0x1234, regionSize = 16384;
+    TelemetryTree tree(uid, regionSize);
+    if (tree.isCreated() == false)
+    {
+        std::cerr << "Error: can't create a synthetic telemetry tree, skipping the pmt suite\n";
+        return;
+    }
+    setenv("PCM_PMT_SYSFS_PATH", tree.getRoot().c_str(), 1);
+
+    // a typical pcm-raw configuration: a few scattered qwords of the region
+    std::vector<size_t> qWords;
+    for (size_t q = 3; q < regionSize / sizeof(uint64) && qWords.size() < 8; q += 37)
+    {
+        qWords.push_back(q);
+    }
+    auto bench = [&](const char * name, const bool readSet, const bool mapped)
+    {
+        setenv("PCM_NO_PMT_MMAP", mapped ? "0" : "1", 1);
+        TelemetryArray array(uid, 0);
+        if (readSet)
+        {
+            for (const auto q : qWords)
+            {
+                array.addToReadSet(q);
+            }
+        }
+        runner.run("pmt", name, qWords.size(), [&]()
+            {
+                array.load();
+                uint64 sum = 0;
+                for (const auto q : qWords)
+                {
+                    sum += array.get(q, 0, 63);
+                }
+                return sum;
+            });
+    };
+    bench("full_region_pread", false, false);
+    bench("readset_pread", true, false);
+    bench("readset_mmap", true, true);
+    unsetenv("PCM_NO_PMT_MMAP");
+    unsetenv("PCM_PMT_SYSFS_PATH");
+}
+
+} // namespace pcm
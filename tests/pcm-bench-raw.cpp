@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+// pcm-bench suite of pcm-raw: parsing of event descriptions into raw PMU configurations
+
+#define UNIT_TEST 1
+
+#include "../src/pcm-raw.cpp"
+
+#undef UNIT_TEST
+
+#include "pcm-bench.h"
+
+namespace pcm {
+
+void benchRawEventParsing(BenchRunner & runner)
+{
+    // an event list mixing core, uncore and register events, as given with -e or in an -el file
+    const std::vector<std::string> events = {
+        "core/config=0x30203,name=LD_BLOCKS.STORE_FORWARD/",
+        "core/config=0x5300c0,name=INST_RETIRED.ANY_P/",
+        "core/fixed,config=0x333/",
+        "cha/config=0,name=UNC_CHA_CLOCKTICKS/",
+        "cha/config=0x00c8177e01b435,config1=0x0000000000000000,name=UNC_CHA_TOR_INSERTS.IA_MISS_DRD/",
+        "imc/fixed,name=DRAM_CLOCKS/",
+        "imc/config=0x0000ff05,name=UNC_M_CAS_COUNT_SCH0.RD/",
+        "upi/config=0x0f02,name=UNC_UPI_TxL_FLITS.ALL_DATA/",
+        "pcicfg/config=0x2c,config1=0x108,width=32,name=RAW_PCICFG/",
+        "mmio/config=0x0,config1=0x120,config2=0,config3=0x1000,width=64,name=RAW_MMIO/",
+        "package_msr/config=0x611,config1=0,name=PKG_ENERGY_STATUS/"
+    };
+
+    // addEvent reports every parsed event on stderr; the formatting stays in the measurement, the output does not
+    null_stream nullStream;
+    std::streambuf * const cerrBuffer = std::cerr.rdbuf(&nullStream);
+    runner.run("raw", "add_event", events.size(), [&]()
+        {
+            PCM::RawPMUConfigs configs;
+            size_t parsed = 0;
+            for (const auto & event : events)
+            {
+                if (addEvent(configs, event) == AddEventStatus::OK)
+                {
+                    ++parsed;
+                }
+            }
+            return parsed;
+        });
+    std::cerr.rdbuf(cerrBuffer);
+}
+
+} // namespace pcm
@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+// pcm-bench: repeatable microbenchmarks of the PCM hot paths on the simulated hardware backend
+//
+// usage: pcm-bench [iterations] [filter]
+// prints one CSV row per benchmark (see BenchRunner::printHeader), the filter selects benchmarks by "suite/name" substring
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include <array>
+#include <vector>
+#include <memory>
+#include "../src/cpucounters.h"
+#include "../src/core_metrics.h"
+#include "../src/simulated_hw.h"
+#include "pcm-bench.h"
+
+using namespace pcm;
+
+std::atomic<uint64> pcm::benchAllocations{0};
+
+// not inlined: GCC would otherwise match the malloc()/free() pairs against the new and delete expressions of this file
+__attribute__((noinline)) void * operator new(size_t size)
+{
+    ++benchAllocations;
+    void * p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept { free(p); }
+
+namespace {
+
+// the fixed-size counter blocks ServerUncoreCounterState used before the packed layout
+struct FixedServerUncoreCounterState
+{
+    typedef ServerUncoreCounterState S;
+    std::array<std::array<uint64, S::maxCounters>, S::maxXPILinks> xPICounter{}, M3UPICounter{};
+    std::array<std::array<uint64, S::maxCounters>, S::maxIIOStacks> IIOCounter{}, IRPCounter{};
+    std::array<std::array<uint64, S::maxCounters>, S::maxCXLPorts> CXLCMCounter{}, CXLDPCounter{};
+    std::array<uint64, S::maxChannels> DRAMClocks{}, HBMClocks{};
+    std::array<std::array<uint64, S::maxCounters>, S::maxChannels> MCCounter{}, EDCCounter{};
+    std::array<std::array<uint64, S::maxCounters>, S::maxControllers> M2MCounter{}, HACounter{};
+};
+
+// a raw counter without device access: advances by a fixed step and wraps at the counter width
+struct SteppingCounter : public CounterWidthExtender::AbstractRawCounter
+{
+    uint64 value = 0;
+    const uint64 step, mask;
+    SteppingCounter(const uint64 step_, const uint64 width) : step(step_), mask((1ULL << width) - 1ULL) { }
+    uint64 operator () () override
+    {
+        value = (value + step) & mask;
+        return value;
+    }
+};
+
+void benchAggregation(BenchRunner & runner, const std::vector<CoreCounterState> & coreStates, const std::vector<SocketCounterState> & socketStates)
+{
+    const size_t cores = coreStates.size(), sockets = socketStates.size();
+    BasicCounterState basic;
+    runner.run("aggregation", "basic_state", cores, [&]()
+        {
+            basic = BasicCounterState();
+            for (const auto & core : coreStates)
+            {
+                basic += core;
+            }
+            return getInstructionsRetired(basic);
+        });
+    UncoreCounterState uncore;
+    runner.run("aggregation", "uncore_state", sockets, [&]()
+        {
+            uncore = UncoreCounterState();
+            for (const auto & socket : socketStates)
+            {
+                uncore += static_cast<const UncoreCounterState &>(socket);
+            }
+            return getBytesReadFromMC(uncore, uncore);
+        });
+    std::vector<SocketCounterState> socketSums(sockets);
+    runner.run("aggregation", "socket_state", cores, [&]()
+        {
+            for (auto & s : socketSums)
+            {
+                s = SocketCounterState();
+            }
+            for (size_t core = 0; core < cores; ++core)
+            {
+                socketSums[core % sockets] += coreStates[core];
+            }
+            return getInstructionsRetired(socketSums[0]);
+        });
+    SystemCounterState system;
+    runner.run("aggregation", "system_state", sockets, [&]()
+        {
+            system = SystemCounterState();
+            for (const auto & socket : socketStates)
+            {
+                system += socket;
+            }
+            return getInstructionsRetired(system);
+        });
+    // the folding of getAllCounterStates: cores into their sockets, sockets into the system
+    runner.run("aggregation", "core_socket_system", cores, [&]()
+        {
+            for (auto & s : socketSums)
+            {
+                s.reset();
+            }
+            system.reset();
+            for (size_t core = 0; core < cores; ++core)
+            {
+                socketSums[core % sockets] += coreStates[core];
+            }
+            for (const auto & s : socketSums)
+            {
+                system += s;
+            }
+            return getInstructionsRetired(system);
+        });
+}
+
+void benchUncoreState(BenchRunner & runner, PCM * m)
+{
+    // the snapshot of a socket taken by pcm-memory, pcm-power and pcm-raw for every before/after sample
+    ServerUncoreCounterState packed = m->getServerUncoreCounterState(0), packedOther = packed;
+    FixedServerUncoreCounterState fixed, fixedOther;
+    auto firstByte = [](const auto & state) { return uint64(*reinterpret_cast<const volatile unsigned char *>(&state)); };
+    runner.run("uncore_state", "copy_packed", packed.getNumCounters(), [&]()
+        {
+            ServerUncoreCounterState copy(packed);
+            return firstByte(copy);
+        });
+    runner.run("uncore_state", "copy_fixed", sizeof(FixedServerUncoreCounterState) / sizeof(uint64), [&]()
+        {
+            FixedServerUncoreCounterState copy(fixed);
+            return firstByte(copy);
+        });
+    runner.run("uncore_state", "swap_packed", packed.getNumCounters(), [&]()
+        {
+            std::swap(packed, packedOther);
+            return firstByte(packed);
+        });
+    runner.run("uncore_state", "swap_fixed", sizeof(FixedServerUncoreCounterState) / sizeof(uint64), [&]()
+        {
+            std::swap(fixed, fixedOther);
+            return firstByte(fixed);
+        });
+}
+
+void benchDerivedMetrics(BenchRunner & runner, const std::vector<CoreCounterState> & before, const std::vector<CoreCounterState> & after,
+    const std::vector<SocketCounterState> & socketBefore, const std::vector<SocketCounterState> & socketAfter,
+    const SystemCounterState & systemBefore, const SystemCounterState & systemAfter)
+{
+    const size_t cores = before.size(), sockets = socketBefore.size();
+    typedef double (*CoreMetric)(const CoreCounterState &, const CoreCounterState &);
+    const std::vector<std::pair<const char *, CoreMetric> > coreMetrics = {
+        { "ipc", &getIPC<CoreCounterState> },
+        { "active_average_frequency", &getActiveAverageFrequency<CoreCounterState> },
+        { "l3_cache_hit_ratio", &getL3CacheHitRatio<CoreCounterState> },
+        { "frontend_bound", &getFrontendBound<CoreCounterState> },
+        { "backend_bound", &getBackendBound<CoreCounterState> },
+        { "memory_bound", &getMemoryBound<CoreCounterState> }
+    };
+    for (const auto & metric : coreMetrics)
+    {
+        runner.run("metrics", metric.first, cores, [&]()
+            {
+                double sum = 0.;
+                for (size_t core = 0; core < cores; ++core)
+                {
+                    sum += metric.second(before[core], after[core]);
+                }
+                return sum;
+            });
+    }
+    // all core metrics of CoreMetrics: per-state functions vs. the columnar evaluation
+    // (the equivalence of both is checked by tests/utests/core-metrics-utest.cpp)
+    const std::vector<std::pair<CoreMetrics::Metric, CoreMetric> > allCoreMetrics = {
+        { CoreMetrics::IPC, &getIPC<CoreCounterState> },
+        { CoreMetrics::AverageFrequency, &getAverageFrequency<CoreCounterState> },
+        { CoreMetrics::ActiveAverageFrequency, &getActiveAverageFrequency<CoreCounterState> },
+        { CoreMetrics::L3CacheHitRatio, &getL3CacheHitRatio<CoreCounterState> },
+        { CoreMetrics::FrontendBound, &getFrontendBound<CoreCounterState> },
+        { CoreMetrics::BadSpeculation, &getBadSpeculation<CoreCounterState> },
+        { CoreMetrics::BackendBound, &getBackendBound<CoreCounterState> },
+        { CoreMetrics::Retiring, &getRetiring<CoreCounterState> },
+        { CoreMetrics::MemoryBound, &getMemoryBound<CoreCounterState> },
+        { CoreMetrics::CoreBound, &getCoreBound<CoreCounterState> }
+    };
+    std::vector<double> perState(allCoreMetrics.size() * cores);
+    runner.run("metrics", "core_metrics_per_state", cores, [&]()
+        {
+            for (size_t k = 0; k < allCoreMetrics.size(); ++k)
+            {
+                for (size_t core = 0; core < cores; ++core)
+                {
+                    perState[k * cores + core] = allCoreMetrics[k].second(before[core], after[core]);
+                }
+            }
+            return perState[0];
+        });
+    CoreMetrics columnar;
+    runner.run("metrics", "core_metrics_columnar", cores, [&]()
+        {
+            columnar.compute(before, after);
+            return columnar.get(CoreMetrics::IPC, 0);
+        });
+    runner.run("metrics", "core_c_state_residency", cores, [&]()
+        {
+            double sum = 0.;
+            for (size_t core = 0; core < cores; ++core)
+            {
+                for (int state = 0; state <= PCM::MAX_C_STATE; ++state)
+                {
+                    sum += getCoreCStateResidency(state, before[core], after[core]);
+                }
+            }
+            return sum;
+        });
+    runner.run("metrics", "socket_memory_and_energy", sockets, [&]()
+        {
+            double sum = 0.;
+            for (size_t s = 0; s < sockets; ++s)
+            {
+                sum += double(getBytesReadFromMC(socketBefore[s], socketAfter[s]) + getBytesWrittenToMC(socketBefore[s], socketAfter[s]));
+                sum += getConsumedJoules(socketBefore[s], socketAfter[s]) + getDRAMConsumedJoules(socketBefore[s], socketAfter[s]);
+                for (int state = 0; state <= PCM::MAX_C_STATE; ++state)
+                {
+                    sum += getPackageCStateResidency(state, socketBefore[s], socketAfter[s]);
+                }
+            }
+            return sum;
+        });
+    runner.run("metrics", "system_summary", 1, [&]()
+        {
+            return getIPC(systemBefore, systemAfter) + getActiveAverageFrequency(systemBefore, systemAfter)
+                + getL3CacheHitRatio(systemBefore, systemAfter) + double(getAllIncomingQPILinkBytes(systemBefore, systemAfter));
+        });
+}
+
+void benchRDTChecks(BenchRunner & runner, PCM * m)
+{
+    // the RDT availability checks of every core sample (L3 occupancy and memory bandwidth reads)
+    runner.run("collection", "rdt_checks_per_core", 3, [&]()
+        {
+            return uint64(m->L3CacheOccupancyMetricAvailable()) + uint64(m->CoreLocalMemoryBWMetricAvailable())
+                + uint64(m->CoreRemoteMemoryBWMetricAvailable());
+        });
+}
+
+void benchWidthExtender(BenchRunner & runner)
+{
+    enum { numExtenders = 64 };
+    std::vector<std::unique_ptr<CounterWidthExtender> > extenders;
+    for (uint64 i = 0; i < numExtenders; ++i)
+    {
+        // 32-bit counters wrapping every ~16 reads; the watchdog period is far above the benchmark duration
+        extenders.emplace_back(new CounterWidthExtender(new SteppingCounter(0x10000000ULL + i, 32), 32, 1000000));
+    }
+    runner.run("width_extender", "read", numExtenders, [&]()
+        {
+            uint64 sum = 0;
+            for (auto & e : extenders)
+            {
+                sum += e->read();
+            }
+            return sum;
+        });
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    const int iterations = (argc > 1) ? std::atoi(argv[1]) : 1000;
+    const std::string filter = (argc > 2) ? argv[2] : "";
+    if (iterations <= 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [iterations] [filter]\n";
+        return 1;
+    }
+
+    BenchRunner runner(iterations, filter);
+    BenchRunner::printHeader();
+    // forks the simulated machines, before this process instantiates PCM
+    if (benchCollectionScaling(runner) == false)
+    {
+        return 1;
+    }
+
+    // the counter states and the topology (2 sockets, 512 threads) come from the deterministic simulated backend.
+    // The processor model comes from the CPUID of the host: it selects the programmed events, the supported
+    // metrics and the uncore PMUs looked for, so results are comparable only between hosts of the same model.
+    SimulatedHardware::enable();
+    SimulatedHardware::setTopology(2, 128, 2);
+    null_stream nullStream;
+    std::streambuf * const coutBuffer = std::cout.rdbuf(&nullStream); // initialization and cleanup messages, the CSV goes to stdout
+    std::streambuf * const cerrBuffer = std::cerr.rdbuf(&nullStream);
+    PCM * m = PCM::getInstance();
+    const auto status = m->program();
+    SystemCounterState systemBefore, systemAfter;
+    std::vector<CoreCounterState> coreBefore, coreAfter;
+    std::vector<SocketCounterState> socketBefore, socketAfter;
+    if (status == PCM::Success)
+    {
+        m->getAllCounterStates(systemBefore, socketBefore, coreBefore);
+        m->getAllCounterStates(systemAfter, socketAfter, coreAfter);
+    }
+    std::cout.rdbuf(coutBuffer);
+    std::cerr.rdbuf(cerrBuffer);
+    if (status != PCM::Success)
+    {
+        std::cerr << "Error: can't program the simulated machine (error " << status << ")\n";
+        return 1;
+    }
+
+    benchAggregation(runner, coreAfter, socketAfter);
+    benchUncoreState(runner, m);
+    benchRDTChecks(runner, m);
+    benchDerivedMetrics(runner, coreBefore, coreAfter, socketBefore, socketAfter, systemBefore, systemAfter);
+    benchWidthExtender(runner);
+    benchMsrReads(runner);
+    benchPMTLoads(runner);
+    benchSensorServer(runner);
+    benchRawEventParsing(runner);
+    std::cerr << "checksum: " << runner.getChecksum() << "\n";
+
+    std::cout.rdbuf(&nullStream);
+    std::cerr.rdbuf(&nullStream);
+    m->cleanup(true);
+    std::cout.rdbuf(coutBuffer);
+    std::cerr.rdbuf(cerrBuffer);
+    return 0;
+}
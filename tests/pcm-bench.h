@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+// Harness of the pcm-bench microbenchmarks: runs a function repeatedly and prints one CSV row per benchmark
+
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <atomic>
+#include <algorithm>
+#include "../src/types.h"
+
+namespace pcm {
+
+//! heap allocations of the process, counted by the operator new of pcm-bench.cpp
+extern std::atomic<uint64> benchAllocations;
+
+class BenchRunner
+{
+    const int iterations;
+    const std::string filter; // runs only the benchmarks whose "suite/name" contains the filter
+    uint64 checksum = 0;
+public:
+    BenchRunner(const int iterations_, const std::string & filter_) : iterations(iterations_), filter(filter_) { }
+
+    static void printHeader()
+    {
+        std::cout << "suite,benchmark,iterations,items,mean_ns,p50_ns,p99_ns,min_ns,mean_ns_per_item,allocations_per_iteration\n";
+    }
+
+    //! \brief measures f, which processes items elements per call and returns a value that is folded into the checksum
+    template <class F>
+    void run(const std::string & suite, const std::string & name, const size_t items, F f)
+    {
+        using namespace std::chrono;
+        if (filter.empty() == false && (suite + "/" + name).find(filter) == std::string::npos)
+        {
+            return;
+        }
+        checksum += uint64(f()); // warm-up
+        std::vector<double> samples(iterations);
+        const uint64 allocationsBefore = benchAllocations;
+        for (auto & sample : samples)
+        {
+            const auto start = steady_clock::now();
+            checksum += uint64(f());
+            sample = double(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+        const double allocations = double(benchAllocations - allocationsBefore) / iterations;
+        const double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / iterations;
+        std::sort(samples.begin(), samples.end());
+        std::cout << suite << "," << name << "," << iterations << "," << items << "," << mean << ","
+            << samples[samples.size() / 2] << "," << samples[(samples.size() * 99) / 100] << "," << samples.front() << ","
+            << (items ? mean / items : mean) << "," << allocations << "\n";
+    }
+
+    //! \brief sum of the benchmark results; printed so that the compiler can not drop the measured work
+    uint64 getChecksum() const { return checksum; }
+};
+
+// suites compiled in separate translation units (they include the pcm-sensor-server and pcm-raw sources)
+void benchSensorServer(BenchRunner & runner);
+void benchRawEventParsing(BenchRunner & runner);
+
+/*! \brief getAllCounterStates on simulated machines of growing size
+
+    Each machine is simulated in a child process (PCM discovers the topology once per process), so the
+    suite must run before the parent process instantiates PCM. Returns false if a child failed.
+*/
+bool benchCollectionScaling(BenchRunner & runner);
+void benchMsrReads(BenchRunner & runner);
+void benchPMTLoads(BenchRunner & runner);
+
+} // namespace pcm
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+// Load test of the pcm-sensor-server HTTP front end on the loopback interface with the simulated hardware backend
+//
+// usage: sensor_server_load_benchmark [seconds per run] [path]
+// every run starts K client threads, each keeps one persistent connection and pipelines P GET requests of the path
+
+#include <iostream>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define UNIT_TEST 1
+
+#include "../src/pcm-sensor-server.cpp"
+
+#undef UNIT_TEST
+
+#include "../src/simulated_hw.h"
+
+namespace {
+
+int connectToServer( uint16_t port ) {
+    int const fd = ::socket( AF_INET, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+        return -1;
+    struct sockaddr_in address;
+    std::memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    address.sin_port = htons( port );
+    if ( ::connect( fd, (struct sockaddr*)&address, sizeof( address ) ) < 0 ) {
+        ::close( fd );
+        return -1;
+    }
+    int const one = 1;
+    ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    return fd;
+}
+
+// Reads one response, returns false if the connection broke or the status is not 200
+bool readResponse( int fd, std::string & buffer, bool & closing ) {
+    char chunk[65536];
+    size_t headEnd = std::string::npos, total = 0;
+    while ( true ) {
+        if ( headEnd == std::string::npos && ( headEnd = buffer.find( "\r\n\r\n" ) ) != std::string::npos ) {
+            size_t const cl = buffer.find( "Content-Length: " );
+            if ( cl == std::string::npos || cl > headEnd || buffer.compare( 0, 12, "HTTP/1.1 200" ) != 0 )
+                return false;
+            total = headEnd + 4 + std::stoul( buffer.substr( cl + 16 ) );
+            closing = buffer.find( "Connection: close" ) < headEnd;
+        }
+        if ( headEnd != std::string::npos && buffer.size() >= total ) {
+            buffer.erase( 0, total );
+            return true;
+        }
+        ssize_t const bytes = ::recv( fd, chunk, sizeof( chunk ), 0 );
+        if ( bytes <= 0 )
+            return false;
+        buffer.append( chunk, (size_t)bytes );
+    }
+}
+
+struct ClientResult {
+    std::vector<double> latencies; // ns per request, from sending the batch to receiving the response
+    size_t errors = 0;
+};
+
+void runClient( uint16_t port, std::string const & path, int pipelineDepth, std::chrono::steady_clock::time_point end, ClientResult & result ) {
+    using namespace std::chrono;
+    std::string const request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nAccept: text/plain; version=0.0.4\r\n\r\n";
+    std::string batch;
+    for ( int i = 0; i < pipelineDepth; ++i )
+        batch += request;
+    std::string buffer;
+    int fd = -1;
+    while ( steady_clock::now() < end ) {
+        if ( fd < 0 && ( fd = connectToServer( port ) ) < 0 ) {
+            ++result.errors;
+            return;
+        }
+        auto const start = steady_clock::now();
+        if ( ::send( fd, batch.data(), batch.size(), MSG_NOSIGNAL ) != (ssize_t)batch.size() ) {
+            ++result.errors;
+            ::close( fd );
+            fd = -1;
+            continue;
+        }
+        for ( int i = 0; i < pipelineDepth; ++i ) {
+            bool closing = false;
+            bool const ok = readResponse( fd, buffer, closing );
+            if ( ok )
+                result.latencies.push_back( double( duration_cast<nanoseconds>( steady_clock::now() - start ).count() ) );
+            else
+                ++result.errors;
+            // the server closes persistent connections after keepAliveRequestLimit requests, the rest of the batch is dropped
+            if ( ! ok || closing ) {
+                ::close( fd );
+                fd = -1;
+                buffer.clear();
+                break;
+            }
+        }
+    }
+    if ( fd >= 0 )
+        ::close( fd );
+}
+
+void stopServer( HTTPServer & server, uint16_t port ) {
+    server.stop();
+    // the thread-per-connection server (PCM_SENSOR_SERVER_BLOCKING_IO=1) checks for stop only after accept returns
+    int const fd = connectToServer( port );
+    if ( fd >= 0 )
+        ::close( fd );
+}
+
+} // namespace
+
+int main( int argc, char * argv[] ) {
+    using namespace std::chrono;
+    double const seconds = ( argc > 1 ) ? std::atof( argv[1] ) : 2.0;
+    std::string const path = ( argc > 2 ) ? argv[2] : "/metrics";
+    if ( seconds <= 0. ) {
+        std::cerr << "Usage: " << argv[0] << " [seconds per run] [path]\n";
+        return 1;
+    }
+
+    SimulatedHardware::enable();
+    null_stream nullStream;
+    std::streambuf * const coutBuffer = std::cout.rdbuf( &nullStream ); // initialization messages, the CSV goes to stdout
+    std::streambuf * const cerrBuffer = std::cerr.rdbuf( &nullStream );
+    PCM * m = PCM::getInstance();
+    if ( m->program() != PCM::Success ) {
+        std::cerr.rdbuf( cerrBuffer );
+        std::cerr << "Error: can't program the simulated PMU\n";
+        return 1;
+    }
+    uint16_t const port = uint16_t( 20000 + getpid() % 10000 );
+    HTTPServer server( "127.0.0.1", port, true );
+    server.registerCallback( HTTPRequestMethod::GET,  my_get_callback );
+    server.registerCallback( HTTPRequestMethod::HEAD, my_get_callback );
+    std::thread serverThread( [&server]() { server.run(); } );
+    // the first sample of the periodic counter fetcher is required by the endpoints
+    server.getLatestAggregator();
+    std::cout.rdbuf( coutBuffer );
+    std::cerr.rdbuf( cerrBuffer );
+
+    // machine-readable CSV
+    std::cout << "clients,pipeline_depth,requests,errors,requests_per_second,mean_ns,p50_ns,p99_ns,max_ns\n";
+    std::pair<int, int> const configs[] = { {1, 1}, {1, 16}, {4, 1}, {4, 16}, {16, 1}, {16, 16}, {64, 4} };
+    for ( auto const & config : configs ) {
+        std::vector<ClientResult> results( config.first );
+        std::vector<std::thread> clients;
+        auto const begin = steady_clock::now();
+        auto const end = begin + duration_cast<steady_clock::duration>( duration<double>( seconds ) );
+        for ( int c = 0; c < config.first; ++c )
+            clients.emplace_back( runClient, port, std::cref( path ), config.second, end, std::ref( results[c] ) );
+        for ( auto & t : clients )
+            t.join();
+        double const elapsed = duration<double>( steady_clock::now() - begin ).count();
+        std::vector<double> latencies;
+        size_t errors = 0;
+        for ( auto const & r : results ) {
+            latencies.insert( latencies.end(), r.latencies.begin(), r.latencies.end() );
+            errors += r.errors;
+        }
+        if ( latencies.empty() ) {
+            std::cerr << "Error: no request succeeded with " << config.first << " clients\n";
+            stopServer( server, port );
+            serverThread.join();
+            return 1;
+        }
+        double const mean = std::accumulate( latencies.begin(), latencies.end(), 0.0 ) / latencies.size();
+        std::sort( latencies.begin(), latencies.end() );
+        std::cout << config.first << "," << config.second << "," << latencies.size() << "," << errors << ","
+            << latencies.size() / elapsed << "," << mean << "," << latencies[latencies.size() / 2] << ","
+            << latencies[( latencies.size() * 99 ) / 100] << "," << latencies.back() << std::endl;
+    }
+
+    std::cout.rdbuf( &nullStream );
+    std::cerr.rdbuf( &nullStream );
+    stopServer( server, port );
+    serverThread.join();
+    m->cleanup();
+    std::cout.rdbuf( coutBuffer );
+    std::cerr.rdbuf( cerrBuffer );
+    return 0;
+}
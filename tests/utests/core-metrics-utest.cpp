@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// Equivalence of the columnar CoreMetrics engine (src/core_metrics.cpp) and the
+// per-state metric functions of cpucounters.h for varied nonzero counter states,
+// including checked_uint64 counters that overflowed between the two samples.
+
+#include "cpucounters.h"
+#include "core_metrics.h"
+#include "simulated_hw.h"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace pcm;
+
+namespace {
+
+// sets the protected counters of a core state
+class CoreCounterStateBuilder : public CoreCounterState
+{
+public:
+    CoreCounterStateBuilder & checked(const int index, const uint64 data, const uint64 overflows)
+    {
+        const checked_uint64 value(data, overflows);
+        switch (index)
+        {
+        case 0: InstRetiredAny = value; break;
+        case 1: CpuClkUnhaltedThread = value; break;
+        case 2: CpuClkUnhaltedRef = value; break;
+        default: Event[index - 3] = value; break;
+        }
+        return *this;
+    }
+    CoreCounterStateBuilder & plain(const int index, const uint64 value)
+    {
+        uint64 * const counters[] = { &InvariantTSC, &FrontendBoundSlots, &BadSpeculationSlots, &BackendBoundSlots,
+            &RetiringSlots, &MemBoundSlots, &FetchLatSlots, &BrMispredSlots, &HeavyOpsSlots };
+        *counters[index] = value;
+        return *this;
+    }
+};
+
+constexpr int numCheckedCounters = 3 + 4; // InstRetiredAny, CpuClkUnhaltedThread, CpuClkUnhaltedRef, Event[0..3]
+constexpr int numPlainCounters = 9;
+constexpr uint64 counterWrap = 1ULL << 48;
+
+typedef double (*MetricFunction)(const CoreCounterState &, const CoreCounterState &);
+
+const std::vector<std::pair<CoreMetrics::Metric, MetricFunction> > & metricFunctions()
+{
+    static const std::vector<std::pair<CoreMetrics::Metric, MetricFunction> > functions = {
+        { CoreMetrics::IPC, &getIPC<CoreCounterState> },
+        { CoreMetrics::AverageFrequency, &getAverageFrequency<CoreCounterState> },
+        { CoreMetrics::ActiveAverageFrequency, &getActiveAverageFrequency<CoreCounterState> },
+        { CoreMetrics::L3CacheMisses, [](const CoreCounterState & b, const CoreCounterState & a) { return double(getL3CacheMisses(b, a)); } },
+        { CoreMetrics::L3CacheHits, [](const CoreCounterState & b, const CoreCounterState & a) { return double(getL3CacheHits(b, a)); } },
+        { CoreMetrics::L3CacheHitRatio, &getL3CacheHitRatio<CoreCounterState> },
+        { CoreMetrics::FrontendBound, &getFrontendBound<CoreCounterState> },
+        { CoreMetrics::BadSpeculation, &getBadSpeculation<CoreCounterState> },
+        { CoreMetrics::BackendBound, &getBackendBound<CoreCounterState> },
+        { CoreMetrics::Retiring, &getRetiring<CoreCounterState> },
+        { CoreMetrics::FetchLatencyBound, &getFetchLatencyBound<CoreCounterState> },
+        { CoreMetrics::FetchBandwidthBound, &getFetchBandwidthBound<CoreCounterState> },
+        { CoreMetrics::BranchMispredictionBound, &getBranchMispredictionBound<CoreCounterState> },
+        { CoreMetrics::MachineClearsBound, &getMachineClearsBound<CoreCounterState> },
+        { CoreMetrics::MemoryBound, &getMemoryBound<CoreCounterState> },
+        { CoreMetrics::CoreBound, &getCoreBound<CoreCounterState> },
+        { CoreMetrics::HeavyOperationsBound, &getHeavyOperationsBound<CoreCounterState> },
+        { CoreMetrics::LightOperationsBound, &getLightOperationsBound<CoreCounterState> }
+    };
+    return functions;
+}
+
+class CoreMetricsTest : public ::testing::Test
+{
+protected:
+    static void SetUpTestSuite()
+    {
+        // the metric functions query the CPU model and the capabilities of the programmed events
+        SimulatedHardware::enable();
+        ASSERT_EQ(PCM::Success, PCM::getInstance()->program());
+    }
+
+    static void TearDownTestSuite()
+    {
+        PCM::getInstance()->cleanup();
+    }
+
+    // random before/after states: every counter advances, every third core wraps its checked counters
+    static void makeStates(const size_t cores, std::vector<CoreCounterState> & before, std::vector<CoreCounterState> & after)
+    {
+        std::mt19937_64 rng(cores);
+        std::uniform_int_distribution<uint64> start(0, counterWrap - 1), delta(1, 1ULL << 32);
+        for (size_t core = 0; core < cores; ++core)
+        {
+            CoreCounterStateBuilder b, a;
+            const uint64 baseOverflows = core % 5;
+            for (int c = 0; c < numCheckedCounters; ++c)
+            {
+                const uint64 first = (core % 3 == 0) ? counterWrap - 1 - (rng() % 1024) : start(rng);
+                const uint64 second = first + delta(rng);
+                b.checked(c, first, baseOverflows);
+                a.checked(c, second % counterWrap, baseOverflows + second / counterWrap);
+            }
+            for (int c = 0; c < numPlainCounters; ++c)
+            {
+                const uint64 first = start(rng);
+                b.plain(c, first);
+                a.plain(c, first + delta(rng));
+            }
+            before.push_back(b);
+            after.push_back(a);
+        }
+    }
+
+    static void expectEqual(const std::vector<CoreCounterState> & before, const std::vector<CoreCounterState> & after, const CoreMetrics & columnar)
+    {
+        ASSERT_EQ(columnar.size(), before.size());
+        for (const auto & metric : metricFunctions())
+        {
+            for (size_t core = 0; core < before.size(); ++core)
+            {
+                const double expected = metric.second(before[core], after[core]);
+                const double actual = columnar.get(metric.first, core);
+                if (std::isnan(expected))
+                {
+                    EXPECT_TRUE(std::isnan(actual)) << "metric " << metric.first << " core " << core;
+                }
+                else
+                {
+                    EXPECT_DOUBLE_EQ(expected, actual) << "metric " << metric.first << " core " << core;
+                }
+            }
+        }
+    }
+};
+
+TEST_F(CoreMetricsTest, VariedStatesMatchPerStateFunctions)
+{
+    std::vector<CoreCounterState> before, after;
+    makeStates(37, before, after);
+    CoreMetrics columnar;
+    columnar.compute(before, after);
+    expectEqual(before, after, columnar);
+}
+
+TEST_F(CoreMetricsTest, OverflowedCountersMatchCheckedDifference)
+{
+    std::vector<CoreCounterState> before, after;
+    makeStates(9, before, after);
+    CoreCounterColumns b, a;
+    b.load(before);
+    a.load(after);
+    for (size_t core = 0; core < before.size(); ++core)
+    {
+        for (const auto column : { CoreCounterColumns::InstRetiredAny, CoreCounterColumns::CpuClkUnhaltedThread, CoreCounterColumns::CpuClkUnhaltedRef })
+        {
+            const uint64 columnar = a.column(column)[core] + a.overflowColumn(column)[core] - b.column(column)[core];
+            uint64 expected = 0;
+            switch (column)
+            {
+            case CoreCounterColumns::InstRetiredAny: expected = getInstructionsRetired(before[core], after[core]); break;
+            case CoreCounterColumns::CpuClkUnhaltedThread: expected = getCycles(before[core], after[core]); break;
+            default: expected = getRefCycles(before[core], after[core]); break;
+            }
+            EXPECT_EQ(expected, columnar) << "column " << column << " core " << core;
+        }
+        EXPECT_EQ(nullptr, a.overflowColumn(CoreCounterColumns::InvariantTSC));
+    }
+}
+
+TEST_F(CoreMetricsTest, ReusedEngineMatchesAfterResize)
+{
+    CoreMetrics columnar;
+    for (const size_t cores : { size_t(64), size_t(3), size_t(130) })
+    {
+        std::vector<CoreCounterState> before, after;
+        makeStates(cores, before, after);
+        columnar.compute(before, after);
+        expectEqual(before, after, columnar);
+    }
+}
+
+TEST_F(CoreMetricsTest, IdenticalStatesMatchPerStateFunctions)
+{
+    // zero differences: the divisions by zero of both paths must agree
+    std::vector<CoreCounterState> before, after;
+    makeStates(5, before, after);
+    CoreMetrics columnar;
+    columnar.compute(after, after);
+    expectEqual(after, after, columnar);
+}
+
+} // namespace
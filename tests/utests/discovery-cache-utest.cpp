@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// File format of the discovery cache (src/discovery_cache.cpp): sections survive a write and read,
+// files of another format or written for another platform state (e.g. before a reboot) are discarded.
+
+#include "discovery_cache.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+using namespace pcm;
+
+namespace {
+
+const std::string key = "boot=5f1c0b6e-3f0a-4a4e-9d55-1e0c2b7a9f10 cpuid=806f8 microcode=0x2b000590 cpus=0-223 pci=412:9a0c";
+
+DiscoveryCache::Sections exampleSections()
+{
+    DiscoveryCache::Sections sections;
+    sections["topology"] = { "0 0 0 0 0", "1 0 1 0 0", "2 1 0 0 1" };
+    sections["uncore pmus"] = { "cha 0x1a 0 4", "", "imc 0x10:0x1a:0x2 8 4" }; // an empty line is content too
+    sections["empty"] = {};
+    return sections;
+}
+
+TEST(DiscoveryCacheTest, FormatParseRoundTrip)
+{
+    const auto sections = exampleSections();
+    DiscoveryCache::Sections parsed;
+    ASSERT_TRUE(DiscoveryCache::parse(DiscoveryCache::format(key, sections), key, parsed));
+    EXPECT_EQ(sections, parsed);
+}
+
+TEST(DiscoveryCacheTest, FormatLayout)
+{
+    DiscoveryCache::Sections sections;
+    sections["a"] = { "1 2", "3" };
+    EXPECT_EQ("PCM discovery cache v2\nkey " + key + "\n[a]\n1 2\n3\n", DiscoveryCache::format(key, sections));
+}
+
+TEST(DiscoveryCacheTest, OtherPlatformKeyIsRejected)
+{
+    const std::string content = DiscoveryCache::format(key, exampleSections());
+    std::string rebooted = key;
+    rebooted[5] = '6'; // another boot_id
+    DiscoveryCache::Sections parsed;
+    EXPECT_FALSE(DiscoveryCache::parse(content, rebooted, parsed));
+    EXPECT_TRUE(parsed.empty());
+    EXPECT_FALSE(DiscoveryCache::parse(content, key + " affinity=ff", parsed));
+    EXPECT_FALSE(DiscoveryCache::parse(content, "", parsed));
+}
+
+TEST(DiscoveryCacheTest, UnknownFormatIsRejected)
+{
+    const std::string content = DiscoveryCache::format(key, exampleSections());
+    DiscoveryCache::Sections parsed;
+    EXPECT_FALSE(DiscoveryCache::parse("", key, parsed));
+    EXPECT_FALSE(DiscoveryCache::parse("PCM discovery cache v1\nkey " + key + "\n[a]\n1\n", key, parsed));
+    EXPECT_FALSE(DiscoveryCache::parse(content.substr(content.find('\n') + 1), key, parsed)); // no header
+    EXPECT_FALSE(DiscoveryCache::parse("PCM discovery cache v2\n", key, parsed));           // no key
+    EXPECT_FALSE(DiscoveryCache::parse("PCM discovery cache v2\r\nkey " + key + "\r\n", key, parsed));
+    EXPECT_TRUE(parsed.empty());
+}
+
+TEST(DiscoveryCacheTest, LinesBeforeTheFirstSectionAreIgnored)
+{
+    DiscoveryCache::Sections parsed;
+    ASSERT_TRUE(DiscoveryCache::parse("PCM discovery cache v2\nkey " + key + "\nstray\n[s]\nx\n", key, parsed));
+    ASSERT_EQ(1u, parsed.size());
+    EXPECT_EQ(DiscoveryCache::Lines({ "x" }), parsed["s"]);
+}
+
+TEST(DiscoveryCacheTest, ParseReplacesPreviousSections)
+{
+    DiscoveryCache::Sections parsed = exampleSections();
+    ASSERT_TRUE(DiscoveryCache::parse("PCM discovery cache v2\nkey " + key + "\n[s]\nx\n", key, parsed));
+    EXPECT_EQ(1u, parsed.size());
+    EXPECT_FALSE(DiscoveryCache::parse("garbage", key, parsed));
+    EXPECT_TRUE(parsed.empty());
+}
+
+#ifdef __linux__
+TEST(DiscoveryCacheTest, SetWritesTheFileWithThePlatformKey)
+{
+    char dirTemplate[] = "/tmp/pcm-discovery-cache-utest-XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+    const std::string path = std::string(dirTemplate) + "/discovery.cache";
+    setenv("PCM_DISCOVERY_CACHE", path.c_str(), 1); // read by the first getInstance() of the process
+    unsetenv("PCM_NO_DISCOVERY_CACHE");
+    unsetenv("PCM_REDISCOVER");
+    auto & cache = DiscoveryCache::getInstance();
+    ASSERT_FALSE(cache.getKey().empty());
+    EXPECT_EQ(0u, cache.getKey().find("boot="));
+
+    const DiscoveryCache::Lines lines = { "0 0 0 0 0", "1 0 1 0 0" };
+    cache.set("utest", lines);
+    DiscoveryCache::Lines cached;
+    ASSERT_TRUE(cache.get("utest", cached));
+    EXPECT_EQ(lines, cached);
+
+    std::ifstream file(path);
+    std::ostringstream content;
+    content << file.rdbuf();
+    DiscoveryCache::Sections parsed;
+    ASSERT_TRUE(DiscoveryCache::parse(content.str(), cache.getKey(), parsed));
+    EXPECT_EQ(lines, parsed["utest"]);
+
+    unlink(path.c_str());
+    rmdir(dirTemplate);
+}
+#endif
+
+} // namespace
@@ -0,0 +1,499 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// pcm-sensor-server on simulated hardware: the response cache shared by the connections, the rate history of
+// the /rate endpoints and the HTTP/1.1 pipelining of the event loop (responses in request order, requests split
+// over several reads, oversized requests, handlers that wait for samples, clients that do not read).
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define UNIT_TEST 1
+#include "../../src/pcm-sensor-server.cpp"
+#undef UNIT_TEST
+
+#include <gtest/gtest.h>
+
+namespace {
+
+void programSimulatedPCM()
+{
+    static bool const programmed = []() {
+        SimulatedHardware::enable();
+        null_stream nullStream;
+        std::streambuf * const coutBuffer = std::cout.rdbuf( &nullStream );
+        std::streambuf * const cerrBuffer = std::cerr.rdbuf( &nullStream );
+        bool const success = PCM::getInstance()->program() == PCM::Success;
+        std::cout.rdbuf( coutBuffer );
+        std::cerr.rdbuf( cerrBuffer );
+        return success;
+    }();
+    ASSERT_TRUE( programmed );
+}
+
+TEST( ResponseCacheTest, SerializesOncePerEpoch ) {
+    ResponseCache cache;
+    auto const epoch = std::chrono::steady_clock::now();
+    int serializations = 0;
+    auto const serialize = [&serializations]() {
+        ++serializations;
+        return std::string( "body " ) + std::to_string( serializations );
+    };
+    auto const first = cache.get( "/metrics", Prometheus_0_0_4, epoch, serialize );
+    auto const second = cache.get( "/metrics", Prometheus_0_0_4, epoch, serialize );
+    EXPECT_EQ( 1, serializations );
+    EXPECT_EQ( first.get(), second.get() ); // the same body, not a copy
+    EXPECT_EQ( "body 1", *first );
+}
+
+TEST( ResponseCacheTest, EndpointAndFormatAreSeparateEntries ) {
+    ResponseCache cache;
+    auto const epoch = std::chrono::steady_clock::now();
+    auto const json = cache.get( "/metrics", JSON, epoch, []() { return std::string( "json" ); } );
+    auto const prometheus = cache.get( "/metrics", Prometheus_0_0_4, epoch, []() { return std::string( "prometheus" ); } );
+    auto const persecond = cache.get( "/persecond/1", JSON, epoch, []() { return std::string( "persecond" ); } );
+    EXPECT_EQ( "json", *json );
+    EXPECT_EQ( "prometheus", *prometheus );
+    EXPECT_EQ( "persecond", *persecond );
+    EXPECT_EQ( "json", *cache.get( "/metrics", JSON, epoch, []() { return std::string( "again" ); } ) );
+}
+
+TEST( ResponseCacheTest, NewEpochSerializesAgainAndKeepsTheOldBody ) {
+    ResponseCache cache;
+    auto const epoch = std::chrono::steady_clock::now();
+    auto const old = cache.get( "/", JSON, epoch, []() { return std::string( "old" ); } );
+    auto const current = cache.get( "/", JSON, epoch + std::chrono::seconds( 1 ), []() { return std::string( "new" ); } );
+    EXPECT_EQ( "old", *old ); // still referenced by a connection sending it
+    EXPECT_EQ( "new", *current );
+    // an older epoch is not served from the entry of the newer one
+    EXPECT_EQ( "older", *cache.get( "/", JSON, epoch, []() { return std::string( "older" ); } ) );
+}
+
+TEST( ResponseCacheTest, ConcurrentRequestsShareOneSerialization ) {
+    ResponseCache cache;
+    auto const epoch = std::chrono::steady_clock::now();
+    std::atomic<int> serializations{ 0 };
+    std::atomic<bool> start{ false };
+    std::vector<ResponseCache::Body> bodies( 8 );
+    std::vector<std::thread> threads;
+    for ( size_t i = 0; i < bodies.size(); ++i ) {
+        threads.emplace_back( [&, i]() {
+            while ( ! start )
+                std::this_thread::yield();
+            bodies[i] = cache.get( "/", Prometheus_0_0_4, epoch, [&serializations]() {
+                ++serializations;
+                std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) ); // the others arrive while serializing
+                return std::string( "shared" );
+            } );
+        } );
+    }
+    start = true;
+    for ( auto & t : threads )
+        t.join();
+    EXPECT_EQ( 1, serializations.load() );
+    for ( auto const & body : bodies ) {
+        ASSERT_NE( nullptr, body.get() );
+        EXPECT_EQ( bodies[0].get(), body.get() );
+    }
+}
+
+TEST( ResponseCacheTest, EntriesAreBounded ) {
+    ResponseCache cache;
+    auto const epoch = std::chrono::steady_clock::now();
+    auto const metrics = cache.get( "/metrics", Prometheus_0_0_4, epoch, []() { return std::string( "metrics" ); } );
+    // a client walking through the windows of /rate/X, /metrics is requested in between
+    for ( size_t periods = 1; periods <= 3600; ++periods ) {
+        cache.get( "/rate/" + std::to_string( periods ), Prometheus_0_0_4, epoch, []() { return std::string( 1000, 'r' ); } );
+        if ( 0 == periods % 8 )
+            cache.get( "/metrics", Prometheus_0_0_4, epoch, []() { return std::string( "again" ); } );
+        ASSERT_LE( cache.size(), ResponseCache::maxEntries );
+    }
+    EXPECT_EQ( ResponseCache::maxEntries, cache.size() );
+    // the recently used entry survived
+    EXPECT_EQ( metrics.get(), cache.get( "/metrics", Prometheus_0_0_4, epoch, []() { return std::string( "again" ); } ).get() );
+}
+
+// counter states with the given instructions retired and invariant TSC on every thread, socket and the system
+class CoreStateBuilder : public CoreCounterState {
+public:
+    CoreStateBuilder( uint64 instructions, uint64 tsc ) {
+        InstRetiredAny = checked_uint64( instructions, 0 );
+        InvariantTSC = tsc;
+    }
+};
+
+class SocketStateBuilder : public SocketCounterState {
+public:
+    SocketStateBuilder( uint64 instructions, uint64 tsc ) {
+        InstRetiredAny = checked_uint64( instructions, 0 );
+        InvariantTSC = tsc;
+    }
+};
+
+class SystemStateBuilder : public SystemCounterState {
+public:
+    SystemStateBuilder( uint64 instructions, uint64 tsc ) {
+        InstRetiredAny = checked_uint64( instructions, 0 );
+        InvariantTSC = tsc;
+    }
+};
+
+class CounterHistoryTest : public ::testing::Test {
+protected:
+    static constexpr size_t numThreads = 3;
+    static constexpr size_t numSockets = 2;
+    static constexpr size_t instructionsIndex = 0; // in coreCounterNames
+    static constexpr size_t tscIndex = 7;
+
+    static void SetUpTestSuite() {
+        programSimulatedPCM(); // the counter functions check the capabilities of the processor
+    }
+
+    // sample i: thread t retired (t + 1) * 1000 * i instructions, sockets and system the sums; taken at i * 100 ms
+    static Aggregator sample( size_t i ) {
+        std::vector<CoreCounterState> threads;
+        uint64 sum = 0;
+        for ( size_t t = 0; t < numThreads; ++t ) {
+            uint64 const instructions = ( t + 1 ) * 1000 * i;
+            threads.push_back( CoreStateBuilder( instructions, 100 * i ) );
+            sum += instructions;
+        }
+        std::vector<SocketCounterState> sockets;
+        for ( size_t s = 0; s < numSockets; ++s )
+            sockets.push_back( SocketStateBuilder( sum * ( s + 1 ), 100 * i ) );
+        return Aggregator( threads, sockets, SystemStateBuilder( sum * 3, 100 * i ), origin() + std::chrono::milliseconds( 100 * i ) );
+    }
+
+    static std::chrono::steady_clock::time_point origin() {
+        static auto const o = std::chrono::steady_clock::now();
+        return o;
+    }
+
+    // rate of the instructions of thread t between samples i and j
+    static double threadRate( size_t t, size_t i, size_t j ) {
+        return double( ( t + 1 ) * 1000 * ( j - i ) ) / ( 0.1 * double( j - i ) );
+    }
+};
+
+TEST_F( CounterHistoryTest, NoRatesBeforeTwoSnapshots ) {
+    CounterHistory history( 8, numThreads, numSockets );
+    CounterHistory::Rates rates;
+    EXPECT_FALSE( history.getRates( 1, rates ) );
+    history.record( sample( 0 ) );
+    EXPECT_FALSE( history.getRates( 1, rates ) );
+    history.record( sample( 1 ) );
+    EXPECT_TRUE( history.getRates( 1, rates ) );
+    EXPECT_EQ( CounterHistory::rowSize( numThreads, numSockets ), rates.values.size() );
+}
+
+TEST_F( CounterHistoryTest, RatesOverTheRequestedPeriods ) {
+    CounterHistory history( 16, numThreads, numSockets );
+    for ( size_t i = 0; i < 10; ++i )
+        history.record( sample( i ) );
+    for ( size_t periods : { 1, 3, 9 } ) {
+        CounterHistory::Rates rates;
+        ASSERT_TRUE( history.getRates( periods, rates ) );
+        EXPECT_EQ( origin() + std::chrono::milliseconds( 900 ), rates.epoch );
+        EXPECT_EQ( int64( periods * 100000 ), rates.intervalUs );
+        for ( size_t t = 0; t < numThreads; ++t )
+            EXPECT_DOUBLE_EQ( threadRate( t, 9 - periods, 9 ), rates.values[ history.threadOffset( uint32( t ) ) + instructionsIndex ] ) << "thread " << t;
+        double const sumRate = threadRate( 0, 0, 1 ) + threadRate( 1, 0, 1 ) + threadRate( 2, 0, 1 );
+        EXPECT_DOUBLE_EQ( sumRate, rates.values[ history.socketOffset( 0 ) + instructionsIndex ] );
+        EXPECT_DOUBLE_EQ( 2 * sumRate, rates.values[ history.socketOffset( 1 ) + instructionsIndex ] );
+        EXPECT_DOUBLE_EQ( 3 * sumRate, rates.values[ history.systemOffset() + instructionsIndex ] );
+        EXPECT_DOUBLE_EQ( 1000., rates.values[ history.systemOffset() + tscIndex ] );
+    }
+}
+
+TEST_F( CounterHistoryTest, WindowIsShortenedToTheHistory ) {
+    CounterHistory history( 4, numThreads, numSockets );
+    for ( size_t i = 0; i < 3; ++i )
+        history.record( sample( i ) );
+    CounterHistory::Rates rates;
+    ASSERT_TRUE( history.getRates( 100, rates ) );
+    EXPECT_EQ( 200000, rates.intervalUs );
+    // wrapped around: the ring holds samples 3..6, the oldest is overwritten
+    for ( size_t i = 3; i < 7; ++i )
+        history.record( sample( i ) );
+    ASSERT_TRUE( history.getRates( 100, rates ) );
+    EXPECT_EQ( origin() + std::chrono::milliseconds( 600 ), rates.epoch );
+    EXPECT_EQ( 300000, rates.intervalUs );
+    EXPECT_DOUBLE_EQ( threadRate( 2, 3, 6 ), rates.values[ history.threadOffset( 2 ) + instructionsIndex ] );
+    // zero periods are one period
+    ASSERT_TRUE( history.getRates( 0, rates ) );
+    EXPECT_EQ( 100000, rates.intervalUs );
+}
+
+TEST_F( CounterHistoryTest, DecreasingCountersHaveZeroRate ) {
+    CounterHistory history( 4, numThreads, numSockets );
+    history.record( sample( 5 ) );
+    history.record( Aggregator( { CoreStateBuilder( 0, 600 ), CoreStateBuilder( 0, 600 ), CoreStateBuilder( 0, 600 ) },
+        { SocketStateBuilder( 0, 600 ), SocketStateBuilder( 0, 600 ) }, SystemStateBuilder( 0, 600 ), origin() + std::chrono::milliseconds( 600 ) ) );
+    CounterHistory::Rates rates;
+    ASSERT_TRUE( history.getRates( 1, rates ) );
+    EXPECT_EQ( 0., rates.values[ history.threadOffset( 1 ) + instructionsIndex ] );
+    EXPECT_EQ( 0., rates.values[ history.systemOffset() + instructionsIndex ] );
+    EXPECT_DOUBLE_EQ( 1000., rates.values[ history.systemOffset() + tscIndex ] );
+}
+
+TEST_F( CounterHistoryTest, MemoryIsBounded ) {
+    size_t const rowBytes = CounterHistory::rowSize( numThreads, numSockets ) * sizeof( uint64 );
+    EXPECT_EQ( 8 * rowBytes, CounterHistory::bytes( 8, numThreads, numSockets ) );
+    EXPECT_EQ( (std::numeric_limits<size_t>::max)(), CounterHistory::bytes( (std::numeric_limits<size_t>::max)() / 2, numThreads, numSockets ) );
+    size_t const maxCapacity = CounterHistory::maxBytes / rowBytes;
+    EXPECT_THROW( CounterHistory( maxCapacity + 1, numThreads, numSockets ), std::length_error );
+    // a week sampled every 100 ms on a large system
+    EXPECT_GT( CounterHistory::bytes( HTTPServer::historyCapacity( { std::chrono::milliseconds( 100 ), std::chrono::seconds( 7 * 24 * 3600 ) } ), 512, 8 ),
+        CounterHistory::maxBytes );
+}
+
+TEST( SamplingOptionsTest, DefaultHistoryIsShortenedToFit ) {
+    // 448 threads on 2 sockets sampled every 100 ms: the default hour does not fit, the longest history that fits does
+    SamplingOptions sampling;
+    sampling.period = std::chrono::milliseconds( 100 );
+    EXPECT_GT( CounterHistory::bytes( HTTPServer::historyCapacity( sampling ), 448, 2 ), CounterHistory::maxBytes );
+    sampling.history = HTTPServer::maxHistory( sampling.period, 448, 2 );
+    EXPECT_EQ( std::chrono::seconds( 2684 ), sampling.history );
+    EXPECT_LE( CounterHistory::bytes( HTTPServer::historyCapacity( sampling ), 448, 2 ), CounterHistory::maxBytes );
+    sampling.history += std::chrono::seconds( 1 );
+    EXPECT_GT( CounterHistory::bytes( HTTPServer::historyCapacity( sampling ), 448, 2 ), CounterHistory::maxBytes );
+    // sampled every second the default hour fits
+    EXPECT_GE( HTTPServer::maxHistory( std::chrono::milliseconds( 1000 ), 448, 2 ), SamplingOptions().history );
+}
+
+TEST( SamplingOptionsTest, PeriodDividesASecond ) {
+    for ( int ms : { 100, 125, 200, 250, 500, 1000 } )
+        EXPECT_TRUE( SamplingOptions::isValidPeriod( std::chrono::milliseconds( ms ) ) ) << ms;
+    for ( int ms : { 0, 50, 99, 150, 300, 333, 400, 750, 999, 2000 } )
+        EXPECT_FALSE( SamplingOptions::isValidPeriod( std::chrono::milliseconds( ms ) ) ) << ms;
+}
+
+// A plain HTTP server of the process on a random local port, running the epoll event loop
+class HTTPPipeliningTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        programSimulatedPCM();
+        unsetenv( "PCM_SENSOR_SERVER_BLOCKING_IO" );
+        std::mt19937 rng( std::random_device{}() );
+        for ( int attempt = 0; attempt < 20 && nullptr == server_; ++attempt ) {
+            port_ = uint16_t( 20000 + rng() % 20000 );
+            try {
+                server_ = new HTTPServer( "", port_ );
+            } catch ( std::exception const & ) {
+                // the port is taken
+            }
+        }
+        ASSERT_NE( nullptr, server_ );
+        server_->registerCallback( HTTPRequestMethod::GET, my_get_callback );
+        serverThread_ = new std::thread( []() { server_->run(); } );
+    }
+
+    static void TearDownTestSuite() {
+        if ( nullptr == server_ )
+            return;
+        server_->stop();
+        serverThread_->join();
+        delete serverThread_;
+        delete server_;
+        server_ = nullptr;
+    }
+
+    struct Response {
+        int status = 0;
+        std::string contentType;
+        std::string connection;
+        std::string body;
+    };
+
+    static int connectToServer() {
+        int const fd = ::socket( AF_INET, SOCK_STREAM, 0 );
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons( port_ );
+        address.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+        if ( fd < 0 || ::connect( fd, (struct sockaddr*)&address, sizeof( address ) ) != 0 ) {
+            if ( fd >= 0 )
+                ::close( fd );
+            return -1;
+        }
+        struct timeval timeout{ 30, 0 };
+        ::setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+        return fd;
+    }
+
+    static void sendAll( int fd, std::string const & data ) {
+        size_t sent = 0;
+        while ( sent < data.size() ) {
+            ssize_t const n = ::send( fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+            if ( n <= 0 )
+                return;
+            sent += size_t( n );
+        }
+    }
+
+    // Reads until the server closes the connection and splits the received bytes into responses
+    static std::vector<Response> receiveResponses( int fd ) {
+        std::string input;
+        char buffer[16384];
+        ssize_t n = 0;
+        while ( ( n = ::recv( fd, buffer, sizeof( buffer ), 0 ) ) > 0 )
+            input.append( buffer, size_t( n ) );
+        std::vector<Response> responses;
+        size_t pos = 0;
+        while ( pos < input.size() ) {
+            size_t const headEnd = input.find( "\r\n\r\n", pos );
+            if ( std::string::npos == headEnd )
+                break;
+            std::istringstream head( input.substr( pos, headEnd - pos ) );
+            Response r;
+            std::string line, protocol;
+            std::getline( head, line );
+            std::istringstream( line ) >> protocol >> r.status;
+            size_t contentLength = 0;
+            while ( std::getline( head, line ) ) {
+                if ( ! line.empty() && line.back() == '\r' )
+                    line.pop_back();
+                size_t const colon = line.find( ": " );
+                if ( std::string::npos == colon )
+                    continue;
+                std::string const name = line.substr( 0, colon ), value = line.substr( colon + 2 );
+                if ( name == "Content-Length" )
+                    contentLength = std::stoul( value );
+                else if ( name == "Content-Type" )
+                    r.contentType = value.substr( 0, value.find( ';' ) );
+                else if ( name == "Connection" )
+                    r.connection = value;
+            }
+            r.body = input.substr( headEnd + 4, contentLength );
+            pos = headEnd + 4 + contentLength;
+            responses.push_back( r );
+        }
+        return responses;
+    }
+
+    static std::string get( std::string const & path, std::string const & extraHeaders = "" ) {
+        return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + extraHeaders + "\r\n";
+    }
+
+    static HTTPServer * server_;
+    static std::thread * serverThread_;
+    static uint16_t port_;
+};
+
+HTTPServer * HTTPPipeliningTest::server_ = nullptr;
+std::thread * HTTPPipeliningTest::serverThread_ = nullptr;
+uint16_t HTTPPipeliningTest::port_ = 0;
+
+TEST_F( HTTPPipeliningTest, ResponsesInRequestOrder ) {
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    // one write: a counter endpoint that waits for the first sample between requests answered right away
+    sendAll( fd, get( "/favicon.ico" ) + get( "/metrics" ) + get( "/dashboard" ) + get( "/", "Accept: text/html\r\n" )
+        + get( "/favicon.ico", "Connection: close\r\n" ) );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    ASSERT_EQ( 5u, responses.size() );
+    std::vector<std::string> const contentTypes = { "image/x-icon", "text/plain", "application/json", "text/html", "image/x-icon" };
+    for ( size_t i = 0; i < responses.size(); ++i ) {
+        EXPECT_EQ( 200, responses[i].status ) << "response " << i;
+        EXPECT_EQ( contentTypes[i], responses[i].contentType ) << "response " << i;
+    }
+    EXPECT_NE( std::string::npos, responses[1].body.find( "Instructions_Retired_Any" ) );
+    EXPECT_EQ( "keep-alive", responses[3].connection );
+    EXPECT_EQ( responses[0].body, responses[4].body );
+}
+
+TEST_F( HTTPPipeliningTest, RequestsSplitOverSeveralWrites ) {
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    std::string const requests = get( "/dashboard" ) + get( "/favicon.ico", "Connection: close\r\n" );
+    // byte by byte at the start, then across the boundary of the two requests
+    for ( size_t i = 0; i < 10; ++i ) {
+        sendAll( fd, requests.substr( i, 1 ) );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+    }
+    size_t const boundary = get( "/dashboard" ).size();
+    sendAll( fd, requests.substr( 10, boundary + 5 - 10 ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    sendAll( fd, requests.substr( boundary + 5 ) );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    ASSERT_EQ( 2u, responses.size() );
+    EXPECT_EQ( "application/json", responses[0].contentType );
+    EXPECT_EQ( "image/x-icon", responses[1].contentType );
+}
+
+TEST_F( HTTPPipeliningTest, BadRequestEndsThePipeline ) {
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    // the request after the malformed one is not answered
+    sendAll( fd, get( "/favicon.ico" ) + "GET /favicon.ico HTTP/1.1\r\n\r\n" + get( "/dashboard" ) );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    ASSERT_EQ( 2u, responses.size() );
+    EXPECT_EQ( 200, responses[0].status );
+    EXPECT_EQ( 400, responses[1].status ); // HTTP/1.1 without Host header
+}
+
+TEST_F( HTTPPipeliningTest, OversizedRequestIsRejected ) {
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    std::string const header = "X-Padding: " + std::string( 1000, 'a' ) + "\r\n";
+    std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n";
+    while ( request.size() <= maxRequestSize )
+        request += header;
+    sendAll( fd, request );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    ASSERT_EQ( 1u, responses.size() );
+    EXPECT_EQ( 431, responses[0].status );
+}
+
+TEST_F( HTTPPipeliningTest, WaitingHandlerDoesNotDelayOtherConnections ) {
+    // /persecond/30 waits for 30 seconds of samples after startup, the waiting handler runs on a worker
+    int const waiting = connectToServer();
+    ASSERT_GE( waiting, 0 );
+    sendAll( waiting, get( "/persecond/30" ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    auto const start = std::chrono::steady_clock::now();
+    sendAll( fd, get( "/favicon.ico", "Connection: close\r\n" ) );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    EXPECT_LT( std::chrono::steady_clock::now() - start, std::chrono::seconds( 5 ) );
+    ASSERT_EQ( 1u, responses.size() );
+    EXPECT_EQ( 200, responses[0].status );
+    ::close( waiting ); // the response of the waiting handler is dropped
+}
+
+TEST_F( HTTPPipeliningTest, ClientReadingLateGetsAllResponses ) {
+    // more response bytes than the socket buffers hold: the server stops taking requests until the client reads
+    int const fd = connectToServer();
+    ASSERT_GE( fd, 0 );
+    size_t const numRequests = 60;
+    std::string requests;
+    for ( size_t i = 0; i + 1 < numRequests; ++i )
+        requests += get( "/dashboard/prometheus" );
+    requests += get( "/favicon.ico", "Connection: close\r\n" );
+    sendAll( fd, requests );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
+    auto const responses = receiveResponses( fd );
+    ::close( fd );
+    ASSERT_EQ( numRequests, responses.size() );
+    for ( size_t i = 0; i + 1 < numRequests; ++i ) {
+        EXPECT_EQ( "application/json", responses[i].contentType ) << "response " << i;
+        EXPECT_EQ( responses[0].body, responses[i].body ) << "response " << i;
+    }
+    EXPECT_EQ( "image/x-icon", responses.back().contentType );
+}
+
+} // namespace
@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// Batched register reads return the values of the single reads they replace: MsrReadPlan (src/msr.h)
+// on simulated MSRs and PciConfigBatch (src/pci.cpp) on the configuration space of the PCI functions of
+// the host (coalesced pread and ECAM mapping) and on simulated functions.
+
+#include "msr.h"
+#include "pci.h"
+#include "simulated_hw.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using namespace pcm;
+
+namespace {
+
+// counts the calls of the batched read of MsrReadPlan::execute
+class RecordingMsrHandle
+{
+public:
+    std::vector<std::vector<uint64> > calls;
+
+    int32 read(const uint64 * msrs, uint64 * values, const size_t n)
+    {
+        calls.emplace_back(msrs, msrs + n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            values[i] = msrs[i] * 3;
+        }
+        return (int32)n;
+    }
+};
+
+uint64 readSingle(PciHandleType & handle, const uint64 offset, const uint32 size)
+{
+    if (size == sizeof(uint64))
+    {
+        uint64 value = 0;
+        handle.read64(offset, &value);
+        return value;
+    }
+    uint32 value = 0;
+    handle.read32(offset, &value);
+    return value;
+}
+
+TEST(MsrReadPlanTest, AddReturnsStablePositions)
+{
+    MsrReadPlan plan;
+    EXPECT_EQ(0u, plan.add(0x309));
+    EXPECT_EQ(1u, plan.add(0x30A));
+    EXPECT_EQ(0u, plan.add(0x309)); // already present
+    EXPECT_EQ(2u, plan.add(0xC1));
+    EXPECT_EQ(1u, plan.add(0x30A));
+    EXPECT_EQ(3u, plan.size());
+    EXPECT_EQ(std::vector<uint64>({ 0x309, 0x30A, 0xC1 }), plan.getMSRs());
+    plan.clear();
+    EXPECT_EQ(0u, plan.size());
+    EXPECT_EQ(0u, plan.add(0xC1));
+}
+
+TEST(MsrReadPlanTest, ExecuteReadsTheTailInOneCall)
+{
+    MsrReadPlan plan;
+    for (uint64 msr = 0x100; msr < 0x108; ++msr)
+    {
+        plan.add(msr);
+    }
+    RecordingMsrHandle handle;
+    std::vector<uint64> values(plan.size(), 0ULL);
+    EXPECT_EQ(8, plan.execute(handle, values.data()));
+    ASSERT_EQ(1u, handle.calls.size());
+    EXPECT_EQ(plan.getMSRs(), handle.calls[0]);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        EXPECT_EQ(plan.getMSRs()[i] * 3, values[i]);
+    }
+
+    // the registers before first keep their values
+    std::fill(values.begin(), values.end(), 7ULL);
+    EXPECT_EQ(3, plan.execute(handle, values.data(), 5));
+    ASSERT_EQ(2u, handle.calls.size());
+    EXPECT_EQ(std::vector<uint64>({ 0x105, 0x106, 0x107 }), handle.calls[1]);
+    EXPECT_EQ(std::vector<uint64>({ 7, 7, 7, 7, 7, 0x105 * 3, 0x106 * 3, 0x107 * 3 }), values);
+
+    EXPECT_EQ(0, plan.execute(handle, values.data(), plan.size()));
+    EXPECT_EQ(2u, handle.calls.size());
+}
+
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+// Registers of the functions on bus 0 of the host that do not change between reads: IDs, class code,
+// header type, base address registers and subsystem IDs. Overlapping, adjacent and scattered reads of
+// both sizes, registered out of order, exercise the sorting and the range building of the batch.
+// The batch reads through the ECAM mapping if /dev/mem can be mapped and with coalesced preads
+// otherwise (or with PCM_NO_PCI_ECAM_MMAP=1, read once per process).
+// Runs before the simulated tests: they switch the process to simulated hardware.
+class HostPciConfigBatchTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        for (uint32 device = 0; device < 32 && handles.size() < 8; ++device)
+        {
+            if (PciHandleType::exists(0, 0, device, 0))
+            {
+                handles.push_back(std::make_shared<PciHandleType>(0, 0, device, 0));
+            }
+        }
+        if (handles.empty())
+        {
+            GTEST_SKIP() << "no PCI configuration space to read";
+        }
+    }
+
+    std::vector<std::shared_ptr<PciHandleType> > handles;
+};
+
+TEST_F(HostPciConfigBatchTest, MatchesSingleReads)
+{
+    const std::vector<std::pair<uint64, uint32> > registers = {
+        { 0x2C, 4 }, { 0x0, 4 }, { 0x10, 8 }, { 0x8, 4 }, { 0x14, 4 }, { 0x0, 8 }, { 0x18, 8 }, { 0x24, 4 }, { 0xC, 4 }, { 0x2C, 4 }
+    };
+    PciConfigBatch batch;
+    std::vector<uint64> values(handles.size() * registers.size(), ~0ULL);
+    // interleave the functions so that the batch has to sort the reads
+    for (size_t r = 0; r < registers.size(); ++r)
+    {
+        for (size_t h = handles.size(); h-- > 0; )
+        {
+            batch.add(handles[h], registers[r].first, registers[r].second, &values[h * registers.size() + r]);
+        }
+    }
+    EXPECT_EQ(values.size(), batch.size());
+    for (int repetition = 0; repetition < 2; ++repetition) // the second execution reuses the compiled ranges
+    {
+        std::fill(values.begin(), values.end(), ~0ULL);
+        batch.execute();
+        for (size_t h = 0; h < handles.size(); ++h)
+        {
+            for (size_t r = 0; r < registers.size(); ++r)
+            {
+                const uint64 single = readSingle(*handles[h], registers[r].first, registers[r].second);
+                EXPECT_EQ(single, values[h * registers.size() + r]) << "function " << h << " offset 0x" << std::hex << registers[r].first;
+            }
+        }
+    }
+}
+#endif
+
+class SimulatedRegisterTest : public ::testing::Test
+{
+protected:
+    static void SetUpTestSuite()
+    {
+        SimulatedHardware::enable();
+    }
+};
+
+TEST_F(SimulatedRegisterTest, MsrReadPlanMatchesSingleReads)
+{
+    const uint32 cpu = 0;
+    MsrReadPlan plan;
+    // more registers than one msr-safe batch ioctl takes
+    for (uint64 i = 0; i < 150; ++i)
+    {
+        const uint64 msr = 0x1000 + i * 0x10;
+        SimulatedHardware::setMSR(cpu, msr, (i + 1) * 0x100000001ULL);
+        plan.add(msr);
+    }
+    SafeMsrHandle msr(cpu);
+    std::vector<uint64> batched(plan.size(), 0ULL);
+    EXPECT_EQ((int32)plan.size(), plan.execute(msr, batched.data()));
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        uint64 single = 0;
+        ASSERT_EQ((int32)sizeof(uint64), msr.read(plan.getMSRs()[i], &single));
+        EXPECT_EQ(single, batched[i]) << "MSR 0x" << std::hex << plan.getMSRs()[i];
+    }
+}
+
+TEST_F(SimulatedRegisterTest, PciConfigBatchMatchesSingleReads)
+{
+    const uint32 bus = 0x7e, device = 0x1d, function = 1;
+    for (uint64 offset = 0; offset < 0x100; offset += 8)
+    {
+        SimulatedHardware::setPCI(0, bus, device, function, offset, 0x0102030405060708ULL * (offset + 1));
+    }
+    auto handle = std::make_shared<PciHandleType>(0, bus, device, function);
+    PciConfigBatch batch;
+    const std::vector<std::pair<uint64, uint32> > registers = { { 0x10, 8 }, { 0x0, 4 }, { 0x48, 8 }, { 0x4, 4 }, { 0xF8, 8 } };
+    std::vector<uint64> values(registers.size(), ~0ULL);
+    for (size_t i = 0; i < registers.size(); ++i)
+    {
+        batch.add(handle, registers[i].first, registers[i].second, &values[i]);
+    }
+    batch.execute();
+    for (size_t i = 0; i < registers.size(); ++i)
+    {
+        const uint64 single = readSingle(*handle, registers[i].first, registers[i].second);
+        EXPECT_EQ(single, values[i]) << "offset 0x" << std::hex << registers[i].first;
+    }
+}
+
+} // namespace
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// Parser of the mem_dump files of the Linux TPMI debugfs interface (src/tpmi.cpp): register values,
+// entry numbering of the mem_write commands and the invalid entries skipped by the handles.
+
+#include "tpmi.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace pcm;
+
+namespace {
+
+struct ParsedMemDump
+{
+    std::vector<uint32> values;
+    std::vector<TPMIMemDumpEntry> entries;
+
+    explicit ParsedMemDump(const std::string & text)
+    {
+        parseTPMIMemDump(text.data(), text.size(), values, entries);
+    }
+
+    std::vector<uint32> registers(const size_t entry) const
+    {
+        const auto & e = entries.at(entry);
+        return std::vector<uint32>(values.begin() + e.begin, values.begin() + e.begin + e.size);
+    }
+};
+
+TEST(TPMIMemDumpTest, EntriesAndRegisters)
+{
+    const ParsedMemDump dump(
+        "TPMI Instance:0 offset:0x40005000\n"
+        " 00000000: 00000001 00000002 0000000a 0000000B\n"
+        " 00000010: deadbeef 00000000\n"
+        "TPMI Instance:1 offset:0x40006000\n"
+        " 00000000: 00000011 00000012 00000013 00000014\n");
+    ASSERT_EQ(2u, dump.entries.size());
+    EXPECT_EQ(0u, dump.entries[0].index);
+    EXPECT_EQ(1u, dump.entries[1].index);
+    EXPECT_EQ(std::vector<uint32>({ 1, 2, 0xa, 0xb, 0xdeadbeef, 0 }), dump.registers(0));
+    EXPECT_EQ(std::vector<uint32>({ 0x11, 0x12, 0x13, 0x14 }), dump.registers(1));
+    EXPECT_EQ(10u, dump.values.size());
+}
+
+TEST(TPMIMemDumpTest, InvalidEntriesKeepTheirIndex)
+{
+    // the handles skip an entry whose first register is ~0, the mem_write commands still count it
+    const ParsedMemDump dump(
+        "TPMI Instance:0 offset:0x40005000\n"
+        " 00000000: ffffffff ffffffff\n"
+        "TPMI Instance:1 offset:0x40006000\n"
+        " 00000000: 00000005 00000006\n"
+        "TPMI Instance:2 offset:0x40007000\n"
+        " 00000000: FFFFFFFF 00000000\n"
+        "TPMI Instance:3 offset:0x40008000\n"
+        " 00000000: 00000007 00000008\n");
+    ASSERT_EQ(2u, dump.entries.size());
+    EXPECT_EQ(1u, dump.entries[0].index);
+    EXPECT_EQ(3u, dump.entries[1].index);
+    EXPECT_EQ(std::vector<uint32>({ 5, 6 }), dump.registers(0));
+    EXPECT_EQ(std::vector<uint32>({ 7, 8 }), dump.registers(1));
+}
+
+TEST(TPMIMemDumpTest, EntriesWithoutRegistersAreNotCounted)
+{
+    const ParsedMemDump dump(
+        "TPMI Instance:0 offset:0x40005000\n"
+        "TPMI Instance:1 offset:0x40006000\n"
+        " 00000000: 00000001\n"
+        "TPMI Instance:2 offset:0x40007000\n");
+    ASSERT_EQ(1u, dump.entries.size());
+    EXPECT_EQ(0u, dump.entries[0].index);
+    EXPECT_EQ(std::vector<uint32>({ 1 }), dump.registers(0));
+    EXPECT_EQ(1u, dump.values.size());
+}
+
+TEST(TPMIMemDumpTest, PrefixesWhitespaceAndMissingFinalNewline)
+{
+    const ParsedMemDump dump(
+        "TPMI Instance:0 offset:0x40005000\r\n"
+        "\t00000000:\t0x00000010  0X00000020\r\n"
+        "  00000008:   00000030\t00000040");
+    ASSERT_EQ(1u, dump.entries.size());
+    EXPECT_EQ(std::vector<uint32>({ 0x10, 0x20, 0x30, 0x40 }), dump.registers(0));
+}
+
+TEST(TPMIMemDumpTest, ValueListEndsAtNonRegisterToken)
+{
+    // more than 8 hex digits or trailing characters are not a 32-bit register, the rest of the line is ignored
+    const ParsedMemDump dump(
+        "TPMI Instance:0 offset:0x40005000\n"
+        " 00000000: 00000001 123456789 00000002\n"
+        " 00000008: 00000003 0000000g 00000004\n"
+        " 00000010: 00000005\n");
+    ASSERT_EQ(1u, dump.entries.size());
+    EXPECT_EQ(std::vector<uint32>({ 1, 3, 5 }), dump.registers(0));
+}
+
+TEST(TPMIMemDumpTest, EmptyText)
+{
+    const ParsedMemDump dump("");
+    EXPECT_TRUE(dump.entries.empty());
+    EXPECT_TRUE(dump.values.empty());
+}
+
+TEST(TPMIMemDumpTest, ReparseReplacesPreviousContent)
+{
+    std::vector<uint32> values;
+    std::vector<TPMIMemDumpEntry> entries;
+    const std::string first = "TPMI Instance:0 offset:0x0\n 00000000: 00000001 00000002\n";
+    const std::string second = "TPMI Instance:0 offset:0x0\n 00000000: 00000003\n";
+    parseTPMIMemDump(first.data(), first.size(), values, entries);
+    parseTPMIMemDump(second.data(), second.size(), values, entries);
+    ASSERT_EQ(1u, entries.size());
+    EXPECT_EQ(std::vector<uint32>({ 3 }), values);
+}
+
+} // namespace
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2025, Intel Corporation
+
+// Snapshot mode of getServerUncoreCounterState (one global uncore freeze per socket instead of the unit freezes):
+// only on the models whose global control freezes all units and never when Linux perf programs the uncore PMUs,
+// there the boxes must be frozen through their unit control to take the perf group snapshots.
+
+#include "cpucounters.h"
+#include "simulated_hw.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+
+using namespace pcm;
+
+namespace {
+
+TEST(UncoreSnapshotTest, OnlyGlobalFreezeModels)
+{
+    EXPECT_TRUE(PCM::uncoreSnapshotAvailable(PCM::SPR, false));
+    EXPECT_TRUE(PCM::uncoreSnapshotAvailable(PCM::EMR, false));
+    for (const int model : { PCM::SKX, PCM::ICX, PCM::SNOWRIDGE, PCM::GNR, PCM::SRF, PCM::ADL })
+    {
+        EXPECT_FALSE(PCM::uncoreSnapshotAvailable(model, false)) << "model " << model;
+    }
+}
+
+TEST(UncoreSnapshotTest, NotInPerfMode)
+{
+    for (const int model : { PCM::SPR, PCM::EMR, PCM::SKX, PCM::ICX, PCM::GNR })
+    {
+        EXPECT_FALSE(PCM::uncoreSnapshotAvailable(model, true)) << "model " << model;
+    }
+}
+
+// with PCM_USE_UNCORE_PERF=1 on a host that has the uncore perf PMUs
+TEST(UncoreSnapshotTest, PerfUncoreInstance)
+{
+    setenv("PCM_USE_UNCORE_PERF", "1", 1);
+    SimulatedHardware::enable();
+    PCM * m = PCM::getInstance();
+    if (m->useLinuxPerfForUncore() == false)
+    {
+        GTEST_SKIP() << "no uncore perf PMUs on this host";
+    }
+    EXPECT_FALSE(m->uncoreSnapshotAvailable());
+}
+
+} // namespace